@@ -0,0 +1,184 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "caldav-change-check.h"
+#include "google-calendar-list.h"
+
+#include <QtCore/QXmlStreamReader>
+#include <QtCore/QDebug>
+
+#include <QtNetwork/QNetworkRequest>
+#include <QtNetwork/QNetworkAccessManager>
+
+#define DAV_NAMESPACE               "DAV:"
+#define CALENDARSERVER_NAMESPACE    "http://calendarserver.org/ns/"
+#define CALDAV_CHECK_TIMEOUT        10000 // 10 secs
+#define CALDAV_CHECK_BODY           "<?xml version=\"1.0\" encoding=\"utf-8\"?>" \
+                                    "<d:propfind xmlns:d=\"DAV:\" xmlns:cs=\"http://calendarserver.org/ns/\">" \
+                                    "<d:prop><cs:getctag/><d:sync-token/></d:prop>" \
+                                    "</d:propfind>"
+
+CalDavChangeCheck::CalDavChangeCheck(QNetworkAccessManager *manager, QObject *parent)
+    : QObject(parent),
+      m_manager(manager ? manager : GoogleCalendarList::sharedManager())
+{
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(CALDAV_CHECK_TIMEOUT);
+    connect(&m_timer, SIGNAL(timeout()), SLOT(onTimeout()));
+}
+
+CalDavChangeCheck::~CalDavChangeCheck()
+{
+    abort();
+}
+
+void CalDavChangeCheck::setToken(const QString &token)
+{
+    m_authorization = QByteArray("Bearer ") + token.toUtf8();
+}
+
+void CalDavChangeCheck::setCredentials(const QString &username, const QString &password)
+{
+    m_authorization = QByteArray("Basic ") + QString("%1:%2").arg(username).arg(password).toUtf8().toBase64();
+}
+
+void CalDavChangeCheck::check(const QMap<QString, QUrl> &collections)
+{
+    abort();
+    m_tokens.clear();
+
+    for(QMap<QString, QUrl>::const_iterator i = collections.begin();
+        i != collections.end();
+        i++) {
+        // the query only carries hints for syncevolution
+        QUrl url(i.value());
+        url.setQuery(QString());
+
+        QNetworkRequest req(url);
+        req.setRawHeader(QByteArray("Depth"), QByteArray("0"));
+        req.setHeader(QNetworkRequest::ContentTypeHeader, QByteArray("application/xml; charset=utf-8"));
+        // the credentials must not follow a redirect, the collection syncs instead
+        req.setAttribute(QNetworkRequest::FollowRedirectsAttribute, false);
+        if (!m_authorization.isEmpty()) {
+            req.setRawHeader(QByteArray("Authorization"), m_authorization);
+        }
+
+        QNetworkReply *reply = m_manager->sendCustomRequest(req, QByteArray("PROPFIND"), QByteArray(CALDAV_CHECK_BODY));
+        connect(reply, SIGNAL(finished()), SLOT(onReplyFinished()));
+        m_replies.insert(reply, i.key());
+    }
+
+    if (m_replies.isEmpty()) {
+        QMetaObject::invokeMethod(this, "finish", Qt::QueuedConnection);
+    } else {
+        m_timer.start();
+    }
+}
+
+void CalDavChangeCheck::abort()
+{
+    m_timer.stop();
+    QList<QNetworkReply*> replies = m_replies.keys();
+    m_replies.clear();
+    Q_FOREACH(QNetworkReply *reply, replies) {
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+}
+
+bool CalDavChangeCheck::isChecking() const
+{
+    return !m_replies.isEmpty();
+}
+
+int CalDavChangeCheck::timeout() const
+{
+    return m_timer.interval();
+}
+
+void CalDavChangeCheck::setTimeout(int msecs)
+{
+    m_timer.setInterval(msecs);
+}
+
+void CalDavChangeCheck::onReplyFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(QObject::sender());
+    if (!reply || !m_replies.contains(reply)) {
+        return;
+    }
+    const QString key = m_replies.take(reply);
+    reply->deleteLater();
+
+    const int responseCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if ((reply->error() != QNetworkReply::NoError) || (responseCode != 207)) {
+        qWarning() << "Could not check collection" << key << "response:" << responseCode << reply->errorString();
+    } else {
+        const QString token = parseToken(reply->readAll());
+        if (token.isEmpty()) {
+            qDebug() << "Server does not report changes of collection:" << key;
+        } else {
+            m_tokens.insert(key, token);
+        }
+    }
+
+    if (m_replies.isEmpty()) {
+        finish();
+    }
+}
+
+void CalDavChangeCheck::onTimeout()
+{
+    qWarning() << "Collection check timeout, pending:" << m_replies.values();
+    abort();
+    finish();
+}
+
+void CalDavChangeCheck::finish()
+{
+    m_timer.stop();
+    Q_EMIT finished(m_tokens);
+}
+
+QString CalDavChangeCheck::parseToken(const QByteArray &data)
+{
+    QString syncToken;
+    QString ctag;
+
+    // properties not supported are returned empty on a 404 propstat
+    QXmlStreamReader xml(data);
+    while (!xml.atEnd()) {
+        if (xml.readNext() != QXmlStreamReader::StartElement) {
+            continue;
+        }
+        if ((xml.namespaceUri() == QLatin1String(DAV_NAMESPACE)) &&
+            (xml.name() == QLatin1String("sync-token"))) {
+            syncToken = xml.readElementText().trimmed();
+        } else if ((xml.namespaceUri() == QLatin1String(CALENDARSERVER_NAMESPACE)) &&
+                   (xml.name() == QLatin1String("getctag"))) {
+            ctag = xml.readElementText().trimmed();
+        }
+    }
+
+    if (xml.hasError()) {
+        qWarning() << "Fail to parse collection properties:" << xml.errorString();
+        return QString();
+    }
+    return syncToken.isEmpty() ? ctag : syncToken;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CALDAV_CHANGE_CHECK_H__
+#define __CALDAV_CHANGE_CHECK_H__
+
+#include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QTimer>
+#include <QtCore/QUrl>
+
+#include <QtNetwork/QNetworkReply>
+
+class QNetworkAccessManager;
+
+// Ask the server for the change token (sync-token or CTag) of each calendar
+// collection with a single PROPFIND. A collection with the same token of the
+// last sync has no remote changes and does not need a sync session.
+class CalDavChangeCheck : public QObject
+{
+    Q_OBJECT
+public:
+    CalDavChangeCheck(QNetworkAccessManager *manager = 0, QObject *parent = 0);
+    ~CalDavChangeCheck();
+
+    // OAuth accounts
+    void setToken(const QString &token);
+    // password accounts
+    void setCredentials(const QString &username, const QString &password);
+
+    // collections url by key, the same key is used on the result; redirects
+    // are not followed, the collection is reported as not checked
+    void check(const QMap<QString, QUrl> &collections);
+    void abort();
+    bool isChecking() const;
+
+    int timeout() const;
+    void setTimeout(int msecs);
+
+    // returns the sync-token of a multistatus response, or the CTag if the
+    // server does not support sync-token
+    static QString parseToken(const QByteArray &data);
+
+Q_SIGNALS:
+    // collections that could not be checked are not present
+    void finished(const QMap<QString, QString> &tokens);
+
+private Q_SLOTS:
+    void onReplyFinished();
+    void onTimeout();
+    void finish();
+
+private:
+    QNetworkAccessManager *m_manager;
+    QHash<QNetworkReply*, QString> m_replies;
+    QMap<QString, QString> m_tokens;
+    QByteArray m_authorization;
+    QTimer m_timer;
+};
+
+#endif
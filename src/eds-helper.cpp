@@ -14,7 +14,8 @@
 
 #include "config.h"
 
-#define CHANGE_TIMEOUT      3000
+// changes done by the sync and its report can arrive a while after it finishes
+#define SYNC_SETTLE_TIMEOUT 2000
 #define COLLECTION_READONLY_METADATA        "collection-readonly"
 #define COLLECTION_SYNC_READONLY_METADATA   "collection-sync-readonly"
 #define COLLECTION_ACCOUNT_ID_METADATA      "collection-account-id"
@@ -26,7 +27,11 @@ using namespace QtContacts;
 
 EdsHelper::EdsHelper(QObject *parent, const QString &organizerManager)
     : QObject(parent),
-      m_freezed(false)
+      m_freezed(false),
+      m_enabled(false),
+      m_fetchRequest(0),
+      m_indexReady(false),
+      m_indexDirty(false)
 {
     qRegisterMetaType<QList<QOrganizerItemId> >("QList<QOrganizerItemId>");
     qRegisterMetaType<QList<QOrganizerItemDetail::DetailType>>("QList<QOrganizerItemDetail::DetailType>");
@@ -37,11 +42,26 @@ EdsHelper::EdsHelper(QObject *parent, const QString &organizerManager)
         m_organizerEngine = 0;
     }
 
-    m_timeoutTimer.setSingleShot(true);
+    if (m_organizerEngine) {
+        connect(m_organizerEngine, &QOrganizerManager::collectionsAdded,
+                this, &EdsHelper::onCollectionsAdded);
+        connect(m_organizerEngine, &QOrganizerManager::collectionsChanged,
+                this, &EdsHelper::onCollectionsChanged);
+        connect(m_organizerEngine, &QOrganizerManager::collectionsRemoved,
+                this, &EdsHelper::onCollectionsRemoved);
+        connect(m_organizerEngine, &QOrganizerManager::dataChanged,
+                this, &EdsHelper::onOrganizerDataChanged);
+        fetchCollections();
+    }
 }
 
 EdsHelper::~EdsHelper()
 {
+    if (m_fetchRequest) {
+        m_fetchRequest->cancel();
+        delete m_fetchRequest;
+        m_fetchRequest = 0;
+    }
     delete m_organizerEngine;
     m_organizerEngine = 0;
 }
@@ -57,6 +77,11 @@ QString EdsHelper::createSource(const QString &sourceName,
         return QString();
     }
 
+    // the source could exist already, do not create a duplicated one
+    if (!ensureIndex()) {
+        qWarning() << "EDS sources not available, can not create" << sourceName;
+        return QString();
+    }
     EdsSource source = sourceByRemoteId(remoteId, accountId);
     if (!source.id.isEmpty()) {
         return source.id;
@@ -74,6 +99,8 @@ QString EdsHelper::createSource(const QString &sourceName,
         qWarning() << "Fail to create collection" << sourceName << m_organizerEngine->error();
         return QString();
     } else {
+        // do not wait for the notification, the source can be used right away
+        indexCollection(collection);
         return sourceFromCollectionId(collection.id());
     }
 }
@@ -90,6 +117,8 @@ void EdsHelper::removeSource(const QString &sourceId)
 
     if (!m_organizerEngine->removeCollection(id)) {
         qWarning() << "Fail to remove source" << id;
+    } else {
+        unindexSource(sourceId);
     }
 }
 
@@ -100,44 +129,29 @@ QString EdsHelper::sourceIdByName(const QString &sourceName, uint account)
         return QString();
     }
 
-    Q_FOREACH(const QOrganizerCollection &c, m_organizerEngine->collections()) {
-        if ((c.extendedMetaData(COLLECTION_ACCOUNT_ID_METADATA) == account) &&
-            (c.metaData(QOrganizerCollection::KeyName).toString() == sourceName)) {
-            return sourceFromCollectionId(c.id());
-        }
-    }
-    return QString();
+    ensureIndex();
+    return m_sourcesByName.value(SourceKey(account, sourceName));
 }
 
 EdsSource EdsHelper::sourceByRemoteId(const QString &remoteId, uint account)
 {
-    Q_FOREACH(const QOrganizerCollection &c, m_organizerEngine->collections()) {
-        if ((c.extendedMetaData(COLLECTION_ACCOUNT_ID_METADATA) == account) &&
-            (c.extendedMetaData(COLLECTION_REMOTE_ID_METADATA).toString() == remoteId)) {
-            EdsSource s;
-            s.id = sourceFromCollectionId(c.id());
-            s.name = c.metaData(QOrganizerCollection::KeyName).toString();
-            s.account = account;
-            s.remoteId = remoteId;
-            return s;
-        }
+    if (!m_organizerEngine) {
+        return EdsSource();
     }
-    return EdsSource();
+
+    ensureIndex();
+    const QString id = m_sourcesByRemoteId.value(SourceKey(account, remoteId));
+    return id.isEmpty() ? EdsSource() : m_sourcesById.value(id);
 }
 
 EdsSource EdsHelper::sourceById(const QString &id)
 {
-    Q_FOREACH(const QOrganizerCollection &c, m_organizerEngine->collections()) {
-        if (c.id().localId() == id) {
-            EdsSource s;
-            s.id = sourceFromCollectionId(c.id());
-            s.name = c.metaData(QOrganizerCollection::KeyName).toString();
-            s.account = c.extendedMetaData(COLLECTION_ACCOUNT_ID_METADATA).toUInt();
-            s.remoteId = c.extendedMetaData(COLLECTION_REMOTE_ID_METADATA).toString();
-            return s;
-        }
+    if (!m_organizerEngine) {
+        return EdsSource();
     }
-    return EdsSource();
+
+    ensureIndex();
+    return m_sourcesById.value(id);
 }
 
 QString
@@ -159,9 +173,8 @@ void EdsHelper::freezeNotify()
 
 void EdsHelper::unfreezeNotify()
 {
-    m_pendingCalendars.clear();
-    m_freezed = false;
-    m_timeoutTimer.start(CHANGE_TIMEOUT);
+    // changes done by the user during the sync
+    flush();
 }
 
 void EdsHelper::flush()
@@ -176,42 +189,353 @@ void EdsHelper::flush()
     m_pendingCalendars.clear();
 }
 
+void EdsHelper::beginSync(uint accountId)
+{
+    m_syncGeneration[accountId]++;
+    m_syncChanges[accountId].clear();
+    m_syncWrites[accountId].clear();
+}
+
+void EdsHelper::addSyncWrites(uint accountId, const QString &remoteId, int count)
+{
+    if (!m_syncChanges.contains(accountId) || (count <= 0)) {
+        return;
+    }
+
+    const QString collectionId = sourceByRemoteId(remoteId, accountId).id;
+    if (!collectionId.isEmpty()) {
+        m_syncWrites[accountId][collectionId] += count;
+    }
+}
+
+void EdsHelper::endSync(uint accountId)
+{
+    if (!m_syncChanges.contains(accountId)) {
+        return;
+    }
+
+    // keep recording until the late notifications and the report arrive
+    const int generation = m_syncGeneration.value(accountId);
+    QTimer::singleShot(SYNC_SETTLE_TIMEOUT, this, [this, accountId, generation]() {
+        finishSync(accountId, generation);
+    });
+}
+
+void EdsHelper::finishSync(uint accountId, int generation)
+{
+    // a new sync started for the account
+    if (m_syncGeneration.value(accountId) != generation) {
+        return;
+    }
+
+    // SyncEvolution only reports how many items it wrote on each calendar,
+    // any other change was done by the user during the sync
+    const QHash<QString, QSet<QString> > changes = m_syncChanges.take(accountId);
+    const QHash<QString, int> writes = m_syncWrites.take(accountId);
+    for(QHash<QString, QSet<QString> >::const_iterator i = changes.begin();
+        i != changes.end();
+        i++) {
+        if (i.value().size() > writes.value(i.key())) {
+            notifyChange(i.key());
+        } else {
+            const EdsSource source = sourceById(i.key());
+            if (!source.remoteId.isEmpty()) {
+                Q_EMIT sourceChangedBySync(source.account, source.remoteId);
+            }
+        }
+    }
+}
+
+bool EdsHelper::isSyncing(uint accountId) const
+{
+    return m_syncChanges.contains(accountId);
+}
+
+void EdsHelper::notifyChange(const QString &collectionId)
+{
+    if (m_freezed) {
+        m_pendingCalendars << collectionId;
+    } else {
+        Q_EMIT dataChanged(collectionId);
+    }
+}
+
 void EdsHelper::setEnabled(bool enabled)
 {
+    m_enabled = enabled;
+    if (!m_organizerEngine) {
+        return;
+    }
+
     if (enabled) {
-        if (m_organizerEngine) {
-            connect(m_organizerEngine, &QOrganizerManager::itemsAdded,
-                    this, &EdsHelper::calendarChanged, Qt::QueuedConnection);
-            connect(m_organizerEngine, &QOrganizerManager::itemsRemoved,
-                    this, &EdsHelper::calendarChanged, Qt::QueuedConnection);
-            connect(m_organizerEngine, &QOrganizerManager::itemsChanged,
-                    this, &EdsHelper::calendarChanged, Qt::QueuedConnection);
-        }
+        // enabling twice must not deliver the notifications twice
+        const Qt::ConnectionType type = static_cast<Qt::ConnectionType>(Qt::QueuedConnection | Qt::UniqueConnection);
+        connect(m_organizerEngine, &QOrganizerManager::itemsAdded,
+                this, &EdsHelper::calendarChanged, type);
+        connect(m_organizerEngine, &QOrganizerManager::itemsRemoved,
+                this, &EdsHelper::calendarChanged, type);
+        connect(m_organizerEngine, &QOrganizerManager::itemsChanged,
+                this, &EdsHelper::calendarChanged, type);
     } else {
-        if (m_organizerEngine) {
-            m_organizerEngine->disconnect(this);
-        }
+        // the collection index keeps following the engine
+        disconnect(m_organizerEngine, &QOrganizerManager::itemsAdded,
+                   this, &EdsHelper::calendarChanged);
+        disconnect(m_organizerEngine, &QOrganizerManager::itemsRemoved,
+                   this, &EdsHelper::calendarChanged);
+        disconnect(m_organizerEngine, &QOrganizerManager::itemsChanged,
+                   this, &EdsHelper::calendarChanged);
     }
 }
 
+bool EdsHelper::isEnabled() const
+{
+    return m_enabled;
+}
+
 QMap<int, QStringList> EdsHelper::sources()
 {
     QMap<int, QStringList> result;
-    QList<QOrganizerCollection> collections = m_organizerEngine->collections();
-    Q_FOREACH(const QOrganizerCollection &collection, collections) {
-        bool ok = false;
-        int accountId = collection.extendedMetaData(COLLECTION_ACCOUNT_ID_METADATA).toInt(&ok);
-        if (!ok) {
-            accountId = -1;
-        }
-        QStringList sources  = result.value(accountId);
-        sources << sourceFromCollectionId(collection.id());
-        result.insert(accountId, sources);
+    if (!m_organizerEngine) {
+        return result;
+    }
+
+    ensureIndex();
+    Q_FOREACH(const EdsSource &source, m_sourcesById) {
+        // sources without account are listed as -1
+        const int accountId = source.account > 0 ? int(source.account) : -1;
+        result[accountId] << source.id;
     }
 
     return result;
 }
 
+QStringList EdsHelper::hiddenSources(uint accountId)
+{
+    QStringList result;
+    if (!m_organizerEngine) {
+        return result;
+    }
+
+    ensureIndex();
+    Q_FOREACH(const EdsSource &source, m_sourcesById) {
+        if ((source.account == accountId) && !source.selected && !source.remoteId.isEmpty()) {
+            result << source.remoteId;
+        }
+    }
+    return result;
+}
+
+bool EdsHelper::isIndexReady() const
+{
+    return m_indexReady;
+}
+
+// Load all collections in background, lookups done before it finishes
+// fall back to a synchronous query
+void EdsHelper::fetchCollections()
+{
+    if (m_fetchRequest) {
+        // results could miss the last changes, fetch again when done
+        m_indexDirty = true;
+        return;
+    }
+
+    m_indexDirty = false;
+    m_fetchRequest = new QOrganizerCollectionFetchRequest(this);
+    m_fetchRequest->setManager(m_organizerEngine);
+    connect(m_fetchRequest, &QOrganizerAbstractRequest::stateChanged,
+            this, &EdsHelper::onCollectionsFetchStateChanged);
+    if (!m_fetchRequest->start()) {
+        qWarning() << "Fail to fetch collections" << m_fetchRequest->error();
+        m_fetchRequest->deleteLater();
+        m_fetchRequest = 0;
+    }
+}
+
+void EdsHelper::onCollectionsFetchStateChanged(QOrganizerAbstractRequest::State state)
+{
+    if ((state != QOrganizerAbstractRequest::FinishedState) &&
+        (state != QOrganizerAbstractRequest::CanceledState)) {
+        return;
+    }
+
+    QOrganizerCollectionFetchRequest *request = m_fetchRequest;
+    m_fetchRequest = 0;
+    request->deleteLater();
+
+    if (state == QOrganizerAbstractRequest::FinishedState) {
+        if (request->error() == QOrganizerManager::NoError) {
+            resetIndex(request->collections());
+        } else {
+            qWarning() << "Fail to fetch collections" << request->error();
+        }
+    }
+
+    if (m_indexDirty) {
+        fetchCollections();
+    }
+}
+
+bool EdsHelper::ensureIndex()
+{
+    if (m_indexReady) {
+        return true;
+    }
+    if (!m_organizerEngine) {
+        return false;
+    }
+
+    // the background fetch did not finish yet
+    if (m_fetchRequest) {
+        m_fetchRequest->disconnect(this);
+        m_fetchRequest->cancel();
+        m_fetchRequest->deleteLater();
+        m_fetchRequest = 0;
+    }
+
+    const QList<QOrganizerCollection> collections = m_organizerEngine->collections();
+    if (m_organizerEngine->error() != QOrganizerManager::NoError) {
+        // an empty index would look like the sources do not exist, keep it
+        // not ready and try again in background
+        qWarning() << "Fail to load collections" << m_organizerEngine->error();
+        fetchCollections();
+        return false;
+    }
+    resetIndex(collections);
+    return true;
+}
+
+void EdsHelper::resetIndex(const QList<QOrganizerCollection> &collections)
+{
+    const QHash<QString, EdsSource> previous = m_sourcesById;
+    m_sourcesById.clear();
+    m_sourcesByRemoteId.clear();
+    m_sourcesByName.clear();
+
+    Q_FOREACH(const QOrganizerCollection &c, collections) {
+        indexCollection(c);
+    }
+
+    if (m_indexReady) {
+        Q_FOREACH(const EdsSource &s, m_sourcesById) {
+            if (previous.contains(s.id) && (previous[s.id].selected != s.selected) && (s.account > 0)) {
+                Q_EMIT sourceSelectionChanged(s.account, s.remoteId, s.selected);
+            }
+        }
+    }
+
+    if (!m_indexReady) {
+        m_indexReady = true;
+        qDebug() << "EDS sources loaded:" << m_sourcesById.size();
+        Q_EMIT indexReady();
+    }
+}
+
+void EdsHelper::indexCollection(const QOrganizerCollection &collection)
+{
+    EdsSource s;
+    s.id = sourceFromCollectionId(collection.id());
+    s.name = collection.metaData(QOrganizerCollection::KeyName).toString();
+    s.account = collection.extendedMetaData(COLLECTION_ACCOUNT_ID_METADATA).toUInt();
+    s.remoteId = collection.extendedMetaData(COLLECTION_REMOTE_ID_METADATA).toString();
+    const QVariant selected = collection.extendedMetaData(COLLECTION_SELECTED_METADATA);
+    s.selected = !selected.isValid() || selected.toBool();
+
+    // the collection could be renamed or moved
+    bool selectionChanged = false;
+    if (m_sourcesById.contains(s.id)) {
+        selectionChanged = (m_sourcesById[s.id].selected != s.selected);
+        unindexSource(s.id);
+    }
+
+    m_sourcesById.insert(s.id, s);
+    // keep the first source found if there are duplicated ones
+    const SourceKey remoteKey(s.account, s.remoteId);
+    if (!s.remoteId.isEmpty() && !m_sourcesByRemoteId.contains(remoteKey)) {
+        m_sourcesByRemoteId.insert(remoteKey, s.id);
+    }
+    const SourceKey nameKey(s.account, s.name);
+    if (!m_sourcesByName.contains(nameKey)) {
+        m_sourcesByName.insert(nameKey, s.id);
+    }
+
+    if (selectionChanged && (s.account > 0)) {
+        Q_EMIT sourceSelectionChanged(s.account, s.remoteId, s.selected);
+    }
+}
+
+void EdsHelper::unindexSource(const QString &sourceId)
+{
+    EdsSource s = m_sourcesById.take(sourceId);
+    if (!s.isValid()) {
+        return;
+    }
+
+    const SourceKey remoteKey(s.account, s.remoteId);
+    const SourceKey nameKey(s.account, s.name);
+    const bool remoteKeyUsed = (m_sourcesByRemoteId.value(remoteKey) == sourceId);
+    const bool nameKeyUsed = (m_sourcesByName.value(nameKey) == sourceId);
+    if (remoteKeyUsed) {
+        m_sourcesByRemoteId.remove(remoteKey);
+    }
+    if (nameKeyUsed) {
+        m_sourcesByName.remove(nameKey);
+    }
+
+    // other source with the same key takes its place
+    if (remoteKeyUsed || nameKeyUsed) {
+        Q_FOREACH(const EdsSource &other, m_sourcesById) {
+            if (remoteKeyUsed && !other.remoteId.isEmpty() &&
+                (SourceKey(other.account, other.remoteId) == remoteKey) &&
+                !m_sourcesByRemoteId.contains(remoteKey)) {
+                m_sourcesByRemoteId.insert(remoteKey, other.id);
+            }
+            if (nameKeyUsed && (SourceKey(other.account, other.name) == nameKey) &&
+                !m_sourcesByName.contains(nameKey)) {
+                m_sourcesByName.insert(nameKey, other.id);
+            }
+        }
+    }
+}
+
+void EdsHelper::onCollectionsAdded(const QList<QOrganizerCollectionId> &collectionIds)
+{
+    if (!m_indexReady) {
+        fetchCollections();
+        return;
+    }
+
+    Q_FOREACH(const QOrganizerCollectionId &id, collectionIds) {
+        QOrganizerCollection collection = m_organizerEngine->collection(id);
+        if (!collection.id().isNull()) {
+            indexCollection(collection);
+        }
+    }
+}
+
+void EdsHelper::onCollectionsChanged(const QList<QOrganizerCollectionId> &collectionIds)
+{
+    onCollectionsAdded(collectionIds);
+}
+
+void EdsHelper::onCollectionsRemoved(const QList<QOrganizerCollectionId> &collectionIds)
+{
+    if (!m_indexReady) {
+        fetchCollections();
+        return;
+    }
+
+    Q_FOREACH(const QOrganizerCollectionId &id, collectionIds) {
+        unindexSource(sourceFromCollectionId(id));
+    }
+}
+
+// too many changes to be reported one by one
+void EdsHelper::onOrganizerDataChanged()
+{
+    fetchCollections();
+}
+
 QString EdsHelper::getCollectionIdFromItemId(const QOrganizerItemId &itemId) const
 {
     return QString::fromUtf8(itemId.localId().split('/').first());
@@ -221,27 +545,24 @@ void EdsHelper::calendarChanged(const QList<QOrganizerItemId> &itemIds)
 {
     Q_ASSERT(m_organizerEngine);
 
-    if (m_timeoutTimer.isActive()) {
-        // ignore changes just after sync
-        return;
-    }
-
     QSet<QString> uniqueColletions;
 
     // eds item ids cotains the collection id we can use that instead of query for the full item
     Q_FOREACH(const QOrganizerItemId &id, itemIds) {
-        uniqueColletions << getCollectionIdFromItemId(id);
-    }
-
-    if (uniqueColletions.isEmpty()) {
-        return;
+        const QString collectionId = getCollectionIdFromItemId(id);
+
+        if (!m_syncChanges.isEmpty()) {
+            const uint account = sourceById(collectionId).account;
+            if (m_syncChanges.contains(account)) {
+                // compared with the sync report once the sync finishes
+                m_syncChanges[account][collectionId] << id.toString();
+                continue;
+            }
+        }
+        uniqueColletions << collectionId;
     }
 
     Q_FOREACH(const QString &collectionId, uniqueColletions) {
-        if (m_freezed) {
-            m_pendingCalendars << collectionId;
-        } else {
-            Q_EMIT dataChanged(collectionId);
-        }
+        notifyChange(collectionId);
     }
 }
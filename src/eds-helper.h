@@ -23,8 +23,11 @@
 #include <QtCore/QStringList>
 #include <QtCore/QTimer>
 #include <QtCore/QSet>
+#include <QtCore/QHash>
+#include <QtCore/QPair>
 
 #include <QtOrganizer/QOrganizerManager>
+#include <QtOrganizer/QOrganizerCollectionFetchRequest>
 #include <QtContacts/QContactManager>
 #include <QtContacts/QContactAbstractRequest>
 
@@ -41,6 +44,10 @@ public:
     QString name;
     uint account;
     QString remoteId;
+    // visible on the calendar app
+    bool selected;
+
+    EdsSource() : account(0), selected(true) {}
 
     bool isValid()
     {
@@ -69,14 +76,40 @@ public:
     void freezeNotify();
     void unfreezeNotify();
     void flush();
+
+    // item changes on the account sources between beginSync and endSync are
+    // recorded, once the sync finishes only the calendars with more changes
+    // than the items written by the sync are notified
+    void beginSync(uint accountId);
+    void addSyncWrites(uint accountId, const QString &remoteId, int count);
+    void endSync(uint accountId);
+    bool isSyncing(uint accountId) const;
     void setEnabled(bool enabled);
+    // item changes are being notified
+    bool isEnabled() const;
     QMap<int, QStringList> sources();
+    // remote ids of the account sources not selected on the calendar app
+    QStringList hiddenSources(uint accountId);
+    bool isIndexReady() const;
+    // loads the sources now if the background fetch did not finish, returns
+    // false if EDS could not be read
+    bool ensureIndex();
 
 Q_SIGNALS:
     void dataChanged(const QString &sourceId);
+    void indexReady();
+    void sourceSelectionChanged(uint accountId, const QString &remoteId, bool selected);
+    // the calendar changes during the sync were taken as done by the sync and
+    // not notified, a user change on the same items could be among them
+    void sourceChangedBySync(uint accountId, const QString &remoteId);
 
 private Q_SLOTS:
     void calendarChanged(const QList<QOrganizerItemId> &itemIds);
+    void onCollectionsFetchStateChanged(QOrganizerAbstractRequest::State state);
+    void onCollectionsAdded(const QList<QOrganizerCollectionId> &collectionIds);
+    void onCollectionsChanged(const QList<QOrganizerCollectionId> &collectionIds);
+    void onCollectionsRemoved(const QList<QOrganizerCollectionId> &collectionIds);
+    void onOrganizerDataChanged();
 
 protected:
     QtOrganizer::QOrganizerManager *m_organizerEngine;
@@ -84,8 +117,30 @@ protected:
     virtual QString getCollectionIdFromItemId(const QtOrganizer::QOrganizerItemId &itemId) const;
 
 private:
-    QTimer m_timeoutTimer;
+    typedef QPair<uint, QString> SourceKey;
+
     bool m_freezed;
+    bool m_enabled;
+
+    // changes done by the sync
+    QHash<uint, int> m_syncGeneration;
+    QHash<uint, QHash<QString, QSet<QString> > > m_syncChanges;
+    QHash<uint, QHash<QString, int> > m_syncWrites;
+
+    // collections index, avoid query EDS for every lookup
+    QHash<QString, EdsSource> m_sourcesById;
+    QHash<SourceKey, QString> m_sourcesByRemoteId;
+    QHash<SourceKey, QString> m_sourcesByName;
+    QOrganizerCollectionFetchRequest *m_fetchRequest;
+    bool m_indexReady;
+    bool m_indexDirty;
+
+    void fetchCollections();
+    void resetIndex(const QList<QOrganizerCollection> &collections);
+    void indexCollection(const QOrganizerCollection &collection);
+    void unindexSource(const QString &sourceId);
+    void finishSync(uint accountId, int generation);
+    void notifyChange(const QString &collectionId);
 
     // late notify
     QSet<QString> m_pendingCalendars;
@@ -0,0 +1,253 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "google-calendar-list.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QJsonArray>
+#include <QtCore/QUrlQuery>
+#include <QtCore/QDebug>
+
+#include <QtNetwork/QNetworkRequest>
+#include <QtNetwork/QNetworkAccessManager>
+
+#define GOOGLE_CALENDAR_LIST_URL    "https://www.googleapis.com/calendar/v3/users/me/calendarList"
+#define GOOGLE_CALENDAR_SYNC_URL    "https://apidata.googleusercontent.com:443/caldav/v2/%u/events/?SyncEvolution=Google"
+// only the fields used to create the SyncDatabase
+#define GOOGLE_CALENDAR_LIST_FIELDS "etag,nextPageToken,items(id,summary,summaryOverride,backgroundColor,accessRole,primary,selected)"
+#define GOOGLE_CALENDAR_LIST_PAGE   "250"
+// google only sends compressed responses if the user agent contains "gzip"
+#define GOOGLE_USER_AGENT           "sync-monitor (gzip)"
+
+GoogleCalendarList::GoogleCalendarList(QNetworkAccessManager *manager, QObject *parent)
+    : QObject(parent),
+      m_manager(manager ? manager : sharedManager()),
+      m_reply(0),
+      m_url(GOOGLE_CALENDAR_LIST_URL),
+      m_notModified(false),
+      m_pageCount(0)
+{
+}
+
+GoogleCalendarList::~GoogleCalendarList()
+{
+    abort();
+}
+
+// All accounts use the same manager, this way the connections to the server
+// can be reused between requests
+QNetworkAccessManager *GoogleCalendarList::sharedManager()
+{
+    static QNetworkAccessManager *manager = 0;
+    if (!manager) {
+        manager = new QNetworkAccessManager(QCoreApplication::instance());
+    }
+    return manager;
+}
+
+void GoogleCalendarList::fetch(const QString &token)
+{
+    abort();
+
+    m_token = token;
+    m_pages.clear();
+    m_pageEtag.clear();
+    m_notModified = false;
+    m_pageCount = 0;
+    requestPage(QString());
+}
+
+void GoogleCalendarList::abort()
+{
+    if (m_reply) {
+        QNetworkReply *reply = m_reply;
+        m_reply = 0;
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+}
+
+bool GoogleCalendarList::isFetching() const
+{
+    return (m_reply != 0);
+}
+
+QArrayOfDatabases GoogleCalendarList::calendars() const
+{
+    return m_calendars;
+}
+
+QByteArray GoogleCalendarList::etag() const
+{
+    return m_etag;
+}
+
+bool GoogleCalendarList::notModified() const
+{
+    return m_notModified;
+}
+
+int GoogleCalendarList::pageCount() const
+{
+    return m_pageCount;
+}
+
+void GoogleCalendarList::reset()
+{
+    m_etag.clear();
+    m_calendars.clear();
+}
+
+QUrl GoogleCalendarList::url() const
+{
+    return m_url;
+}
+
+void GoogleCalendarList::setUrl(const QUrl &url)
+{
+    m_url = url;
+}
+
+void GoogleCalendarList::requestPage(const QString &pageToken)
+{
+    QUrl url(m_url);
+    QUrlQuery query(url);
+    query.addQueryItem("fields", GOOGLE_CALENDAR_LIST_FIELDS);
+    query.addQueryItem("maxResults", GOOGLE_CALENDAR_LIST_PAGE);
+    if (!pageToken.isEmpty()) {
+        query.addQueryItem("pageToken", pageToken);
+    }
+    url.setQuery(query);
+
+    QNetworkRequest req(url);
+    req.setRawHeader(QByteArray("GData-Version"), QByteArray("3.0"));
+    req.setRawHeader(QByteArray("Authorization"), QByteArray("Bearer " + m_token.toUtf8()));
+    req.setHeader(QNetworkRequest::UserAgentHeader, QByteArray(GOOGLE_USER_AGENT));
+    // the ETag refers to the whole list, only the first page can be validated
+    if (pageToken.isEmpty() && !m_etag.isEmpty()) {
+        req.setRawHeader(QByteArray("If-None-Match"), m_etag);
+    }
+
+    m_pageCount++;
+    m_reply = m_manager->get(req);
+    connect(m_reply, SIGNAL(finished()), SLOT(onReplyFinished()));
+}
+
+void GoogleCalendarList::onReplyFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(QObject::sender());
+    if (!reply || (reply != m_reply)) {
+        return;
+    }
+    m_reply = 0;
+    reply->deleteLater();
+
+    const int responseCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if ((responseCode == 304) && (m_pageCount == 1) && !m_etag.isEmpty()) {
+        qDebug() << "Calendar list not modified";
+        m_notModified = true;
+        finish(0);
+        return;
+    }
+
+    if (reply->error() != QNetworkReply::NoError) {
+        qWarning() << "Could not fetch remote sources:" << reply->errorString();
+        finish(reply->error() == QNetworkReply::AuthenticationRequiredError ? 403 : 20007);
+        return;
+    }
+
+    if (responseCode != 200) {
+        qWarning() << "Could not fetch remote source response:" << responseCode;
+        finish(20007);
+        return;
+    }
+
+    if (m_pageCount == 1) {
+        m_pageEtag = reply->rawHeader("ETag");
+    }
+
+    QString nextPageToken;
+    if (!parsePage(reply->readAll(), &nextPageToken)) {
+        finish(20007);
+        return;
+    }
+
+    if (nextPageToken.isEmpty()) {
+        m_calendars = m_pages;
+        m_etag = m_pageEtag;
+        finish(0);
+    } else {
+        requestPage(nextPageToken);
+    }
+}
+
+bool GoogleCalendarList::parsePage(const QByteArray &data, QString *nextPageToken)
+{
+    static QStringList writableRoles;
+    if (writableRoles.isEmpty()) {
+        writableRoles << "writer"
+                      << "owner";
+    }
+
+    QJsonParseError jError;
+    QJsonDocument doc = QJsonDocument::fromJson(data, &jError);
+    if (jError.error != QJsonParseError::NoError) {
+        qWarning() << "Fail to parse calendar list:" << jError.errorString();
+        return false;
+    }
+
+    QJsonObject body = doc.object();
+    if (m_pageEtag.isEmpty() && (m_pageCount == 1)) {
+        m_pageEtag = body.value("etag").toString().toUtf8();
+    }
+    *nextPageToken = body.value("nextPageToken").toString();
+
+    QJsonArray items = body.value("items").toArray();
+    Q_FOREACH(const QJsonValue &i, items) {
+        QJsonObject calendar = i.toObject();
+        qDebug() << "Found db:"
+                 << "\n\tSummary:" << calendar.value("summary").toString()
+                 << "\n\tID:" << calendar.value("id").toString()
+                 << "\n\tSelected:" << calendar.value("selected").toBool()
+                 << "\n\tAccessRole:" << calendar.value("accessRole").toString();
+
+        if (calendar.value("selected").toBool()) {
+            SyncDatabase db;
+
+            db.name = calendar.value("summary").toString();
+            db.remoteId = calendar.value("id").toString();
+            db.source = QString(GOOGLE_CALENDAR_SYNC_URL).replace("%u", QUrl::toPercentEncoding(db.remoteId));
+            db.writable =  writableRoles.contains(calendar.value("accessRole").toString());
+            db.defaultCalendar = calendar.value("primary").toBool();
+            db.title = calendar.value("summaryOverride").toString();
+            db.color = calendar.value("backgroundColor").toString();
+            m_pages << db;
+        }
+    }
+    return true;
+}
+
+void GoogleCalendarList::finish(int error)
+{
+    m_token.clear();
+    m_pages.clear();
+    Q_EMIT finished(error == 0 ? m_calendars : QArrayOfDatabases(), error);
+}
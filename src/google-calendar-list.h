@@ -0,0 +1,81 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GOOGLE_CALENDAR_LIST_H__
+#define __GOOGLE_CALENDAR_LIST_H__
+
+#include <QtCore/QObject>
+#include <QtCore/QUrl>
+
+#include <QtNetwork/QNetworkReply>
+
+#include "dbustypes.h"
+
+class QNetworkAccessManager;
+
+// Fetch the list of calendars of a google account.
+// The ETag of the last complete list is kept, if the server reports that the
+// list did not change the previous one is returned without download it again.
+class GoogleCalendarList : public QObject
+{
+    Q_OBJECT
+public:
+    GoogleCalendarList(QNetworkAccessManager *manager = 0, QObject *parent = 0);
+    ~GoogleCalendarList();
+
+    void fetch(const QString &token);
+    void abort();
+    bool isFetching() const;
+
+    // the list returned by the last finished fetch
+    QArrayOfDatabases calendars() const;
+    QByteArray etag() const;
+    bool notModified() const;
+    int pageCount() const;
+    void reset();
+
+    QUrl url() const;
+    void setUrl(const QUrl &url);
+
+    static QNetworkAccessManager *sharedManager();
+
+Q_SIGNALS:
+    // error is 0 on success or the same error code used by syncevolution
+    void finished(const QArrayOfDatabases &calendars, int error);
+
+private Q_SLOTS:
+    void onReplyFinished();
+
+private:
+    QNetworkAccessManager *m_manager;
+    QNetworkReply *m_reply;
+    QUrl m_url;
+    QString m_token;
+    QByteArray m_etag;
+    QByteArray m_pageEtag;
+    QArrayOfDatabases m_calendars;
+    QArrayOfDatabases m_pages;
+    bool m_notModified;
+    int m_pageCount;
+
+    void requestPage(const QString &pageToken);
+    void finish(int error);
+    bool parsePage(const QByteArray &data, QString *nextPageToken);
+};
+
+#endif
@@ -20,63 +20,211 @@
 
 #include <QtCore/QDebug>
 #include <QtCore/QUuid>
-#include <QtDBus/QDBusReply>
+#include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusMessage>
+#include <QtDBus/QDBusPendingCallWatcher>
 
 #define POWERD_SERVICE_NAME     "com.canonical.powerd"
 #define POWERD_IFACE_NAME       "com.canonical.powerd"
 #define POWERD_OBJECT_PATH      "/com/canonical/powerd"
+#define POWERD_CLIENT_NAME      "sync-monitor-wakeup"
 
 PowerdProxy::PowerdProxy(QObject *parent)
-    : QObject(parent)
+    : QObject(parent),
+      m_requestingLock(false),
+      m_unlockRequested(false),
+      m_holdTime(0),
+      m_lastHoldTime(0),
+      m_lockCount(0),
+      m_wakeupRequest(0)
 {
-    m_iface = new QDBusInterface(POWERD_SERVICE_NAME,
-                                 POWERD_OBJECT_PATH,
-                                 POWERD_IFACE_NAME,
-                                 QDBusConnection::systemBus());
+    QDBusConnection::systemBus().connect(POWERD_SERVICE_NAME,
+                                         POWERD_OBJECT_PATH,
+                                         POWERD_IFACE_NAME,
+                                         "Wakeup",
+                                         this, SLOT(onWakeup()));
 }
 
 PowerdProxy::~PowerdProxy()
 {
     unlock();
+    setWakeup(QDateTime());
 }
 
-QString PowerdProxy::requestWakelock(const QString &name) const
+QDBusPendingCall PowerdProxy::asyncCall(const QString &method, const QVariantList &args) const
 {
-    QDBusReply<QString> reply = m_iface->call("requestSysState", name, 1);
-    if (reply.error().isValid()) {
-        qWarning() << "Fail to request wake lock" << reply.error().message();
-        return QString();
+    QDBusMessage msg = QDBusMessage::createMethodCall(POWERD_SERVICE_NAME,
+                                                      POWERD_OBJECT_PATH,
+                                                      POWERD_IFACE_NAME,
+                                                      method);
+    msg.setArguments(args);
+    return QDBusConnection::systemBus().asyncCall(msg);
+}
+
+QDBusPendingReply<QString> PowerdProxy::requestWakelock(const QString &name) const
+{
+    return asyncCall("requestSysState", QVariantList() << name << 1);
+}
+
+QDBusPendingReply<> PowerdProxy::clearWakelock(const QString &cookie) const
+{
+    return asyncCall("clearSysState", QVariantList() << cookie);
+}
+
+QDBusPendingReply<QString> PowerdProxy::requestWakeup(const QString &name, const QDateTime &time) const
+{
+    return asyncCall("requestWakeup", QVariantList() << name << quint64(time.toTime_t()));
+}
+
+QDBusPendingReply<> PowerdProxy::clearWakeup(const QString &cookie) const
+{
+    return asyncCall("clearWakeup", QVariantList() << cookie);
+}
+
+bool PowerdProxy::isLocked() const
+{
+    return m_lockTime.isValid();
+}
+
+qint64 PowerdProxy::holdTime() const
+{
+    return m_holdTime + (m_lockTime.isValid() ? m_lockTime.elapsed() : 0);
+}
+
+qint64 PowerdProxy::lastHoldTime() const
+{
+    return m_lastHoldTime;
+}
+
+int PowerdProxy::lockCount() const
+{
+    return m_lockCount;
+}
+
+void PowerdProxy::setWakeup(const QDateTime &time)
+{
+    if (time == m_wakeupTime) {
+        return;
+    }
+
+    // powerd keeps every alarm requested, drop the old one first
+    if (!m_wakeupCookie.isEmpty()) {
+        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(clearWakeup(m_wakeupCookie), this);
+        connect(watcher, &QDBusPendingCallWatcher::finished, this,
+                [](QDBusPendingCallWatcher *call) {
+            call->deleteLater();
+            QDBusPendingReply<> reply = *call;
+            if (reply.isError()) {
+                qWarning() << "Fail to clear wakeup" << reply.error().message();
+            }
+        });
+        m_wakeupCookie.clear();
     }
 
-    return reply.value();
+    m_wakeupTime = time;
+    uint request = ++m_wakeupRequest;
+    if (!time.isValid()) {
+        return;
+    }
+
+    qDebug() << "Request wakeup at" << time.toString(Qt::ISODate);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(requestWakeup(POWERD_CLIENT_NAME, time), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, request](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QString> reply = *call;
+        if (reply.isError()) {
+            qWarning() << "Fail to request wakeup" << reply.error().message();
+            return;
+        }
+
+        // the alarm was replaced while the request was in flight
+        if (request != m_wakeupRequest) {
+            clearWakeup(reply.value());
+            return;
+        }
+        m_wakeupCookie = reply.value();
+    });
+}
+
+QDateTime PowerdProxy::wakeupTime() const
+{
+    return m_wakeupTime;
 }
 
-bool PowerdProxy::clearWakelock(const QString &cookie) const
+void PowerdProxy::onWakeup()
 {
-    QDBusReply<void> reply = m_iface->call("clearSysState", cookie);
-    if (reply.error().isValid()) {
-        qWarning() << "Fail to clear wake lock" << reply.error().message();
-        return false;
+    if (!m_wakeupTime.isValid()) {
+        return;
+    }
+
+    // the signal is broadcast for every client alarm, powerd only drops
+    // ours once it is due
+    if (m_wakeupTime <= QDateTime::currentDateTime()) {
+        qDebug() << "Device woke up for sync";
+        m_wakeupCookie.clear();
+        m_wakeupTime = QDateTime();
+        ++m_wakeupRequest;
     }
-    return true;
+    Q_EMIT wakeup();
 }
 
 void PowerdProxy::lock()
 {
-    if (!m_currentLock.isEmpty()) {
+    m_unlockRequested = false;
+    if (!m_currentLock.isEmpty() || m_requestingLock) {
         qDebug() << "Wake lock aready created for sync-monitor";
         return;
     }
 
-    QString cookie = requestWakelock("sync-monitor-wakelock");
-    if (!cookie.isEmpty()) {
-        m_currentLock = cookie;
-    }
+    m_requestingLock = true;
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(requestWakelock("sync-monitor-wakelock"), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QString> reply = *call;
+        m_requestingLock = false;
+        if (reply.isError()) {
+            qWarning() << "Fail to request wake lock" << reply.error().message();
+            return;
+        }
+
+        m_currentLock = reply.value();
+        m_lockTime.start();
+        m_lockCount++;
+        // sync finished before the lock arrived
+        if (m_unlockRequested) {
+            unlock();
+        }
+    });
 }
 
 void PowerdProxy::unlock()
 {
-    if (!m_currentLock.isEmpty() &&  clearWakelock(m_currentLock)) {
-        m_currentLock.clear();
+    if (m_requestingLock) {
+        m_unlockRequested = true;
+        return;
+    }
+
+    if (m_currentLock.isEmpty()) {
+        return;
     }
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(clearWakelock(m_currentLock), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<> reply = *call;
+        if (reply.isError()) {
+            qWarning() << "Fail to clear wake lock" << reply.error().message();
+        }
+    });
+    m_unlockRequested = false;
+    m_currentLock.clear();
+
+    m_lastHoldTime = m_lockTime.elapsed();
+    m_holdTime += m_lastHoldTime;
+    m_lockTime.invalidate();
+    qDebug() << "Wake lock released after" << m_lastHoldTime << "ms, total"
+             << m_holdTime << "ms in" << m_lockCount << "locks";
 }
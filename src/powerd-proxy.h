@@ -24,8 +24,10 @@
 #include <QtCore/QObject>
 #include <QtCore/QStringList>
 #include <QtCore/QHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
 
-#include <QtDBus/QDBusInterface>
+#include <QtDBus/QDBusPendingReply>
 
 class SyncEvolutionSessionProxy;
 
@@ -36,16 +38,45 @@ public:
     PowerdProxy(QObject *parent=0);
     ~PowerdProxy();
 
-    QString requestWakelock(const QString &name) const;
-    bool clearWakelock(const QString &cookie) const;
+    QDBusPendingReply<QString> requestWakelock(const QString &name) const;
+    QDBusPendingReply<> clearWakelock(const QString &cookie) const;
+    QDBusPendingReply<QString> requestWakeup(const QString &name, const QDateTime &time) const;
+    QDBusPendingReply<> clearWakeup(const QString &cookie) const;
+
+    bool isLocked() const;
+    // msecs the wake lock was held, including the current lock
+    qint64 holdTime() const;
+    qint64 lastHoldTime() const;
+    int lockCount() const;
+
+    // resume the device from suspend at the given time, an invalid time
+    // cancels the current alarm
+    void setWakeup(const QDateTime &time);
+    QDateTime wakeupTime() const;
+
+Q_SIGNALS:
+    void wakeup();
 
 public Q_SLOTS:
     void lock();
     void unlock();
 
+private Q_SLOTS:
+    void onWakeup();
+
 private:
-    QDBusInterface *m_iface;
     QString m_currentLock;
+    bool m_requestingLock;
+    bool m_unlockRequested;
+    QElapsedTimer m_lockTime;
+    qint64 m_holdTime;
+    qint64 m_lastHoldTime;
+    int m_lockCount;
+    QString m_wakeupCookie;
+    QDateTime m_wakeupTime;
+    uint m_wakeupRequest;
+
+    QDBusPendingCall asyncCall(const QString &method, const QVariantList &args) const;
 };
 
 #endif
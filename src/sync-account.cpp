@@ -18,41 +18,77 @@
 
 #include "sync-account.h"
 #include "sync-auth.h"
+#include "sync-token-cache.h"
 #include "sync-configure.h"
 #include "syncevolution-server-proxy.h"
 #include "syncevolution-session-proxy.h"
 #include "sync-i18n.h"
+#include "google-calendar-list.h"
+#include "caldav-change-check.h"
+#include "eds-helper.h"
+#include "sync-result-store.h"
+#include "sync-retry-policy.h"
+#include "sync-trace.h"
 
-#include <QtCore/QJsonDocument>
-#include <QtCore/QJsonObject>
+#include <QtCore/QCryptographicHash>
 
-#include <QtNetwork/QNetworkRequest>
-#include <QtNetwork/QNetworkAccessManager>
+#include <QtDBus/QDBusPendingCallWatcher>
+#include <QtDBus/QDBusPendingReply>
 
 #include "config.h"
 
 using namespace Accounts;
 
 #define REFRESH_FROM_REMOTE_SYNC "refresh-from-remote"
+#define ONE_WAY_FROM_REMOTE_SYNC "one-way-from-remote"
+#define ACCOUNT_SYNC_PERIOD      30 // minutes
+#define ACCOUNT_SYNC_WINDOW      30 // days
+#define ACCOUNT_FIRST_SYNC_WINDOW 7 // days
+#define REMOTE_SOURCES_CACHE_TTL (4 * 60 * 60 * 1000) // 4 hours
 
 SyncAccount::SyncAccount(Account *account,
                          const QSettings *settings,
                          QObject *parent)
     : QObject(parent),
       m_config(0),
+      m_eds(0),
+      m_results(0),
+      m_retryPolicy(0),
       m_currentSession(0),
+      m_calendarList(0),
+      m_changeCheck(0),
+      m_discoverySession(0),
+      m_queryingCalendars(false),
+      m_fetchingRemoteSources(false),
+      m_fetchGeneration(0),
       m_account(account),
       m_state(SyncAccount::Idle),
       m_settings(settings),
       m_lastError(0),
-      m_retrySync(true)
+      m_retrySync(true),
+      m_waitingSession(false),
+      m_sharedSession(false),
+      m_openingSession(false),
+      m_sessionCount(0),
+      m_firstPass(false),
+      m_checkingChanges(false)
 {
     setup();
+
+    // the calendars can come from the cache, the google API, the server or the command
+    connect(this, &SyncAccount::remoteSourcesAvailable, [this]() {
+        m_fetchingRemoteSources = false;
+        SyncTrace::instance()->end(id(), QString(), "fetch-calendars");
+    });
 }
 
 SyncAccount::~SyncAccount()
 {
     cancel();
+    if (m_discoverySession) {
+        m_discoverySession->destroy();
+        m_discoverySession = 0;
+    }
 }
 
 // Load all available services for the online-account
@@ -83,6 +119,9 @@ void SyncAccount::setup()
         connect(m_account,
                 SIGNAL(enabledChanged(QString,bool)),
                 SLOT(onAccountEnabledChanged(QString,bool)));
+        connect(m_account,
+                SIGNAL(displayNameChanged(QString)),
+                SLOT(invalidateRemoteSources()));
     }
 }
 
@@ -92,6 +131,21 @@ void SyncAccount::cancel(const QStringList &sources)
     qDebug() << "Sync cancel requested" << sources;
 
     //TODO: cancel the only the source
+    m_waitingSession = false;
+    m_deferredSources.clear();
+    cancelConfigure();
+    if (m_checkingChanges) {
+        m_checkingChanges = false;
+        if (m_changeCheck) {
+            m_changeCheck->abort();
+        }
+        setState(SyncAccount::Idle);
+    }
+    if (m_openingSession) {
+        // the session is closed as soon as the server replies
+        m_openingSession = false;
+        setState(SyncAccount::Idle);
+    }
     if (m_currentSession) {
         m_currentSession->destroy();
         m_currentSession = 0;
@@ -101,8 +155,43 @@ void SyncAccount::cancel(const QStringList &sources)
         } else {
             qDebug() << "Cancelled with no sync state";
         }
+    }
+    if (m_state != SyncAccount::Idle) {
         setState(SyncAccount::Idle);
+    }
+}
+
+// Stops the configuration and the calendar discovery of a canceled sync
+void SyncAccount::cancelConfigure()
+{
+    if (m_config) {
+        m_sessionCount += m_config->sessionCount();
+        m_config->disconnect(this);
+        delete m_config;
+        m_config = 0;
+        SyncTrace::instance()->end(m_account->id(), QString(), "configure");
+    }
+
+    Q_FOREACH(SyncAuth *auth, findChildren<SyncAuth*>()) {
+        auth->disconnect(this);
+        auth->deleteLater();
+    }
+    Q_FOREACH(QProcess *process, findChildren<QProcess*>()) {
+        process->disconnect(this);
+        process->kill();
+        process->deleteLater();
+    }
+    if (m_calendarList) {
+        m_calendarList->abort();
+    }
 
+    m_fetchGeneration++;
+    if (m_discoverySession) {
+        releaseDiscoverySession(m_discoverySession);
+    }
+    // other clients can be waiting for the calendars
+    if (m_fetchingRemoteSources) {
+        Q_EMIT remoteSourcesAvailable(QArrayOfDatabases(), 20017);
     }
 }
 
@@ -111,8 +200,13 @@ void SyncAccount::sync(const QStringList &sources)
     switch(m_state) {
     case SyncAccount::Idle:
         qDebug() << "Sync requested:" << m_account->displayName() << sources;
+        m_sessionCount = 0;
         m_sourcesToSync.clear();
         m_sourcesToSync << sources;
+        m_deferredSources.clear();
+        m_checkedTokens.clear();
+        m_sessionWindows.clear();
+        m_firstPass = true;
         m_startSyncTime = QDateTime::currentDateTime();
         configure();
         break;
@@ -122,34 +216,76 @@ void SyncAccount::sync(const QStringList &sources)
     }
 }
 
-bool SyncAccount::prepareSession(const QString &session)
+void SyncAccount::prepareSession()
 {
-    QString sessionName(session);
-    if (session == QString::null) {
-        sessionName = SyncConfigure::accountSessionName(m_account);
-    }
-
+    const QString sessionName = SyncConfigure::accountSessionName(m_account);
     SyncEvolutionServerProxy *proxy = SyncEvolutionServerProxy::instance();
-    SyncEvolutionSessionProxy *sessionProxy = proxy->openSession(sessionName,
-                                                            QStringList());
-    if (sessionProxy) {
-        attachSession(sessionProxy);
-        return true;
-    } else {
-        qWarning() << "Could not open session" << sessionName;
-        return false;
-    }
+
+    m_openingSession = true;
+    SyncTrace::instance()->begin(m_account->id(), QString(), "open-session");
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(proxy->openSession(sessionName, QStringList()), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, sessionName](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QDBusObjectPath> reply = *call;
+
+        if (!m_openingSession) {
+            // sync canceled while the session was starting
+            if (!reply.isError()) {
+                SyncEvolutionServerProxy::instance()->createSession(sessionName, reply.value())->destroy();
+            }
+            return;
+        }
+        m_openingSession = false;
+        SyncTrace::instance()->end(m_account->id(), QString(), "open-session");
+
+        if (reply.isError()) {
+            qWarning() << "Could not open session" << sessionName << reply.error().message();
+            m_currentSyncResults.insert("", "-1");
+            fail("Could not open session");
+            return;
+        }
+
+        m_sessionCount++;
+        attachSession(SyncEvolutionServerProxy::instance()->createSession(sessionName, reply.value()));
+        waitForSession();
+    });
 }
 
-QList<SourceData> SyncAccount::sources() const
+void SyncAccount::waitForSession()
 {
-    QList<SourceData> sources;
+    // the server runs one session at time, while other account is syncing
+    // our session stays queued; wait for it before start the sync.
+    // onSessionStatusChanged also handles the transition
+    m_waitingSession = true;
+    SyncTrace::instance()->begin(m_account->id(), QString(), "wait-session");
+
+    SyncEvolutionSessionProxy *session = m_currentSession;
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(session->status(), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, session](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QString> reply = *call;
+        if ((session != m_currentSession) || !m_waitingSession) {
+            return;
+        }
 
-    if (!m_currentSession) {
-        return sources;
-    }
+        if (reply.isError()) {
+            qWarning() << "Fail to get session status" << reply.error().message();
+        } else if (reply.value() == "queueing") {
+            qDebug() << "Session queued, waiting for the server:" << m_account->displayName();
+            return;
+        }
+
+        m_waitingSession = false;
+        startSync();
+    });
+}
+
+QList<SourceData> SyncAccount::sources(const QStringMultiMap &config) const
+{
+    QList<SourceData> sources;
 
-    QStringMultiMap config = m_currentSession->getConfig("@default", false);
     Q_FOREACH(const QString &key, config.keys()) {
         if (config[key]["backend"] == CALENDAR_EDS_BACKEND) {
             const QString sourceName = key.split("/").last();
@@ -174,53 +310,175 @@ QList<SourceData> SyncAccount::sources() const
 
 QString SyncAccount::lastSyncStatus(const QString &sourceName) const
 {
+    if (m_results) {
+        return m_results->lastResult(m_account->id(), sourceName);
+    }
+
     const QString logKey = QString(ACCOUNT_LOG_GROUP_FORMAT).arg(m_account->id()).arg(sourceName);
     QSettings settings;
 
     return settings.value(logKey + ACCOUNT_LOG_LAST_SYNC_RESULT).toString();
 }
 
-void SyncAccount::continueSync()
+void SyncAccount::continueSync(SyncEvolutionSessionProxy *session)
 {
     setState(SyncAccount::AboutToSync);
 
-    QStringMap syncFlags;
-    if (!prepareSession()) {
-        setState(SyncAccount::Invalid);
-        return;
+    // reuse the session from the configuration if possible
+    m_sharedSession = (session != 0);
+    if (m_sharedSession) {
+        attachSession(session);
+        waitForSession();
+    } else {
+        prepareSession();
     }
+}
 
+void SyncAccount::startSync()
+{
+    SyncTrace::instance()->end(m_account->id(), QString(), "wait-session");
     if (!isEnabled()) {
         qDebug() << "Calendar Service disabled for account:" << m_account->id() << ". Skip sync!";
-    } else {
-        qDebug() << "Will prepare to sync:" << m_account->id() << m_sourcesToSync;
-        Q_FOREACH(const SourceData &source, sources()) {
-            if (m_sourcesToSync.isEmpty() || m_sourcesToSync.contains(source.remoteId)) {
-                bool firstSync = false;
-                // read-only sources aways sync with "refresh-from-remote"
-                QString mode(REFRESH_FROM_REMOTE_SYNC);
-                if (source.writable) {
-                    mode = syncMode(source.sourceName, &firstSync);
-                }
-                syncFlags.insert(source.sourceName, mode);
-                m_sourcesOnSync.insert(source.sourceName, SyncAccount::SourceSyncStarting);
-                m_sourcesToSync.removeAll(source.remoteId);
+        m_sourcesToSync.clear();
+        qDebug() << "Nothing to sync!";
+        setFinished();
+        return;
+    }
+
+    SyncEvolutionSessionProxy *session = m_currentSession;
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(session->getConfig("@default", false), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, session](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QStringMultiMap> reply = *call;
+        if (session != m_currentSession) {
+            return;
+        }
+        if (reply.isError()) {
+            qWarning() << "Fail to get session named config" << reply.error().message();
+        }
+        startSync(reply.value());
+    });
+}
+
+void SyncAccount::startSync(const QStringMultiMap &config)
+{
+    QStringMap syncFlags;
+    QStringMultiMap windows;
+    qDebug() << "Will prepare to sync:" << m_account->id() << m_sourcesToSync;
+
+    // account wide syncs leave the hidden calendars to the daemon, see
+    // SyncDaemon::scheduleHiddenCalendars()
+    const bool accountWide = m_sourcesToSync.isEmpty();
+    QList<SourceData> toSync;
+    Q_FOREACH(const SourceData &source, sources(config)) {
+        if (accountWide && isHiddenSource(source)) {
+            qDebug() << "Skip hidden calendar" << source.remoteId;
+        } else if (accountWide || m_sourcesToSync.contains(source.remoteId)) {
+            toSync << source;
+            m_sourcesToSync.removeAll(source.remoteId);
+        }
+    }
+
+    // sync the calendars the user is looking at on a first session and
+    // the others on a second one
+    if (m_firstPass) {
+        m_firstPass = false;
+        QSet<QString> priorityIds;
+        Q_FOREACH(const SourceData &source, toSync) {
+            if (isPrioritySource(source)) {
+                priorityIds << source.remoteId;
             }
         }
-        if (!m_sourcesToSync.isEmpty()) {
-            qDebug() << "Source not present on remote side:" << m_sourcesToSync;
-            m_sourcesToSync.clear();
+        toSync = splitPrioritySources(toSync, priorityIds, &m_deferredSources);
+        if (!m_deferredSources.isEmpty()) {
+            qDebug() << "Sync" << toSync.size() << "priority calendars first, deferred:" << m_deferredSources;
         }
     }
 
-    if (!syncFlags.isEmpty()) {
-        qDebug() << "Will sync with flags" << syncFlags;
-        m_syncTime.restart();
-        m_currentSession->sync("none", syncFlags);
-    } else {
+    Q_FOREACH(const SourceData &source, toSync) {
+        bool firstSync = false;
+        QString mode = syncMode(source.sourceName, &firstSync);
+        // read-only sources have no local changes, fetch only the remote
+        // changes once a good baseline exists and reload them otherwise
+        if (!source.writable) {
+            mode = (mode == "two-way") ? ONE_WAY_FROM_REMOTE_SYNC : REFRESH_FROM_REMOTE_SYNC;
+        }
+        syncFlags.insert(source.sourceName, mode);
+        const int window = sourceWindow(source.sourceName);
+        m_sessionWindows.insert(source.sourceName, window);
+        if (window > 0) {
+            windows["source/" + source.sourceName].insert("syncInterval", QString::number(window));
+        }
+        m_sourcesOnSync.insert(source.sourceName, SyncAccount::SourceSyncStarting);
+    }
+    if (!m_sourcesToSync.isEmpty()) {
+        qDebug() << "Source not present on remote side:" << m_sourcesToSync;
+        m_sourcesToSync.clear();
+    }
+
+    if (syncFlags.isEmpty()) {
         qDebug() << "Nothing to sync!";
         setFinished();
+        return;
+    }
+
+    if (windows.isEmpty()) {
+        startSync(syncFlags);
+        return;
     }
+
+    // narrow the sync window for this session only, the saved config keeps the full one
+    qDebug() << "Will limit the sync window to" << windows;
+    SyncEvolutionSessionProxy *session = m_currentSession;
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(session->saveConfig("", windows, true, true), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, session, syncFlags](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<> reply = *call;
+        if (session != m_currentSession) {
+            return;
+        }
+        if (reply.isError()) {
+            qWarning() << "Fail to set the sync window, sync the full window" << reply.error().message();
+        }
+        startSync(syncFlags);
+    });
+}
+
+void SyncAccount::startSync(const QStringMap &syncFlags)
+{
+    qDebug() << "Will sync with flags" << syncFlags;
+    m_syncTime.restart();
+    SyncTrace::instance()->begin(m_account->id(), QString(), "sync");
+
+    SyncEvolutionSessionProxy *session = m_currentSession;
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(session->sync("none", syncFlags), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, session](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<> reply = *call;
+        if ((session != m_currentSession) || !reply.isError()) {
+            return;
+        }
+
+        qWarning() << "Fail to sync account" << reply.error().message();
+        if (m_sharedSession) {
+            // the server refused to sync on the configuration session, start a new one
+            qDebug() << "Could not sync using the configuration session, open a new one";
+            m_sourcesOnSync.clear();
+            // pick the priority calendars again on the new session
+            if (!m_deferredSources.isEmpty()) {
+                m_deferredSources.clear();
+                m_firstPass = true;
+            }
+            releaseSession();
+            continueSync();
+        } else {
+            m_currentSyncResults.insert("", "-1");
+            fail(reply.error().message());
+        }
+    });
 }
 
 void SyncAccount::wait()
@@ -238,74 +496,23 @@ QString SyncAccount::syncMode(const QString &sourceName,
 {
     const QString lastStatus = lastSyncStatus(sourceName);
     *firstSync = lastStatus.isEmpty();
+
+    // without the result store only the last status is known
+    bool hasBaseline = !lastStatus.isEmpty();
+    if (m_results) {
+        hasBaseline = !m_results->result(m_account->id(), sourceName).lastSuccessfulDate.isEmpty();
+    }
+    // the same count drives the retry backoff
+    const int failures = m_retryPolicy ? m_retryPolicy->failures(m_account->id(), sourceRemoteId(sourceName)) : 0;
+
+    QString reason;
+    const QString mode = SyncRetryPolicy::syncMode(lastStatus, hasBaseline, failures, &reason);
     qDebug() << "\tAccount" << m_account->displayName()
              << "source" << sourceName
              << "Last status" << lastStatus
-             << "Is first sync" << *firstSync;
-
-    if (*firstSync) {
-        return REFRESH_FROM_REMOTE_SYNC;
-    }
-    switch(lastStatus.toInt())
-    {
-    case 0:
-    case 200:
-    case 204:
-    case 207:
-        // status ok
-    case 500:
-        // server side generic error (just retry the sync)
-    case 1500:
-        // server side generic error (just retry the sync)
-    case 403:
-        // "Forbidden / access denied";
-    case 10403:
-        // "Forbidden / access denied";
-        return "two-way";
-    case 401:
-    case 404:
-        // "Object not found / unassigned field";
-    case 405:
-        // "Command not allowed";
-    case 406:
-    case 407:
-        // "Proxy authentication required";
-    case 420:
-        // "Disk full";
-    case 506:
-        // "Failed to sync due to a remote problem";
-    case 514:
-        // "Remote problem, not way to recovery";
-    case 20023:
-        // "Unknown status"
-        return "refresh-from-remote";
-    case 22001:
-        // "Failed to sync some items";
-    case 22002:
-        // "Process died unexpectedly";
-    case 20006:
-    case 20007:
-        // "Server sent bad content";
-    case 20017:
-        // "Sync Canceled";
-    case 20020:
-        // "Connection timeout";
-    case 20021:
-        // "Connection certificate has expired";
-    case 20022:
-        // "Connection certificate is invalid";
-    case 20026:
-    case 20027:
-    case 20028:
-        // "Failed to connect to the server";
-    case 20046:
-    case 20047:
-        // "Server not found";
-    case 22000:
-        // "Failed to run \"two-way\" sync";
-    default:
-        return "slow";
-    }
+             << "Is first sync" << *firstSync
+             << "Mode" << mode << "because" << reason;
+    return mode;
 }
 
 bool SyncAccount::isEnabled() const
@@ -426,6 +633,9 @@ void SyncAccount::removeOldConfig() const
 
 void SyncAccount::removeConfig()
 {
+    invalidateRemoteSources();
+    m_configFingerprint.clear();
+
     //TODO
     QString configPath;
     Q_FOREACH(const QString &service, m_availabeServices.keys()) {
@@ -512,6 +722,8 @@ QString SyncAccount::calendarServiceName() const
 
 void SyncAccount::onAccountEnabledChanged(const QString &serviceName, bool enabled)
 {
+    invalidateRemoteSources();
+
     // empty service name means that the hole account has been enabled/disabled
     if (serviceName.isEmpty()) {
         setupServices();
@@ -535,6 +747,19 @@ void SyncAccount::onAccountEnabledChanged(const QString &serviceName, bool enabl
 
 void SyncAccount::onSessionStatusChanged(const QString &status, quint32 error, const QSyncStatusMap &sources)
 {
+    SyncTrace::instance()->instant(m_account->id(), QString(), QString("status: %1").arg(status));
+    if (m_waitingSession) {
+        if (status == "queueing") {
+            return;
+        }
+        m_waitingSession = false;
+        if (status != "done") {
+            qDebug() << "Session ready:" << m_account->displayName();
+            startSync();
+            return;
+        }
+    }
+
     if (status != "done") {
         switch (m_state) {
         case SyncAccount::AboutToSync:
@@ -569,6 +794,8 @@ void SyncAccount::onSessionStatusChanged(const QString &status, quint32 error, c
         if (newStatus == "running") {
             if (m_sourcesOnSync.value(sourceName) == SyncAccount::SourceSyncStarting) {
                 m_sourcesOnSync[sourceName] = SyncAccount::SourceSyncRunning;
+                m_sourceSyncTime[sourceName].start();
+                SyncTrace::instance()->begin(m_account->id(), sourceName, "sync-source");
                 Q_EMIT syncSourceStarted(m_syncServiceName, newStatus, isFirstSync);
             }
 
@@ -576,6 +803,8 @@ void SyncAccount::onSessionStatusChanged(const QString &status, quint32 error, c
             if (m_sourcesOnSync.value(sourceName) == SyncAccount::SourceSyncRunning) {
                 m_sourcesOnSync[sourceName] = SyncAccount::SourceSyncDone;
                 m_currentSyncResults.insert(sourceName, QString::number(i.value().error));
+                m_sourceDurations.insert(sourceName, m_sourceSyncTime.take(sourceName).elapsed());
+                SyncTrace::instance()->end(m_account->id(), sourceName, "sync-source");
                 Q_EMIT syncSourceFinished(m_syncServiceName, sourceName, isFirstSync, newStatus, "");
             }
         } else if ((status == "running;waiting") ||
@@ -619,13 +848,56 @@ void SyncAccount::fail(const QString &errorMessage)
         return;
     }
     Q_EMIT syncError(calendarServiceName(), errorMessage);
+    // the other calendars would fail the same way
+    m_deferredSources.clear();
     setFinished();
 }
 
 void SyncAccount::setFinished()
 {
+    // the calendar could be removed from the server, discover it again on the next sync
+    if (m_currentSyncResults.values().contains("404")) {
+        invalidateRemoteSources();
+    }
+
+    if (m_currentSession) {
+        fetchSyncReport(m_currentSession, reportSources(m_sourcesOnSync.keys(), m_currentSyncResults));
+    }
+    SyncTrace::instance()->end(m_account->id(), QString(), "sync");
+
+    // the calendars synced are up to date with the token checked before the sync
+    for(QMap<QString, QString>::const_iterator i = m_currentSyncResults.begin();
+        i != m_currentSyncResults.end();
+        i++) {
+        const QString remoteId = sourceRemoteId(i.key());
+        if (remoteId.isEmpty()) {
+            continue;
+        }
+        const QString token = m_checkedTokens.value(remoteId);
+        if (!token.isEmpty() && SyncResultStore::isSuccess(i.value())) {
+            m_collectionTokens.insert(remoteId, token);
+        } else {
+            m_collectionTokens.remove(remoteId);
+        }
+    }
+
+    m_waitingSession = false;
     m_sourcesOnSync.clear();
     m_sourcesToSync.clear();
+    m_sourceSyncTime.clear();
+    m_sourceDurations.clear();
+
+    // the priority calendars are ready, continue with the others on a new session
+    if (!m_deferredSources.isEmpty()) {
+        releaseSession();
+        qDebug() << "Priority calendars synced in" << m_syncTime.elapsed() << "ms, continue with" << m_deferredSources;
+        Q_EMIT prioritySyncFinished(m_syncServiceName, m_currentSyncResults);
+        m_sourcesToSync = m_deferredSources;
+        m_deferredSources.clear();
+        continueSync();
+        return;
+    }
+
     setState(SyncAccount::Idle);
     releaseSession();
 
@@ -635,6 +907,8 @@ void SyncAccount::setFinished()
         qDebug() << "---------------------------------------------------------Sync finished:"
             << m_syncTime.elapsed() / 1000 << "secs";
     }
+    qDebug() << "Sessions opened for sync:" << m_account->displayName() << m_sessionCount
+             << "total:" << SyncEvolutionServerProxy::sessionCount();
 }
 
 void SyncAccount::onSessionProgressChanged(int progress)
@@ -653,7 +927,15 @@ void SyncAccount::configure()
         return;
     }
 
+    if (remoteSourcesCached()) {
+        qDebug() << "Remote calendars cached, skip configure:" << m_account->displayName()
+                 << "age:" << m_remoteSourcesAge.elapsed() / 1000 << "secs";
+        checkChanges();
+        return;
+    }
+
     setState(SyncAccount::Configuring);
+    SyncTrace::instance()->begin(m_account->id(), QString(), "configure");
     m_config = new SyncConfigure(this,
                                  m_settings,
                                  this);
@@ -667,20 +949,155 @@ void SyncAccount::configure()
     m_config->configure();
 }
 
+// Skip the sync session of calendars that did not change since the last
+// successful sync: the server reports a new token for each remote change and
+// the local changes forget the token of the calendar, see notifyLocalChange()
+void SyncAccount::checkChanges()
+{
+    setState(SyncAccount::AboutToSync);
+    m_checkingChanges = true;
+    m_checkedTokens.clear();
+    m_checkedSources.clear();
+    SyncTrace::instance()->begin(m_account->id(), QString(), "check-changes");
+
+    SyncAuth *auth = new SyncAuth(m_account, calendarServiceName(), this);
+    connect(auth, SIGNAL(success()), SLOT(onChangeCheckAuthSuccess()));
+    connect(auth, SIGNAL(fail()), SLOT(onChangeCheckAuthFailed()));
+    if (!auth->authenticate()) {
+        auth->deleteLater();
+        qWarning() << "Could not authenticate account, sync without check changes";
+        onChangeCheckFinished(QMap<QString, QString>());
+    }
+}
+
+void SyncAccount::onChangeCheckAuthSuccess()
+{
+    SyncAuth *auth = qobject_cast<SyncAuth*>(QObject::sender());
+    Q_ASSERT(auth);
+    auth->deleteLater();
+    if (!m_checkingChanges) {
+        return;
+    }
+
+    if (!m_changeCheck) {
+        m_changeCheck = new CalDavChangeCheck(0, this);
+        connect(m_changeCheck, &CalDavChangeCheck::finished,
+                this, &SyncAccount::onChangeCheckFinished);
+    }
+    if (!auth->token().isEmpty()) {
+        m_changeCheck->setToken(auth->token());
+    } else if (!auth->secret().isEmpty()) {
+        m_changeCheck->setCredentials(auth->username(), auth->secret());
+    } else {
+        qDebug() << "No credentials available, sync without check changes";
+        onChangeCheckFinished(QMap<QString, QString>());
+        return;
+    }
+
+    // calendars still fetching their history always sync
+    const QStringList backfill = backfillSources();
+    const QUrl baseUrl(host());
+    QMap<QString, QUrl> collections;
+    Q_FOREACH(const SyncDatabase &db, m_remoteSources) {
+        const SourceData source(SyncConfigure::formatSourceName(m_account->id(), db.remoteId),
+                                db.remoteId, db.writable);
+        const bool requested = m_sourcesToSync.isEmpty() ? !isHiddenSource(source)
+                                                         : m_sourcesToSync.contains(db.remoteId);
+        if (!requested) {
+            continue;
+        }
+        m_checkedSources << db.remoteId;
+        const QUrl url = baseUrl.resolved(QUrl(db.source));
+        if (!backfill.contains(db.remoteId) && url.isValid()) {
+            collections.insert(db.remoteId, url);
+        }
+    }
+    m_changeCheck->check(collections);
+}
+
+void SyncAccount::onChangeCheckAuthFailed()
+{
+    SyncAuth *auth = qobject_cast<SyncAuth*>(QObject::sender());
+    Q_ASSERT(auth);
+    auth->deleteLater();
+    if (m_checkingChanges) {
+        // the sync reports the authentication error
+        onChangeCheckFinished(QMap<QString, QString>());
+    }
+}
+
+void SyncAccount::onChangeCheckFinished(const QMap<QString, QString> &tokens)
+{
+    if (!m_checkingChanges) {
+        return;
+    }
+    m_checkingChanges = false;
+    SyncTrace::instance()->end(m_account->id(), QString(), "check-changes");
+
+    // EDS changes are not notified before the first client attaches, a local
+    // change could be missed: sync everything and do not keep the tokens
+    const bool trackingComplete = m_eds && m_eds->isEnabled();
+    m_checkedTokens = trackingComplete ? tokens : QMap<QString, QString>();
+
+    const QStringList unchanged = unchangedSources(m_checkedSources, tokens, m_collectionTokens, trackingComplete);
+    QStringList changed;
+    Q_FOREACH(const QString &remoteId, m_checkedSources) {
+        if (!unchanged.contains(remoteId)) {
+            changed << remoteId;
+        }
+    }
+    m_checkedSources.clear();
+
+    if (unchanged.isEmpty()) {
+        continueSync();
+        return;
+    }
+
+    qDebug() << "Calendars not changed since the last sync:" << m_account->displayName() << unchanged;
+    if (changed.isEmpty()) {
+        m_sourcesToSync.clear();
+        qDebug() << "Nothing to sync!";
+        setFinished();
+        return;
+    }
+
+    m_sourcesToSync = changed;
+    continueSync();
+}
+
+void SyncAccount::notifyLocalChange(const QString &remoteId)
+{
+    if (remoteId.isEmpty()) {
+        m_collectionTokens.clear();
+    } else {
+        m_collectionTokens.remove(remoteId);
+    }
+}
+
 void SyncAccount::onAccountConfigured(const QStringList &services)
 {
+    SyncEvolutionSessionProxy *session = m_config->takeSession();
+    m_sessionCount += m_config->sessionCount();
     m_config->deleteLater();
     m_config = 0;
 
+    m_configFingerprint = configFingerprint(m_remoteSources);
+    m_remoteSourcesAge.start();
+    SyncTrace::instance()->end(m_account->id(), QString(), "configure");
+
     Q_EMIT configured(services);
 
-    continueSync();
+    continueSync(session);
 }
 
 void SyncAccount::onAccountConfigureError(int error)
 {
+    invalidateRemoteSources();
+    m_configFingerprint.clear();
+    m_sessionCount += m_config->sessionCount();
     m_config->deleteLater();
     m_config = 0;
+    SyncTrace::instance()->end(m_account->id(), QString(), "configure");
 
     qWarning() << "Failed to configure account" << m_account->displayName() << error;
     Q_EMIT syncError(calendarServiceName(), QString::number(error));
@@ -723,6 +1140,293 @@ void SyncAccount::releaseSession()
     }
 }
 
+// Requests the report of the last sync before the session is released and
+// converts it to history entries of the synced sources
+void SyncAccount::fetchSyncReport(SyncEvolutionSessionProxy *session, const QStringList &sourceNames)
+{
+    QMap<QString, QString> remoteIds;
+    Q_FOREACH(const QString &sourceName, sourceNames) {
+        remoteIds.insert(sourceName, sourceRemoteId(sourceName));
+    }
+    if (remoteIds.isEmpty()) {
+        return;
+    }
+
+    const QMap<QString, qint64> durations = m_sourceDurations;
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(session->reports(0, 1), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, remoteIds, durations](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QArrayOfStringMap> reply = *call;
+        if (reply.isError() || reply.value().isEmpty()) {
+            qWarning() << "Fail to get sync report" << reply.error().message();
+            return;
+        }
+
+        const QStringMap report = reply.value().first();
+        QList<SyncHistoryEntry> entries;
+        for(QMap<QString, QString>::const_iterator i = remoteIds.begin(); i != remoteIds.end(); i++) {
+            SyncHistoryEntry entry = SyncHistory::entryFromReport(m_account->id(),
+                                                                  i.key(),
+                                                                  i.value(),
+                                                                  SyncHistory::filterSourceReport(report, i.key()));
+            if (durations.contains(i.key())) {
+                entry.duration = durations.value(i.key());
+            }
+            if (entry.mode == "slow") {
+                qWarning() << "Slow sync on source" << i.key() << "account" << m_account->displayName();
+            }
+            entries << entry;
+        }
+        Q_EMIT syncReportAvailable(entries);
+    });
+}
+
+QList<SourceData> SyncAccount::splitPrioritySources(const QList<SourceData> &sources,
+                                                   const QSet<QString> &priorityIds,
+                                                   QStringList *deferred)
+{
+    QList<SourceData> priority;
+    QStringList others;
+    Q_FOREACH(const SourceData &source, sources) {
+        if (priorityIds.contains(source.remoteId)) {
+            priority << source;
+        } else {
+            others << source.remoteId;
+        }
+    }
+
+    deferred->clear();
+    if (priority.isEmpty() || others.isEmpty()) {
+        return sources;
+    }
+    *deferred = others;
+    return priority;
+}
+
+QStringList SyncAccount::unchangedSources(const QStringList &sources,
+                                          const QMap<QString, QString> &tokens,
+                                          const QHash<QString, QString> &knownTokens,
+                                          bool trackingComplete)
+{
+    QStringList unchanged;
+    if (!trackingComplete) {
+        return unchanged;
+    }
+
+    Q_FOREACH(const QString &remoteId, sources) {
+        const QString token = tokens.value(remoteId);
+        if (!token.isEmpty() && (knownTokens.value(remoteId) == token)) {
+            unchanged << remoteId;
+        }
+    }
+    return unchanged;
+}
+
+QStringList SyncAccount::reportSources(const QStringList &sessionSources,
+                                       const QMap<QString, QString> &results)
+{
+    QStringList sourceNames;
+    Q_FOREACH(const QString &sourceName, sessionSources) {
+        if (!sourceName.isEmpty() && results.contains(sourceName)) {
+            sourceNames << sourceName;
+        }
+    }
+    return sourceNames;
+}
+
+// Interval in minutes between periodic syncs, providers can change it with
+// the "sync-period" key on the calendar group of the template
+int SyncAccount::syncPeriod() const
+{
+    if (!m_settings) {
+        return ACCOUNT_SYNC_PERIOD;
+    }
+    return m_settings->value(CALENDAR_SERVICE_TYPE"/sync-period", ACCOUNT_SYNC_PERIOD).toInt();
+}
+
+// Days of history synced, providers can change it with the "sync-window" key
+// on the calendar group of the template
+int SyncAccount::syncWindow() const
+{
+    if (!m_settings) {
+        return ACCOUNT_SYNC_WINDOW;
+    }
+    return m_settings->value(CALENDAR_SERVICE_TYPE"/sync-window", ACCOUNT_SYNC_WINDOW).toInt();
+}
+
+// Days of history fetched by the first sync of a calendar, the rest of the
+// sync window is fetched later in steps, see sourceWindow()
+int SyncAccount::firstSyncWindow() const
+{
+    if (!m_settings) {
+        return ACCOUNT_FIRST_SYNC_WINDOW;
+    }
+    return m_settings->value(CALENDAR_SERVICE_TYPE"/first-sync-window", ACCOUNT_FIRST_SYNC_WINDOW).toInt();
+}
+
+// Window to use on the next sync of the source, 0 means the full window.
+// Every successful sync doubles the window of a staged first sync until it
+// covers the full one, the daemon saves it once the source syncs.
+int SyncAccount::sourceWindow(const QString &sourceName) const
+{
+    if (!m_results) {
+        return 0;
+    }
+    return m_results->nextWindow(m_account->id(), sourceName, firstSyncWindow(), syncWindow());
+}
+
+QHash<QString, int> SyncAccount::sessionWindows() const
+{
+    return m_sessionWindows;
+}
+
+// The default calendar of the account and the calendars visible on the
+// calendar app. New calendars are always selected on EDS, so the selection
+// only counts after the first sync.
+bool SyncAccount::isPrioritySource(const SourceData &source) const
+{
+    Q_FOREACH(const SyncDatabase &db, m_remoteSources) {
+        if ((db.remoteId == source.remoteId) && db.defaultCalendar) {
+            return true;
+        }
+    }
+
+    if (!m_eds || !m_eds->isIndexReady() || lastSyncStatus(source.sourceName).isEmpty()) {
+        return false;
+    }
+    return m_eds->sourceByRemoteId(source.remoteId, m_account->id()).selected;
+}
+
+// Calendars hidden on the calendar app, new calendars are never hidden
+bool SyncAccount::isHiddenSource(const SourceData &source) const
+{
+    if (!m_eds || !m_eds->isIndexReady() || lastSyncStatus(source.sourceName).isEmpty()) {
+        return false;
+    }
+    return !m_eds->sourceByRemoteId(source.remoteId, m_account->id()).selected;
+}
+
+// Remote ids of the calendars still fetching their history
+QStringList SyncAccount::backfillSources() const
+{
+    QStringList remoteIds;
+    if (!m_results) {
+        return remoteIds;
+    }
+
+    Q_FOREACH(const QString &sourceName, m_results->windows(m_account->id()).keys()) {
+        const QString remoteId = sourceRemoteId(sourceName);
+        if (!remoteId.isEmpty()) {
+            remoteIds << remoteId;
+        }
+    }
+    return remoteIds;
+}
+
+// Identifies the syncevolution config created for the remote calendars, if
+// any of the values used by SyncConfigure changes the account needs to be
+// configured again
+QByteArray SyncAccount::configFingerprint(const QArrayOfDatabases &sources) const
+{
+    QStringList dbs;
+    Q_FOREACH(const SyncDatabase &db, sources) {
+        dbs << QString("%1|%2|%3|%4|%5")
+               .arg(db.remoteId)
+               .arg(db.source)
+               .arg(db.writable)
+               .arg(db.name)
+               .arg(db.title);
+    }
+    dbs.sort();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(host().toUtf8());
+    hash.addData(calendarServiceName().toUtf8());
+    if (m_settings) {
+        hash.addData(m_settings->value(CALENDAR_SERVICE_TYPE"/uoa-service").toByteArray());
+        hash.addData(m_settings->value(GLOBAL_CONFIG_GROUP"/template").toByteArray());
+    }
+    hash.addData(dbs.join("\n").toUtf8());
+    return hash.result();
+}
+
+bool SyncAccount::isConfiguredFor(const QArrayOfDatabases &sources) const
+{
+    return !m_configFingerprint.isEmpty() &&
+           (m_configFingerprint == configFingerprint(sources));
+}
+
+// The remote calendars from the last discovery can be used without configure
+// the account again
+bool SyncAccount::remoteSourcesCached() const
+{
+    if (m_remoteSources.isEmpty() ||
+        !m_remoteSourcesAge.isValid() ||
+        m_remoteSourcesAge.hasExpired(REMOTE_SOURCES_CACHE_TTL)) {
+        return false;
+    }
+
+    // account settings changed since the last configuration
+    if (!isConfiguredFor(m_remoteSources)) {
+        return false;
+    }
+
+    // calendar requested explicitly that was not present on last discovery
+    Q_FOREACH(const QString &remoteId, m_sourcesToSync) {
+        bool found = false;
+        Q_FOREACH(const SyncDatabase &db, m_remoteSources) {
+            if (db.remoteId == remoteId) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SyncAccount::invalidateRemoteSources()
+{
+    if (m_remoteSourcesAge.isValid()) {
+        qDebug() << "Remote calendars cache invalidated:" << m_account->displayName();
+    }
+    m_remoteSourcesAge.invalidate();
+}
+
+// EDS sources shared with the daemon, used during the configuration
+EdsHelper *SyncAccount::edsHelper() const
+{
+    return m_eds;
+}
+
+void SyncAccount::setEdsHelper(EdsHelper *eds)
+{
+    m_eds = eds;
+}
+
+void SyncAccount::setResultStore(SyncResultStore *results)
+{
+    m_results = results;
+}
+
+void SyncAccount::setRetryPolicy(SyncRetryPolicy *retryPolicy)
+{
+    m_retryPolicy = retryPolicy;
+}
+
+QString SyncAccount::sourceRemoteId(const QString &sourceName) const
+{
+    Q_FOREACH(const SyncDatabase &db, m_remoteSources) {
+        if (SyncConfigure::formatSourceName(m_account->id(), db.remoteId) == sourceName) {
+            return db.remoteId;
+        }
+    }
+    return QString();
+}
+
 QString SyncAccount::statusDescription(const QString &status)
 {
     if (status.isEmpty()) {
@@ -785,9 +1489,11 @@ QString SyncAccount::statusDescription(const QString &status)
 
 void SyncAccount::fetchRemoteSources(const QString &serviceName)
 {
+    SyncTrace::instance()->begin(m_account->id(), QString(), "fetch-calendars");
     m_remoteSources.clear();
+    m_fetchingRemoteSources = true;
 
-    SyncAuth *auth = new SyncAuth(m_account->id(), serviceName, this);
+    SyncAuth *auth = new SyncAuth(m_account, serviceName, this);
     connect(auth, SIGNAL(success()), SLOT(onAuthSucess()));
     connect(auth, SIGNAL(fail()), SLOT(onAuthFailed()));
     if (!auth->authenticate()) {
@@ -803,19 +1509,15 @@ void SyncAccount::onAuthSucess()
     Q_ASSERT(auth);
 
     if (providerName() == GOOGLE_PROVIDER_NAME) {
-        QNetworkAccessManager *manager = new QNetworkAccessManager(this);
-        connect(manager, SIGNAL(finished(QNetworkReply*)),
-                this, SLOT(onReplyFinished(QNetworkReply*)));
-
-        QNetworkRequest req;
-        req.setUrl(QUrl("https://www.googleapis.com/calendar/v3/users/me/calendarList"));
-        req.setRawHeader(QByteArray("GData-Version"), QByteArray("3.0"));
-        req.setRawHeader(QByteArray("Authorization"), QByteArray("Bearer " + auth->token().toUtf8()));
-
-        manager->get(req);
+        if (!m_calendarList) {
+            m_calendarList = new GoogleCalendarList(0, this);
+            connect(m_calendarList, &GoogleCalendarList::finished,
+                    this, &SyncAccount::onCalendarListFinished);
+        }
+        m_calendarList->fetch(auth->token());
     } else {
         const QString username = QString("uoa:%1,%2").arg(id()).arg(calendarServiceName());
-        fetchRemoteCalendarsFromCommand(username, "");
+        fetchRemoteCalendarsFromSession(username);
     }
     auth->deleteLater();
 }
@@ -829,75 +1531,24 @@ void SyncAccount::onAuthFailed()
     Q_EMIT remoteSourcesAvailable(m_remoteSources, 403);
 }
 
-void SyncAccount::onReplyFinished(QNetworkReply *reply)
+void SyncAccount::onCalendarListFinished(const QArrayOfDatabases &calendars, int error)
 {
-    static QStringList writableRoles;
-    static const QString calendarSyncUrl("https://apidata.googleusercontent.com:443/caldav/v2/%u/events/?SyncEvolution=Google");
-    QNetworkAccessManager *manager = qobject_cast<QNetworkAccessManager*>(QObject::sender());
-    manager->deleteLater();
-    reply->deleteLater();
-
-    if (reply->error() != QNetworkReply::NoError) {
-        qWarning() << "Could not fetch remote sources:" << reply->errorString();
-        Q_EMIT remoteSourcesAvailable(m_remoteSources, reply->error() == QNetworkReply::AuthenticationRequiredError ? 403 : 20007);
-        return;
-    }
-
-    int responseCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-    if (responseCode != 200) {
-        qWarning() << "Could not fetch remote source response:" << responseCode;
-        Q_EMIT remoteSourcesAvailable(m_remoteSources, 20007);
-        return;
+    // the token was revoked, do not use it again
+    if (error == 403) {
+        SyncTokenCache::instance()->remove(m_account->id(), calendarServiceName());
     }
-
-    if (writableRoles.isEmpty()) {
-        writableRoles << "writer"
-                      << "owner";
-    }
-
-    QByteArray data = reply->readAll();
-
-    // parse result
-    QJsonParseError jError;
-    QJsonDocument doc = QJsonDocument::fromJson(data, &jError);
-    if (jError.error == QJsonParseError::NoError) {
-        QJsonObject body = doc.object();
-        if (body.value("kind").toString() == "calendar#calendarList") {
-            QJsonArray items = body.value("items").toArray();
-            Q_FOREACH(const QJsonValue &i, items) {
-                QJsonObject calendar = i.toObject();
-                if (calendar.value("kind").toString() == "calendar#calendarListEntry") {
-                    qDebug() << "Found db:"
-                             << "\n\tSummary:" << calendar.value("summary").toString()
-                             << "\n\tID:" << calendar.value("id").toString()
-                             << "\n\tSelected:" << calendar.value("selected").toBool()
-                             << "\n\tAccessRole:" << calendar.value("accessRole").toString();
-
-                    if (calendar.value("selected").toBool()) {
-                        SyncDatabase db;
-
-                        db.name = calendar.value("summary").toString();
-                        db.remoteId = calendar.value("id").toString();
-                        db.source = QString(calendarSyncUrl).replace("%u", QUrl::toPercentEncoding(db.remoteId));
-                        db.writable =  writableRoles.contains(calendar.value("accessRole").toString());
-                        db.defaultCalendar = calendar.value("primary").toBool();
-                        db.title = calendar.value("summaryOverride").toString();
-                        db.color = calendar.value("backgroundColor").toString();
-                        m_remoteSources << db;
-                    }
-                }
-            }
-        }
+    if (error == 0) {
+        qDebug() << "Calendar list fetched:" << m_account->displayName()
+                 << "pages:" << m_calendarList->pageCount()
+                 << "not modified:" << m_calendarList->notModified();
     }
-
-    Q_EMIT remoteSourcesAvailable(m_remoteSources, 0);
+    m_remoteSources = calendars;
+    Q_EMIT remoteSourcesAvailable(m_remoteSources, error);
 }
 
 
-void SyncAccount::fetchRemoteCalendarsFromCommand(const QString &username, const QString &password) const
+QString SyncAccount::databasesUrl() const
 {
-    // syncevolution --print-databases backend=caldav
-    QStringList args;
     QString syncUrl(host());
 
     // Use well-known url that will re-direct to the correct path
@@ -905,23 +1556,154 @@ void SyncAccount::fetchRemoteCalendarsFromCommand(const QString &username, const
         providerName().toLower() == "nextcloud") {
         syncUrl += QStringLiteral("/remote.php/caldav");
     }
+    return syncUrl;
+}
+
+// Ask syncevo-dbus-server for the calendars using a temporary config,
+// the config is never saved and the session is closed after the query
+void SyncAccount::fetchRemoteCalendarsFromSession(const QString &username)
+{
+    const QString sessionName = QString("%1-databases").arg(SyncConfigure::accountSessionName(m_account));
+    SyncEvolutionServerProxy *proxy = SyncEvolutionServerProxy::instance();
+
+    const uint generation = m_fetchGeneration;
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(proxy->openSession(sessionName, QStringList()), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, sessionName, username, generation](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QDBusObjectPath> reply = *call;
+        if (generation != m_fetchGeneration) {
+            // canceled while the session was starting
+            if (!reply.isError()) {
+                SyncEvolutionServerProxy::instance()->createSession(sessionName, reply.value())->destroy();
+            }
+            return;
+        }
+        if (reply.isError()) {
+            qWarning() << "Could not open session to fetch calendars" << reply.error().message();
+            fetchRemoteCalendarsFromCommand(username, "");
+            return;
+        }
+
+        m_sessionCount++;
+        m_queryingCalendars = false;
+        m_discoverySession = SyncEvolutionServerProxy::instance()->createSession(sessionName, reply.value());
+        SyncEvolutionSessionProxy *session = m_discoverySession;
+
+        // the session stays queued while other account is syncing
+        connect(session, &SyncEvolutionSessionProxy::statusChanged, this,
+                [this, session, username](const QString &status, uint errorNumber, QSyncStatusMap sources) {
+            Q_UNUSED(errorNumber);
+            Q_UNUSED(sources);
+            if (status != "queueing") {
+                queryRemoteCalendars(session, username);
+            }
+        });
+
+        QDBusPendingCallWatcher *statusWatcher = new QDBusPendingCallWatcher(session->status(), this);
+        connect(statusWatcher, &QDBusPendingCallWatcher::finished, this,
+                [this, session, username, generation](QDBusPendingCallWatcher *call) {
+            call->deleteLater();
+            QDBusPendingReply<QString> reply = *call;
+            if (generation != m_fetchGeneration) {
+                return;
+            }
+            if (!reply.isError() && (reply.value() == "queueing")) {
+                return;
+            }
+            queryRemoteCalendars(session, username);
+        });
+    });
+}
+
+void SyncAccount::queryRemoteCalendars(SyncEvolutionSessionProxy *session, const QString &username)
+{
+    // the status change and the status reply can both report the session
+    // ready, query only once; a different session means it was canceled
+    if ((session != m_discoverySession) || m_queryingCalendars) {
+        return;
+    }
+    m_queryingCalendars = true;
+    session->disconnect(this);
+
+    QStringMultiMap config;
+    config[""]["username"] = username;
+    config[""]["syncURL"] = databasesUrl();
+    config["source/calendar"]["backend"] = "caldav";
+
+    const uint generation = m_fetchGeneration;
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(session->saveConfig("", config, true), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, session, username, generation](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<> reply = *call;
+        // the session was released by cancel()
+        if (generation != m_fetchGeneration) {
+            return;
+        }
+        if (reply.isError()) {
+            qWarning() << "Could not create temporary config" << reply.error().message();
+            releaseDiscoverySession(session);
+            fetchRemoteCalendarsFromCommand(username, "");
+            return;
+        }
+
+        qDebug() << "Fetching remote calendars…";
+        QDBusPendingCallWatcher *dbWatcher = new QDBusPendingCallWatcher(session->getDatabases("calendar"), this);
+        connect(dbWatcher, &QDBusPendingCallWatcher::finished, this,
+                [this, session, username, generation](QDBusPendingCallWatcher *call) {
+            call->deleteLater();
+            QDBusPendingReply<QArrayOfDatabases> reply = *call;
+            if (generation != m_fetchGeneration) {
+                return;
+            }
+            releaseDiscoverySession(session);
 
+            if (reply.isError()) {
+                qWarning() << "Fail to fetch databases" << reply.error().message();
+                fetchRemoteCalendarsFromCommand(username, "");
+                return;
+            }
+            m_remoteSources = reply.value();
+            Q_EMIT remoteSourcesAvailable(m_remoteSources, 0);
+        });
+    });
+}
+
+void SyncAccount::releaseDiscoverySession(SyncEvolutionSessionProxy *session)
+{
+    if (session == m_discoverySession) {
+        m_discoverySession = 0;
+        m_queryingCalendars = false;
+    }
+    session->destroy();
+}
+
+void SyncAccount::fetchRemoteCalendarsFromCommand(const QString &username, const QString &password)
+{
+    // syncevolution --print-databases backend=caldav
+    QStringList args;
     args << "--print-databases"
          << "backend=caldav"
          << QString("username=%1").arg(username)
-         << QString("password=%1").arg(password)
-         << QString("syncURL=%1").arg(syncUrl);
-    QProcess *syncEvo = new QProcess;
+         << QString("syncURL=%1").arg(databasesUrl());
+    // do not expose the password on the process list if not needed
+    if (!password.isEmpty()) {
+        args << QString("password=%1").arg(password);
+    }
+    QProcess *syncEvo = new QProcess(this);
     syncEvo->setProcessChannelMode(QProcess::MergedChannels);
-    syncEvo->start("syncevolution", args);
     connect(syncEvo, SIGNAL(finished(int,QProcess::ExitStatus)),
             SLOT(fetchRemoteCalendarsProcessDone(int,QProcess::ExitStatus)));
-    qDebug() << "Fetching remote calendars…)";
+    syncEvo->start("syncevolution", args);
+    qDebug() << "Fetching remote calendars with syncevolution command";
 }
 
 void SyncAccount::fetchRemoteCalendarsProcessDone(int exitCode, QProcess::ExitStatus exitStatus)
 {
+    Q_UNUSED(exitCode);
     QProcess *syncEvo = qobject_cast<QProcess*>(QObject::sender());
+    syncEvo->deleteLater();
 
     if (exitStatus == QProcess::NormalExit) {
         QString output = syncEvo->readAll();
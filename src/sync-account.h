@@ -24,15 +24,22 @@
 #include <QtCore/QSettings>
 #include <QtCore/QPair>
 #include <QtCore/QString>
-
-#include <QtNetwork/QNetworkReply>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QProcess>
+#include <QtCore/QSet>
 
 #include <Accounts/Account>
 
 #include "dbustypes.h"
+#include "sync-history.h"
 
 class SyncEvolutionSessionProxy;
 class SyncConfigure;
+class GoogleCalendarList;
+class CalDavChangeCheck;
+class EdsHelper;
+class SyncResultStore;
+class SyncRetryPolicy;
 
 class SourceData
 {
@@ -93,10 +100,42 @@ public:
     QString host() const;
     QString providerName() const;
     QString calendarServiceName() const;
+    QString sourceRemoteId(const QString &sourceName) const;
+    int syncPeriod() const;
+    int syncWindow() const;
+    int firstSyncWindow() const;
+    QStringList backfillSources() const;
+    // windows used by the current sync, by source name
+    QHash<QString, int> sessionWindows() const;
+    EdsHelper *edsHelper() const;
+    void setEdsHelper(EdsHelper *eds);
+    void setResultStore(SyncResultStore *results);
+    void setRetryPolicy(SyncRetryPolicy *retryPolicy);
 
     void fetchRemoteSources(const QString &serviceName);
+    bool isConfiguredFor(const QArrayOfDatabases &sources) const;
+    bool remoteSourcesCached() const;
+    // the calendar was changed locally, an empty remoteId means any calendar
+    void notifyLocalChange(const QString &remoteId);
 
     static QString statusDescription(const QString &status);
+    // sources of the first session, the remote ids of the others are moved to
+    // deferred; nothing is deferred when all or none of them have priority
+    static QList<SourceData> splitPrioritySources(const QList<SourceData> &sources,
+                                                  const QSet<QString> &priorityIds,
+                                                  QStringList *deferred);
+    // calendars with the same token of the last sync, none while the local
+    // changes are not tracked
+    static QStringList unchangedSources(const QStringList &sources,
+                                        const QMap<QString, QString> &tokens,
+                                        const QHash<QString, QString> &knownTokens,
+                                        bool trackingComplete);
+    // sources of a finished session with a result, each session has its own report
+    static QStringList reportSources(const QStringList &sessionSources,
+                                     const QMap<QString, QString> &results);
+
+public Q_SLOTS:
+    void invalidateRemoteSources();
 
 Q_SIGNALS:
     void stateChanged(AccountState newState);
@@ -105,6 +144,8 @@ Q_SIGNALS:
 
     void syncStarted();
     void syncFinished(const QString &serviceName, QMap<QString, QString> sourcesStatus);
+    // the calendars synced first are ready, the others are still syncing
+    void prioritySyncFinished(const QString &serviceName, QMap<QString, QString> sourcesStatus);
     void syncError(const QString &serviceName, const QString &syncError);
 
     void enableChanged(const QString &serviceName, bool enable);
@@ -112,6 +153,7 @@ Q_SIGNALS:
     void sourceRemoved(const QString &sourceName);
 
     void remoteSourcesAvailable(const QArrayOfDatabases &sources, int error);
+    void syncReportAvailable(const QList<SyncHistoryEntry> &entries);
 
 private Q_SLOTS:
     void onAccountConfigured(const QStringList &services);
@@ -126,7 +168,12 @@ private Q_SLOTS:
     // calendar list
     void onAuthSucess();
     void onAuthFailed();
-    void onReplyFinished(QNetworkReply *reply);
+    void onCalendarListFinished(const QArrayOfDatabases &calendars, int error);
+
+    // change check
+    void onChangeCheckAuthSuccess();
+    void onChangeCheckAuthFailed();
+    void onChangeCheckFinished(const QMap<QString, QString> &tokens);
 
 protected:
     void fail(const QString &errorMessage);
@@ -136,12 +183,28 @@ private:
     Accounts::Account *m_account;
     QDateTime m_startSyncTime;
     SyncEvolutionSessionProxy *m_currentSession;
+    GoogleCalendarList *m_calendarList;
+    CalDavChangeCheck *m_changeCheck;
+    SyncEvolutionSessionProxy *m_discoverySession;
+    // the calendars are queried once per discovery session
+    bool m_queryingCalendars;
+    bool m_fetchingRemoteSources;
+    // replies of a canceled calendar fetch are ignored
+    uint m_fetchGeneration;
     const QSettings *m_settings;
     SyncConfigure *m_config;
+    EdsHelper *m_eds;
+    SyncResultStore *m_results;
+    SyncRetryPolicy *m_retryPolicy;
     QStringList m_sourcesToSync;
+    QStringList m_deferredSources;
+    bool m_firstPass;
     QMap<QString, SyncAccount::SourceState> m_sourcesOnSync;
     QMap<QString, QString> m_currentSyncResults;
     QElapsedTimer m_syncTime;
+    QHash<QString, QElapsedTimer> m_sourceSyncTime;
+    QMap<QString, qint64> m_sourceDurations;
+    QHash<QString, int> m_sessionWindows;
 
     QMap<QString, bool> m_availabeServices;
     AccountState m_state;
@@ -149,28 +212,53 @@ private:
     uint m_lastError;
     bool m_retrySync;
     QArrayOfDatabases m_remoteSources;
+    QElapsedTimer m_remoteSourcesAge;
+    QByteArray m_configFingerprint;
+    // collection tokens by remote id at the last successful sync
+    QHash<QString, QString> m_collectionTokens;
+    QMap<QString, QString> m_checkedTokens;
+    QStringList m_checkedSources;
+    bool m_checkingChanges;
+    bool m_waitingSession;
+    bool m_sharedSession;
+    bool m_openingSession;
+    int m_sessionCount;
 
     // current sync information
     QString m_syncMode;
     QString m_syncServiceName;
 
     void configure();
-    void continueSync();
-
+    void checkChanges();
+    void continueSync(SyncEvolutionSessionProxy *session = 0);
+    void startSync();
+    void startSync(const QStringMultiMap &config);
+    void startSync(const QStringMap &syncFlags);
+    int sourceWindow(const QString &sourceName) const;
+
+    void cancelConfigure();
     void setState(AccountState state);
     QString syncMode(const QString &sourceName, bool *firstSync) const;
     bool syncService(const QString &serviceName);
     void setupServices();
 
-    void fetchRemoteCalendarsFromCommand(const QString &username, const QString &password) const;
+    QString databasesUrl() const;
+    void fetchRemoteCalendarsFromSession(const QString &username);
+    void queryRemoteCalendars(SyncEvolutionSessionProxy *session, const QString &username);
+    void releaseDiscoverySession(SyncEvolutionSessionProxy *session);
+    void fetchRemoteCalendarsFromCommand(const QString &username, const QString &password);
 
     // session control
-    bool prepareSession(const QString &session = QString::null);
+    void prepareSession();
+    void waitForSession();
     void attachSession(SyncEvolutionSessionProxy *session);
     void releaseSession();
+    void fetchSyncReport(SyncEvolutionSessionProxy *session, const QStringList &sourceNames);
 
-    QList<SourceData> sources() const;
-    QStringMap filterSourceReport(const QStringMap &report, const QString &serviceName, uint accountId, const QString &sourceName) const;
+    QByteArray configFingerprint(const QArrayOfDatabases &sources) const;
+    QList<SourceData> sources(const QStringMultiMap &config) const;
+    bool isPrioritySource(const SourceData &source) const;
+    bool isHiddenSource(const SourceData &source) const;
 
     QString lastSyncStatus(const QString &sourceName) const;
 };
@@ -18,6 +18,8 @@
 
 
 #include "sync-auth.h"
+#include "sync-token-cache.h"
+#include "sync-trace.h"
 
 #include <Accounts/Manager>
 #include <Accounts/Account>
@@ -28,13 +30,17 @@ using namespace Accounts;
 using namespace SignOn;
 
 
-SyncAuth::SyncAuth(uint accountId, const QString &serviceName, QObject *parent)
+SyncAuth::SyncAuth(Account *account, const QString &serviceName, QObject *parent)
     : QObject(parent),
-      m_accountId(accountId),
-      m_serviceName(serviceName),
-      m_accountManager(new Manager(this))
+      m_account(account),
+      m_serviceName(serviceName)
 {
-    m_account.reset(Account::fromId(m_accountManager.data(), accountId));
+    connect(this, &SyncAuth::success, [this]() {
+        SyncTrace::instance()->end(m_account->id(), QString(), "authenticate");
+    });
+    connect(this, &SyncAuth::fail, [this]() {
+        SyncTrace::instance()->end(m_account->id(), QString(), "authenticate");
+    });
 }
 
 QString SyncAuth::token() const
@@ -42,10 +48,42 @@ QString SyncAuth::token() const
     return m_token;
 }
 
+QString SyncAuth::username() const
+{
+    return m_username;
+}
+
+QString SyncAuth::secret() const
+{
+    return m_secret;
+}
+
 bool SyncAuth::authenticate()
 {
     if (!m_account) {
-        qWarning() << "Invalid account id:" << m_accountId;
+        qWarning() << "Invalid account";
+        return false;
+    }
+
+    SyncTrace::instance()->begin(m_account->id(), QString(), "authenticate");
+    if (SyncTokenCache::instance()->token(m_account->id(), m_serviceName, &m_token)) {
+        qDebug() << "Using cached token for account:" << m_account->displayName();
+        QMetaObject::invokeMethod(this, "tokenChanged", Qt::QueuedConnection);
+        QMetaObject::invokeMethod(this, "success", Qt::QueuedConnection);
+        return true;
+    }
+
+    if (!refresh()) {
+        SyncTrace::instance()->end(m_account->id(), QString(), "authenticate");
+        return false;
+    }
+    return true;
+}
+
+bool SyncAuth::refresh()
+{
+    if (!m_account) {
+        qWarning() << "Invalid account";
         return false;
     }
 
@@ -55,16 +93,14 @@ bool SyncAuth::authenticate()
         return true;
     }
 
-    Accounts::Service srv(m_accountManager->service(m_serviceName));
+    Accounts::Service srv(m_account->manager()->service(m_serviceName));
     if (!srv.isValid()) {
         qWarning() << QString("error: Service [%1] not found for account [%2].")
                 .arg(m_serviceName)
                 .arg(m_account->displayName());
         return false;
     }
-    m_account->selectService(srv);
-
-    Accounts::AccountService *accSrv = new Accounts::AccountService(m_account.data(), srv);
+    Accounts::AccountService *accSrv = new Accounts::AccountService(m_account, srv);
     if (!accSrv) {
         qWarning() << QString("error: Account %1 has no valid account service")
                       .arg(m_account->displayName());
@@ -121,7 +157,14 @@ void SyncAuth::onSessionResponse(const SignOn::SessionData &sessionData)
     m_session.clear();
 
     m_token = sessionData.getProperty(QStringLiteral("AccessToken")).toString();
+    m_username = sessionData.getProperty(QStringLiteral("UserName")).toString();
+    m_secret = sessionData.getProperty(QStringLiteral("Secret")).toString();
     qDebug() << "Authenticated !!!";
+    // passwords are kept by signon
+    if (!m_token.isEmpty()) {
+        SyncTokenCache::instance()->insert(m_account->id(), m_serviceName, m_token,
+                                           sessionData.getProperty(QStringLiteral("ExpiresIn")).toInt());
+    }
 
     Q_EMIT tokenChanged();
     Q_EMIT success();
@@ -134,8 +177,10 @@ void SyncAuth::onError(const SignOn::Error &error)
     m_session.clear();
 
     qWarning() << "Fail to authenticate:" << error.message();
+    SyncTokenCache::instance()->remove(m_account->id(), m_serviceName);
 
     m_token = "";
+    m_secret.clear();
     Q_EMIT tokenChanged();
     Q_EMIT fail();
 }
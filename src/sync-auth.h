@@ -34,10 +34,16 @@ class SyncAuth : public QObject
     Q_PROPERTY(QString token READ token NOTIFY tokenChanged)
 
 public:
-    SyncAuth(uint accountId, const QString &serviceName, QObject *parent = 0);
+    SyncAuth(Accounts::Account *account, const QString &serviceName, QObject *parent = 0);
 
     QString token() const;
+    // only available for password accounts, never cached
+    QString username() const;
+    QString secret() const;
+    // use the cached token if available
     bool authenticate();
+    // always ask signon for a new token
+    bool refresh();
 
 Q_SIGNALS:
     void tokenChanged();
@@ -49,13 +55,13 @@ private Q_SLOTS:
     void onError(const SignOn::Error &error);
 
 private:
-    uint m_accountId;
+    Accounts::Account *m_account;
     QString m_serviceName;
     QString m_token;
+    QString m_username;
+    QString m_secret;
 
-    QScopedPointer<Accounts::Manager> m_accountManager;
     QScopedPointer<SignOn::Identity> m_identity;
-    QScopedPointer<Accounts::Account> m_account;
     SignOn::AuthSessionP m_session;
 };
 
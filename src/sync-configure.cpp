@@ -21,11 +21,16 @@
 #include "syncevolution-server-proxy.h"
 #include "syncevolution-session-proxy.h"
 #include "eds-helper.h"
+#include "sync-trace.h"
 #include "dbustypes.h"
 
-#include "config.h"
+#include <QtCore/QScopedPointer>
+#include <QtCore/QPointer>
+
+#include <QtDBus/QDBusPendingCallWatcher>
+#include <QtDBus/QDBusPendingReply>
 
-#define ACCOUNT_SYNC_INTERVAL   "30"
+#include "config.h"
 
 using namespace Accounts;
 
@@ -34,12 +39,45 @@ SyncConfigure::SyncConfigure(SyncAccount *account,
                              QObject *parent)
     : QObject(parent),
       m_account(account),
-      m_settings(settings)
+      m_settings(settings),
+      m_session(0),
+      m_sessionCount(0),
+      m_sessionReady(false),
+      m_eds(0)
 {
 }
 
 SyncConfigure::~SyncConfigure()
 {
+    // session not used for the sync
+    if (m_session) {
+        m_session->destroy();
+        m_session = 0;
+    }
+}
+
+SyncEvolutionSessionProxy *SyncConfigure::takeSession()
+{
+    SyncEvolutionSessionProxy *session = m_session;
+    m_session = 0;
+    return session;
+}
+
+// use the daemon sources index if available
+EdsHelper *SyncConfigure::eds()
+{
+    if (m_account->edsHelper()) {
+        return m_account->edsHelper();
+    }
+    if (!m_eds) {
+        m_eds = new EdsHelper(this);
+    }
+    return m_eds;
+}
+
+int SyncConfigure::sessionCount() const
+{
+    return m_sessionCount;
 }
 
 AccountId SyncConfigure::accountId() const
@@ -76,68 +114,163 @@ void SyncConfigure::onRemoteSourcesAvailable(const QArrayOfDatabases &sources, i
         return;
     }
     m_remoteDatabasesByService.insert(CALENDAR_SERVICE_TYPE, sources);
+
+    // nothing changed on the server since the last configuration
+    if (m_account->isConfiguredFor(sources)) {
+        qDebug() << "Remote calendars did not change, skip peer configuration";
+        Q_EMIT done(QStringList() << CALENDAR_SERVICE_TYPE);
+        return;
+    }
     configurePeer(QStringList() << CALENDAR_SERVICE_TYPE);
 }
 
 void SyncConfigure::configurePeer(const QStringList &services)
 {
     SyncEvolutionServerProxy *proxy = SyncEvolutionServerProxy::instance();
-    QString peerName = accountSessionName(m_account->account());
-    SyncEvolutionSessionProxy *session = proxy->openSession(peerName,
-                                                            QStringList() << "all-configs");
-
-    if (session->status() != "queueing") {
-        continuePeerConfig(session, services);
-    } else {
-        connect(session, &SyncEvolutionSessionProxy::statusChanged,
-                [this, session, services](const QString &status, uint errorNuber, QSyncStatusMap source) {
-            if (errorNuber != 0) {
-                qWarning() << "Fail to configure peer" << errorNuber;
-                session->destroy();
-                Q_EMIT error(-1);
-            } else if (status != "queueing") {
-                continuePeerConfig(session, services);
+    const QString peerName = accountSessionName(m_account->account());
+    m_services = services;
+
+    // the reply can arrive after the configuration is canceled and deleted,
+    // the session must be closed anyway
+    QPointer<SyncConfigure> self(this);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(proxy->openSession(peerName,
+                                                                                      QStringList() << "all-configs"),
+                                                                   proxy);
+    connect(watcher, &QDBusPendingCallWatcher::finished, proxy,
+            [this, self, peerName](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QDBusObjectPath> reply = *call;
+        if (!self) {
+            if (!reply.isError()) {
+                SyncEvolutionServerProxy::instance()->createSession(peerName, reply.value())->destroy();
             }
-        });
-    }
+            return;
+        }
+        if (reply.isError()) {
+            qWarning() << "Fail to start session" << reply.error().message();
+            Q_EMIT error(-1);
+            return;
+        }
+
+        m_session = SyncEvolutionServerProxy::instance()->createSession(peerName, reply.value());
+        m_sessionCount++;
+        waitForSession();
+    });
 }
 
-void SyncConfigure::continuePeerConfig(SyncEvolutionSessionProxy *session, const QStringList &services)
+void SyncConfigure::waitForSession()
 {
-    //TODO: should we disconnect statusChanged ???
-    SyncEvolutionServerProxy *proxy = SyncEvolutionServerProxy::instance();
-    QStringList configs = proxy->configs();
+    // the server runs one session at time, ours can stay queued while other
+    // account is syncing. Listen for changes before asking for the status
+    // to not miss the transition.
+    SyncTrace::instance()->begin(m_account->id(), QString(), "wait-session");
+    connect(m_session, &SyncEvolutionSessionProxy::statusChanged, this,
+            [this](const QString &status, uint errorNuber, QSyncStatusMap source) {
+        Q_UNUSED(source);
+        if (m_sessionReady) {
+            return;
+        }
+        if (errorNuber != 0) {
+            qWarning() << "Fail to configure peer" << errorNuber;
+            m_session->disconnect(this);
+            Q_EMIT error(-1);
+        } else if (status != "queueing") {
+            onSessionReady();
+        }
+    });
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(m_session->status(), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QString> reply = *call;
+        if (m_sessionReady) {
+            return;
+        }
+        if (reply.isError()) {
+            qWarning() << "Fail to get session status" << reply.error().message();
+            m_session->disconnect(this);
+            Q_EMIT error(-1);
+        } else if (reply.value() != "queueing") {
+            onSessionReady();
+        }
+    });
+}
 
-    QString peerName = accountSessionName(m_account->account());
-    QString peerConfigName = QString("target-config@%1").arg(peerName);
+void SyncConfigure::onSessionReady()
+{
+    m_sessionReady = true;
+    m_session->disconnect(this);
+    SyncTrace::instance()->end(m_account->id(), QString(), "wait-session");
+    continuePeerConfig();
+}
 
-    // config peer
-    QStringMultiMap config;
-    if (configs.contains(peerConfigName)) {
-        config = session->getConfig(peerConfigName, false);
-    } else {
+void SyncConfigure::continuePeerConfig()
+{
+    SyncTrace::instance()->begin(m_account->id(), QString(), "peer-config");
+    SyncEvolutionServerProxy *proxy = SyncEvolutionServerProxy::instance();
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(proxy->configs(), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QStringList> reply = *call;
+        if (reply.isError()) {
+            qWarning() << "Fail to get configs" << reply.error().message();
+            Q_EMIT error(-1);
+            return;
+        }
+
+        const QString peerName = accountSessionName(m_account->account());
+        const QString peerConfigName = QString("target-config@%1").arg(peerName);
+        const bool isNew = !reply.value().contains(peerConfigName);
         const QString serviceName = m_settings->value(CALENDAR_SERVICE_TYPE"/uoa-service", "").toString();
         const QString templateName = m_settings->value(GLOBAL_CONFIG_GROUP"/template", "Google").toString();
 
-        qDebug() << "Create New config with template" << templateName << "for service" << serviceName;
-        config = session->getConfig(templateName, true);
-        //FIXME: use hardcoded calendar service, we only support calendar for now
-        config[""]["username"] = QString("uoa:%1,%2").arg(m_account->id()).arg(serviceName);
-        config[""]["password"] = QString();
-        config[""]["consumerReady"] = "0";
-        config[""]["syncURL"] = m_account->host();
-        config[""]["dumpData"] = "0";
-        config[""]["printChanges"] = "0";
-        config[""]["maxlogdirs"] = "2";
-        config[""]["loglevel"] = "1";
-    }
+        if (isNew) {
+            qDebug() << "Create New config with template" << templateName << "for service" << serviceName;
+        }
+
+        QDBusPendingCallWatcher *configWatcher =
+            new QDBusPendingCallWatcher(m_session->getConfig(isNew ? templateName : peerConfigName, isNew), this);
+        connect(configWatcher, &QDBusPendingCallWatcher::finished, this,
+                [this, isNew, serviceName](QDBusPendingCallWatcher *call) {
+            call->deleteLater();
+            QDBusPendingReply<QStringMultiMap> reply = *call;
+            if (reply.isError()) {
+                qWarning() << "Fail to get session named config" << reply.error().message();
+                Q_EMIT error(-1);
+                return;
+            }
+
+            QStringMultiMap config = reply.value();
+            if (isNew) {
+                //FIXME: use hardcoded calendar service, we only support calendar for now
+                config[""]["username"] = QString("uoa:%1,%2").arg(m_account->id()).arg(serviceName);
+                config[""]["password"] = QString();
+                config[""]["consumerReady"] = "0";
+                config[""]["syncURL"] = m_account->host();
+                config[""]["dumpData"] = "0";
+                config[""]["printChanges"] = "0";
+                config[""]["maxlogdirs"] = "2";
+                config[""]["loglevel"] = "1";
+            }
+            updatePeerConfig(config);
+        });
+    });
+}
+
+void SyncConfigure::updatePeerConfig(QStringMultiMap config)
+{
+    const QStringList services(m_services);
+    const QString peerName = accountSessionName(m_account->account());
+    const QString peerConfigName = QString("target-config@%1").arg(peerName);
 
     static QMap<QString, QString> templates;
     if (templates.isEmpty()) {
         templates.insert(CALENDAR_SERVICE_TYPE, QString("source/calendar"));
     }
 
-    EdsHelper eds;
+    EdsHelper *eds = this->eds();
 
     bool changed = false;
     // Map [source-name] as key [dbId, inUse] as value
@@ -175,6 +308,12 @@ void SyncConfigure::continuePeerConfig(SyncEvolutionSessionProxy *session, const
 
         qDebug() << "Actual sources:" << sourcesToRemove;
 
+        // without the EDS sources every calendar would look new
+        if (!eds->ensureIndex()) {
+            qWarning() << "EDS sources not available, keep the current config";
+            continue;
+        }
+
         Q_FOREACH(const SyncDatabase &db, dbs) {
             if (db.name.isEmpty()) {
                 continue;
@@ -184,22 +323,22 @@ void SyncConfigure::continuePeerConfig(SyncEvolutionSessionProxy *session, const
             // check if a source with the same account name already exists
             QString localDbId;
             if (db.name == m_account->displayName()) {
-                localDbId = eds.sourceIdByName(db.name, 0);
+                localDbId = eds->sourceIdByName(db.name, 0);
             }
             // check if there is a source for this remote url already
             if (localDbId.isEmpty()) {
-                localDbId = eds.sourceByRemoteId(db.remoteId, m_account->id()).id;
+                localDbId = eds->sourceByRemoteId(db.remoteId, m_account->id()).id;
             } else {
                 qDebug() << "Using legacy source:" << localDbId << db.name;
             }
             // create new source if not found
             if (localDbId.isEmpty()) {
                 QString title = db.title.isEmpty() ? db.name : db.title;
-                localDbId = eds.createSource(title,
-                                             db.color,
-                                             db.remoteId,
-                                             db.writable,
-                                             m_account->id());
+                localDbId = eds->createSource(title,
+                                              db.color,
+                                              db.remoteId,
+                                              db.writable,
+                                              m_account->id());
                 qDebug() << "Create new EDS source for:" << title << localDbId;
             }
             // remove qorganizer prefix: "qtorganizer:eds::"
@@ -239,7 +378,7 @@ void SyncConfigure::continuePeerConfig(SyncEvolutionSessionProxy *session, const
                 QStringMap sourceConfig(configTemplate);
                 sourceConfig["backend"] = "CalDav";
                 sourceConfig["database"] = db.source;
-                sourceConfig["syncInterval"] = ACCOUNT_SYNC_INTERVAL;
+                sourceConfig["syncInterval"] = QString::number(m_account->syncWindow());
                 config[fullSourceName] = sourceConfig;
 
                 sourceToDatabase.insert(fullSourceName, qMakePair(localDbId, true));
@@ -258,39 +397,62 @@ void SyncConfigure::continuePeerConfig(SyncEvolutionSessionProxy *session, const
         }
     }
 
-    if (changed) {
-        bool result = session->saveConfig(peerConfigName, config);
-        if (!result) {
-            qWarning() << "Fail to save account client config";
-            Q_EMIT error(-1);
-        } else {
-            qDebug() << "\tPeer Saved" << peerName;
-        }
-    }
-
-    session->destroy();
     if (!changed) {
         qDebug() << "Sources config did not change. No confign needed";
+        SyncTrace::instance()->end(m_account->id(), QString(), "peer-config");
         Q_EMIT done(services);
         return;
     }
 
-    qDebug() << "\tStart local config:"
-             << "\n\t-------------------";
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(m_session->saveConfig(peerConfigName, config), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, peerName, sourceToDatabase, removedSources](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<> reply = *call;
+        if (reply.isError()) {
+            qWarning() << "Fail to save account client config" << reply.error().message();
+            Q_EMIT error(-1);
+            return;
+        }
 
-    // local session
-    session = proxy->openSession("", QStringList() << "all-configs");
-    if (session->status() == "queueing") {
-        qWarning() << "Fail to open local session";
-        session->destroy();
-        return;
-    }
+        qDebug() << "\tPeer Saved" << peerName;
+        qDebug() << "\tStart local config:"
+                 << "\n\t-------------------";
+
+        // the session was opened with "all-configs", it can change the local
+        // config too, no need to wait for a new session
+        continueLocalConfig(sourceToDatabase, removedSources);
+    });
+}
+
+void SyncConfigure::continueLocalConfig(const QMap<QString, QPair<QString, bool> > &sourceToDatabase,
+                                        const QStringList &removedSources)
+{
+    SyncTrace::instance()->end(m_account->id(), QString(), "peer-config");
+    SyncTrace::instance()->begin(m_account->id(), QString(), "local-config");
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(m_session->getConfig("@default", false), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, sourceToDatabase, removedSources](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QStringMultiMap> reply = *call;
+        if (reply.isError()) {
+            qWarning() << "Fail to get session named config" << reply.error().message();
+        }
+        updateLocalConfig(reply.value(), sourceToDatabase, removedSources);
+    });
+}
+
+void SyncConfigure::updateLocalConfig(QStringMultiMap config,
+                                      const QMap<QString, QPair<QString, bool> > &sourceToDatabase,
+                                      QStringList removedSources)
+{
+    bool changed = false;
+    EdsHelper *eds = this->eds();
 
     // create local sources
-    config = session->getConfig("@default", false);
     qDebug() << "\tLocal sources:" << config.keys();
 
-    for(QMap<QString, QPair<QString, bool> >::Iterator i = sourceToDatabase.begin();
+    for(QMap<QString, QPair<QString, bool> >::ConstIterator i = sourceToDatabase.begin();
         i != sourceToDatabase.end(); i++) {
         const QString configName(i.key());
 
@@ -298,7 +460,7 @@ void SyncConfigure::continuePeerConfig(SyncEvolutionSessionProxy *session, const
         if (!config.contains(configName)) {
             config[configName].insert("backend", "evolution-calendar");
             config[configName].insert("database", i.value().first);
-            config[configName].insert("syncInterval", ACCOUNT_SYNC_INTERVAL);
+            config[configName].insert("syncInterval", QString::number(m_account->syncWindow()));
             qDebug() << "\tCreate local source for[" << configName << "] = " << i.value().first;
             changed = true;
         }
@@ -319,33 +481,70 @@ void SyncConfigure::continuePeerConfig(SyncEvolutionSessionProxy *session, const
 
         const QString database = config[source].value("database");
         if (!database.isEmpty()) {
-            EdsSource eSource = eds.sourceById("qtorganizer:eds::" + database.trimmed());
+            EdsSource eSource = eds->sourceById("qtorganizer:eds::" + database.trimmed());
             if (eSource.isValid() && (eSource.account == m_account->id())) {
                 qDebug() << "Remove local config and database" << source << config[source].value("database");
                 Q_EMIT sourceRemoved(source);
-                eds.removeSource(eSource.id);
+                eds->removeSource(eSource.id);
                 config.remove(source);
                 removedSources << source;
                 changed = true;
             }
         }
     }
-    if (changed) {
-        if (!session->saveConfig("@default", config)) {
-            qWarning() << "Fail to save @default config";
+    if (!changed) {
+        configureLocalPeer(removedSources);
+        return;
+    }
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(m_session->saveConfig("@default", config), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, removedSources](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<> reply = *call;
+        if (reply.isError()) {
+            qWarning() << "Fail to save @default config" << reply.error().message();
         } else {
             qDebug() << "Local config saved!";
         }
-    }
+        configureLocalPeer(removedSources);
+    });
+}
+
+void SyncConfigure::configureLocalPeer(const QStringList &removedSources)
+{
+    const QString peerName = accountSessionName(m_account->account());
 
     // create sync config
-    if (!session->hasConfig(peerName)) {
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(m_session->getConfig(peerName, false), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, peerName, removedSources](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<QStringMultiMap> reply = *call;
+        if (!reply.isError() && !reply.value().isEmpty()) {
+            qDebug() << "Update peer config";
+            saveLocalPeer(reply.value(), removedSources);
+            return;
+        }
+
         qDebug() << "Create peer config on default config" << peerName;
-        config = session->getConfig("SyncEvolution_Client", true);
-    } else {
-        qDebug() << "Update peer config";
-        config = session->getConfig(peerName, false);
-    }
+        QDBusPendingCallWatcher *templateWatcher =
+            new QDBusPendingCallWatcher(m_session->getConfig("SyncEvolution_Client", true), this);
+        connect(templateWatcher, &QDBusPendingCallWatcher::finished, this,
+                [this, removedSources](QDBusPendingCallWatcher *call) {
+            call->deleteLater();
+            QDBusPendingReply<QStringMultiMap> reply = *call;
+            if (reply.isError()) {
+                qWarning() << "Fail to get session named config" << reply.error().message();
+            }
+            saveLocalPeer(reply.value(), removedSources);
+        });
+    });
+}
+
+void SyncConfigure::saveLocalPeer(QStringMultiMap config, const QStringList &removedSources)
+{
+    const QString peerName = accountSessionName(m_account->account());
 
     config[""]["syncURL"] = QString("local://@%1").arg(peerName);
     config[""]["username"] = QString();
@@ -354,22 +553,28 @@ void SyncConfigure::continuePeerConfig(SyncEvolutionSessionProxy *session, const
     config[""]["dumpData"] = "0";
     config[""]["printChanges"] = "0";
     config[""]["maxlogdirs"] = "2";
-    if (!session->saveConfig(peerName, config)) {
-        qWarning() << "Fail to save sync config" << peerName;
-    } else {
-        qDebug() << "Local peer saved!";
-    }
 
-    session->destroy();
-    SyncEvolutionServerProxy::destroy();
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(m_session->saveConfig(peerName, config), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, peerName, removedSources](QDBusPendingCallWatcher *call) {
+        call->deleteLater();
+        QDBusPendingReply<> reply = *call;
+        if (reply.isError()) {
+            qWarning() << "Fail to save sync config" << peerName << reply.error().message();
+        } else {
+            qDebug() << "Local peer saved!";
+        }
 
-    // remove sources dir when necessary
-    Q_FOREACH(const QString &key, removedSources) {
-        QString sourceName = key.mid(key.indexOf('/') + 1);
-        removeAccountSourceConfig(m_account->account(), sourceName);
-    }
+        // remove sources dir when necessary
+        Q_FOREACH(const QString &key, removedSources) {
+            QString sourceName = key.mid(key.indexOf('/') + 1);
+            removeAccountSourceConfig(m_account->account(), sourceName);
+        }
 
-    Q_EMIT done(services);
+        // the session is kept, it will be used for the sync
+        SyncTrace::instance()->end(m_account->id(), QString(), "local-config");
+        Q_EMIT done(m_services);
+    });
 }
 
 QString SyncConfigure::normalizeDBName(const QString &name)
@@ -439,7 +644,7 @@ void SyncConfigure::removeAccountSourceConfig(Account *account, const QString &s
 
 }
 
-void SyncConfigure::removeAccountConfig(uint accountId)
+void SyncConfigure::removeAccountConfig(uint accountId, EdsHelper *eds)
 {
     QString configPath = QString("%1/")
             .arg(QStandardPaths::locate(QStandardPaths::ConfigLocation,
@@ -474,13 +679,16 @@ void SyncConfigure::removeAccountConfig(uint accountId)
                                             QStandardPaths::LocateDirectory));
     configDir = QDir(configPath);
     configDir.setNameFilters(QStringList() << "*");
-    EdsHelper eds;
+    QScopedPointer<EdsHelper> localEds(eds ? 0 : new EdsHelper);
+    if (!eds) {
+        eds = localEds.data();
+    }
 
     Q_FOREACH(const QString &dir, configDir.entryList()) {
         QSettings config(configDir.absoluteFilePath(dir) + "/config.ini", QSettings::IniFormat);
         if (config.value("backend").toString() == CALENDAR_EDS_BACKEND) {
             const QString dbId = config.value("database").toString();
-            EdsSource eSource = eds.sourceById("qtorganizer:eds::" + dbId);
+            EdsSource eSource = eds->sourceById("qtorganizer:eds::" + dbId);
             if (!eSource.isValid()) {
                 removeConfigDir(configDir.absoluteFilePath(dir));
             }
@@ -30,6 +30,7 @@
 
 class SyncAccount;
 class SyncEvolutionSessionProxy;
+class EdsHelper;
 
 class SyncConfigure : public QObject
 {
@@ -42,6 +43,9 @@ public:
 
     Accounts::AccountId accountId() const;
     void configure();
+    // session used during the configuration, the caller owns it
+    SyncEvolutionSessionProxy *takeSession();
+    int sessionCount() const;
 
 
     static QString accountSessionName(Accounts::Account *account);
@@ -50,7 +54,7 @@ public:
     static void dumpMap(const QStringMultiMap &map);
     static void dumpMap(const QStringMap &map);
     static void removeAccountSourceConfig(Accounts::Account *account, const QString &sourceName);
-    static void removeAccountConfig(uint accountId);
+    static void removeAccountConfig(uint accountId, EdsHelper *eds = 0);
 
 Q_SIGNALS:
     void done(const QStringList &services);
@@ -65,11 +69,27 @@ private:
     QMap<QString, QArrayOfDatabases> m_remoteDatabasesByService;
     QMap<SyncEvolutionSessionProxy*, QStringList> m_peers;
     const QSettings *m_settings;
+    SyncEvolutionSessionProxy *m_session;
+    int m_sessionCount;
+    bool m_sessionReady;
+    QStringList m_services;
+    EdsHelper *m_eds;
 
+    EdsHelper *eds();
     void fetchRemoteCalendars();
     void fetchRemoteCalendarsFromSession(SyncEvolutionSessionProxy *session);
     void configurePeer(const QStringList &services);
-    void continuePeerConfig(SyncEvolutionSessionProxy *session, const QStringList &services);
+    void waitForSession();
+    void onSessionReady();
+    void continuePeerConfig();
+    void updatePeerConfig(QStringMultiMap config);
+    void continueLocalConfig(const QMap<QString, QPair<QString, bool> > &sourceToDatabase,
+                             const QStringList &removedSources);
+    void updateLocalConfig(QStringMultiMap config,
+                           const QMap<QString, QPair<QString, bool> > &sourceToDatabase,
+                           QStringList removedSources);
+    void configureLocalPeer(const QStringList &removedSources);
+    void saveLocalPeer(QStringMultiMap config, const QStringList &removedSources);
     void checkSyncConfig(SyncEvolutionSessionProxy *session,
                          const QString &peerName,
                          const QString &serviceName,
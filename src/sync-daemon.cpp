@@ -21,12 +21,19 @@
 #include "sync-daemon.h"
 #include "sync-account.h"
 #include "sync-queue.h"
+#include "sync-queue-journal.h"
+#include "sync-result-store.h"
+#include "sync-history.h"
+#include "sync-trace.h"
 #include "sync-dbus.h"
 #include "sync-i18n.h"
 #include "eds-helper.h"
 #include "notify-message.h"
 #include "provider-template.h"
 #include "sync-network.h"
+#include "sync-retry-policy.h"
+#include "sync-scheduler.h"
+#include "sync-token-cache.h"
 #include "syncevolution-server-proxy.h"
 #include "powerd-proxy.h"
 
@@ -38,9 +45,18 @@
 using namespace Accounts;
 
 
-#define DAEMON_SYNC_TIMEOUT         1000 * 60 // one minute
+#define DAEMON_MAX_CONCURRENT_SYNCS 2
 #define SYNC_MONITOR_ICON_PATH      "/usr/share/icons/ubuntu-mobile/actions/scalable/reload.svg"
 #define SYNC_ON_MOBILE_CONFIG_KEY   "sync-on-mobile-connection"
+#define MAX_CONCURRENT_SYNCS_CONFIG_KEY "max-concurrent-syncs"
+#define SYNC_PERIOD_CONFIG_KEY      "sync-period"
+#define SKIP_HIDDEN_CALENDARS_CONFIG_KEY "skip-hidden-calendars"
+// calendars hidden on the calendar app sync this many times less often
+#define HIDDEN_CALENDARS_PERIOD_FACTOR  8
+#define SYNC_QUEUE_JOURNAL_FILE     "sync-queue.journal"
+#define OFFLINE_QUEUE_JOURNAL_FILE  "offline-queue.journal"
+#define SYNC_RESULTS_FILE           "sync-results.log"
+#define SYNC_HISTORY_FILE           "sync-history.log"
 
 
 SyncDaemon::SyncDaemon()
@@ -61,21 +77,44 @@ SyncDaemon::SyncDaemon()
     m_networkStatus = new SyncNetwork(this);
     connect(m_networkStatus, SIGNAL(stateChanged(SyncNetwork::NetworkState)), SLOT(onOnlineStatusChanged(SyncNetwork::NetworkState)));
 
+    // the wake lock is only held while sessions run, see updatePowerState()
     m_powerd = new PowerdProxy(this);
-    connect(this, SIGNAL(syncAboutToStart()), m_powerd, SLOT(lock()));
-    connect(this, SIGNAL(done()), m_powerd, SLOT(unlock()));
+    connect(m_powerd, SIGNAL(wakeup()), SLOT(onDeviceWakeup()));
 
-    m_timeout = new QTimer(this);
-    m_timeout->setInterval(DAEMON_SYNC_TIMEOUT);
-    m_timeout->setSingleShot(true);
+    m_retryPolicy = new SyncRetryPolicy(&m_settings, this);
+    connect(m_retryPolicy, SIGNAL(retryDue(int,QStringList)), SLOT(onRetryDue(int,QStringList)));
+
+    m_scheduler = new SyncScheduler(this);
+    connect(m_scheduler, SIGNAL(syncDue(int,QStringList)), SLOT(onPeriodicSyncDue(int,QStringList)));
+
+    m_timeout = new SyncDebounce(this);
     connect(m_timeout, SIGNAL(timeout()), SLOT(continueSync()));
+
+    m_results = new SyncResultStore(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+                                    + "/" SYNC_RESULTS_FILE);
+    m_results->load();
+    m_results->migrate(&m_settings);
+
+    m_history = new SyncHistory(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+                                + "/" SYNC_HISTORY_FILE);
+    m_history->load();
+
+    // number of accounts allowed to sync at the same time
+    m_maxActiveJobs = qMax(1, m_settings.value(MAX_CONCURRENT_SYNCS_CONFIG_KEY,
+                                               DAEMON_MAX_CONCURRENT_SYNCS).toInt());
 }
 
 SyncDaemon::~SyncDaemon()
 {
     quit();
     delete m_timeout;
+    delete m_retryPolicy;
+    delete m_scheduler;
+    delete m_results;
+    delete m_history;
+    delete m_syncQueue->journal();
     delete m_syncQueue;
+    delete m_offlineQueue->journal();
     delete m_offlineQueue;
     delete m_networkStatus;
     delete m_powerd;
@@ -89,6 +128,7 @@ void SyncDaemon::setupAccounts()
     qDebug() << "Loading accounts...";
 
     m_manager = new Manager(this);
+    SyncTokenCache::instance()->setManager(m_manager);
     Q_FOREACH(const AccountId &accountId, m_manager->accountList()) {
         addAccount(accountId, false);
     }
@@ -120,6 +160,50 @@ void SyncDaemon::setupTriggers()
     m_eds = new EdsHelper(this);
     connect(m_eds, &EdsHelper::dataChanged,
             this, &SyncDaemon::onDataChanged);
+    connect(m_eds, &EdsHelper::indexReady,
+            this, &SyncDaemon::onEdsIndexReady);
+    connect(m_eds, &EdsHelper::sourceSelectionChanged,
+            this, &SyncDaemon::onSourceSelectionChanged);
+    connect(m_eds, &EdsHelper::sourceChangedBySync,
+            this, &SyncDaemon::onSourceChangedBySync);
+
+    // accounts are loaded before the triggers
+    Q_FOREACH(SyncAccount *acc, m_accounts) {
+        acc->setEdsHelper(m_eds);
+    }
+}
+
+void SyncDaemon::setupQueues()
+{
+    // restore syncs pending from the last run
+    const QString dataDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    restoreQueue(m_syncQueue, dataDir + "/" SYNC_QUEUE_JOURNAL_FILE);
+    restoreQueue(m_offlineQueue, dataDir + "/" OFFLINE_QUEUE_JOURNAL_FILE);
+
+    if (isOnline() && !m_offlineQueue->isEmpty()) {
+        m_syncQueue->push(*m_offlineQueue);
+        m_offlineQueue->clear();
+    }
+
+    if (!m_syncQueue->isEmpty()) {
+        qDebug() << "Pending syncs restored:" << m_syncQueue->count();
+        sync(false);
+    }
+}
+
+void SyncDaemon::restoreQueue(SyncQueue *queue, const QString &journalFile)
+{
+    SyncQueueJournal *journal = new SyncQueueJournal(journalFile);
+    Q_FOREACH(const SyncJournalEntry &entry, journal->load()) {
+        SyncAccount *acc = m_accounts.value(entry.accountId);
+        if (acc) {
+            queue->push(acc, entry.sources, entry.runOnPayedConnection, entry.priority);
+        } else {
+            qDebug() << "Drop pending sync for removed account" << entry.accountId;
+        }
+    }
+    // from now on every change is recorded
+    queue->setJournal(journal);
 }
 
 void SyncDaemon::cleanupConfig()
@@ -141,7 +225,7 @@ void SyncDaemon::cleanupConfig()
         uint id = accountId.toUInt(&ok);
         if (ok) {
             if (!accountIds.contains(id)) {
-                SyncConfigure::removeAccountConfig(id);
+                SyncConfigure::removeAccountConfig(id, m_eds);
             }
         }
     }
@@ -150,7 +234,10 @@ void SyncDaemon::cleanupConfig()
 void SyncDaemon::onDataChanged(const QString &sourceId)
 {
     if (sourceId.isEmpty()) {
-        syncAll(false, false);
+        Q_FOREACH(SyncAccount *acc, m_accounts.values()) {
+            acc->notifyLocalChange(QString());
+        }
+        syncAll(false, false, SyncJob::LocalChangePriority);
     } else {
         EdsSource eSource = m_eds->sourceById(sourceId);
 
@@ -165,7 +252,13 @@ void SyncDaemon::onDataChanged(const QString &sourceId)
         }
 
         if (!eSource.remoteId.isEmpty()) {
-            syncAccount(eSource.account, QStringList() << eSource.remoteId, false, false);
+            // the calendar can not skip the next sync
+            SyncAccount *acc = accountById(eSource.account);
+            if (acc) {
+                acc->notifyLocalChange(eSource.remoteId);
+            }
+            syncAccount(eSource.account, QStringList() << eSource.remoteId, false, false,
+                        SyncJob::LocalChangePriority);
         }
     }
 }
@@ -190,24 +283,25 @@ void SyncDaemon::onOnlineStatusChanged(SyncNetwork::NetworkState state)
         m_syncQueue->push(*m_offlineQueue);
         m_offlineQueue->clear();
         if (!m_syncing && !m_syncQueue->isEmpty()) {
-            qDebug() << "Will sync in" << DAEMON_SYNC_TIMEOUT / 1000 << "secs;";
             m_syncing = true;
-            m_timeout->start();
+            notifyChange();
         } else {
             qDebug() << "No change to sync";
         }
     } else if (state == SyncNetwork::NetworkOffline) {
-        qDebug() << "Device is offline cancel active syncs. There is a sync in progress?" << (m_currentJob.isValid() ? "Yes" : "No");
-        if (m_currentJob.isValid()) {
-            if (m_currentJob.account()->retrySync()) {
+        qDebug() << "Device is offline cancel active syncs. Syncs in progress:" << m_activeJobs.size();
+        Q_FOREACH(const SyncJob &job, m_activeJobs.values()) {
+            if (job.account()->retrySync()) {
                 qDebug() << "Push sync to later sync";
-                m_offlineQueue->push(m_currentJob);
+                m_offlineQueue->push(job);
             } else {
                  qDebug() << "Do not try re-sync the account";
             }
-            m_currentJob.account()->cancel();
-            m_currentJob = SyncJob();
+            job.account()->cancel();
+            m_syncQueue->finish(job.account());
+            m_eds->endSync(job.account()->id());
         }
+        m_activeJobs.clear();
         if (m_timeout->isActive()) {
             m_timeout->stop();
         }
@@ -217,18 +311,19 @@ void SyncDaemon::onOnlineStatusChanged(SyncNetwork::NetworkState state)
     Q_EMIT accountsChanged();
 }
 
-void SyncDaemon::syncAll(bool runNow, bool syncOnMobile)
+void SyncDaemon::syncAll(bool runNow, bool syncOnMobile, SyncJob::Priority priority)
 {
     Q_FOREACH(SyncAccount *acc, m_accounts.values()) {
-        sync(acc, QStringList(), runNow, syncOnMobile);
+        sync(acc, QStringList(), runNow, syncOnMobile, priority);
     }
 }
 
-void SyncDaemon::syncAccount(quint32 accountId, const QStringList &calendars, bool runNow, bool syncOnMobile)
+void SyncDaemon::syncAccount(quint32 accountId, const QStringList &calendars, bool runNow, bool syncOnMobile,
+                             SyncJob::Priority priority)
 {
     SyncAccount *acc = m_accounts.value(accountId);
     if (acc) {
-        sync(acc, calendars, runNow, syncOnMobile);
+        sync(acc, calendars, runNow, syncOnMobile, priority);
     } else {
         qWarning() << "Sync account requested with invalid account id:" << accountId;
     }
@@ -250,17 +345,22 @@ void SyncDaemon::syncAllNowAndOnMobile() {
 
 void SyncDaemon::continueSync()
 {
-    SyncJob newJob = m_syncQueue->popNext();
     SyncNetwork::NetworkState netState = m_networkStatus->state();
-    const bool isOnLine = (netState == SyncNetwork::NetworkOnline) ||
-                          (netState != SyncNetwork::NetworkOffline && newJob.runOnPayedConnection());
-    const bool continueSync = newJob.isValid() && isOnLine;
-    if (!continueSync) {
+
+    // fill the worker pool with the next jobs on the queue, accounts already
+    // syncing stay on the queue until the current sync finishes
+    while (!m_aboutToQuit && (m_activeJobs.size() < m_maxActiveJobs)) {
+        SyncJob newJob = m_syncQueue->popNext(m_activeJobs.keys().toSet());
+        if (!newJob.isValid()) {
+            break;
+        }
+
+        const bool isOnLine = (netState == SyncNetwork::NetworkOnline) ||
+                              (netState != SyncNetwork::NetworkOffline && newJob.runOnPayedConnection());
         if (!isOnLine) {
             qDebug() << "Device is offline we will sync later.";
-            if (newJob.isValid()) {
-                m_offlineQueue->push(newJob);
-            }
+            m_offlineQueue->push(newJob);
+            m_syncQueue->finish(newJob.account());
             Q_FOREACH(const SyncJob &j, m_syncQueue->jobs()) {
                 if (j.account() && j.account()->retrySync()) {
                     qDebug() << "Push account to later sync";
@@ -268,37 +368,43 @@ void SyncDaemon::continueSync()
                 }
             }
             m_syncQueue->clear();
-            newJob = SyncJob();
-        } else {
-            Q_ASSERT(m_syncQueue->count() == 0);
-            qDebug() << "No more job to sync.";
+            break;
         }
-        syncFinishedImpl();
-        return;
-    }
-    m_syncing = true;
-
-    // flush any change in EDS
-    m_eds->flush();
 
-    // freeze notifications during the sync, to save some CPU
-    m_eds->freezeNotify();
+        startJob(newJob);
+    }
 
-    // sync the next service on the queue
-    if (!m_aboutToQuit && newJob.isValid()) {
-        m_currentJob = newJob;
+    if (m_activeJobs.isEmpty()) {
+        qDebug() << "No more job to sync.";
+        syncFinishedImpl();
     } else {
-        m_currentJob = SyncJob();
+        updatePowerState();
     }
+}
 
-    if (m_currentJob.isValid()) {
-        // remove sync reqeust from offline queue
-        m_offlineQueue->remove(m_currentJob);
-        Q_EMIT syncAboutToStart();
-        m_currentJob.account()->sync(m_currentJob.sources());
-    } else {
-        syncFinishedImpl();
+void SyncDaemon::startJob(const SyncJob &job)
+{
+    if (m_activeJobs.isEmpty()) {
+        // flush any change in EDS
+        m_eds->flush();
+
+        // freeze notifications during the sync, to save some CPU
+        m_eds->freezeNotify();
     }
+
+    m_syncing = true;
+    m_activeJobs.insert(job.account()->id(), job);
+    SyncTrace::instance()->end(job.account()->id(), QString(), "queue");
+    SyncTrace::instance()->begin(job.account()->id(), QString(), "job");
+    m_eds->beginSync(job.account()->id());
+    qDebug() << "Start sync job for account" << job.account()->displayName()
+             << "Active syncs:" << m_activeJobs.size() << "/" << m_maxActiveJobs;
+
+    // remove sync reqeust from offline queue
+    m_offlineQueue->remove(job);
+    m_powerd->lock();
+    Q_EMIT syncAboutToStart();
+    job.account()->sync(job.sources());
 }
 
 bool SyncDaemon::registerService()
@@ -328,66 +434,91 @@ bool SyncDaemon::registerService()
 void SyncDaemon::syncFinishedImpl()
 {
     // The sync has done, unblock notifications
+    Q_FOREACH(const SyncJob &job, m_activeJobs.values()) {
+        m_eds->endSync(job.account()->id());
+        m_syncQueue->finish(job.account());
+    }
     m_eds->unfreezeNotify();
 
     m_timeout->stop();
-    m_currentJob.clear();
+    m_activeJobs.clear();
     m_wentOffline = false;
     m_syncing = false;
+    updatePowerState();
     Q_EMIT done();
 }
 
-void SyncDaemon::saveSyncResult(uint accountId, const QString &sourceName, const QString &result, const QString &date)
+void SyncDaemon::notifyChange()
 {
-    static QStringList okStatus;
+    m_timeout->notifyChange();
+    // QTimer does not count the time suspended, keep the wall clock deadline
+    // to know when the device must be woken up
+    m_debounceDeadline = QDateTime::currentDateTimeUtc().addMSecs(m_timeout->remainingTime());
+    updatePowerState();
+}
 
-     if (okStatus.isEmpty()) {
-         okStatus << "0"
-                  << "200"
-                  << "204"
-                  << "207";
-     }
+void SyncDaemon::updatePowerState()
+{
+    if (!m_activeJobs.isEmpty()) {
+        m_powerd->lock();
+        m_powerd->setWakeup(QDateTime());
+        return;
+    }
 
-    const QString logKey = QString(ACCOUNT_LOG_GROUP_FORMAT).arg(accountId).arg(sourceName);
-    m_settings.setValue(logKey + ACCOUNT_LOG_LAST_SYNC_RESULT, result);
-    m_settings.setValue(logKey + ACCOUNT_LOG_LAST_SYNC_DATE, date);
-    if (okStatus.contains(result)) {
-        m_settings.setValue(logKey + ACCOUNT_LOG_LAST_SUCCESSFUL_DATE, date);
+    // idle, let the device suspend and wake it up for the next deferred sync
+    m_powerd->unlock();
+    QDateTime next;
+    if (m_timeout->isActive()) {
+        next = m_debounceDeadline;
     }
-    m_settings.sync();
+    Q_FOREACH(const QDateTime &due, QList<QDateTime>() << m_retryPolicy->nextDue() << m_scheduler->nextDue()) {
+        if (due.isValid() && (!next.isValid() || (due < next))) {
+            next = due;
+        }
+    }
+    m_powerd->setWakeup(next);
+}
+
+void SyncDaemon::onDeviceWakeup()
+{
+    // timers were frozen while suspended, run anything that expired meanwhile
+    if (m_timeout->isActive() && (m_debounceDeadline <= QDateTime::currentDateTimeUtc())) {
+        qDebug() << "Debounce window expired while suspended";
+        m_timeout->stop();
+        continueSync();
+    }
+    m_retryPolicy->checkDue();
+    m_scheduler->checkDue();
+    updatePowerState();
+}
+
+void SyncDaemon::saveSyncResult(uint accountId, const QString &sourceName, const QString &result, const QString &date)
+{
+    // written to disk once the account finishes the sync
+    m_results->save(accountId, sourceName, result, date);
 }
 
 void SyncDaemon::clearResultForSource(uint accountId, const QString &sourceName)
 {
-    const QString logKey = QString(ACCOUNT_LOG_GROUP_FORMAT).arg(accountId).arg(sourceName);
-    m_settings.remove(logKey);
-    m_settings.sync();
+    m_results->remove(accountId, sourceName);
+    m_results->flush();
 }
 
 QString SyncDaemon::loadSyncResult(uint accountId, const QString &sourceName)
 {
-    const QString logKey = QString(ACCOUNT_LOG_GROUP_FORMAT).arg(accountId).arg(sourceName);
-    return m_settings.value(logKey + ACCOUNT_LOG_LAST_SYNC_RESULT).toString();
+    return m_results->lastResult(accountId, sourceName);
 }
 
 bool SyncDaemon::isFirstSync(uint accountId)
 {
     // check if there is a sync log for this account before
-    const QString accountGroupPrefix = QString("account_%1").arg(accountId);
-    Q_FOREACH(const QString &group, m_settings.childGroups()) {
-        if (group.startsWith(accountGroupPrefix)) {
-            return false;
-        }
-    }
-    return true;
+    return !m_results->hasResults(accountId);
 }
 
 QString SyncDaemon::lastSuccessfulSyncDate(quint32 accountId, const QString &calendarId)
 {
     const QString sourceName = SyncConfigure::formatSourceName(accountId, calendarId);
-    const QString configKey = QString(ACCOUNT_LOG_GROUP_FORMAT).arg(accountId).arg(sourceName);
-
-    return m_settings.value(configKey + ACCOUNT_LOG_LAST_SUCCESSFUL_DATE).toString();
+    return m_results->lastSuccessfulDate(accountId, sourceName);
 }
 
 void SyncDaemon::cleanupLogs()
@@ -397,29 +528,21 @@ void SyncDaemon::cleanupLogs()
         accountIds << acc->id();
     }
 
-    Q_FOREACH(const QString &group, m_settings.childGroups()) {
-        QString strId = group.split("_").value(1, "");
-        if (strId.isEmpty())
-            continue;
-
-        bool ok = true;
-        int id = strId.toInt(&ok);
-        if (!ok)
-            continue;
-
+    Q_FOREACH(uint id, m_results->accounts()) {
         if (!accountIds.contains(id)) {
-            qDebug() << "Clean log entry" << group << "from account:" << id;
-            m_settings.remove(group);
-            SyncConfigure::removeAccountConfig(id);
+            qDebug() << "Clean log entry from account:" << id;
+            m_results->removeAccount(id);
+            SyncConfigure::removeAccountConfig(id, m_eds);
         }
     }
-    m_settings.sync();
+    m_results->flush();
 }
 
 void SyncDaemon::run()
 {
     setupAccounts();
     setupTriggers();
+    setupQueues();
     cleanupLogs();
     cleanupConfig();
 
@@ -435,8 +558,8 @@ bool SyncDaemon::isPending() const
 
 bool SyncDaemon::isSyncing() const
 {
-    // the sync is happening right now
-    return (m_syncing && m_currentJob.isValid());
+    // at least one account is syncing right now
+    return (m_syncing && !m_activeJobs.isEmpty());
 }
 
 QStringList SyncDaemon::availableServices() const
@@ -479,6 +602,11 @@ SyncAccount *SyncDaemon::accountById(quint32 accountId)
     return m_accounts.value(accountId);
 }
 
+QList<SyncHistoryEntry> SyncDaemon::syncHistory(quint32 accountId, int maxCount) const
+{
+    return m_history->entries(accountId, maxCount);
+}
+
 void SyncDaemon::addAccount(const AccountId &accountId, bool startSync)
 {
     Account *acc = m_manager->account(accountId);
@@ -489,6 +617,9 @@ void SyncDaemon::addAccount(const AccountId &accountId, bool startSync)
         SyncAccount *syncAcc = new SyncAccount(acc,
                                                m_provider->settings(acc->providerName()),
                                                this);
+        syncAcc->setEdsHelper(m_eds);
+        syncAcc->setResultStore(m_results);
+        syncAcc->setRetryPolicy(m_retryPolicy);
         m_accounts.insert(accountId, syncAcc);
         connect(syncAcc, SIGNAL(syncStarted()),
                          SLOT(onAccountSyncStart()));
@@ -498,12 +629,18 @@ void SyncDaemon::addAccount(const AccountId &accountId, bool startSync)
                          SLOT(onAccountSourceSyncFinished(QString,QString,bool,QString,QString)));
         connect(syncAcc, SIGNAL(syncFinished(QString,QMap<QString,QString>)),
                          SLOT(onAccountSyncFinished(QString,QMap<QString,QString>)));
+        connect(syncAcc, SIGNAL(prioritySyncFinished(QString,QMap<QString,QString>)),
+                         SLOT(onAccountPrioritySyncFinished(QString,QMap<QString,QString>)));
         connect(syncAcc, SIGNAL(enableChanged(QString, bool)),
                          SLOT(onAccountEnableChanged(QString, bool)));
         connect(syncAcc, SIGNAL(syncError(QString,QString)),
                          SLOT(onAccountSyncError(QString, QString)));
         connect(syncAcc, SIGNAL(sourceRemoved(QString)),
                          SLOT(onAccountSourceRemoved(QString)));
+        connect(syncAcc, SIGNAL(syncReportAvailable(QList<SyncHistoryEntry>)),
+                         SLOT(onAccountSyncReport(QList<SyncHistoryEntry>)));
+
+        schedulePeriodicSync(syncAcc);
 
         const bool accountEnabled = syncAcc->isEnabled();
         if (startSync && accountEnabled) {
@@ -521,11 +658,12 @@ void SyncDaemon::sync(bool runNow)
         continueSync();
     } else {
         // wait some time for new sync requests
-        m_timeout->start();
+        notifyChange();
     }
 }
 
-void SyncDaemon::sync(SyncAccount *syncAcc, const QStringList &sources, bool runNow, bool syncOnMobile)
+void SyncDaemon::sync(SyncAccount *syncAcc, const QStringList &sources, bool runNow, bool syncOnMobile,
+                      SyncJob::Priority priority)
 {
     qDebug() << "syn requested for account:" << syncAcc->displayName() << sources;
 
@@ -535,8 +673,8 @@ void SyncDaemon::sync(SyncAccount *syncAcc, const QStringList &sources, bool run
         return;
     }
 
-    // check if the request is the current sync
-    if (m_currentJob.contains(syncAcc, sources)) {
+    // check if the request is already syncing
+    if (m_activeJobs.value(syncAcc->id()).contains(syncAcc, sources)) {
         qDebug() << "Syncing the requested account and sources. Ignore request!";
         return;
     }
@@ -551,11 +689,18 @@ void SyncDaemon::sync(SyncAccount *syncAcc, const QStringList &sources, bool run
 
     if (!sources.isEmpty() && newSources.isEmpty()) {
         qDebug() << "Sources already in the queue. Ignore request!";
+        // only update the job priority
+        m_syncQueue->push(syncAcc, sources, syncOnMobile || syncOnMobileConnection(), priority);
         return;
     }
 
+    if (!m_firstSyncTime.contains(syncAcc->id()) && isFirstSync(syncAcc->id())) {
+        m_firstSyncTime[syncAcc->id()].start();
+    }
+
     qDebug() << "Pushed into queue with immediately sync?" << runNow << "Sync is running" << m_syncing;
-    m_syncQueue->push(syncAcc, newSources, syncOnMobile || syncOnMobileConnection());
+    m_syncQueue->push(syncAcc, newSources, syncOnMobile || syncOnMobileConnection(), priority);
+    SyncTrace::instance()->begin(syncAcc->id(), QString(), "queue");
     // if not syncing start a full sync
     if (!m_syncing) {
         qDebug() << "Request sync";
@@ -564,8 +709,8 @@ void SyncDaemon::sync(SyncAccount *syncAcc, const QStringList &sources, bool run
         return;
     }
 
-    // immediately request, force sync to start
-    if (runNow && !isSyncing()) {
+    // immediately request, force sync to start if there is a free worker
+    if (runNow && (m_activeJobs.size() < m_maxActiveJobs)) {
         Q_EMIT syncAboutToStart();
         sync(runNow);
     }
@@ -580,19 +725,32 @@ void SyncDaemon::cancel(SyncAccount *syncAcc, const QStringList &sources)
         accounts << syncAcc;
     }
 
-    Q_FOREACH(const SyncAccount *acc, accounts) {
-        m_syncQueue->remove(syncAcc, sources);
-        syncAcc->cancel();
-        if (m_currentJob.account() == syncAcc) {
-            qDebug() << "Current sync canceled";
-            m_currentJob.clear();
-        } else if (m_syncQueue->isEmpty()) {
-            syncFinishedImpl();
+    bool activeCanceled = false;
+    Q_FOREACH(SyncAccount *acc, accounts) {
+        m_syncQueue->remove(acc, sources);
+        acc->cancel();
+        if (m_activeJobs.remove(acc->id()) > 0) {
+            qDebug() << "Current sync canceled" << acc->displayName();
+            m_syncQueue->finish(acc);
+            m_eds->endSync(acc->id());
+            activeCanceled = true;
+            SyncTrace::instance()->endAll(acc->id());
+        } else if (sources.isEmpty()) {
+            SyncTrace::instance()->endAll(acc->id());
         }
         Q_FOREACH(const QString &source, sources) {
-            Q_EMIT syncError(syncAcc, source, "canceled");
+            Q_EMIT syncError(acc, source, "canceled");
         }
     }
+
+    if (m_activeJobs.isEmpty() && m_syncQueue->isEmpty()) {
+        syncFinishedImpl();
+    } else if (activeCanceled && !m_timeout->isActive()) {
+        // use the free worker for the next job
+        continueSync();
+    } else {
+        updatePowerState();
+    }
 }
 
 void SyncDaemon::removeAccount(const AccountId &accountId)
@@ -600,6 +758,11 @@ void SyncDaemon::removeAccount(const AccountId &accountId)
     SyncAccount *syncAcc = m_accounts.take(accountId);
     if (syncAcc) {
         cancel(syncAcc, QStringList());
+        m_retryPolicy->reset(accountId);
+        m_scheduler->remove(accountId);
+        m_firstSyncTime.remove(accountId);
+        m_history->removeAccount(accountId);
+        SyncTokenCache::instance()->remove(accountId);
         // Remove legacy source if necessary
         QString sourceId = m_eds->sourceIdByName(syncAcc->displayName(), 0);
         if (!sourceId.isEmpty()) {
@@ -659,7 +822,7 @@ void SyncDaemon::onAccountSourceSyncStarted(const QString &serviceName,
                                             bool firstSync)
 {
     SyncAccount *acc = qobject_cast<SyncAccount*>(QObject::sender());
-    m_syncElapsedTime.restart();
+    m_syncElapsedTime[acc->id()].restart();
     qDebug() << QString("[%3] Syncing %1 (%2)")
                 .arg(acc->displayName())
                 .arg(serviceName + "/" + sourceName)
@@ -680,7 +843,6 @@ void SyncDaemon::onAccountSyncError(const QString &serviceName, const QString &e
     } else {
         Q_EMIT syncError(acc, serviceName, error);
     }
-    syncFinishedImpl();
 }
 
 void SyncDaemon::onAccountSourceSyncFinished(const QString &serviceName,
@@ -694,13 +856,14 @@ void SyncDaemon::onAccountSourceSyncFinished(const QString &serviceName,
 
     SyncAccount *acc = qobject_cast<SyncAccount*>(QObject::sender());
     QString errorMessage = SyncAccount::statusDescription(status);
+    const qint64 elapsed = m_syncElapsedTime.value(acc->id()).elapsed();
 
     qDebug() << QString("[%6] Sync done: %1 (%2) Status: %3 Error: %4 Duration: %5s")
                 .arg(acc->displayName())
                 .arg(serviceName + "/" + sourceName)
                 .arg(status)
                 .arg(errorMessage.isEmpty() ? "None" : errorMessage)
-                .arg((m_syncElapsedTime.elapsed() < 1000 ? 1  : m_syncElapsedTime.elapsed() / 1000))
+                .arg((elapsed < 1000 ? 1  : elapsed / 1000))
                 .arg(QDateTime::currentDateTime().toString(Qt::SystemLocaleShortDate));
 
 }
@@ -708,70 +871,101 @@ void SyncDaemon::onAccountSourceSyncFinished(const QString &serviceName,
 void SyncDaemon::onAccountSyncFinished(const QString &serviceName,
                                        const QMap<QString, QString> &statusList)
 {
-    // error on that list will trigger a new sync
-    static QStringList whiteListStatus;
-
     SyncAccount *acc = qobject_cast<SyncAccount*>(QObject::sender());
+    if (!m_activeJobs.contains(acc->id())) {
+        qDebug() << "Ignore sync finished of a canceled job" << acc->displayName();
+        return;
+    }
+    const SyncJob job = m_activeJobs.take(acc->id());
+    m_syncQueue->finish(acc);
+    m_syncElapsedTime.remove(acc->id());
+    m_eds->endSync(acc->id());
+    SyncTrace::instance()->endAll(acc->id());
+
+    // no need for a periodic sync right after this one
+    if (job.sources().isEmpty()) {
+        m_scheduler->reschedule(acc->id(), QString());
+    } else {
+        Q_FOREACH(const QString &source, job.sources()) {
+            m_scheduler->reschedule(acc->id(), source);
+        }
+    }
+
     // check fisrt sync before store the log information
     const bool firstSync = isFirstSync(acc->id());
     const bool accountEnabled = acc->isEnabled();
+    const QHash<QString, int> windows = acc->sessionWindows();
 
     Q_EMIT syncFinished(acc, serviceName);
 
-    // populate white list erros
-    if (whiteListStatus.isEmpty()) {
-        // "error code from SyncEvolution access denied (remote, status 403): could not obtain OAuth2 token:
-        // this can happen if the network goes off during the sync, or syc started before the network stabilished
-        whiteListStatus << QStringLiteral("10403");
-
-        // error code from SyncEvolution fatal error (local, status 10500): no sources active, check configuration"
-        // this is a bug on SyncEvolution sometimes it fail to read the correct address book
-        // FIXME: we should fix that on SyncEvolution
-        whiteListStatus << QStringLiteral("10500");
-        whiteListStatus << QStringLiteral("500");
-    }
-
     // check if we are going re-sync due a know problem
     uint errorCode = 0;
     bool fail = false;
     Q_FOREACH(const QString &source, statusList.keys()) {
         const QString status = statusList.value(source);
         QString errorMessage = SyncAccount::statusDescription(status);
-        errorCode = status.toUInt();
+        const SyncRetryPolicy::ErrorClass errorClass = SyncRetryPolicy::classify(status);
+        // retries are tracked by remote id, empty means the whole account
+        const QString remoteId = source.isEmpty() ? QString() : acc->sourceRemoteId(source);
         bool saveLog = accountEnabled;
 
         /* If the network status changed during the sync operation, we always
          * retry it instead of reporting errors to the user. */
-        if (m_wentOffline ||
-            (acc->lastError() == 0 && !errorMessage.isEmpty() && whiteListStatus.contains(status))) {
+        if (m_wentOffline) {
             fail = true;
             saveLog = false;
-            // white list error retry the sync
-            qDebug() << "Attempting to sync again:" << errorMessage;
-            m_syncQueue->push(acc, QStringList(), false);
+            qDebug() << "Network went off during the sync, attempting to sync again:" << errorMessage;
+            m_syncQueue->push(acc, QStringList(), false, SyncJob::RetryPriority);
             break;
-        } else if (!errorMessage.isEmpty()) {
+        } else if (errorClass == SyncRetryPolicy::Success) {
+            m_retryPolicy->clear(acc->id(), remoteId);
+            // the source has the history of this sync, the next one fetches more
+            if (accountEnabled && windows.contains(source)) {
+                m_results->setWindow(acc->id(), source, windows.value(source));
+            }
+        } else if ((errorClass == SyncRetryPolicy::Transient) &&
+                   m_retryPolicy->failed(acc->id(), remoteId)) {
+            // the result is kept so the next sync mode knows the error the retry count refers to
             fail = true;
-            errorCode = 0;
-            // only show error message if is the first sync or if error is not on whitelist
-            if (firstSync || !whiteListStatus.contains(status)) {
-                NotifyMessage *notify = new NotifyMessage(true, this);
-                notify->show(_("Synchronization"),
-                             QString(_("Could not sync calendar %1 from account %2.\n%3"))
-                                 .arg(source)
-                                 .arg(acc->displayName())
-                                 .arg(errorMessage),
-                             acc->iconName(CALENDAR_SERVICE_TYPE));
+            errorCode = status.toUInt();
+            qDebug() << "Sync failed with a transient error, will retry later:" << errorMessage;
+        } else {
+            fail = true;
+            if (errorClass == SyncRetryPolicy::Permanent) {
+                // retrying will not help; wait for the user or the next sync request
+                m_retryPolicy->clear(acc->id(), remoteId);
             }
+            errorCode = 0;
+            NotifyMessage *notify = new NotifyMessage(true, this);
+            notify->show(_("Synchronization"),
+                         QString(_("Could not sync calendar %1 from account %2.\n%3"))
+                             .arg(source)
+                             .arg(acc->displayName())
+                             .arg(errorMessage),
+                         acc->iconName(CALENDAR_SERVICE_TYPE));
         }
 
         if (saveLog && !source.isEmpty()) {
             saveSyncResult((uint) acc->id(), source, status, QDateTime::currentDateTime().toUTC().toString(Qt::ISODate));
         }
     }
+    // one disk write for all sources of this sync
+    m_results->flush();
 
     if (!fail) {
         errorCode = 0;
+        if (m_firstSyncTime.contains(acc->id())) {
+            qDebug() << "Time to first usable calendar for account" << acc->displayName()
+                     << m_firstSyncTime.take(acc->id()).elapsed() << "ms";
+            SyncTrace::instance()->instant(acc->id(), QString(), "first-usable");
+        }
+
+        // fetch the rest of the history of a staged first sync in the background
+        const QStringList backfill = acc->backfillSources();
+        if (accountEnabled && !backfill.isEmpty()) {
+            qDebug() << "Backfill history of" << backfill;
+            sync(acc, backfill, false, false, SyncJob::PeriodicPriority);
+        }
         // avoid to show sync done message for disabled accounts.
         if (accountEnabled && firstSync) {
             NotifyMessage *notify = new NotifyMessage(true, this);
@@ -784,11 +978,135 @@ void SyncDaemon::onAccountSyncFinished(const QString &serviceName,
 
     acc->setLastError(errorCode);
 
-    SyncEvolutionServerProxy::destroy();
+    // other accounts still using sessions from the server
+    if (m_activeJobs.isEmpty()) {
+        SyncEvolutionServerProxy::release();
+    }
     // sync next account
     continueSync();
 }
 
+void SyncDaemon::onAccountPrioritySyncFinished(const QString &serviceName,
+                                               const QMap<QString, QString> &statusList)
+{
+    SyncAccount *acc = qobject_cast<SyncAccount*>(QObject::sender());
+    if (!m_activeJobs.contains(acc->id())) {
+        return;
+    }
+    qDebug() << "Priority calendars of" << acc->displayName() << "synced" << statusList;
+
+    bool usable = false;
+    Q_FOREACH(const QString &status, statusList.values()) {
+        usable |= SyncResultStore::isSuccess(status);
+    }
+    if (usable && m_firstSyncTime.contains(acc->id())) {
+        qDebug() << "Time to first usable calendar for account" << acc->displayName()
+                 << m_firstSyncTime.take(acc->id()).elapsed() << "ms";
+        SyncTrace::instance()->instant(acc->id(), QString(), "first-usable");
+    }
+
+    // let the calendar app reload, the account is still syncing the other calendars
+    Q_EMIT syncFinished(acc, serviceName);
+}
+
+void SyncDaemon::onRetryDue(int accountId, const QStringList &sources)
+{
+    SyncAccount *acc = m_accounts.value(accountId);
+    if (!acc) {
+        qDebug() << "Retry due for a removed account" << accountId;
+        m_retryPolicy->reset(accountId);
+        return;
+    }
+
+    sync(acc, sources, true, false, SyncJob::RetryPriority);
+}
+
+void SyncDaemon::onPeriodicSyncDue(int accountId, const QStringList &sources)
+{
+    SyncAccount *acc = m_accounts.value(accountId);
+    if (!acc || !acc->isEnabled()) {
+        qDebug() << "Periodic sync due for a removed or disabled account" << accountId;
+        m_scheduler->remove(accountId);
+        return;
+    }
+
+    sync(acc, sources, true, false, SyncJob::PeriodicPriority);
+}
+
+void SyncDaemon::schedulePeriodicSync(SyncAccount *syncAcc)
+{
+    // the daemon setting overrides the provider period, zero disables periodic syncs
+    const int period = m_settings.value(SYNC_PERIOD_CONFIG_KEY, syncAcc->syncPeriod()).toInt();
+    if (syncAcc->isEnabled() && (period > 0)) {
+        qDebug() << "Periodic sync for" << syncAcc->displayName() << "every" << period << "minutes";
+        m_scheduler->schedule(syncAcc->id(), QString(), period * 60);
+        scheduleHiddenCalendars(syncAcc);
+    } else {
+        m_scheduler->remove(syncAcc->id());
+    }
+}
+
+// Account wide syncs skip the calendars hidden on the calendar app, they
+// get their own slower periodic sync unless the user chose to skip them
+void SyncDaemon::scheduleHiddenCalendars(SyncAccount *syncAcc)
+{
+    if (!m_eds || !m_eds->isIndexReady()) {
+        // called again once EDS is loaded
+        return;
+    }
+
+    const int period = m_settings.value(SYNC_PERIOD_CONFIG_KEY, syncAcc->syncPeriod()).toInt()
+                       * HIDDEN_CALENDARS_PERIOD_FACTOR;
+    const bool skip = m_settings.value(SKIP_HIDDEN_CALENDARS_CONFIG_KEY, false).toBool() ||
+                      !syncAcc->isEnabled() || (period <= 0);
+    const QStringList hidden = skip ? QStringList() : m_eds->hiddenSources(syncAcc->id());
+
+    Q_FOREACH(const QString &source, m_scheduler->sources(syncAcc->id())) {
+        if (!source.isEmpty() && !hidden.contains(source)) {
+            m_scheduler->remove(syncAcc->id(), source);
+        }
+    }
+    Q_FOREACH(const QString &remoteId, hidden) {
+        if (!m_scheduler->contains(syncAcc->id(), remoteId)) {
+            m_scheduler->schedule(syncAcc->id(), remoteId, period * 60);
+        }
+    }
+    if (!hidden.isEmpty()) {
+        qDebug() << "Hidden calendars of" << syncAcc->displayName() << "sync every" << period << "minutes" << hidden;
+    }
+}
+
+void SyncDaemon::onEdsIndexReady()
+{
+    Q_FOREACH(SyncAccount *acc, m_accounts) {
+        scheduleHiddenCalendars(acc);
+    }
+}
+
+void SyncDaemon::onSourceSelectionChanged(uint accountId, const QString &remoteId, bool selected)
+{
+    SyncAccount *acc = m_accounts.value(accountId);
+    if (!acc) {
+        return;
+    }
+
+    qDebug() << "Calendar" << remoteId << "of" << acc->displayName() << (selected ? "shown" : "hidden");
+    scheduleHiddenCalendars(acc);
+    // the user wants to see it, bring it up to date
+    if (selected && acc->isEnabled()) {
+        sync(acc, QStringList() << remoteId, true, false, SyncJob::InteractivePriority);
+    }
+}
+
+void SyncDaemon::onSourceChangedBySync(uint accountId, const QString &remoteId)
+{
+    // the server check can not tell if a user change was missed
+    SyncAccount *acc = m_accounts.value(accountId);
+    if (acc) {
+        acc->notifyLocalChange(remoteId);
+    }
+}
+
 void SyncDaemon::onAccountEnableChanged(const QString &serviceName, bool enabled)
 {
     SyncAccount *acc = qobject_cast<SyncAccount*>(QObject::sender());
@@ -803,6 +1121,7 @@ void SyncDaemon::onAccountEnableChanged(const QString &serviceName, bool enabled
     }
 
 
+    schedulePeriodicSync(acc);
     if (enabled) {
         sync(acc, QStringList(), true, true);
     } else {
@@ -817,6 +1136,30 @@ void SyncDaemon::onAccountSourceRemoved(const QString &source)
     clearResultForSource(acc->id(), source.mid(source.indexOf("/") + 1));
 }
 
+void SyncDaemon::onAccountSyncReport(const QList<SyncHistoryEntry> &entries)
+{
+    Q_FOREACH(const SyncHistoryEntry &entry, entries) {
+        qDebug() << "Sync report:" << entry.sourceName
+                 << "mode" << entry.mode
+                 << "status" << entry.status
+                 << "duration" << entry.duration << "ms"
+                 << "local (+/~/-)" << entry.added[SyncHistoryEntry::Local]
+                 << entry.updated[SyncHistoryEntry::Local]
+                 << entry.removed[SyncHistoryEntry::Local]
+                 << "remote (+/~/-)" << entry.added[SyncHistoryEntry::Remote]
+                 << entry.updated[SyncHistoryEntry::Remote]
+                 << entry.removed[SyncHistoryEntry::Remote]
+                 << "items" << entry.items()
+                 << "bytes (sent/received)" << entry.sentBytes << entry.receivedBytes;
+        m_history->add(entry);
+        m_eds->addSyncWrites(entry.accountId, entry.remoteId,
+                             entry.added[SyncHistoryEntry::Local] +
+                             entry.updated[SyncHistoryEntry::Local] +
+                             entry.removed[SyncHistoryEntry::Local]);
+    }
+    m_history->flush();
+}
+
 void SyncDaemon::quit()
 {
     m_aboutToQuit = true;
@@ -831,6 +1174,14 @@ void SyncDaemon::quit()
         m_eds = 0;
     }
 
+    // the pending jobs are restored on the next start, stop recording
+    // before the queues are drained
+    Q_FOREACH(SyncQueue *queue, QList<SyncQueue*>() << m_syncQueue << m_offlineQueue) {
+        SyncQueueJournal *journal = queue->journal();
+        queue->setJournal(0);
+        delete journal;
+    }
+
     // cancel all sync operation
     while(m_syncQueue->count()) {
         SyncJob job = m_syncQueue->popNext();
@@ -849,6 +1200,8 @@ void SyncDaemon::quit()
     }
 
     if (m_manager) {
+        SyncTokenCache::instance()->clear();
+        SyncTokenCache::instance()->setManager(0);
         delete m_manager;
         m_manager = 0;
     }
@@ -23,18 +23,25 @@
 #include <QtCore/QHash>
 #include <QtCore/QTimer>
 #include <QtCore/QElapsedTimer>
+#include <QtCore/QDateTime>
 #include <QtCore/QSettings>
 
 #include <Accounts/Manager>
 
 #include "sync-network.h"
 #include "sync-queue.h"
+#include "sync-debounce.h"
 
 class SyncAccount;
 class EdsHelper;
 class ProviderTemplate;
 class SyncDBus;
 class PowerdProxy;
+class SyncRetryPolicy;
+class SyncScheduler;
+class SyncResultStore;
+class SyncHistory;
+class SyncHistoryEntry;
 
 class SyncDaemon : public QObject
 {
@@ -54,6 +61,7 @@ public:
     void setSyncOnMobileConnection(bool flag);
 
     SyncAccount *accountById(quint32 accountId);
+    QList<SyncHistoryEntry> syncHistory(quint32 accountId, int maxCount) const;
 
 Q_SIGNALS:
     void syncStarted(SyncAccount *syncAcc, const QString &source);
@@ -66,8 +74,9 @@ Q_SIGNALS:
 
 public Q_SLOTS:
     void quit();
-    void syncAll(bool runNow, bool syncOnMobile);
-    void syncAccount(quint32 accountId, const QStringList &calendars, bool runNow = true, bool syncOnMobile = false);
+    void syncAll(bool runNow, bool syncOnMobile, SyncJob::Priority priority = SyncJob::InteractivePriority);
+    void syncAccount(quint32 accountId, const QStringList &calendars, bool runNow = true, bool syncOnMobile = false,
+                     SyncJob::Priority priority = SyncJob::InteractivePriority);
     void cancel(uint accountId = 0, const QStringList &sources = QStringList());
     // Used for the --sync option
     void syncAllNowAndOnMobile();
@@ -84,43 +93,67 @@ private Q_SLOTS:
 
     void onAccountSyncStart();
     void onAccountSyncFinished(const QString &serviceName, const QMap<QString, QString> &statusList);
+    void onAccountPrioritySyncFinished(const QString &serviceName, const QMap<QString, QString> &statusList);
     void onAccountSourceSyncStarted(const QString &serviceName, const QString &source, bool firstSync);
     void onAccountSourceSyncFinished(const QString &serviceName, const QString &sourceName, const bool firstSync, const QString &status, const QString &mode);
     void onAccountSyncError(const QString &serviceName, const QString &error);
     void onAccountEnableChanged(const QString &serviceName, bool enabled);
     void onAccountSourceRemoved(const QString &source);
+    void onAccountSyncReport(const QList<SyncHistoryEntry> &entries);
     void onDataChanged(const QString &sourceId);
     void onClientAttached();
+    void onRetryDue(int accountId, const QStringList &sources);
+    void onPeriodicSyncDue(int accountId, const QStringList &sources);
 
     void onOnlineStatusChanged(SyncNetwork::NetworkState state);
+    void onDeviceWakeup();
+    void onEdsIndexReady();
+    void onSourceSelectionChanged(uint accountId, const QString &remoteId, bool selected);
+    void onSourceChangedBySync(uint accountId, const QString &remoteId);
 
 private:
     Accounts::Manager *m_manager;
-    QTimer *m_timeout;
+    SyncDebounce *m_timeout;
     QHash<Accounts::AccountId, SyncAccount*> m_accounts;
     SyncQueue *m_syncQueue;
     SyncQueue *m_offlineQueue;
-    SyncJob m_currentJob;
+    QHash<int, SyncJob> m_activeJobs;
+    int m_maxActiveJobs;
     EdsHelper *m_eds;
     ProviderTemplate *m_provider;
     SyncDBus *m_dbusAddaptor;
     SyncNetwork *m_networkStatus;
     PowerdProxy *m_powerd;
+    SyncRetryPolicy *m_retryPolicy;
+    SyncScheduler *m_scheduler;
+    SyncResultStore *m_results;
+    SyncHistory *m_history;
     bool m_syncing;
     bool m_wentOffline;
     bool m_aboutToQuit;
-    QElapsedTimer m_syncElapsedTime;
+    QHash<int, QElapsedTimer> m_syncElapsedTime;
+    // time to the first usable calendar of new accounts
+    QHash<int, QElapsedTimer> m_firstSyncTime;
     bool m_firstClient;
     QSettings m_settings;
+    QDateTime m_debounceDeadline;
 
     void setupAccounts();
     void setupTriggers();
+    void setupQueues();
+    void restoreQueue(SyncQueue *queue, const QString &journalFile);
     void cleanupConfig();
-    void sync(SyncAccount *syncAcc, const QStringList &calendars, bool runNow, bool syncOnMobile);
+    void sync(SyncAccount *syncAcc, const QStringList &calendars, bool runNow, bool syncOnMobile,
+              SyncJob::Priority priority = SyncJob::InteractivePriority);
     void cancel(SyncAccount *syncAcc, const QStringList &sources);
     void sync(bool runNow);
+    void startJob(const SyncJob &job);
+    void schedulePeriodicSync(SyncAccount *syncAcc);
+    void scheduleHiddenCalendars(SyncAccount *syncAcc);
     bool registerService();
     void syncFinishedImpl();
+    void notifyChange();
+    void updatePowerState();
 
     void saveSyncResult(uint accountId, const QString &sourceName, const QString &result, const QString &date);
     void clearResultForSource(uint accountId, const QString &sourceName);
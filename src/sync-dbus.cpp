@@ -19,6 +19,8 @@
 #include "sync-dbus.h"
 #include "sync-daemon.h"
 #include "sync-account.h"
+#include "sync-history.h"
+#include "sync-trace.h"
 
 SyncDBus::SyncDBus(const QDBusConnection &connection, SyncDaemon *parent)
     : QDBusAbstractAdaptor(parent),
@@ -30,6 +32,7 @@ SyncDBus::SyncDBus(const QDBusConnection &connection, SyncDaemon *parent)
     connect(m_parent, SIGNAL(syncFinished(SyncAccount*,QString)), SLOT(onSyncFinished(SyncAccount*,QString)));
     connect(m_parent, SIGNAL(syncError(SyncAccount*,QString,QString)), SLOT(onSyncError(SyncAccount*,QString,QString)));
     connect(m_parent, SIGNAL(syncAboutToStart()), SLOT(updateState()));
+    connect(m_parent, SIGNAL(syncFinished(SyncAccount*,QString)), SLOT(updateState()));
     connect(m_parent, SIGNAL(done()), SLOT(updateState()));
     connect(m_parent, SIGNAL(accountsChanged()), SIGNAL(enabledServicesChanged()));
     connect(m_parent, SIGNAL(isOnlineChanged(bool)), SIGNAL(enabledServicesChanged()));
@@ -103,6 +106,23 @@ QString SyncDBus::lastSuccessfulSyncDate(quint32 accountId, const QString &remot
     return result;
 }
 
+// Last sync sessions of each source, newest first. Account 0 returns the
+// history of all accounts and maxCount 0 the complete history.
+QArrayOfStringMap SyncDBus::syncHistory(quint32 accountId, quint32 maxCount)
+{
+    QArrayOfStringMap result;
+    Q_FOREACH(const SyncHistoryEntry &entry, m_parent->syncHistory(accountId, maxCount > 0 ? int(maxCount) : -1)) {
+        result << entry.toMap();
+    }
+    return result;
+}
+
+// Recent sync phases as Chrome trace events, load it on chrome://tracing
+QString SyncDBus::dumpTrace()
+{
+    return QString::fromUtf8(SyncTrace::instance()->toJson());
+}
+
 QMap<QString, QString> SyncDBus::listCalendarsByAccount(quint32 accountId, const QDBusMessage &message)
 {
     QMap<QString, QString> result;
@@ -72,6 +72,14 @@ class SyncDBus : public QDBusAbstractAdaptor
 "      <arg direction=\"in\" type=\"s\"/>\n"
 "      <arg direction=\"out\" type=\"s\" name=\"date\"/>\n"
 "    </method>\n"
+"    <method name=\"syncHistory\">\n"
+"      <arg direction=\"in\" type=\"u\"/>\n"
+"      <arg direction=\"in\" type=\"u\"/>\n"
+"      <arg direction=\"out\" type=\"aa{ss}\" name=\"entries\"/>\n"
+"    </method>\n"
+"    <method name=\"dumpTrace\">\n"
+"      <arg direction=\"out\" type=\"s\" name=\"trace\"/>\n"
+"    </method>\n"
 "    <method name=\"cancelAll\" />\n"
 "    <method name=\"attach\"/>\n"
 "    <method name=\"detach\"/>\n"
@@ -104,6 +112,8 @@ public Q_SLOTS:
     void syncAccount(quint32 accountId, const QStringList &sources);
     QString lastSuccessfulSyncDate(quint32 accountId, const QString &remoteId, const QDBusMessage &message);
     QMap<QString, QString> listCalendarsByAccount(quint32 accountId, const QDBusMessage &message);
+    QArrayOfStringMap syncHistory(quint32 accountId, quint32 maxCount);
+    QString dumpTrace();
     void cancelAll();
     QString state() const;
     QStringList enabledServices() const;
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sync-debounce.h"
+#include "sync-trace.h"
+
+#include <QtCore/QDebug>
+
+#define DEBOUNCE_MIN_WAIT           1000 * 5 // five seconds
+#define DEBOUNCE_BURST_INTERVAL     1000 * 15 // changes closer than this are part of a burst
+#define DEBOUNCE_MAX_WAIT           1000 * 60 // one minute
+
+SyncDebounce::SyncDebounce(QObject *parent, int minWait, int burstInterval, int maxWait)
+    : QObject(parent),
+      m_averageInterval(0),
+      m_averageDelay(0),
+      m_changes(0),
+      m_burstChanges(0),
+      m_minWait(minWait >= 0 ? minWait : DEBOUNCE_MIN_WAIT),
+      m_burstInterval(burstInterval >= 0 ? burstInterval : DEBOUNCE_BURST_INTERVAL),
+      m_maxWait(maxWait >= 0 ? maxWait : DEBOUNCE_MAX_WAIT)
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, SIGNAL(timeout()), SLOT(onTimeout()));
+}
+
+void SyncDebounce::notifyChange()
+{
+    if (!m_timer.isActive()) {
+        // new window
+        m_firstChange.start();
+        m_changes = 0;
+        SyncTrace::instance()->begin(0, QString(), "debounce");
+    }
+
+    // the burst is measured against the threshold and not the current
+    // window, a change arriving right after a dispatch still belongs to it
+    const qint64 interval = m_lastChange.isValid() ? m_lastChange.elapsed() : -1;
+    if ((interval >= 0) && (interval < m_burstInterval)) {
+        m_averageInterval = (m_burstChanges > 1) ? ((m_averageInterval * 3) + interval) / 4 : interval;
+        m_burstChanges++;
+    } else {
+        m_averageInterval = 0;
+        m_burstChanges = 1;
+    }
+    m_lastChange.start();
+    m_changes++;
+
+    qint64 wait = m_minWait;
+    if (m_burstChanges > 1) {
+        // changes still arriving, wait a bit longer than the current interval
+        wait = qMax<qint64>(m_minWait, m_averageInterval * 2);
+    }
+
+    // never wait more than the max latency counted from the first change
+    const qint64 remaining = qMax<qint64>(0, m_maxWait - m_firstChange.elapsed());
+    wait = qMin(wait, remaining);
+
+    qDebug() << "Change received, will sync in" << wait / 1000 << "secs;"
+             << "changes:" << m_changes
+             << "interval:" << m_averageInterval << "ms";
+    m_timer.start(wait);
+}
+
+void SyncDebounce::stop()
+{
+    m_timer.stop();
+    SyncTrace::instance()->end(0, QString(), "debounce");
+}
+
+bool SyncDebounce::isActive() const
+{
+    return m_timer.isActive();
+}
+
+int SyncDebounce::remainingTime() const
+{
+    return m_timer.remainingTime();
+}
+
+void SyncDebounce::onTimeout()
+{
+    const qint64 delay = m_firstChange.elapsed();
+    m_averageDelay = m_averageDelay ? ((m_averageDelay * 3) + delay) / 4 : delay;
+    qDebug() << "Dispatching" << m_changes << "changes after" << delay << "ms;"
+             << "average delay:" << m_averageDelay << "ms";
+    SyncTrace::instance()->end(0, QString(), "debounce");
+    m_changes = 0;
+    Q_EMIT timeout();
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYNC_DEBOUNCE_H__
+#define __SYNC_DEBOUNCE_H__
+
+#include <QtCore/QObject>
+#include <QtCore/QTimer>
+#include <QtCore/QElapsedTimer>
+
+// Coalesce change notifications before a sync.
+// Isolated changes are dispatched after a short wait, while a burst of
+// changes keeps extending the window up to a hard maximum latency
+// counted from the first change. A burst continues across a dispatch, the
+// change-to-dispatch delay is recorded as the "debounce" trace phase.
+class SyncDebounce : public QObject
+{
+    Q_OBJECT
+public:
+    // times in msecs, negative values use the defaults
+    SyncDebounce(QObject *parent = 0, int minWait = -1, int burstInterval = -1, int maxWait = -1);
+
+    void notifyChange();
+    void stop();
+    bool isActive() const;
+    int remainingTime() const;
+
+Q_SIGNALS:
+    void timeout();
+
+private Q_SLOTS:
+    void onTimeout();
+
+private:
+    QTimer m_timer;
+    QElapsedTimer m_firstChange;
+    QElapsedTimer m_lastChange;
+    qint64 m_averageInterval;
+    qint64 m_averageDelay;
+    int m_changes;
+    int m_burstChanges;
+    int m_minWait;
+    int m_burstInterval;
+    int m_maxWait;
+};
+
+#endif
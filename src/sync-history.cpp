@@ -0,0 +1,385 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sync-history.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QTextStream>
+#include <QtCore/QUrl>
+
+#define HISTORY_MAX_ENTRIES         1000
+#define HISTORY_MAX_AGE_DAYS        30
+// rewrite the log when it has this many records more than entries
+#define HISTORY_COMPACT_RECORDS     256
+#define HISTORY_LOG_VERSION         "1"
+#define HISTORY_EMPTY_FIELD         "-"
+
+/*
+ * Log format, one record per line with fields separated by spaces:
+ *
+ *   V <version>
+ *   H <account id> <source> <remote id> <start> <duration> <mode> <status>
+ *     <local added> <local updated> <local removed>
+ *     <remote added> <remote updated> <remote removed>
+ *     [<sent bytes> <received bytes>]
+ *
+ * Start is in secs since epoch and duration in msecs. Text fields are
+ * percent-encoded and "-" is used for empty values. The byte counters were
+ * added later, records without them are still accepted.
+ */
+
+SyncHistoryEntry::SyncHistoryEntry()
+    : accountId(0),
+      duration(-1),
+      sentBytes(0),
+      receivedBytes(0)
+{
+    for(int i = 0; i < 2; i++) {
+        added[i] = 0;
+        updated[i] = 0;
+        removed[i] = 0;
+    }
+}
+
+int SyncHistoryEntry::items() const
+{
+    int total = 0;
+    for(int i = 0; i < 2; i++) {
+        total += added[i] + updated[i] + removed[i];
+    }
+    return total;
+}
+
+QStringMap SyncHistoryEntry::toMap() const
+{
+    QStringMap map;
+    map.insert("account", QString::number(accountId));
+    map.insert("source", sourceName);
+    map.insert("remoteId", remoteId);
+    map.insert("start", start.toUTC().toString(Qt::ISODate));
+    map.insert("duration", QString::number(duration));
+    map.insert("mode", mode);
+    map.insert("status", status);
+    map.insert("local-added", QString::number(added[Local]));
+    map.insert("local-updated", QString::number(updated[Local]));
+    map.insert("local-removed", QString::number(removed[Local]));
+    map.insert("remote-added", QString::number(added[Remote]));
+    map.insert("remote-updated", QString::number(updated[Remote]));
+    map.insert("remote-removed", QString::number(removed[Remote]));
+    map.insert("sent-bytes", QString::number(sentBytes));
+    map.insert("received-bytes", QString::number(receivedBytes));
+    return map;
+}
+
+SyncHistory::SyncHistory(const QString &fileName, int maxEntries, int maxAgeDays)
+    : m_file(fileName),
+      m_records(0),
+      m_maxEntries(maxEntries > 0 ? maxEntries : HISTORY_MAX_ENTRIES),
+      m_maxAgeDays(maxAgeDays > 0 ? maxAgeDays : HISTORY_MAX_AGE_DAYS)
+{
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+}
+
+SyncHistory::~SyncHistory()
+{
+    flush();
+    m_file.close();
+}
+
+QString SyncHistory::fileName() const
+{
+    return m_file.fileName();
+}
+
+void SyncHistory::load()
+{
+    m_entries.clear();
+    m_records = 0;
+
+    QFile file(m_file.fileName());
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return;
+    }
+
+    QTextStream stream(&file);
+    bool invalid = false;
+    while (!stream.atEnd()) {
+        const QStringList fields = stream.readLine().split(' ', QString::SkipEmptyParts);
+        if (fields.isEmpty()) {
+            continue;
+        }
+
+        if ((fields[0] == "V") && (fields.size() == 2)) {
+            if (fields[1] != HISTORY_LOG_VERSION) {
+                qWarning() << "Unsupported sync history version" << fields[1];
+                m_entries.clear();
+                return;
+            }
+        } else {
+            SyncHistoryEntry entry;
+            if (!parseEntry(fields, &entry)) {
+                // probably a partial write during a crash, ignore it
+                invalid = true;
+                continue;
+            }
+            m_entries << entry;
+        }
+        m_records++;
+    }
+    file.close();
+
+    // new records would be appended to the incomplete line
+    if (prune() || invalid) {
+        compact();
+    }
+}
+
+void SyncHistory::add(const SyncHistoryEntry &entry)
+{
+    m_entries << entry;
+    m_pending << formatEntry(entry);
+    prune();
+}
+
+void SyncHistory::removeAccount(uint accountId)
+{
+    const int size = m_entries.size();
+    for(int i = size - 1; i >= 0; i--) {
+        if (m_entries[i].accountId == accountId) {
+            m_entries.removeAt(i);
+        }
+    }
+    if (m_entries.size() != size) {
+        compact();
+    }
+}
+
+void SyncHistory::flush()
+{
+    if (m_pending.isEmpty()) {
+        return;
+    }
+
+    if ((m_records + m_pending.size()) >= (m_entries.size() + HISTORY_COMPACT_RECORDS)) {
+        compact();
+        return;
+    }
+
+    if (!m_file.isOpen() &&
+        !m_file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        qWarning() << "Fail to open sync history" << m_file.fileName() << m_file.errorString();
+        return;
+    }
+
+    m_file.write(QString(m_pending.join("\n") + "\n").toUtf8());
+    m_file.flush();
+    m_records += m_pending.size();
+    m_pending.clear();
+}
+
+void SyncHistory::compact()
+{
+    m_file.close();
+
+    QSaveFile file(m_file.fileName());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Fail to compact sync history" << file.fileName() << file.errorString();
+        return;
+    }
+
+    QTextStream stream(&file);
+    stream << "V " << HISTORY_LOG_VERSION << "\n";
+    Q_FOREACH(const SyncHistoryEntry &entry, m_entries) {
+        stream << formatEntry(entry) << "\n";
+    }
+    stream.flush();
+
+    if (!file.commit()) {
+        qWarning() << "Fail to save sync history" << file.fileName() << file.errorString();
+        return;
+    }
+    m_records = m_entries.size();
+    m_pending.clear();
+}
+
+QList<SyncHistoryEntry> SyncHistory::entries(uint accountId, int maxCount) const
+{
+    QList<SyncHistoryEntry> result;
+    for(int i = m_entries.size() - 1; i >= 0; i--) {
+        if ((maxCount >= 0) && (result.size() >= maxCount)) {
+            break;
+        }
+        if ((accountId == 0) || (m_entries[i].accountId == accountId)) {
+            result << m_entries[i];
+        }
+    }
+    return result;
+}
+
+int SyncHistory::count() const
+{
+    return m_entries.size();
+}
+
+int SyncHistory::pendingRecords() const
+{
+    return m_pending.size();
+}
+
+// SyncEvolution escapes "_" as "__" and "-" as "_+" on the source name
+// used in the report keys
+QStringMap SyncHistory::filterSourceReport(const QStringMap &report, const QString &sourceName)
+{
+    QString escapedName(sourceName);
+    escapedName.replace("_", "__").replace("-", "_+");
+    const QString sourcePrefix = QString("source-%1-").arg(escapedName);
+
+    QStringMap result;
+    for(QStringMap::const_iterator i = report.begin(); i != report.end(); i++) {
+        if (i.key().startsWith(sourcePrefix)) {
+            result.insert(i.key().mid(sourcePrefix.size()), i.value());
+        } else if (!i.key().startsWith("source-") && !result.contains(i.key())) {
+            // source values take precedence over the session ones
+            result.insert(i.key(), i.value());
+        }
+    }
+    return result;
+}
+
+SyncHistoryEntry SyncHistory::entryFromReport(uint accountId,
+                                              const QString &sourceName,
+                                              const QString &remoteId,
+                                              const QStringMap &sourceReport)
+{
+    static const char *locations[] = { "local", "remote" };
+
+    SyncHistoryEntry entry;
+    entry.accountId = accountId;
+    entry.sourceName = sourceName;
+    entry.remoteId = remoteId;
+    entry.mode = sourceReport.value("mode");
+    entry.status = sourceReport.value("status", "0");
+
+    bool ok = false;
+    const uint start = sourceReport.value("start").toUInt(&ok);
+    if (ok) {
+        entry.start = QDateTime::fromTime_t(start);
+        const uint end = sourceReport.value("end").toUInt(&ok);
+        if (ok && (end >= start)) {
+            entry.duration = qint64(end - start) * 1000;
+        }
+    }
+
+    for(int i = 0; i < 2; i++) {
+        const QString stat = QString("stat-%1-%2-total").arg(locations[i]);
+        entry.added[i] = sourceReport.value(stat.arg("added")).toInt();
+        entry.updated[i] = sourceReport.value(stat.arg("updated")).toInt();
+        entry.removed[i] = sourceReport.value(stat.arg("removed")).toInt();
+        // SyncEvolution counts the transfered data on the "any" item state
+        const QString bytes = QString("stat-%1-any-%2-bytes").arg(locations[i]);
+        entry.sentBytes += sourceReport.value(bytes.arg("sent")).toLongLong();
+        entry.receivedBytes += sourceReport.value(bytes.arg("received")).toLongLong();
+    }
+    return entry;
+}
+
+bool SyncHistory::prune()
+{
+    const QDateTime limit = QDateTime::currentDateTime().addDays(-m_maxAgeDays);
+    bool changed = false;
+
+    while (m_entries.size() > m_maxEntries) {
+        m_entries.removeFirst();
+        changed = true;
+    }
+    for(int i = m_entries.size() - 1; i >= 0; i--) {
+        if (m_entries[i].start.isValid() && (m_entries[i].start < limit)) {
+            m_entries.removeAt(i);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+QString SyncHistory::formatEntry(const SyncHistoryEntry &entry)
+{
+    return QString("H %1 %2 %3 %4 %5 %6 %7 %8 %9 %10 %11 %12 %13 %14 %15")
+            .arg(entry.accountId)
+            .arg(encode(entry.sourceName))
+            .arg(encode(entry.remoteId))
+            .arg(entry.start.isValid() ? entry.start.toTime_t() : 0)
+            .arg(entry.duration)
+            .arg(encode(entry.mode))
+            .arg(encode(entry.status))
+            .arg(entry.added[SyncHistoryEntry::Local])
+            .arg(entry.updated[SyncHistoryEntry::Local])
+            .arg(entry.removed[SyncHistoryEntry::Local])
+            .arg(entry.added[SyncHistoryEntry::Remote])
+            .arg(entry.updated[SyncHistoryEntry::Remote])
+            .arg(entry.removed[SyncHistoryEntry::Remote])
+            .arg(entry.sentBytes)
+            .arg(entry.receivedBytes);
+}
+
+bool SyncHistory::parseEntry(const QStringList &fields, SyncHistoryEntry *entry)
+{
+    if (((fields.size() != 14) && (fields.size() != 16)) || (fields[0] != "H")) {
+        return false;
+    }
+
+    entry->accountId = fields[1].toUInt();
+    entry->sourceName = decode(fields[2]);
+    entry->remoteId = decode(fields[3]);
+    const uint start = fields[4].toUInt();
+    if (start > 0) {
+        entry->start = QDateTime::fromTime_t(start);
+    }
+    entry->duration = fields[5].toLongLong();
+    entry->mode = decode(fields[6]);
+    entry->status = decode(fields[7]);
+    entry->added[SyncHistoryEntry::Local] = fields[8].toInt();
+    entry->updated[SyncHistoryEntry::Local] = fields[9].toInt();
+    entry->removed[SyncHistoryEntry::Local] = fields[10].toInt();
+    entry->added[SyncHistoryEntry::Remote] = fields[11].toInt();
+    entry->updated[SyncHistoryEntry::Remote] = fields[12].toInt();
+    entry->removed[SyncHistoryEntry::Remote] = fields[13].toInt();
+    if (fields.size() == 16) {
+        entry->sentBytes = fields[14].toLongLong();
+        entry->receivedBytes = fields[15].toLongLong();
+    }
+    return (entry->accountId > 0);
+}
+
+QString SyncHistory::encode(const QString &value)
+{
+    if (value.isEmpty()) {
+        return QStringLiteral(HISTORY_EMPTY_FIELD);
+    }
+    return QString::fromLatin1(QUrl::toPercentEncoding(value, QByteArray(), HISTORY_EMPTY_FIELD));
+}
+
+QString SyncHistory::decode(const QString &field)
+{
+    if (field == HISTORY_EMPTY_FIELD) {
+        return QString();
+    }
+    return QUrl::fromPercentEncoding(field.toLatin1());
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYNC_HISTORY_H__
+#define __SYNC_HISTORY_H__
+
+#include <QtCore/QDateTime>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QList>
+#include <QtCore/QFile>
+
+#include "dbustypes.h"
+
+class SyncHistoryEntry
+{
+public:
+    enum Location {
+        Local = 0,
+        Remote
+    };
+
+    uint accountId;
+    QString sourceName;
+    QString remoteId;
+    QDateTime start;
+    qint64 duration;    // msecs
+    QString mode;
+    QString status;
+    int added[2];
+    int updated[2];
+    int removed[2];
+    qint64 sentBytes;
+    qint64 receivedBytes;
+
+    SyncHistoryEntry();
+    int items() const;
+    QStringMap toMap() const;
+};
+
+// Bounded history of the sync sessions of every source.
+// Entries are built from the SyncEvolution session reports and saved on an
+// append-only log, entries older than the retention time or above the
+// maximum count are dropped.
+class SyncHistory
+{
+public:
+    SyncHistory(const QString &fileName, int maxEntries = -1, int maxAgeDays = -1);
+    ~SyncHistory();
+
+    QString fileName() const;
+    void load();
+    void add(const SyncHistoryEntry &entry);
+    void removeAccount(uint accountId);
+    void flush();
+    void compact();
+
+    // newest entries first, accountId 0 means all accounts
+    QList<SyncHistoryEntry> entries(uint accountId = 0, int maxCount = -1) const;
+    int count() const;
+    int pendingRecords() const;
+
+    // session values and the values of the source with the "source-<name>-" prefix removed
+    static QStringMap filterSourceReport(const QStringMap &report, const QString &sourceName);
+    static SyncHistoryEntry entryFromReport(uint accountId,
+                                            const QString &sourceName,
+                                            const QString &remoteId,
+                                            const QStringMap &sourceReport);
+
+private:
+    QFile m_file;
+    QList<SyncHistoryEntry> m_entries;
+    QStringList m_pending;
+    int m_records;
+    int m_maxEntries;
+    int m_maxAgeDays;
+
+    bool prune();
+    static QString formatEntry(const SyncHistoryEntry &entry);
+    static bool parseEntry(const QStringList &fields, SyncHistoryEntry *entry);
+    static QString encode(const QString &value);
+    static QString decode(const QString &field);
+};
+
+#endif
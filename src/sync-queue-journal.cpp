@@ -0,0 +1,249 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sync-queue-journal.h"
+#include "sync-account.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QTextStream>
+#include <QtCore/QUrl>
+
+// rewrite the journal after this number of records
+#define JOURNAL_COMPACT_RECORDS     256
+#define JOURNAL_VERSION             "1"
+#define JOURNAL_ALL_SOURCES         "*"
+
+/*
+ * Journal format, one record per line with fields separated by spaces:
+ *
+ *   V <version>
+ *   P <account id> <payed> <priority> <sources>
+ *   R <account id> <sources>
+ *   C
+ *
+ * <sources> is a comma separated list of percent-encoded source names or
+ * "*" for all sources of the account.
+ */
+
+SyncQueueJournal::SyncQueueJournal(const QString &fileName)
+    : m_file(fileName),
+      m_records(0)
+{
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+}
+
+SyncQueueJournal::~SyncQueueJournal()
+{
+    m_file.close();
+}
+
+QString SyncQueueJournal::fileName() const
+{
+    return m_file.fileName();
+}
+
+QList<SyncJournalEntry> SyncQueueJournal::load() const
+{
+    QList<SyncJournalEntry> entries;
+    QFile file(m_file.fileName());
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return entries;
+    }
+
+    QTextStream stream(&file);
+    int lineNumber = 0;
+    while (!stream.atEnd()) {
+        const QString line = stream.readLine();
+        const QStringList fields = line.split(' ', QString::SkipEmptyParts);
+        lineNumber++;
+
+        if (fields.isEmpty()) {
+            continue;
+        }
+
+        const QString &op = fields[0];
+        if ((op == "V") && (fields.size() == 2)) {
+            if (fields[1] != JOURNAL_VERSION) {
+                qWarning() << "Unsupported sync journal version" << fields[1];
+                return QList<SyncJournalEntry>();
+            }
+        } else if ((op == "P") && (fields.size() == 5)) {
+            const int accountId = fields[1].toInt();
+            const QStringList sources = decodeSources(fields[4]);
+            const SyncJob::Priority priority = (SyncJob::Priority) qBound(int(SyncJob::InteractivePriority),
+                                                                         fields[3].toInt(),
+                                                                         int(SyncJob::PeriodicPriority));
+            bool found = false;
+            for (int i = 0; i < entries.size(); i++) {
+                SyncJournalEntry &entry = entries[i];
+                if (entry.accountId != accountId) {
+                    continue;
+                }
+                // same merge rules used by SyncQueue::push
+                if (sources.isEmpty() || entry.sources.isEmpty()) {
+                    entry.sources.clear();
+                } else {
+                    Q_FOREACH(const QString &source, sources) {
+                        if (!entry.sources.contains(source)) {
+                            entry.sources << source;
+                        }
+                    }
+                }
+                entry.priority = qMin(entry.priority, priority);
+                found = true;
+                break;
+            }
+
+            if (!found) {
+                SyncJournalEntry entry;
+                entry.accountId = accountId;
+                entry.sources = sources;
+                entry.runOnPayedConnection = (fields[2] == "1");
+                entry.priority = priority;
+                entries << entry;
+            }
+        } else if ((op == "R") && (fields.size() == 3)) {
+            const int accountId = fields[1].toInt();
+            const QStringList sources = decodeSources(fields[2]);
+            for (int i = 0; i < entries.size(); i++) {
+                SyncJournalEntry &entry = entries[i];
+                if (entry.accountId != accountId) {
+                    continue;
+                }
+                if (sources.isEmpty()) {
+                    entries.removeAt(i);
+                } else if (!entry.sources.isEmpty()) {
+                    Q_FOREACH(const QString &source, sources) {
+                        entry.sources.removeAll(source);
+                    }
+                    if (entry.sources.isEmpty()) {
+                        entries.removeAt(i);
+                    }
+                }
+                // removing a source from a job that syncs everything keeps the job
+                break;
+            }
+        } else if (op == "C") {
+            entries.clear();
+        } else {
+            // probably a partial write during a crash, ignore it
+            qWarning() << "Invalid sync journal record at line" << lineNumber << line;
+        }
+    }
+
+    return entries;
+}
+
+void SyncQueueJournal::recordPush(int accountId, const QStringList &sources, bool runOnPayedConnection, SyncJob::Priority priority)
+{
+    append(formatPush(accountId, sources, runOnPayedConnection, priority));
+}
+
+void SyncQueueJournal::recordRemove(int accountId, const QStringList &sources)
+{
+    append(QString("R %1 %2").arg(accountId).arg(encodeSources(sources)));
+}
+
+void SyncQueueJournal::recordClear()
+{
+    append(QStringLiteral("C"));
+}
+
+bool SyncQueueJournal::needsCompaction() const
+{
+    return (m_records >= JOURNAL_COMPACT_RECORDS);
+}
+
+void SyncQueueJournal::compact(const QList<SyncJob> &jobs)
+{
+    m_file.close();
+
+    QSaveFile file(m_file.fileName());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Fail to compact sync journal" << file.fileName() << file.errorString();
+        return;
+    }
+
+    QTextStream stream(&file);
+    stream << "V " << JOURNAL_VERSION << "\n";
+    Q_FOREACH(const SyncJob &job, jobs) {
+        if (job.isValid()) {
+            stream << formatPush(job.account()->id(), job.sources(),
+                                 job.runOnPayedConnection(), job.priority()) << "\n";
+        }
+    }
+    stream.flush();
+
+    if (!file.commit()) {
+        qWarning() << "Fail to save sync journal" << file.fileName() << file.errorString();
+        return;
+    }
+    m_records = 0;
+}
+
+void SyncQueueJournal::append(const QString &line)
+{
+    if (!m_file.isOpen() &&
+        !m_file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        qWarning() << "Fail to open sync journal" << m_file.fileName() << m_file.errorString();
+        return;
+    }
+
+    // a single write per record, a crash can only leave the last line incomplete
+    m_file.write(QString(line + "\n").toUtf8());
+    m_file.flush();
+    m_records++;
+}
+
+QString SyncQueueJournal::formatPush(int accountId, const QStringList &sources, bool runOnPayedConnection, SyncJob::Priority priority)
+{
+    return QString("P %1 %2 %3 %4")
+            .arg(accountId)
+            .arg(runOnPayedConnection ? 1 : 0)
+            .arg(int(priority))
+            .arg(encodeSources(sources));
+}
+
+QString SyncQueueJournal::encodeSources(const QStringList &sources)
+{
+    if (sources.isEmpty()) {
+        return QStringLiteral(JOURNAL_ALL_SOURCES);
+    }
+
+    QStringList encoded;
+    Q_FOREACH(const QString &source, sources) {
+        encoded << QString::fromLatin1(QUrl::toPercentEncoding(source));
+    }
+    return encoded.join(",");
+}
+
+QStringList SyncQueueJournal::decodeSources(const QString &field)
+{
+    QStringList sources;
+    if (field == JOURNAL_ALL_SOURCES) {
+        return sources;
+    }
+
+    Q_FOREACH(const QString &source, field.split(',', QString::SkipEmptyParts)) {
+        sources << QUrl::fromPercentEncoding(source.toLatin1());
+    }
+    return sources;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYNC_QUEUE_JOURNAL_H__
+#define __SYNC_QUEUE_JOURNAL_H__
+
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QList>
+#include <QtCore/QFile>
+
+#include "sync-queue.h"
+
+// Pending job read back from the journal, accounts are referenced by id
+// since the SyncAccount objects do not survive a restart.
+class SyncJournalEntry
+{
+public:
+    int accountId;
+    QStringList sources;
+    bool runOnPayedConnection;
+    SyncJob::Priority priority;
+
+    SyncJournalEntry()
+        : accountId(0), runOnPayedConnection(false), priority(SyncJob::InteractivePriority)
+    {}
+};
+
+// Append-only log of the SyncQueue mutations.
+// Every change is written as a single line, the file is rewritten with the
+// current queue contents after a number of records to keep it small.
+class SyncQueueJournal
+{
+public:
+    SyncQueueJournal(const QString &fileName);
+    ~SyncQueueJournal();
+
+    QString fileName() const;
+    QList<SyncJournalEntry> load() const;
+
+    void recordPush(int accountId, const QStringList &sources, bool runOnPayedConnection, SyncJob::Priority priority);
+    void recordRemove(int accountId, const QStringList &sources);
+    void recordClear();
+    void compact(const QList<SyncJob> &jobs);
+    bool needsCompaction() const;
+
+private:
+    QFile m_file;
+    int m_records;
+
+    void append(const QString &line);
+    static QString formatPush(int accountId, const QStringList &sources, bool runOnPayedConnection, SyncJob::Priority priority);
+    static QString encodeSources(const QStringList &sources);
+    static QStringList decodeSources(const QString &field);
+};
+
+#endif
@@ -18,8 +18,26 @@
 
 #include "sync-queue.h"
 #include "sync-account.h"
+#include "sync-queue-journal.h"
 
-const QString SyncJob::SyncAllKeyword = QString("ALL");
+SyncQueue::SyncQueue()
+    : m_sequence(0),
+      m_journal(0)
+{
+}
+
+void SyncQueue::setJournal(SyncQueueJournal *journal)
+{
+    m_journal = journal;
+    if (m_journal) {
+        m_journal->compact(journalJobs());
+    }
+}
+
+SyncQueueJournal *SyncQueue::journal() const
+{
+    return m_journal;
+}
 
 int SyncQueue::count() const
 {
@@ -33,41 +51,60 @@ bool SyncQueue::isEmpty() const
 
 void SyncQueue::clear()
 {
-    m_jobs.clear();;
+    m_jobs.clear();
+    m_order.clear();
+    m_orderByAccount.clear();
+    if (!m_journal) {
+        return;
+    }
+    // the running jobs are still pending
+    if (m_running.isEmpty()) {
+        m_journal->recordClear();
+    } else {
+        m_journal->compact(journalJobs());
+    }
 }
 
 const QList<SyncJob> SyncQueue::jobs() const
 {
-    return m_jobs;
+    QList<SyncJob> result;
+    Q_FOREACH(int accountId, m_order.values()) {
+        result << m_jobs.value(accountId);
+    }
+    return result;
 }
 
 void SyncQueue::push(SyncAccount *account,
                      const QStringList &sources,
-                     bool syncOnPayedConnection)
+                     bool syncOnPayedConnection,
+                     SyncJob::Priority priority)
 {
-    // check if there is job for this account already
-    for(int i=0; i < m_jobs.size(); i++) {
-        SyncJob &job = m_jobs[i];
-        if (job.account()->id() == account->id()) {
-            job.appendSources(sources);
-            return;
-        }
+    if (m_journal) {
+        m_journal->recordPush(account->id(), sources, syncOnPayedConnection, priority);
     }
 
-    // there is no job for this account, create
-    SyncJob job(account, sources, syncOnPayedConnection);
-    push(job);
+    // check if there is job for this account already
+    QHash<int, SyncJob>::iterator i = m_jobs.find(account->id());
+    if (i != m_jobs.end()) {
+        i.value().appendSources(sources);
+        promote(account->id(), priority);
+    } else {
+        // there is no job for this account, create
+        insert(SyncJob(account, sources, syncOnPayedConnection, priority));
+    }
+    compactJournal();
 }
 
 void SyncQueue::push(SyncAccount *account,
                      const QString &sourceName,
-                     bool syncOnPayedConnection)
+                     bool syncOnPayedConnection,
+                     SyncJob::Priority priority)
 {
     QStringList sources;
     if (!sourceName.isEmpty()) {
         sources << sourceName;
     }
-    push(account, sources, syncOnPayedConnection);
+    push(account, sources, syncOnPayedConnection, priority);
 }
 
 void SyncQueue::push(const SyncQueue &other)
@@ -79,8 +116,18 @@ void SyncQueue::push(const SyncQueue &other)
 
 void SyncQueue::push(const SyncJob &job)
 {
-    if (!contains(job)) {
-        m_jobs << job;
+    if (!job.isValid()) {
+        return;
+    }
+
+    if (m_jobs.contains(job.account()->id())) {
+        push(job.account(), job.sources(), job.runOnPayedConnection(), job.priority());
+    } else {
+        if (m_journal) {
+            m_journal->recordPush(job.account()->id(), job.sources(), job.runOnPayedConnection(), job.priority());
+        }
+        insert(job);
+        compactJournal();
     }
 }
 
@@ -96,19 +143,47 @@ bool SyncQueue::contains(SyncAccount *account, const QString &sourceName) const
 
 bool SyncQueue::contains(SyncAccount *account, const QStringList &sources) const
 {
-    Q_FOREACH(const SyncJob &job, m_jobs) {
-        if (job.contains(account, sources))
-            return true;
+    QHash<int, SyncJob>::const_iterator i = m_jobs.find(account->id());
+    if (i == m_jobs.end()) {
+        return false;
     }
-    return false;
+    return i.value().contains(account, sources);
 }
 
 SyncJob SyncQueue::popNext()
 {
-    if (m_jobs.isEmpty()) {
+    if (m_order.isEmpty()) {
         return SyncJob();
     }
-    return m_jobs.takeFirst();
+
+    const int accountId = m_order.begin().value();
+    SyncJob job = m_jobs.value(accountId);
+    take(accountId);
+    m_running.insert(accountId, job);
+    return job;
+}
+
+SyncJob SyncQueue::popNext(const QSet<int> &busyAccounts)
+{
+    for(QMap<OrderKey, int>::const_iterator i = m_order.begin(); i != m_order.end(); i++) {
+        const int accountId = i.value();
+        if (!busyAccounts.contains(accountId)) {
+            SyncJob job = m_jobs.value(accountId);
+            take(accountId);
+            m_running.insert(accountId, job);
+            return job;
+        }
+    }
+    return SyncJob();
+}
+
+void SyncQueue::finish(SyncAccount *account)
+{
+    if (m_running.remove(account->id()) && m_journal) {
+        // a new job of the account can be queued, rewrite the journal
+        // instead of removing the sources of both
+        m_journal->compact(journalJobs());
+    }
 }
 
 void SyncQueue::remove(const SyncJob &job)
@@ -123,36 +198,96 @@ void SyncQueue::remove(SyncAccount *account, const QString &source)
 
 void SyncQueue::remove(SyncAccount *account, const QStringList &sources)
 {
-    QList<SyncJob> newList = m_jobs;
-    for(int i=0; i < m_jobs.count(); i++) {
-        SyncJob &job =  m_jobs[i];
-        if (job.account()->id() == account->id()) {
-            job.removeSources(sources);
-            if (job.isEmpty()) {
-                newList.removeOne(job);
-            }
-        }
+    QHash<int, SyncJob>::iterator i = m_jobs.find(account->id());
+    if (i == m_jobs.end()) {
+        return;
     }
 
-    m_jobs = newList;
+    i.value().removeSources(sources);
+    if (i.value().isEmpty()) {
+        take(account->id());
+    }
+    journalRemove(account->id(), sources);
 }
 
-SyncJob::SyncJob()
-    : m_account(0),
-      m_runOnPayedConnection(false)
+void SyncQueue::insert(const SyncJob &job)
 {
+    const int accountId = job.account()->id();
+    const OrderKey key(job.priority(), m_sequence++);
+
+    m_jobs.insert(accountId, job);
+    m_order.insert(key, accountId);
+    m_orderByAccount.insert(accountId, key);
 }
 
-SyncJob::SyncJob(SyncAccount *account, const QStringList &sources, bool runOnPayedConnection)
-    : m_account(account), m_runOnPayedConnection(runOnPayedConnection)
+void SyncQueue::take(int accountId)
 {
-    if (sources.isEmpty()) {
-        m_sources << SyncJob::SyncAllKeyword;
+    m_order.remove(m_orderByAccount.take(accountId));
+    m_jobs.remove(accountId);
+}
+
+void SyncQueue::promote(int accountId, SyncJob::Priority priority)
+{
+    SyncJob &job = m_jobs[accountId];
+    if (priority >= job.priority()) {
+        return;
+    }
+
+    // move the job to the end of the higher priority class
+    const OrderKey key(priority, m_sequence++);
+    m_order.remove(m_orderByAccount.value(accountId));
+    m_order.insert(key, accountId);
+    m_orderByAccount.insert(accountId, key);
+    job.setPriority(priority);
+}
+
+void SyncQueue::journalRemove(int accountId, const QStringList &sources)
+{
+    if (!m_journal) {
+        return;
+    }
+
+    if (m_running.contains(accountId)) {
+        m_journal->compact(journalJobs());
     } else {
-        m_sources << sources;
+        m_journal->recordRemove(accountId, sources);
+        compactJournal();
+    }
+}
+
+void SyncQueue::compactJournal()
+{
+    // the queue is small, rewrite it from time to time
+    if (m_journal && m_journal->needsCompaction()) {
+        m_journal->compact(journalJobs());
     }
 }
 
+QList<SyncJob> SyncQueue::journalJobs() const
+{
+    return m_running.values() + jobs();
+}
+
+SyncJob::SyncJob()
+    : m_account(0),
+      m_syncAll(false),
+      m_runOnPayedConnection(false),
+      m_priority(SyncJob::InteractivePriority)
+{
+}
+
+SyncJob::SyncJob(SyncAccount *account,
+                 const QStringList &sources,
+                 bool runOnPayedConnection,
+                 SyncJob::Priority priority)
+    : m_account(account),
+      m_sources(sources.toSet()),
+      m_syncAll(sources.isEmpty()),
+      m_runOnPayedConnection(runOnPayedConnection),
+      m_priority(priority)
+{
+}
+
 SyncAccount *SyncJob::account() const
 {
     return m_account;
@@ -160,29 +295,27 @@ SyncAccount *SyncJob::account() const
 
 QStringList SyncJob::sources() const
 {
-    if (m_sources.contains(SyncJob::SyncAllKeyword)) {
+    if (m_syncAll) {
         return QStringList();
     } else {
-        return m_sources;
+        return m_sources.toList();
     }
 }
 
 void SyncJob::appendSources(const QStringList &sources)
 {
-    if (m_sources.contains(SyncJob::SyncAllKeyword)) {
+    if (m_syncAll) {
         return;
     }
 
     if (sources.isEmpty()) {
         m_sources.clear();
-        m_sources << SyncJob::SyncAllKeyword;
+        m_syncAll = true;
         return;
     }
 
     Q_FOREACH(const QString &source, sources) {
-        if (!m_sources.contains(source)) {
-            m_sources.append(source);
-        }
+        m_sources.insert(source);
     }
 }
 
@@ -190,9 +323,10 @@ void SyncJob::removeSources(const QStringList &sources)
 {
     if (sources.isEmpty()) {
         m_sources.clear();
+        m_syncAll = false;
     } else {
         Q_FOREACH(const QString &source, sources) {
-            m_sources.removeOne(source);
+            m_sources.remove(source);
         }
     }
 }
@@ -202,24 +336,36 @@ bool SyncJob::runOnPayedConnection() const
     return m_runOnPayedConnection;
 }
 
+SyncJob::Priority SyncJob::priority() const
+{
+    return m_priority;
+}
+
+void SyncJob::setPriority(SyncJob::Priority priority)
+{
+    m_priority = priority;
+}
+
 bool SyncJob::operator==(const SyncJob &other) const
 {
-    return (m_account->id() == other.account()->id()) && compareSources(m_sources, other.sources());
+    return (m_account->id() == other.m_account->id()) &&
+           (m_syncAll == other.m_syncAll) &&
+           (m_sources == other.m_sources);
 }
 
 bool SyncJob::isValid() const
 {
-    return ((m_account != 0) && !m_sources.isEmpty());
+    return ((m_account != 0) && (m_syncAll || !m_sources.isEmpty()));
 }
 
 bool SyncJob::isEmpty()
 {
-    return m_sources.isEmpty();
+    return (!m_syncAll && m_sources.isEmpty());
 }
 
 bool SyncJob::contains(const QStringList &sources) const
 {
-    if (m_sources.contains(SyncJob::SyncAllKeyword)) {
+    if (m_syncAll) {
         return true;
     }
 
@@ -247,34 +393,12 @@ bool SyncJob::contains(SyncAccount *account, const QStringList &sources) const
 
 bool SyncJob::contains(const QString &source) const
 {
-    return (m_sources.contains(SyncJob::SyncAllKeyword) ||
-            m_sources.contains(source));
+    return (m_syncAll || m_sources.contains(source));
 }
 
 void SyncJob::clear()
 {
     m_account = 0;
     m_sources.clear();
-}
-
-bool SyncJob::compareSources(const QStringList &listA, const QStringList &listB)
-{
-    QStringList newListA(listA);
-    if (newListA.isEmpty()) {
-        newListA << SyncJob::SyncAllKeyword;
-    }
-
-    QStringList newListB(listB);
-    if (newListB.isEmpty()) {
-        newListB << SyncJob::SyncAllKeyword;
-    }
-
-    if (newListA.size() != newListB.size())
-        return false;
-
-    Q_FOREACH(const QString &valueA, newListA) {
-        if (!newListB.contains(valueA))
-            return false;
-    }
-    return true;
+    m_syncAll = false;
 }
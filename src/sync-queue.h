@@ -22,20 +22,37 @@
 #include <QtCore/QString>
 #include <QtCore/QStringList>
 #include <QtCore/QMap>
+#include <QtCore/QHash>
+#include <QtCore/QPair>
+#include <QtCore/QSet>
 
 class SyncAccount;
+class SyncQueueJournal;
 
 class SyncJob
 {
 public:
+    // lower values are scheduled first
+    enum Priority {
+        InteractivePriority = 0,
+        LocalChangePriority,
+        RetryPriority,
+        PeriodicPriority
+    };
+
     SyncJob();
-    SyncJob(SyncAccount *account, const QStringList &sources, bool runOnPayedConnection);
+    SyncJob(SyncAccount *account,
+            const QStringList &sources,
+            bool runOnPayedConnection,
+            Priority priority = InteractivePriority);
 
     SyncAccount *account() const;
     QStringList sources() const;
     void appendSources(const QStringList &sources);
     void removeSources(const QStringList &sources);
     bool runOnPayedConnection() const;
+    Priority priority() const;
+    void setPriority(Priority priority);
     bool operator==(const SyncJob &other) const;
     bool isValid() const;
     bool isEmpty();
@@ -45,24 +62,39 @@ public:
     void clear();
 
 private:
-    static const QString SyncAllKeyword;
-
     SyncAccount *m_account;
-    QStringList m_sources;
+    QSet<QString> m_sources;
+    bool m_syncAll;
     bool m_runOnPayedConnection;
-
-    static bool compareSources(const QStringList &listA, const QStringList &listB);
+    Priority m_priority;
 };
 
 class SyncQueue
 {
 public:
+    SyncQueue();
+
+    // record changes on the journal, the current jobs are written to it
+    void setJournal(SyncQueueJournal *journal);
+    SyncQueueJournal *journal() const;
+
+    // the job stays on the journal until finish() is called, a job running
+    // during a crash is restored on the next start
     SyncJob popNext();
+    SyncJob popNext(const QSet<int> &busyAccounts);
+    // the job of the account finished or was canceled
+    void finish(SyncAccount *account);
 
     void push(const SyncQueue &other);
     void push(const SyncJob &job);
-    void push(SyncAccount *account, const QString &sourceName, bool syncOnPayedConnection);
-    void push(SyncAccount *account, const QStringList &sources = QStringList(), bool syncOnPayedConnection = false);
+    void push(SyncAccount *account,
+              const QString &sourceName,
+              bool syncOnPayedConnection,
+              SyncJob::Priority priority = SyncJob::InteractivePriority);
+    void push(SyncAccount *account,
+              const QStringList &sources = QStringList(),
+              bool syncOnPayedConnection = false,
+              SyncJob::Priority priority = SyncJob::InteractivePriority);
 
     bool contains(const SyncJob &otherJob) const;
     bool contains(SyncAccount *account, const QString &sourceName) const;
@@ -78,7 +110,24 @@ public:
     const QList<SyncJob> jobs() const;
 
 private:
-    QList<SyncJob> m_jobs;
+    typedef QPair<int, quint64> OrderKey;
+
+    // one job per account, indexed by account id
+    QHash<int, SyncJob> m_jobs;
+    // scheduling order: (priority, arrival) -> account id
+    QMap<OrderKey, int> m_order;
+    QHash<int, OrderKey> m_orderByAccount;
+    // jobs returned by popNext() and not finished yet
+    QHash<int, SyncJob> m_running;
+    quint64 m_sequence;
+    SyncQueueJournal *m_journal;
+
+    void insert(const SyncJob &job);
+    void take(int accountId);
+    void promote(int accountId, SyncJob::Priority priority);
+    void journalRemove(int accountId, const QStringList &sources);
+    void compactJournal();
+    QList<SyncJob> journalJobs() const;
 };
 
 
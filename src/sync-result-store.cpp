@@ -0,0 +1,394 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sync-result-store.h"
+
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSettings>
+#include <QtCore/QTextStream>
+#include <QtCore/QUrl>
+
+#include "config.h"
+
+// rewrite the log when it has this many records more than results
+#define RESULT_LOG_COMPACT_RECORDS  256
+#define RESULT_LOG_VERSION          "1"
+#define RESULT_LOG_ALL_SOURCES      "*"
+#define RESULT_LOG_EMPTY_FIELD      "-"
+
+/*
+ * Log format, one record per line with fields separated by spaces:
+ *
+ *   V <version>
+ *   S <account id> <source> <result> <date> <last successful date>
+ *   W <account id> <source> <days>
+ *   D <account id> <source>
+ *
+ * Fields are percent-encoded, "-" is used for empty values and "*" as
+ * source of D removes all results of the account. S records may carry a
+ * seventh field, a failure count written by older versions; it is ignored,
+ * failures are counted by SyncRetryPolicy. W records store the window of a
+ * staged first sync, 0 days removes it.
+ */
+
+SyncResultStore::SyncResultStore(const QString &fileName)
+    : m_file(fileName),
+      m_records(0)
+{
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+}
+
+SyncResultStore::~SyncResultStore()
+{
+    flush();
+    m_file.close();
+}
+
+QString SyncResultStore::fileName() const
+{
+    return m_file.fileName();
+}
+
+void SyncResultStore::load()
+{
+    m_results.clear();
+    m_windows.clear();
+    m_records = 0;
+
+    QFile file(m_file.fileName());
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return;
+    }
+
+    QTextStream stream(&file);
+    int lineNumber = 0;
+    bool invalid = false;
+    while (!stream.atEnd()) {
+        const QString line = stream.readLine();
+        const QStringList fields = line.split(' ', QString::SkipEmptyParts);
+        lineNumber++;
+
+        if (fields.isEmpty()) {
+            continue;
+        }
+
+        const QString &op = fields[0];
+        if ((op == "V") && (fields.size() == 2)) {
+            if (fields[1] != RESULT_LOG_VERSION) {
+                qWarning() << "Unsupported sync result log version" << fields[1];
+                m_results.clear();
+                return;
+            }
+        } else if ((op == "S") && ((fields.size() == 6) || (fields.size() == 7))) {
+            SyncResult result;
+            result.result = decode(fields[3]);
+            result.date = decode(fields[4]);
+            result.lastSuccessfulDate = decode(fields[5]);
+            m_results[fields[1].toUInt()].insert(decode(fields[2]), result);
+        } else if ((op == "W") && (fields.size() == 4)) {
+            const uint accountId = fields[1].toUInt();
+            const int days = fields[3].toInt();
+            if (days > 0) {
+                m_windows[accountId].insert(decode(fields[2]), days);
+            } else if (m_windows.contains(accountId)) {
+                m_windows[accountId].remove(decode(fields[2]));
+            }
+        } else if ((op == "D") && (fields.size() == 3)) {
+            const uint accountId = fields[1].toUInt();
+            if (fields[2] == RESULT_LOG_ALL_SOURCES) {
+                m_results.remove(accountId);
+                m_windows.remove(accountId);
+            } else if (m_results.contains(accountId)) {
+                m_results[accountId].remove(decode(fields[2]));
+                if (m_results[accountId].isEmpty()) {
+                    m_results.remove(accountId);
+                }
+            }
+        } else {
+            // probably a partial write during a crash, ignore it
+            qWarning() << "Invalid sync result record at line" << lineNumber << line;
+            invalid = true;
+            continue;
+        }
+        m_records++;
+    }
+    file.close();
+
+    // new records would be appended to the incomplete line
+    if (invalid) {
+        compact();
+    }
+}
+
+int SyncResultStore::migrate(QSettings *settings)
+{
+    int count = 0;
+    Q_FOREACH(const QString &group, settings->childGroups()) {
+        // account_<account id>_<source name>
+        if (!group.startsWith("account_")) {
+            continue;
+        }
+        const int separator = group.indexOf('_', 8);
+        bool ok = false;
+        const uint accountId = group.mid(8, separator - 8).toUInt(&ok);
+        if ((separator == -1) || !ok) {
+            continue;
+        }
+
+        const QString logKey = group + "/";
+        SyncResult result;
+        result.result = settings->value(logKey + ACCOUNT_LOG_LAST_SYNC_RESULT).toString();
+        result.date = settings->value(logKey + ACCOUNT_LOG_LAST_SYNC_DATE).toString();
+        result.lastSuccessfulDate = settings->value(logKey + ACCOUNT_LOG_LAST_SUCCESSFUL_DATE).toString();
+        // old versions did not save the successful date
+        if (isSuccess(result.result) && result.lastSuccessfulDate.isEmpty()) {
+            result.lastSuccessfulDate = result.date;
+        }
+        const QString sourceName = group.mid(separator + 1);
+
+        m_results[accountId].insert(sourceName, result);
+        m_pending << formatResult(accountId, sourceName, result);
+        settings->remove(group);
+        count++;
+    }
+
+    if (count > 0) {
+        qDebug() << "Sync results migrated from settings:" << count;
+        flush();
+        settings->sync();
+    }
+    return count;
+}
+
+void SyncResultStore::save(uint accountId, const QString &sourceName, const QString &result, const QString &date)
+{
+    SyncResult &entry = m_results[accountId][sourceName];
+    entry.result = result;
+    entry.date = date;
+    if (isSuccess(result)) {
+        entry.lastSuccessfulDate = date;
+    }
+    m_pending << formatResult(accountId, sourceName, entry);
+}
+
+void SyncResultStore::remove(uint accountId, const QString &sourceName)
+{
+    setWindow(accountId, sourceName, 0);
+    if (!m_results.contains(accountId) || !m_results[accountId].contains(sourceName)) {
+        return;
+    }
+
+    m_results[accountId].remove(sourceName);
+    if (m_results[accountId].isEmpty()) {
+        m_results.remove(accountId);
+    }
+    m_pending << QString("D %1 %2").arg(accountId).arg(encode(sourceName));
+}
+
+void SyncResultStore::removeAccount(uint accountId)
+{
+    const bool hasWindows = (m_windows.remove(accountId) > 0);
+    if ((m_results.remove(accountId) > 0) || hasWindows) {
+        m_pending << QString("D %1 %2").arg(accountId).arg(RESULT_LOG_ALL_SOURCES);
+    }
+}
+
+void SyncResultStore::flush()
+{
+    if (m_pending.isEmpty()) {
+        return;
+    }
+
+    if (needsCompaction()) {
+        compact();
+        return;
+    }
+
+    if (!m_file.isOpen() &&
+        !m_file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        qWarning() << "Fail to open sync result log" << m_file.fileName() << m_file.errorString();
+        return;
+    }
+
+    // a single write for all records, a crash can only leave the last line
+    // incomplete and load() rewrites the log when it finds one
+    m_file.write(QString(m_pending.join("\n") + "\n").toUtf8());
+    m_file.flush();
+    m_records += m_pending.size();
+    m_pending.clear();
+}
+
+void SyncResultStore::compact()
+{
+    m_file.close();
+
+    QSaveFile file(m_file.fileName());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Fail to compact sync result log" << file.fileName() << file.errorString();
+        return;
+    }
+
+    int records = 0;
+    QTextStream stream(&file);
+    stream << "V " << RESULT_LOG_VERSION << "\n";
+    QHash<uint, QHash<QString, SyncResult> >::const_iterator i = m_results.constBegin();
+    for(; i != m_results.constEnd(); i++) {
+        QHash<QString, SyncResult>::const_iterator s = i.value().constBegin();
+        for(; s != i.value().constEnd(); s++) {
+            stream << formatResult(i.key(), s.key(), s.value()) << "\n";
+            records++;
+        }
+    }
+    QHash<uint, QHash<QString, int> >::const_iterator w = m_windows.constBegin();
+    for(; w != m_windows.constEnd(); w++) {
+        QHash<QString, int>::const_iterator s = w.value().constBegin();
+        for(; s != w.value().constEnd(); s++) {
+            stream << QString("W %1 %2 %3").arg(w.key()).arg(encode(s.key())).arg(s.value()) << "\n";
+            records++;
+        }
+    }
+    stream.flush();
+
+    if (!file.commit()) {
+        qWarning() << "Fail to save sync result log" << file.fileName() << file.errorString();
+        return;
+    }
+    m_records = records;
+    m_pending.clear();
+}
+
+void SyncResultStore::setWindow(uint accountId, const QString &sourceName, int days)
+{
+    days = qMax(0, days);
+    if (window(accountId, sourceName) == days) {
+        return;
+    }
+
+    if (days > 0) {
+        m_windows[accountId].insert(sourceName, days);
+    } else {
+        m_windows[accountId].remove(sourceName);
+        if (m_windows[accountId].isEmpty()) {
+            m_windows.remove(accountId);
+        }
+    }
+    m_pending << QString("W %1 %2 %3").arg(accountId).arg(encode(sourceName)).arg(days);
+}
+
+int SyncResultStore::window(uint accountId, const QString &sourceName) const
+{
+    return m_windows.value(accountId).value(sourceName, 0);
+}
+
+QHash<QString, int> SyncResultStore::windows(uint accountId) const
+{
+    return m_windows.value(accountId);
+}
+
+int SyncResultStore::nextWindow(uint accountId, const QString &sourceName, int firstWindow, int fullWindow) const
+{
+    int days = 0;
+    if (result(accountId, sourceName).lastSuccessfulDate.isEmpty()) {
+        days = firstWindow;
+    } else {
+        days = window(accountId, sourceName) * 2;
+    }
+    return (days >= fullWindow) ? 0 : days;
+}
+
+SyncResult SyncResultStore::result(uint accountId, const QString &sourceName) const
+{
+    return m_results.value(accountId).value(sourceName);
+}
+
+QString SyncResultStore::lastResult(uint accountId, const QString &sourceName) const
+{
+    return result(accountId, sourceName).result;
+}
+
+QString SyncResultStore::lastSuccessfulDate(uint accountId, const QString &sourceName) const
+{
+    return result(accountId, sourceName).lastSuccessfulDate;
+}
+
+bool SyncResultStore::hasResults(uint accountId) const
+{
+    return m_results.contains(accountId);
+}
+
+QList<uint> SyncResultStore::accounts() const
+{
+    return m_results.keys();
+}
+
+bool SyncResultStore::needsCompaction() const
+{
+    int results = 0;
+    Q_FOREACH(const QHash<QString, SyncResult> &sources, m_results) {
+        results += sources.size();
+    }
+    return ((m_records + m_pending.size()) >= (results + RESULT_LOG_COMPACT_RECORDS));
+}
+
+int SyncResultStore::pendingRecords() const
+{
+    return m_pending.size();
+}
+
+bool SyncResultStore::isSuccess(const QString &result)
+{
+    static QStringList okStatus;
+
+    if (okStatus.isEmpty()) {
+        okStatus << "0"
+                 << "200"
+                 << "204"
+                 << "207";
+    }
+    return okStatus.contains(result);
+}
+
+QString SyncResultStore::formatResult(uint accountId, const QString &sourceName, const SyncResult &result)
+{
+    return QString("S %1 %2 %3 %4 %5")
+            .arg(accountId)
+            .arg(encode(sourceName))
+            .arg(encode(result.result))
+            .arg(encode(result.date))
+            .arg(encode(result.lastSuccessfulDate));
+}
+
+QString SyncResultStore::encode(const QString &value)
+{
+    if (value.isEmpty()) {
+        return QStringLiteral(RESULT_LOG_EMPTY_FIELD);
+    }
+    // "-" is reserved for empty values
+    return QString::fromLatin1(QUrl::toPercentEncoding(value, QByteArray(), RESULT_LOG_EMPTY_FIELD));
+}
+
+QString SyncResultStore::decode(const QString &field)
+{
+    if (field == RESULT_LOG_EMPTY_FIELD) {
+        return QString();
+    }
+    return QUrl::fromPercentEncoding(field.toLatin1());
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYNC_RESULT_STORE_H__
+#define __SYNC_RESULT_STORE_H__
+
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QFile>
+
+class QSettings;
+
+class SyncResult
+{
+public:
+    QString result;
+    QString date;
+    QString lastSuccessfulDate;
+};
+
+// Last sync result of every source.
+// Results are kept in memory and written to an append-only log, new records
+// are buffered until flush() is called, usually once per sync session. The
+// log is rewritten with the current results when it grows too much.
+class SyncResultStore
+{
+public:
+    SyncResultStore(const QString &fileName);
+    ~SyncResultStore();
+
+    QString fileName() const;
+    void load();
+    // import the results saved by old versions on the settings file
+    int migrate(QSettings *settings);
+
+    void save(uint accountId, const QString &sourceName, const QString &result, const QString &date);
+    void remove(uint accountId, const QString &sourceName);
+    void removeAccount(uint accountId);
+    void flush();
+    void compact();
+
+    SyncResult result(uint accountId, const QString &sourceName) const;
+    QString lastResult(uint accountId, const QString &sourceName) const;
+    QString lastSuccessfulDate(uint accountId, const QString &sourceName) const;
+    bool hasResults(uint accountId) const;
+
+    // days of history fetched so far by a staged first sync, 0 once the
+    // source covers the whole sync window
+    void setWindow(uint accountId, const QString &sourceName, int days);
+    int window(uint accountId, const QString &sourceName) const;
+    QHash<QString, int> windows(uint accountId) const;
+    // window of the next sync: the first window until a sync succeeds, then
+    // twice the fetched one, 0 once it reaches the full window
+    int nextWindow(uint accountId, const QString &sourceName, int firstWindow, int fullWindow) const;
+
+    QList<uint> accounts() const;
+    bool needsCompaction() const;
+    int pendingRecords() const;
+
+    static bool isSuccess(const QString &result);
+
+private:
+    QFile m_file;
+    QHash<uint, QHash<QString, SyncResult> > m_results;
+    QHash<uint, QHash<QString, int> > m_windows;
+    QStringList m_pending;
+    int m_records;
+
+    void append(const QString &line);
+    static QString formatResult(uint accountId, const QString &sourceName, const SyncResult &result);
+    static QString encode(const QString &value);
+    static QString decode(const QString &field);
+};
+
+#endif
@@ -0,0 +1,348 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sync-retry-policy.h"
+
+#include <QtCore/QDebug>
+
+#define RETRY_BASE_DELAY            1000 * 30 // thirty seconds
+#define RETRY_MAX_DELAY             1000 * 60 * 60 // one hour
+#define RETRY_MAX_ATTEMPTS          8
+#define RETRY_CONFIG_GROUP          "retry"
+// consecutive failures of unknown cause before falling back to a slow sync
+#define RETRY_SLOW_SYNC_FAILURES    3
+
+SyncRetryPolicy::SyncRetryPolicy(QSettings *settings, QObject *parent)
+    : QObject(parent),
+      m_settings(settings)
+{
+    qsrand(QDateTime::currentMSecsSinceEpoch());
+    m_timer.setSingleShot(true);
+    connect(&m_timer, SIGNAL(timeout()), SLOT(onTimeout()));
+    load();
+    scheduleNext();
+}
+
+SyncRetryPolicy::~SyncRetryPolicy()
+{
+    m_timer.stop();
+}
+
+SyncRetryPolicy::StatusCause SyncRetryPolicy::statusCause(const QString &status)
+{
+    if (status.isEmpty()) {
+        return Succeeded;
+    }
+
+    switch(status.toInt())
+    {
+    case 0:
+    case 200:
+    case 204:
+    case 207:
+        return Succeeded;
+    // server or network problems, no item changed and these usually go away by themselves
+    case 500:
+    case 506:
+    case 1500:
+    case 10403:  // could not obtain OAuth2 token, network went off during the sync
+    case 10500:  // no sources active, SyncEvolution sometimes fail to read the address book
+    case 20017:
+    case 20020:
+    case 20026:
+    case 20027:
+    case 20028:
+    case 20046:
+    case 20047:
+    case 22002:
+        return Transport;
+    // the server refused the sync, no item changed; the user or the server need to fix it
+    case 401:
+    case 403:
+    case 405:
+    case 407:
+    case 20021:
+    case 20022:
+        return Refused;
+    // the local copy is incomplete
+    case 404:
+    case 420:
+    case 514:
+        return Incomplete;
+    // items may differ on both sides
+    case 406:
+    case 20006:
+    case 20007:
+    case 22000:
+    case 22001:
+        return Inconsistent;
+    default:
+        return Unknown;
+    }
+}
+
+SyncRetryPolicy::ErrorClass SyncRetryPolicy::classify(const QString &status)
+{
+    switch(statusCause(status))
+    {
+    case Succeeded:
+        return Success;
+    case Transport:
+        return Transient;
+    // unknown errors (including -1, SyncEvolution did not report a status) are
+    // retried: the backoff gives up after RETRY_MAX_ATTEMPTS and syncMode()
+    // falls back to a slow sync after RETRY_SLOW_SYNC_FAILURES of them
+    case Unknown:
+        return Transient;
+    // retrying will not help
+    case Refused:
+    case Incomplete:
+    case Inconsistent:
+    default:
+        return Permanent;
+    }
+}
+
+QString SyncRetryPolicy::syncMode(const QString &lastStatus, bool hasBaseline, int failures,
+                                  QString *reason)
+{
+    QString mode("two-way");
+    QString why;
+
+    if (lastStatus.isEmpty()) {
+        mode = "refresh-from-remote";
+        why = "first sync";
+    } else if (!hasBaseline) {
+        // nothing to compare with, same as the first sync
+        mode = "refresh-from-remote";
+        why = QString("no successful sync yet, last error %1").arg(lastStatus);
+    } else {
+        switch(statusCause(lastStatus))
+        {
+        case Succeeded:
+            why = "last sync succeeded";
+            break;
+        case Transport:
+            why = QString("transport error %1, last good state kept").arg(lastStatus);
+            break;
+        case Refused:
+            why = QString("refused by the server with %1, last good state kept").arg(lastStatus);
+            break;
+        case Incomplete:
+            mode = "refresh-from-remote";
+            why = QString("local data incomplete after error %1").arg(lastStatus);
+            break;
+        case Inconsistent:
+            mode = "slow";
+            why = QString("data consistency error %1").arg(lastStatus);
+            break;
+        case Unknown:
+        default:
+            if (failures >= RETRY_SLOW_SYNC_FAILURES) {
+                mode = "slow";
+                why = QString("error %1 after %2 consecutive failures").arg(lastStatus).arg(failures);
+            } else {
+                why = QString("error %1, failure %2 of %3 before a slow sync")
+                        .arg(lastStatus).arg(failures).arg(RETRY_SLOW_SYNC_FAILURES);
+            }
+            break;
+        }
+    }
+
+    if (reason) {
+        *reason = why;
+    }
+    return mode;
+}
+
+bool SyncRetryPolicy::failed(int accountId, const QString &source)
+{
+    Entry &entry = m_entries[Key(accountId, source)];
+    entry.failures++;
+
+    if (entry.failures > RETRY_MAX_ATTEMPTS) {
+        qDebug() << "Giving up retrying" << accountId << source << "after" << RETRY_MAX_ATTEMPTS << "attempts";
+        entry.nextAttempt = QDateTime();
+        save();
+        scheduleNext();
+        return false;
+    }
+
+    const qint64 delay = backoff(entry.failures);
+    entry.nextAttempt = QDateTime::currentDateTimeUtc().addMSecs(delay);
+    qDebug() << "Will retry" << accountId << source
+             << "in" << delay / 1000 << "secs; attempt:" << entry.failures;
+    save();
+    scheduleNext();
+    return true;
+}
+
+void SyncRetryPolicy::clear(int accountId, const QString &source)
+{
+    bool changed = (m_entries.remove(Key(accountId, source)) > 0);
+    // the account reached the server, so it is not failing as a whole
+    if (!source.isEmpty()) {
+        changed |= (m_entries.remove(Key(accountId, QString())) > 0);
+    }
+
+    if (changed) {
+        save();
+        scheduleNext();
+    }
+}
+
+void SyncRetryPolicy::reset(int accountId)
+{
+    bool changed = false;
+    Q_FOREACH(const Key &key, m_entries.keys()) {
+        if (key.first == accountId) {
+            m_entries.remove(key);
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        save();
+        scheduleNext();
+    }
+}
+
+int SyncRetryPolicy::failures(int accountId, const QString &source) const
+{
+    return m_entries.value(Key(accountId, source)).failures;
+}
+
+QDateTime SyncRetryPolicy::nextAttempt(int accountId, const QString &source) const
+{
+    return m_entries.value(Key(accountId, source)).nextAttempt;
+}
+
+qint64 SyncRetryPolicy::backoff(int failures)
+{
+    qint64 delay = RETRY_BASE_DELAY;
+    for (int i = 1; (i < failures) && (delay < RETRY_MAX_DELAY); i++) {
+        delay *= 2;
+    }
+    delay = qMin<qint64>(delay, RETRY_MAX_DELAY);
+
+    // pick a random point on the upper half of the interval to avoid
+    // accounts failing together from retrying together
+    const qint64 half = delay / 2;
+    return half + (qrand() % (half + 1));
+}
+
+void SyncRetryPolicy::onTimeout()
+{
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    QHash<int, QStringList> due;
+
+    QHash<Key, Entry>::iterator i = m_entries.begin();
+    for (; i != m_entries.end(); i++) {
+        if (i.value().nextAttempt.isValid() && (i.value().nextAttempt <= now)) {
+            i.value().nextAttempt = QDateTime();
+            due[i.key().first] << i.key().second;
+        }
+    }
+
+    if (!due.isEmpty()) {
+        save();
+    }
+    scheduleNext();
+
+    Q_FOREACH(int accountId, due.keys()) {
+        QStringList sources = due.value(accountId);
+        // the whole account failed, sync all sources
+        if (sources.contains(QString())) {
+            sources.clear();
+        }
+        qDebug() << "Retry due for account" << accountId << sources;
+        Q_EMIT retryDue(accountId, sources);
+    }
+}
+
+QDateTime SyncRetryPolicy::nextDue() const
+{
+    QDateTime next;
+    Q_FOREACH(const Entry &entry, m_entries) {
+        if (entry.nextAttempt.isValid() &&
+            (!next.isValid() || (entry.nextAttempt < next))) {
+            next = entry.nextAttempt;
+        }
+    }
+    return next;
+}
+
+void SyncRetryPolicy::checkDue()
+{
+    onTimeout();
+}
+
+void SyncRetryPolicy::scheduleNext()
+{
+    const QDateTime next = nextDue();
+    if (next.isValid()) {
+        m_timer.start(qMax<qint64>(0, QDateTime::currentDateTimeUtc().msecsTo(next)));
+    } else {
+        m_timer.stop();
+    }
+}
+
+void SyncRetryPolicy::load()
+{
+    if (!m_settings) {
+        return;
+    }
+
+    int size = m_settings->beginReadArray(RETRY_CONFIG_GROUP);
+    for (int i = 0; i < size; i++) {
+        m_settings->setArrayIndex(i);
+        Entry entry;
+        entry.failures = m_settings->value("failures", 0).toInt();
+        entry.nextAttempt = QDateTime::fromString(m_settings->value("next").toString(), Qt::ISODate);
+        if (entry.nextAttempt.isValid()) {
+            entry.nextAttempt.setTimeSpec(Qt::UTC);
+        }
+        if (entry.failures > 0) {
+            m_entries.insert(Key(m_settings->value("account").toInt(),
+                                 m_settings->value("source").toString()),
+                             entry);
+        }
+    }
+    m_settings->endArray();
+}
+
+void SyncRetryPolicy::save()
+{
+    if (!m_settings) {
+        return;
+    }
+
+    m_settings->remove(RETRY_CONFIG_GROUP);
+    m_settings->beginWriteArray(RETRY_CONFIG_GROUP, m_entries.size());
+    int index = 0;
+    QHash<Key, Entry>::const_iterator i = m_entries.constBegin();
+    for (; i != m_entries.constEnd(); i++, index++) {
+        m_settings->setArrayIndex(index);
+        m_settings->setValue("account", i.key().first);
+        m_settings->setValue("source", i.key().second);
+        m_settings->setValue("failures", i.value().failures);
+        m_settings->setValue("next", i.value().nextAttempt.toString(Qt::ISODate));
+    }
+    m_settings->endArray();
+    m_settings->sync();
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYNC_RETRY_POLICY_H__
+#define __SYNC_RETRY_POLICY_H__
+
+#include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QPair>
+#include <QtCore/QTimer>
+#include <QtCore/QDateTime>
+#include <QtCore/QSettings>
+#include <QtCore/QStringList>
+
+// Decide if and when a failed sync should run again.
+// Failures are counted per account and source; an empty source means the
+// whole account. Transient errors are retried with a capped exponential
+// backoff plus jitter, permanent errors are never retried. Statuses not
+// known by statusCause() are handled as transient.
+class SyncRetryPolicy : public QObject
+{
+    Q_OBJECT
+public:
+    enum ErrorClass {
+        Success = 0,
+        Transient,
+        Permanent
+    };
+
+    // what a SyncEvolution status says about the local and remote data,
+    // shared by classify() and syncMode()
+    enum StatusCause {
+        Succeeded = 0,
+        Transport,
+        Refused,
+        Incomplete,
+        Inconsistent,
+        Unknown
+    };
+
+    SyncRetryPolicy(QSettings *settings, QObject *parent = 0);
+    ~SyncRetryPolicy();
+
+    static StatusCause statusCause(const QString &status);
+    static ErrorClass classify(const QString &status);
+    // cheapest SyncEvolution mode able to recover from the last result of a source;
+    // failures is the count kept by failed() for the source
+    static QString syncMode(const QString &lastStatus, bool hasBaseline, int failures,
+                            QString *reason = 0);
+
+    // returns false if no more attempts should be done for this source
+    bool failed(int accountId, const QString &source);
+    // forget the failures of a source, e.g. after a successful sync
+    void clear(int accountId, const QString &source);
+    void reset(int accountId);
+
+    int failures(int accountId, const QString &source) const;
+    QDateTime nextAttempt(int accountId, const QString &source) const;
+    // earliest retry pending, invalid if there is none
+    QDateTime nextDue() const;
+
+Q_SIGNALS:
+    void retryDue(int accountId, const QStringList &sources);
+
+public Q_SLOTS:
+    // the timer does not run while the device is suspended, call this after resume
+    void checkDue();
+
+private Q_SLOTS:
+    void onTimeout();
+
+private:
+    typedef QPair<int, QString> Key;
+    class Entry
+    {
+    public:
+        int failures;
+        QDateTime nextAttempt;
+
+        Entry() : failures(0) {}
+    };
+
+    QSettings *m_settings;
+    QHash<Key, Entry> m_entries;
+    QTimer m_timer;
+
+    static qint64 backoff(int failures);
+    void load();
+    void save();
+    void scheduleNext();
+};
+
+#endif
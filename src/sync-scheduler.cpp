@@ -0,0 +1,276 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sync-scheduler.h"
+
+#include <QtCore/QDebug>
+
+#define SCHEDULER_SLOT_SIZE         1000 * 60 * 5 // five minutes
+#define SCHEDULER_WHEEL_SIZE        288 // one day with the default slot size
+// jobs can run up to this fraction of their period earlier to share a wake-up
+#define SCHEDULER_ALIGN_FRACTION    4
+
+SyncScheduler::SyncScheduler(QObject *parent, int slotSize)
+    : QObject(parent),
+      m_slotSize(slotSize > 0 ? slotSize : SCHEDULER_SLOT_SIZE),
+      m_wheel(SCHEDULER_WHEEL_SIZE)
+{
+    m_lastTick = currentTick();
+    m_timer.setSingleShot(true);
+    // slots are minutes long, a few seconds late do not matter
+    m_timer.setTimerType(m_slotSize >= 60000 ? Qt::VeryCoarseTimer : Qt::CoarseTimer);
+    connect(&m_timer, SIGNAL(timeout()), SLOT(onTimeout()));
+}
+
+SyncScheduler::~SyncScheduler()
+{
+    m_timer.stop();
+}
+
+void SyncScheduler::schedule(int accountId, const QString &source, int period)
+{
+    const Key key(accountId, source);
+    if (period <= 0) {
+        remove(accountId, source);
+        return;
+    }
+
+    // keep the current slot if only the period changed
+    if (m_entries.contains(key) && (m_entries[key].period == period)) {
+        return;
+    }
+
+    take(key);
+    m_entries[key].period = period;
+    insert(key, currentTick() + periodTicks(period));
+    scheduleNext();
+}
+
+void SyncScheduler::reschedule(int accountId, const QString &source)
+{
+    const Key key(accountId, source);
+    if (!m_entries.contains(key)) {
+        return;
+    }
+
+    const int period = m_entries[key].period;
+    take(key);
+    m_entries[key].period = period;
+    insert(key, currentTick() + periodTicks(period));
+    scheduleNext();
+}
+
+void SyncScheduler::remove(int accountId, const QString &source)
+{
+    const Key key(accountId, source);
+    if (m_entries.contains(key)) {
+        take(key);
+        m_entries.remove(key);
+        scheduleNext();
+    }
+}
+
+void SyncScheduler::remove(int accountId)
+{
+    Q_FOREACH(const Key &key, m_entries.keys()) {
+        if (key.first == accountId) {
+            take(key);
+            m_entries.remove(key);
+        }
+    }
+    scheduleNext();
+}
+
+void SyncScheduler::clear()
+{
+    m_entries.clear();
+    for (int i = 0; i < m_wheel.size(); i++) {
+        m_wheel[i].clear();
+    }
+    m_timer.stop();
+}
+
+bool SyncScheduler::contains(int accountId, const QString &source) const
+{
+    return m_entries.contains(Key(accountId, source));
+}
+
+QStringList SyncScheduler::sources(int accountId) const
+{
+    QStringList result;
+    Q_FOREACH(const Key &key, m_entries.keys()) {
+        if (key.first == accountId) {
+            result << key.second;
+        }
+    }
+    return result;
+}
+
+int SyncScheduler::period(int accountId, const QString &source) const
+{
+    return m_entries.value(Key(accountId, source)).period;
+}
+
+QDateTime SyncScheduler::nextSync(int accountId, const QString &source) const
+{
+    const Key key(accountId, source);
+    if (!m_entries.contains(key)) {
+        return QDateTime();
+    }
+    return QDateTime::fromMSecsSinceEpoch(m_entries[key].dueTick * m_slotSize);
+}
+
+QDateTime SyncScheduler::nextDue() const
+{
+    qint64 next = -1;
+    Q_FOREACH(const Entry &entry, m_entries) {
+        if ((next < 0) || (entry.dueTick < next)) {
+            next = entry.dueTick;
+        }
+    }
+    if (next < 0) {
+        return QDateTime();
+    }
+    return QDateTime::fromMSecsSinceEpoch(next * m_slotSize);
+}
+
+void SyncScheduler::checkDue()
+{
+    onTimeout();
+}
+
+int SyncScheduler::count() const
+{
+    return m_entries.size();
+}
+
+qint64 SyncScheduler::currentTick() const
+{
+    return QDateTime::currentMSecsSinceEpoch() / m_slotSize;
+}
+
+qint64 SyncScheduler::periodTicks(int period) const
+{
+    // round up, a job never runs before its period expires unless aligned
+    return qMax<qint64>(1, ((qint64(period) * 1000) + m_slotSize - 1) / m_slotSize);
+}
+
+void SyncScheduler::insert(const Key &key, qint64 dueTick)
+{
+    m_entries[key].dueTick = dueTick;
+    m_wheel[dueTick % m_wheel.size()] << key;
+}
+
+void SyncScheduler::take(const Key &key)
+{
+    QHash<Key, Entry>::const_iterator i = m_entries.constFind(key);
+    if (i != m_entries.constEnd()) {
+        m_wheel[i.value().dueTick % m_wheel.size()].removeOne(key);
+    }
+}
+
+void SyncScheduler::onTimeout()
+{
+    const qint64 tick = currentTick();
+    const int wheelSize = m_wheel.size();
+    QList<Key> due;
+
+    // collect expired slots, including the ones missed while suspended
+    for (qint64 t = qMin(qMax(m_lastTick + 1, tick - wheelSize + 1), tick); t <= tick; t++) {
+        Q_FOREACH(const Key &key, m_wheel[t % wheelSize]) {
+            if (m_entries[key].dueTick <= tick) {
+                due << key;
+            }
+        }
+    }
+    m_lastTick = tick;
+
+    // bring forward jobs that would wake us up again soon
+    if (!due.isEmpty()) {
+        qint64 lookAhead = 0;
+        Q_FOREACH(const Entry &entry, m_entries) {
+            lookAhead = qMax(lookAhead, (qint64(entry.period) * 1000) / SCHEDULER_ALIGN_FRACTION);
+        }
+        lookAhead = qMin<qint64>(lookAhead / m_slotSize, wheelSize - 1);
+
+        for (qint64 t = tick + 1; t <= tick + lookAhead; t++) {
+            const qint64 ahead = (t - tick) * m_slotSize;
+            Q_FOREACH(const Key &key, m_wheel[t % wheelSize]) {
+                const Entry &entry = m_entries[key];
+                if ((entry.dueTick == t) &&
+                    (ahead <= (qint64(entry.period) * 1000) / SCHEDULER_ALIGN_FRACTION)) {
+                    due << key;
+                }
+            }
+        }
+    }
+
+    QHash<int, QStringList> accounts;
+    Q_FOREACH(const Key &key, due) {
+        const int period = m_entries[key].period;
+        take(key);
+        insert(key, tick + periodTicks(period));
+        accounts[key.first] << key.second;
+    }
+    scheduleNext();
+
+    Q_FOREACH(int accountId, accounts.keys()) {
+        QStringList sources = accounts.value(accountId);
+        // the whole account is due, no need to list the sources
+        if (sources.contains(QString())) {
+            sources.clear();
+        }
+        qDebug() << "Periodic sync due for account" << accountId << sources;
+        Q_EMIT syncDue(accountId, sources);
+    }
+}
+
+void SyncScheduler::scheduleNext()
+{
+    if (m_entries.isEmpty()) {
+        m_timer.stop();
+        return;
+    }
+
+    // look for the next non-empty slot on the current turn of the wheel,
+    // starting on the slots not processed yet
+    const int wheelSize = m_wheel.size();
+    const qint64 tick = currentTick();
+    const qint64 first = qMin(qMax(m_lastTick + 1, tick - wheelSize + 1), tick);
+    qint64 next = -1;
+    for (qint64 t = first; (next < 0) && (t < first + wheelSize); t++) {
+        Q_FOREACH(const Key &key, m_wheel[t % wheelSize]) {
+            if (m_entries[key].dueTick <= t) {
+                next = t;
+                break;
+            }
+        }
+    }
+
+    // everything is on a later turn
+    if (next < 0) {
+        Q_FOREACH(const Entry &entry, m_entries) {
+            if ((next < 0) || (entry.dueTick < next)) {
+                next = entry.dueTick;
+            }
+        }
+    }
+
+    const qint64 wait = (next * m_slotSize) - QDateTime::currentMSecsSinceEpoch();
+    m_timer.start(qMax<qint64>(0, wait));
+}
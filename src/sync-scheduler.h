@@ -0,0 +1,93 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYNC_SCHEDULER_H__
+#define __SYNC_SCHEDULER_H__
+
+#include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QPair>
+#include <QtCore/QVector>
+#include <QtCore/QTimer>
+#include <QtCore/QDateTime>
+#include <QtCore/QStringList>
+
+// Periodic sync scheduler based on a timer wheel.
+// Time is split in fixed slots aligned to the wall clock and every
+// account/source is placed in the slot where its period expires; a single
+// timer wakes up on the next non-empty slot. Jobs due shortly after the
+// current slot are fired with it, so several accounts share one wake-up.
+// An empty source means the whole account.
+class SyncScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    SyncScheduler(QObject *parent = 0, int slotSize = 0);
+    ~SyncScheduler();
+
+    // period in seconds
+    void schedule(int accountId, const QString &source, int period);
+    // postpone the next sync by a full period, e.g. after a sync that was not periodic
+    void reschedule(int accountId, const QString &source);
+    void remove(int accountId, const QString &source);
+    void remove(int accountId);
+    void clear();
+
+    bool contains(int accountId, const QString &source) const;
+    QStringList sources(int accountId) const;
+    int period(int accountId, const QString &source) const;
+    QDateTime nextSync(int accountId, const QString &source) const;
+    // earliest sync scheduled, invalid if there is none
+    QDateTime nextDue() const;
+    int count() const;
+
+Q_SIGNALS:
+    void syncDue(int accountId, const QStringList &sources);
+
+public Q_SLOTS:
+    // the timer does not run while the device is suspended, call this after resume
+    void checkDue();
+
+private Q_SLOTS:
+    void onTimeout();
+
+private:
+    typedef QPair<int, QString> Key;
+    class Entry
+    {
+    public:
+        int period;
+        qint64 dueTick;
+
+        Entry() : period(0), dueTick(0) {}
+    };
+
+    qint64 m_slotSize;
+    qint64 m_lastTick;
+    QVector<QList<Key> > m_wheel;
+    QHash<Key, Entry> m_entries;
+    QTimer m_timer;
+
+    qint64 currentTick() const;
+    qint64 periodTicks(int period) const;
+    void insert(const Key &key, qint64 dueTick);
+    void take(const Key &key);
+    void scheduleNext();
+};
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sync-token-cache.h"
+#include "sync-auth.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDebug>
+
+#include <Accounts/Manager>
+#include <Accounts/Account>
+
+#define TOKEN_REFRESH_MARGIN    1000 * 60 * 5 // five minutes
+#define TOKEN_DEFAULT_LIFETIME  1000 * 60 * 30 // tokens without expiration info
+
+SyncTokenCache *SyncTokenCache::m_instance = 0;
+
+SyncTokenCache::SyncTokenCache(QObject *parent, int refreshMargin)
+    : QObject(parent),
+      m_manager(0),
+      m_refreshMargin(refreshMargin >= 0 ? refreshMargin : TOKEN_REFRESH_MARGIN)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::CoarseTimer);
+    connect(&m_timer, SIGNAL(timeout()), SLOT(onTimeout()));
+}
+
+SyncTokenCache::~SyncTokenCache()
+{
+    if (m_instance == this) {
+        m_instance = 0;
+    }
+    clear();
+}
+
+SyncTokenCache *SyncTokenCache::instance()
+{
+    if (!m_instance) {
+        m_instance = new SyncTokenCache(QCoreApplication::instance());
+    }
+    return m_instance;
+}
+
+void SyncTokenCache::setManager(Accounts::Manager *manager)
+{
+    m_manager = manager;
+}
+
+Accounts::Manager *SyncTokenCache::manager() const
+{
+    return m_manager;
+}
+
+bool SyncTokenCache::token(uint accountId, const QString &serviceName, QString *token)
+{
+    const Key key(accountId, serviceName);
+    QHash<Key, Entry>::iterator i = m_entries.find(key);
+    if (i == m_entries.end()) {
+        return false;
+    }
+
+    if (!isValid(i.value())) {
+        m_entries.erase(i);
+        scheduleNext();
+        return false;
+    }
+
+    // keep the token fresh while the account uses it
+    if (!i.value().used) {
+        i.value().used = true;
+        scheduleNext();
+    }
+    *token = i.value().token;
+    return true;
+}
+
+void SyncTokenCache::insert(uint accountId, const QString &serviceName, const QString &token, int expiresIn)
+{
+    Entry entry;
+    entry.token = token;
+    entry.lifetime = (expiresIn > 0) ? qint64(expiresIn) * 1000 : TOKEN_DEFAULT_LIFETIME;
+    entry.used = false;
+    entry.age.start();
+    m_entries.insert(Key(accountId, serviceName), entry);
+    scheduleNext();
+}
+
+void SyncTokenCache::remove(uint accountId, const QString &serviceName)
+{
+    Q_FOREACH(const Key &key, m_entries.keys()) {
+        if ((key.first == accountId) &&
+            (serviceName.isEmpty() || (key.second == serviceName))) {
+            m_entries.remove(key);
+        }
+    }
+    Q_FOREACH(const Key &key, m_refreshing.keys()) {
+        if ((key.first == accountId) &&
+            (serviceName.isEmpty() || (key.second == serviceName))) {
+            m_refreshing.take(key)->deleteLater();
+        }
+    }
+    scheduleNext();
+}
+
+void SyncTokenCache::clear()
+{
+    m_entries.clear();
+    Q_FOREACH(SyncAuth *auth, m_refreshing) {
+        auth->deleteLater();
+    }
+    m_refreshing.clear();
+    m_timer.stop();
+}
+
+bool SyncTokenCache::contains(uint accountId, const QString &serviceName) const
+{
+    const Key key(accountId, serviceName);
+    return m_entries.contains(key) && isValid(m_entries[key]);
+}
+
+int SyncTokenCache::count() const
+{
+    return m_entries.size();
+}
+
+// tokens are not used during the last minutes of its life, a sync
+// started with it could fail in the middle
+bool SyncTokenCache::isValid(const Entry &entry) const
+{
+    return entry.age.elapsed() < (entry.lifetime - m_refreshMargin);
+}
+
+static qint64 refreshTime(qint64 validTime, int margin)
+{
+    // short lived tokens are not refreshed in advance
+    const qint64 refreshAt = validTime - margin;
+    return (refreshAt >= (validTime / 2)) ? refreshAt : -1;
+}
+
+void SyncTokenCache::onTimeout()
+{
+    QList<Key> toRefresh;
+    QHash<Key, Entry>::iterator i = m_entries.begin();
+    while (i != m_entries.end()) {
+        Entry &entry = i.value();
+        const qint64 validTime = entry.lifetime - m_refreshMargin;
+        const qint64 refreshAt = refreshTime(validTime, m_refreshMargin);
+        const qint64 elapsed = entry.age.elapsed();
+
+        if (elapsed >= validTime) {
+            i = m_entries.erase(i);
+            continue;
+        }
+        if (entry.used && (refreshAt >= 0) && (elapsed >= refreshAt) && !m_refreshing.contains(i.key())) {
+            // refreshed once, the new token needs to be used again to be kept fresh
+            entry.used = false;
+            toRefresh << i.key();
+        }
+        ++i;
+    }
+
+    Q_FOREACH(const Key &key, toRefresh) {
+        Q_EMIT refreshNeeded(key.first, key.second);
+        refresh(key);
+    }
+    scheduleNext();
+}
+
+void SyncTokenCache::refresh(const SyncTokenCache::Key &key)
+{
+    if (!m_manager) {
+        return;
+    }
+
+    Accounts::Account *account = m_manager->account(key.first);
+    if (!account) {
+        m_entries.remove(key);
+        return;
+    }
+
+    qDebug() << "Refresh token for account:" << key.first << key.second;
+    SyncAuth *auth = new SyncAuth(account, key.second, this);
+    m_refreshing.insert(key, auth);
+    connect(auth, &SyncAuth::success, this, [this, key, auth]() {
+        m_refreshing.remove(key);
+        auth->deleteLater();
+    });
+    connect(auth, &SyncAuth::fail, this, [this, key, auth]() {
+        qWarning() << "Fail to refresh token for account:" << key.first << key.second;
+        m_refreshing.remove(key);
+        auth->deleteLater();
+        scheduleNext();
+    });
+
+    if (!auth->refresh()) {
+        m_refreshing.remove(key);
+        auth->deleteLater();
+    }
+}
+
+void SyncTokenCache::scheduleNext()
+{
+    qint64 next = -1;
+    QHash<Key, Entry>::const_iterator i = m_entries.constBegin();
+    for(; i != m_entries.constEnd(); i++) {
+        const Entry &entry = i.value();
+        const qint64 validTime = entry.lifetime - m_refreshMargin;
+        const qint64 refreshAt = refreshTime(validTime, m_refreshMargin);
+
+        qint64 when = validTime;
+        if (entry.used && (refreshAt >= 0) && !m_refreshing.contains(i.key())) {
+            when = refreshAt;
+        }
+        when = qMax(qint64(0), when - entry.age.elapsed());
+        if ((next < 0) || (when < next)) {
+            next = when;
+        }
+    }
+
+    if (next < 0) {
+        m_timer.stop();
+    } else {
+        m_timer.start(int(next));
+    }
+}
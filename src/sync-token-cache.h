@@ -0,0 +1,89 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYNC_TOKEN_CACHE_H__
+#define __SYNC_TOKEN_CACHE_H__
+
+#include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QPair>
+#include <QtCore/QTimer>
+#include <QtCore/QElapsedTimer>
+
+namespace Accounts {
+    class Manager;
+}
+
+class SyncAuth;
+
+// Access tokens shared by all accounts, keyed by account and service.
+// Tokens are kept until shortly before they expire; tokens used since the
+// last authentication are refreshed in advance so the next sync does not
+// need to wait for signon.
+class SyncTokenCache : public QObject
+{
+    Q_OBJECT
+public:
+    SyncTokenCache(QObject *parent = 0, int refreshMargin = -1);
+    ~SyncTokenCache();
+
+    static SyncTokenCache *instance();
+
+    // used to retrieve the accounts for the proactive refresh
+    void setManager(Accounts::Manager *manager);
+    Accounts::Manager *manager() const;
+
+    // returns true if a valid token is available
+    bool token(uint accountId, const QString &serviceName, QString *token);
+    // expiresIn in seconds, tokens without expiration use a default lifetime
+    void insert(uint accountId, const QString &serviceName, const QString &token, int expiresIn = 0);
+    void remove(uint accountId, const QString &serviceName = QString());
+    void clear();
+    bool contains(uint accountId, const QString &serviceName) const;
+    int count() const;
+
+Q_SIGNALS:
+    void refreshNeeded(uint accountId, const QString &serviceName);
+
+private Q_SLOTS:
+    void onTimeout();
+
+private:
+    typedef QPair<uint, QString> Key;
+    class Entry
+    {
+    public:
+        QString token;
+        QElapsedTimer age;
+        qint64 lifetime;
+        bool used;
+    };
+
+    static SyncTokenCache *m_instance;
+    Accounts::Manager *m_manager;
+    QHash<Key, Entry> m_entries;
+    QHash<Key, SyncAuth*> m_refreshing;
+    QTimer m_timer;
+    int m_refreshMargin;
+
+    bool isValid(const Entry &entry) const;
+    void refresh(const Key &key);
+    void scheduleNext();
+};
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sync-trace.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+
+#define SYNC_TRACE_CAPACITY     4096
+#define SYNC_TRACE_CATEGORY     "sync"
+
+SyncTrace *SyncTrace::m_instance = 0;
+
+SyncTrace::SyncTrace(int capacity)
+    : m_next(0),
+      m_count(0),
+      m_enabled(true)
+{
+    setCapacity(capacity);
+    m_clock.start();
+}
+
+SyncTrace *SyncTrace::instance()
+{
+    if (!m_instance) {
+        m_instance = new SyncTrace;
+        m_instance->setEnabled(qgetenv("SYNC_MONITOR_TRACE") != "0");
+    }
+    return m_instance;
+}
+
+void SyncTrace::setEnabled(bool enabled)
+{
+    if (m_enabled != enabled) {
+        m_enabled = enabled;
+        clear();
+    }
+}
+
+bool SyncTrace::isEnabled() const
+{
+    return m_enabled;
+}
+
+void SyncTrace::setCapacity(int capacity)
+{
+    m_events = QVector<SyncTraceEvent>(capacity > 0 ? capacity : SYNC_TRACE_CAPACITY);
+    m_next = 0;
+    m_count = 0;
+}
+
+int SyncTrace::capacity() const
+{
+    return m_events.size();
+}
+
+void SyncTrace::begin(int accountId, const QString &source, const QString &name)
+{
+    if (!m_enabled || isOpen(accountId, source, name)) {
+        return;
+    }
+    m_open[accountId] << qMakePair(source, name);
+    append(SyncTraceEvent::Begin, accountId, source, name);
+}
+
+void SyncTrace::end(int accountId, const QString &source, const QString &name)
+{
+    if (!m_enabled || !m_open.contains(accountId)) {
+        return;
+    }
+
+    QList<QPair<QString, QString> > &open = m_open[accountId];
+    if (open.removeAll(qMakePair(source, name)) == 0) {
+        return;
+    }
+    if (open.isEmpty()) {
+        m_open.remove(accountId);
+    }
+    append(SyncTraceEvent::End, accountId, source, name);
+}
+
+void SyncTrace::instant(int accountId, const QString &source, const QString &name)
+{
+    if (m_enabled) {
+        append(SyncTraceEvent::Instant, accountId, source, name);
+    }
+}
+
+void SyncTrace::endAll(int accountId)
+{
+    const QList<QPair<QString, QString> > open = m_open.take(accountId);
+    // inner phases first
+    for(int i = open.size() - 1; i >= 0; i--) {
+        append(SyncTraceEvent::End, accountId, open[i].first, open[i].second);
+    }
+}
+
+bool SyncTrace::isOpen(int accountId, const QString &source, const QString &name) const
+{
+    return m_open.value(accountId).contains(qMakePair(source, name));
+}
+
+void SyncTrace::clear()
+{
+    m_events = QVector<SyncTraceEvent>(m_events.size());
+    m_next = 0;
+    m_count = 0;
+    m_open.clear();
+}
+
+int SyncTrace::count() const
+{
+    return m_count;
+}
+
+QList<SyncTraceEvent> SyncTrace::events() const
+{
+    QList<SyncTraceEvent> result;
+    const int first = (m_count < m_events.size()) ? 0 : m_next;
+    for(int i = 0; i < m_count; i++) {
+        result << m_events[(first + i) % m_events.size()];
+    }
+    return result;
+}
+
+// Async events are used since the phases of different accounts and
+// sources overlap, the id groups the events of a source.
+QByteArray SyncTrace::toJson() const
+{
+    static const char *types[] = { "b", "e", "n" };
+    const qint64 pid = QCoreApplication::applicationPid();
+
+    QJsonArray traceEvents;
+    Q_FOREACH(const SyncTraceEvent &event, events()) {
+        QJsonObject args;
+        args.insert("account", event.accountId);
+        if (!event.source.isEmpty()) {
+            args.insert("source", event.source);
+        }
+
+        QJsonObject object;
+        object.insert("name", event.name);
+        object.insert("cat", QStringLiteral(SYNC_TRACE_CATEGORY));
+        object.insert("ph", QString::fromLatin1(types[event.type]));
+        object.insert("ts", double(event.timestamp));
+        object.insert("pid", double(pid));
+        object.insert("tid", event.accountId);
+        object.insert("id", QString("%1/%2").arg(event.accountId).arg(event.source));
+        object.insert("args", args);
+        traceEvents << object;
+    }
+
+    QJsonObject root;
+    root.insert("traceEvents", traceEvents);
+    root.insert("displayTimeUnit", QStringLiteral("ms"));
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+void SyncTrace::append(SyncTraceEvent::Type type, int accountId, const QString &source, const QString &name)
+{
+    SyncTraceEvent &event = m_events[m_next];
+    event.type = type;
+    event.accountId = accountId;
+    event.source = source;
+    event.name = name;
+    event.timestamp = m_clock.nsecsElapsed() / 1000;
+
+    m_next = (m_next + 1) % m_events.size();
+    if (m_count < m_events.size()) {
+        m_count++;
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYNC_TRACE_H__
+#define __SYNC_TRACE_H__
+
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+class SyncTraceEvent
+{
+public:
+    enum Type {
+        Begin = 0,
+        End,
+        Instant
+    };
+
+    Type type;
+    int accountId;
+    QString source;
+    QString name;
+    qint64 timestamp;   // usecs since the trace started
+};
+
+// Begin/end spans of the sync phases, keyed by account, source and phase.
+// The last events are kept on a ring buffer and can be saved as Chrome
+// trace events (chrome://tracing). Set SYNC_MONITOR_TRACE=0 to disable it.
+class SyncTrace
+{
+public:
+    SyncTrace(int capacity = -1);
+
+    static SyncTrace *instance();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+    void setCapacity(int capacity);
+    int capacity() const;
+
+    // a phase already open for the same account and source is not restarted
+    void begin(int accountId, const QString &source, const QString &name);
+    // ends without a matching begin are ignored
+    void end(int accountId, const QString &source, const QString &name);
+    void instant(int accountId, const QString &source, const QString &name);
+    // ends all open phases of the account, used when the sync stops halfway
+    void endAll(int accountId);
+    bool isOpen(int accountId, const QString &source, const QString &name) const;
+    void clear();
+
+    int count() const;
+    // oldest events first
+    QList<SyncTraceEvent> events() const;
+    QByteArray toJson() const;
+
+private:
+    static SyncTrace *m_instance;
+    QVector<SyncTraceEvent> m_events;
+    int m_next;
+    int m_count;
+    bool m_enabled;
+    QElapsedTimer m_clock;
+    // open phases by account
+    QHash<int, QList<QPair<QString, QString> > > m_open;
+
+    void append(SyncTraceEvent::Type type, int accountId, const QString &source, const QString &name);
+};
+
+#endif
@@ -20,29 +20,41 @@
 #include "syncevolution-session-proxy.h"
 
 #include <QtCore/QDebug>
-#include <QtDBus/QDBusReply>
+#include <QtCore/QProcess>
+#include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusMessage>
+#include <QtDBus/QDBusPendingCallWatcher>
 
 #define SYNCEVOLUTION_SERVICE_NAME          "org.syncevolution"
 #define SYNCEVOLUTION_OBJECT_PATH           "/org/syncevolution/Server"
 #define SYNCEVOLUTION_IFACE_NAME            "org.syncevolution.Server"
+#define SYNCEVOLUTION_IDLE_TIMEOUT          1000 * 60 * 5 // five minutes
 
 SyncEvolutionServerProxy *SyncEvolutionServerProxy::m_instance = 0;
+uint SyncEvolutionServerProxy::m_sessionCount = 0;
 
 SyncEvolutionServerProxy::SyncEvolutionServerProxy(QObject *parent)
     : QObject(parent)
 {
-    m_iface = new QDBusInterface(SYNCEVOLUTION_SERVICE_NAME,
-                                 SYNCEVOLUTION_OBJECT_PATH,
-                                 SYNCEVOLUTION_IFACE_NAME);
+    m_idleTimer.setSingleShot(true);
+    m_idleTimer.setInterval(SYNCEVOLUTION_IDLE_TIMEOUT);
+    connect(&m_idleTimer, SIGNAL(timeout()), SLOT(onIdleTimeout()));
 }
 
 SyncEvolutionServerProxy::~SyncEvolutionServerProxy()
 {
-    if (m_iface) {
-        m_iface->call("Detach");
-        delete m_iface;
-        m_iface = 0;
-    }
+    // no need to wait for the reply
+    asyncCall("Detach");
+}
+
+QDBusPendingCall SyncEvolutionServerProxy::asyncCall(const QString &method, const QVariantList &args) const
+{
+    QDBusMessage msg = QDBusMessage::createMethodCall(SYNCEVOLUTION_SERVICE_NAME,
+                                                      SYNCEVOLUTION_OBJECT_PATH,
+                                                      SYNCEVOLUTION_IFACE_NAME,
+                                                      method);
+    msg.setArguments(args);
+    return QDBusConnection::sessionBus().asyncCall(msg);
 }
 
 void SyncEvolutionServerProxy::killServer()
@@ -56,60 +68,77 @@ SyncEvolutionServerProxy *SyncEvolutionServerProxy::instance()
 {
     if (!m_instance) {
         m_instance = new SyncEvolutionServerProxy();
+    } else {
+        // in use again
+        m_instance->m_idleTimer.stop();
     }
     return m_instance;
 }
 
-void SyncEvolutionServerProxy::destroy()
+void SyncEvolutionServerProxy::release()
 {
     if (m_instance) {
-        delete m_instance;
+        m_instance->m_idleTimer.start();
+    }
+}
+
+uint SyncEvolutionServerProxy::sessionCount()
+{
+    return m_sessionCount;
+}
+
+void SyncEvolutionServerProxy::onIdleTimeout()
+{
+    // a canceled or long sync can still use its session
+    if (SyncEvolutionSessionProxy::m_count > 0) {
+        qDebug() << "SyncEvolution sessions still alive:" << SyncEvolutionSessionProxy::m_count;
+        m_idleTimer.start();
+        return;
+    }
+
+    qDebug() << "SyncEvolution server connection idle, detaching";
+    // we are running from our own timer, delete later
+    if (m_instance == this) {
         m_instance = 0;
     }
+    deleteLater();
 }
 
-SyncEvolutionSessionProxy* SyncEvolutionServerProxy::openSession(const QString &sessionName,
-                                                                 QStringList flags)
+QDBusPendingReply<QDBusObjectPath> SyncEvolutionServerProxy::openSession(const QString &sessionName,
+                                                                      QStringList flags)
 {
-    QDBusReply<QDBusObjectPath> reply;
     if (flags.isEmpty()) {
-        reply = m_iface->call("StartSession", sessionName);
+        return asyncCall("StartSession", QVariantList() << sessionName);
     } else {
-        reply = m_iface->call("StartSessionWithFlags", sessionName, flags);
-    }
-
-    if (m_iface->lastError().isValid()) {
-        qWarning() << "Fail to start session" << m_iface->lastError().message();
-        return 0;
+        return asyncCall("StartSessionWithFlags", QVariantList() << sessionName << flags);
     }
+}
 
-    return new SyncEvolutionSessionProxy(sessionName, reply.value(), this);
+SyncEvolutionSessionProxy *SyncEvolutionServerProxy::createSession(const QString &sessionName,
+                                                                   const QDBusObjectPath &objectPath)
+{
+    ++m_sessionCount;
+    // owned by the caller, released with SyncEvolutionSessionProxy::destroy()
+    return new SyncEvolutionSessionProxy(sessionName, objectPath);
 }
 
-QStringList SyncEvolutionServerProxy::configs(bool templates) const
+QDBusPendingReply<QStringList> SyncEvolutionServerProxy::configs(bool templates) const
 {
-    QDBusReply<QStringList> reply = m_iface->call("GetConfigs", templates);
-    return reply.value();
+    return asyncCall("GetConfigs", QVariantList() << templates);
 }
 
 void SyncEvolutionServerProxy::getDatabases(const QString &sourceName)
 {
-    QDBusPendingCall pcall =  m_iface->asyncCall("GetDatabases", sourceName);
+    QDBusPendingCall pcall = asyncCall("GetDatabases", QVariantList() << sourceName);
     QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pcall, this);
 
     QObject::connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
                      this, SLOT(getDatabasesFinished(QDBusPendingCallWatcher*)));
 }
 
-QArrayOfStringMap SyncEvolutionServerProxy::reports(const QString &sessionName, uint start, uint count)
+QDBusPendingReply<QArrayOfStringMap> SyncEvolutionServerProxy::reports(const QString &sessionName, uint start, uint count)
 {
-    QDBusReply<QArrayOfStringMap> reply = m_iface->call("GetReports", sessionName, start, count);
-    if (reply.error().isValid()) {
-        qWarning() << "Fail to get sync reports" << reply.error().message();
-        return QArrayOfStringMap();
-    } else {
-        return reply.value();
-    }
+    return asyncCall("GetReports", QVariantList() << sessionName << start << count);
 }
 
 void SyncEvolutionServerProxy::getDatabasesFinished(QDBusPendingCallWatcher *call)
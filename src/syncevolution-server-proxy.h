@@ -24,8 +24,10 @@
 #include <QtCore/QObject>
 #include <QtCore/QStringList>
 #include <QtCore/QHash>
+#include <QtCore/QTimer>
 
-#include <QtDBus/QDBusInterface>
+#include <QtDBus/QDBusObjectPath>
+#include <QtDBus/QDBusPendingReply>
 
 class SyncEvolutionSessionProxy;
 
@@ -34,27 +36,35 @@ class SyncEvolutionServerProxy : public QObject
     Q_OBJECT
 public:
     static SyncEvolutionServerProxy *instance();
-    static void destroy();
+    // keep the connection for a while in case a new sync starts soon
+    static void release();
+    // number of sessions opened since the daemon started
+    static uint sessionCount();
 
-    SyncEvolutionSessionProxy *openSession(const QString &sessionName, QStringList flags);
-    QStringList configs(bool templates=false) const;
+    // replies with the session path, use createSession() to access it
+    QDBusPendingReply<QDBusObjectPath> openSession(const QString &sessionName, QStringList flags);
+    SyncEvolutionSessionProxy *createSession(const QString &sessionName, const QDBusObjectPath &objectPath);
+    QDBusPendingReply<QStringList> configs(bool templates=false) const;
     void getDatabases(const QString &sourceName);
-    QArrayOfStringMap reports(const QString &sessionName, uint start, uint count);
+    QDBusPendingReply<QArrayOfStringMap> reports(const QString &sessionName, uint start, uint count);
 
 Q_SIGNALS:
     void databasesReceived(const QArrayOfDatabases &databases);
 
 private Q_SLOTS:
     void getDatabasesFinished(QDBusPendingCallWatcher *call);
+    void onIdleTimeout();
 
 private:
     static SyncEvolutionServerProxy *m_instance;
-    QDBusInterface *m_iface;
+    static uint m_sessionCount;
+    QTimer m_idleTimer;
 
     SyncEvolutionServerProxy(QObject *parent = 0);
     ~SyncEvolutionServerProxy();
 
     static void killServer();
+    QDBusPendingCall asyncCall(const QString &method, const QVariantList &args = QVariantList()) const;
 };
 
 #endif
@@ -20,7 +20,9 @@
 #include "dbustypes.h"
 
 #include <QtCore/QDebug>
-#include <QtDBus/QDBusReply>
+#include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusMessage>
+#include <QtDBus/QDBusPendingCallWatcher>
 
 #define SYNCEVOLUTION_SERVICE_NAME          "org.syncevolution"
 #define SYNCEVOLUTIOON_SESSION_IFACE_NAME   "org.syncevolution.Session"
@@ -31,26 +33,25 @@ SyncEvolutionSessionProxy::SyncEvolutionSessionProxy(const QString &sessionName,
                                                      const QDBusObjectPath &objectPath,
                                                      QObject *parent)
     : QObject(parent),
-      m_sessionName(sessionName)
+      m_sessionName(sessionName),
+      m_path(objectPath.path())
 {
     ++m_count;
-    m_iface = new QDBusInterface(SYNCEVOLUTION_SERVICE_NAME,
-                                 objectPath.path(),
-                                 SYNCEVOLUTIOON_SESSION_IFACE_NAME);
 
-    m_iface->connection().connect(SYNCEVOLUTION_SERVICE_NAME,
-                                  objectPath.path(),
-                                  SYNCEVOLUTIOON_SESSION_IFACE_NAME,
-                                  "StatusChanged",
-                                  this,
-                                  SIGNAL(statusChanged(QString,uint,QSyncStatusMap)));
+    // plain messages, a QDBusInterface would introspect the session synchronously
+    QDBusConnection::sessionBus().connect(SYNCEVOLUTION_SERVICE_NAME,
+                                          m_path,
+                                          SYNCEVOLUTIOON_SESSION_IFACE_NAME,
+                                          "StatusChanged",
+                                          this,
+                                          SIGNAL(statusChanged(QString,uint,QSyncStatusMap)));
 
-    m_iface->connection().connect(SYNCEVOLUTION_SERVICE_NAME,
-                                  objectPath.path(),
-                                  SYNCEVOLUTIOON_SESSION_IFACE_NAME,
-                                  "ProgressChanged",
-                                  this,
-                                  SLOT(onSessionProgressChanged(int, QSyncProgressMap)));
+    QDBusConnection::sessionBus().connect(SYNCEVOLUTION_SERVICE_NAME,
+                                          m_path,
+                                          SYNCEVOLUTIOON_SESSION_IFACE_NAME,
+                                          "ProgressChanged",
+                                          this,
+                                          SLOT(onSessionProgressChanged(int, QSyncProgressMap)));
 }
 
 SyncEvolutionSessionProxy::~SyncEvolutionSessionProxy()
@@ -58,6 +59,16 @@ SyncEvolutionSessionProxy::~SyncEvolutionSessionProxy()
     --m_count;
 }
 
+QDBusPendingCall SyncEvolutionSessionProxy::asyncCall(const QString &method, const QVariantList &args) const
+{
+    QDBusMessage msg = QDBusMessage::createMethodCall(SYNCEVOLUTION_SERVICE_NAME,
+                                                      m_path,
+                                                      SYNCEVOLUTIOON_SESSION_IFACE_NAME,
+                                                      method);
+    msg.setArguments(args);
+    return QDBusConnection::sessionBus().asyncCall(msg);
+}
+
 QString SyncEvolutionSessionProxy::sessionName() const
 {
     return m_sessionName;
@@ -66,149 +77,106 @@ QString SyncEvolutionSessionProxy::sessionName() const
 QString SyncEvolutionSessionProxy::id() const
 {
     Q_ASSERT(isValid());
-    return m_iface->path();
+    return m_path;
 }
 
 void SyncEvolutionSessionProxy::destroy()
 {
-    // abort any operation
-    m_iface->call("Abort");
-
-    // notify server to close the session
-    m_iface->call("Detach");
-
-    // delete interface
-    m_iface->deleteLater();
-
-    m_iface = 0;
+    if (isValid()) {
+        QDBusConnection::sessionBus().disconnect(SYNCEVOLUTION_SERVICE_NAME,
+                                                 m_path,
+                                                 SYNCEVOLUTIOON_SESSION_IFACE_NAME,
+                                                 "StatusChanged",
+                                                 this,
+                                                 SIGNAL(statusChanged(QString,uint,QSyncStatusMap)));
+        QDBusConnection::sessionBus().disconnect(SYNCEVOLUTION_SERVICE_NAME,
+                                                 m_path,
+                                                 SYNCEVOLUTIOON_SESSION_IFACE_NAME,
+                                                 "ProgressChanged",
+                                                 this,
+                                                 SLOT(onSessionProgressChanged(int, QSyncProgressMap)));
+
+        // abort any operation and notify server to close the session,
+        // the messages are sent in order; no need to wait for the replies
+        asyncCall("Abort");
+        detach();
+        m_path.clear();
+    }
 
     // self destroy
     deleteLater();
 }
 
-QString SyncEvolutionSessionProxy::status() const
+void SyncEvolutionSessionProxy::detach()
 {
     Q_ASSERT(isValid());
-    QDBusReply<QString> reply = m_iface->call("GetStatus");
-    if (reply.error().isValid()) {
-        qWarning() << "Fail to get session status" << reply.error().message();
-        return QString();
-    } else {
-        return reply.value();
-    }
+    asyncCall("Detach");
 }
 
-bool SyncEvolutionSessionProxy::hasConfig(const QString &configName)
+QDBusPendingReply<QString> SyncEvolutionSessionProxy::status() const
 {
     Q_ASSERT(isValid());
-    QDBusReply<QStringMultiMap> reply = m_iface->call("GetNamedConfig", configName, false);
-    if (reply.error().isValid()) {
-        return false;
-    }
-    return (reply.value().size() > 0);
+    return asyncCall("GetStatus");
 }
 
-QStringMultiMap SyncEvolutionSessionProxy::getConfig(const QString &configName,
-                                                     bool isTemplate)
+QDBusPendingReply<QStringMultiMap> SyncEvolutionSessionProxy::getConfig(const QString &configName,
+                                                                       bool isTemplate)
 {
     Q_ASSERT(isValid());
-    QDBusReply<QStringMultiMap> reply;
-
     if (configName.isEmpty()) {
-        reply = m_iface->call("GetConfig",
-                              isTemplate);
+        return asyncCall("GetConfig", QVariantList() << isTemplate);
     } else {
-        reply = m_iface->call("GetNamedConfig",
-                              configName,
-                              isTemplate);
+        return asyncCall("GetNamedConfig", QVariantList() << configName << isTemplate);
     }
-    if (reply.error().isValid()) {
-        qWarning() << "Fail to get session named config" << reply.error().message();
-        return QStringMultiMap();
-    }
-
-    return reply.value();
 }
 
-bool SyncEvolutionSessionProxy::saveConfig(const QString &configName,
-                                           QStringMultiMap config,
-                                           bool temporary,
-                                           bool update)
+QDBusPendingReply<> SyncEvolutionSessionProxy::saveConfig(const QString &configName,
+                                                          QStringMultiMap config,
+                                                          bool temporary,
+                                                          bool update)
 {
     Q_ASSERT(isValid());
-    QDBusReply<void> reply;
     if (configName.isEmpty()) {
-        reply = m_iface->call("SetConfig",
-                              update,
-                              temporary,
-                              QVariant::fromValue(config));
+        return asyncCall("SetConfig",
+                         QVariantList() << update
+                                        << temporary
+                                        << QVariant::fromValue(config));
     } else {
-        reply = m_iface->call("SetNamedConfig",
-                              configName,
-                              update,
-                              temporary,
-                              QVariant::fromValue(config));
-    }
-    if (reply.error().isValid()) {
-        qWarning() << "Fail to save named config" << reply.error().message();
-        return false;
+        return asyncCall("SetNamedConfig",
+                         QVariantList() << configName
+                                        << update
+                                        << temporary
+                                        << QVariant::fromValue(config));
     }
-    return true;
 }
 
 bool SyncEvolutionSessionProxy::isValid() const
 {
-    return (m_iface != 0);
+    return !m_path.isEmpty();
 }
 
-void SyncEvolutionSessionProxy::sync(const QString &mode, QStringMap services)
+QDBusPendingReply<> SyncEvolutionSessionProxy::sync(const QString &mode, QStringMap services)
 {
     Q_ASSERT(isValid());
-    QDBusReply<void> reply = m_iface->call("Sync", mode, QVariant::fromValue(services));
-    if (reply.error().isValid()) {
-        qWarning() << "Fail to sync account" << reply.error().message();
-    }
+    return asyncCall("Sync", QVariantList() << mode << QVariant::fromValue(services));
 }
 
-QArrayOfStringMap SyncEvolutionSessionProxy::reports(uint start, uint maxCount)
+QDBusPendingReply<QArrayOfStringMap> SyncEvolutionSessionProxy::reports(uint start, uint maxCount)
 {
-    QDBusReply<QArrayOfStringMap> reply = m_iface->call("GetReports", start, maxCount);
-    if (reply.error().isValid()) {
-        qWarning() << "Fail to get sync reports" << reply.error().message();
-        return QArrayOfStringMap();
-    } else {
-        return reply.value();
-    }
-}
-
-void SyncEvolutionSessionProxy::getDatabases(const QString &sourceName)
-{
-    QDBusPendingCall pcall =  m_iface->asyncCall("GetDatabases", sourceName);
-    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pcall, this);
-
-    QObject::connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
-                     this, SLOT(getDatabasesFinished(QDBusPendingCallWatcher*)));
+    Q_ASSERT(isValid());
+    return asyncCall("GetReports", QVariantList() << start << maxCount);
 }
 
-void SyncEvolutionSessionProxy::getDatabasesFinished(QDBusPendingCallWatcher *call)
+QDBusPendingReply<QArrayOfDatabases> SyncEvolutionSessionProxy::getDatabases(const QString &sourceName)
 {
-    QDBusPendingReply<QArrayOfDatabases> reply = *call;
-    call->deleteLater();
-
-    if (reply.isError()) {
-        qWarning() << "Fail to fetch databases" << reply.error().message();
-        Q_EMIT databasesReceived(QArrayOfDatabases());
-    } else {
-         Q_EMIT databasesReceived(reply.value());
-    }
+    Q_ASSERT(isValid());
+    return asyncCall("GetDatabases", QVariantList() << sourceName);
 }
 
-void SyncEvolutionSessionProxy::execute(const QStringList &args)
+QDBusPendingReply<> SyncEvolutionSessionProxy::execute(const QStringList &args)
 {
-    QDBusReply<void> reply = m_iface->call("Execute", args);
-    if (reply.error().isValid()) {
-        qWarning() << "Fail to execute command" << reply.error().message();
-    }
+    Q_ASSERT(isValid());
+    return asyncCall("Execute", QVariantList() << args);
 }
 
 void SyncEvolutionSessionProxy::onSessionProgressChanged(int progress, QSyncProgressMap sources)
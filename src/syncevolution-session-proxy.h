@@ -1,4 +1,3 @@
-#ifndef __SYNCEVOLUTION_SESSION_PROXY_H__
 /*
  * Copyright 2014 Canonical Ltd.
  *
@@ -17,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef __SYNCEVOLUTION_SESSION_PROXY_H__
 #define __SYNCEVOLUTION_SESSION_PROXY_H__
 
 #include "dbustypes.h"
@@ -25,8 +25,10 @@
 #include <QtCore/QStringList>
 #include <QtCore/QHash>
 
-#include <QtDBus/QDBusInterface>
+#include <QtDBus/QDBusObjectPath>
+#include <QtDBus/QDBusPendingReply>
 
+// All calls are asynchronous, wait for the replies with a QDBusPendingCallWatcher
 class SyncEvolutionSessionProxy : public QObject
 {
     Q_OBJECT
@@ -34,34 +36,33 @@ public:
     QString sessionName() const;
     QString id() const;
     void destroy();
-    QString status() const;
-    bool hasConfig(const QString &configName);
-    QStringMultiMap getConfig(const QString &configName, bool isTemplate);
-    bool saveConfig(const QString &configName, QStringMultiMap config, bool temporary = false, bool update = false);
+    QDBusPendingReply<QString> status() const;
+    QDBusPendingReply<QStringMultiMap> getConfig(const QString &configName, bool isTemplate);
+    QDBusPendingReply<> saveConfig(const QString &configName, QStringMultiMap config, bool temporary = false, bool update = false);
     void detach();
     bool isValid() const;
-    void sync(const QString &mode, QStringMap services);
-    QArrayOfStringMap reports(uint start, uint maxCount);
-    void getDatabases(const QString &sourceName);
-    void execute(const QStringList &args);
+    QDBusPendingReply<> sync(const QString &mode, QStringMap services);
+    QDBusPendingReply<QArrayOfStringMap> reports(uint start, uint maxCount);
+    QDBusPendingReply<QArrayOfDatabases> getDatabases(const QString &sourceName);
+    QDBusPendingReply<> execute(const QStringList &args);
 
 Q_SIGNALS:
     void statusChanged(const QString &status, uint errorNuber, QSyncStatusMap source);
     void progressChanged(int progress);
-    void databasesReceived(const QArrayOfDatabases &databases);
 
 private Q_SLOTS:
     void onSessionProgressChanged(int progress, QSyncProgressMap sources);
-    void getDatabasesFinished(QDBusPendingCallWatcher *call);
 
 private:
     QString m_sessionName;
-    QDBusInterface *m_iface;
+    QString m_path;
     static uint m_count;
 
     SyncEvolutionSessionProxy(const QString &sessionName, const QDBusObjectPath &objectPath, QObject *parent=0);
     ~SyncEvolutionSessionProxy();
 
+    QDBusPendingCall asyncCall(const QString &method, const QVariantList &args = QVariantList()) const;
+
     friend class SyncEvolutionServerProxy;
 };
 
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/caldav-change-check.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QNetworkAccessManager>
+#include <QNetworkProxy>
+#include <QRegularExpression>
+
+// Minimal CalDAV server, answers each collection with its multistatus
+// response; collections without response never reply
+class FakeCalDavServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    QMap<QString, QByteArray> responses;
+    QList<QByteArray> requests;
+
+    void setCollection(const QString &path, int status, const QByteArray &body)
+    {
+        QByteArray response;
+        response += QString("HTTP/1.1 %1 %2\r\n").arg(status).arg(status == 207 ? "Multi-Status" : "Status").toUtf8();
+        response += "Content-Type: application/xml; charset=utf-8\r\n";
+        response += QString("Content-Length: %1\r\n").arg(body.size()).toUtf8();
+        response += "Connection: close\r\n";
+        response += "\r\n";
+        response += body;
+        responses.insert(path, response);
+    }
+
+    void setRedirect(const QString &path, const QString &location)
+    {
+        QByteArray response;
+        response += "HTTP/1.1 301 Moved Permanently\r\n";
+        response += QString("Location: %1\r\n").arg(location).toUtf8();
+        response += "Content-Length: 0\r\n";
+        response += "Connection: close\r\n";
+        response += "\r\n";
+        responses.insert(path, response);
+    }
+
+    QString url(const QString &path) const
+    {
+        return QString("http://127.0.0.1:%1%2").arg(serverPort()).arg(path);
+    }
+
+protected:
+    void incomingConnection(qintptr handle)
+    {
+        QTcpSocket *socket = new QTcpSocket(this);
+        socket->setSocketDescriptor(handle);
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+            QByteArray buffer = socket->property("buffer").toByteArray() + socket->readAll();
+            socket->setProperty("buffer", buffer);
+            const int headerEnd = buffer.indexOf("\r\n\r\n");
+            if (headerEnd < 0) {
+                return;
+            }
+
+            // wait for the propfind body
+            QRegularExpression lengthExp("Content-Length: *(\\d+)", QRegularExpression::CaseInsensitiveOption);
+            QRegularExpressionMatch match = lengthExp.match(QString::fromUtf8(buffer.left(headerEnd)));
+            const int length = match.hasMatch() ? match.captured(1).toInt() : 0;
+            if (buffer.size() < (headerEnd + 4 + length)) {
+                return;
+            }
+
+            requests << buffer;
+            const QString path = QString::fromUtf8(buffer.split(' ').value(1));
+            if (responses.contains(path)) {
+                socket->write(responses.value(path));
+                socket->disconnectFromHost();
+            }
+        });
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    }
+};
+
+class CalDavChangeCheckTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    FakeCalDavServer *m_server;
+    QNetworkAccessManager *m_manager;
+
+    static QByteArray multistatus(const QString &href, const QString &ctag, const QString &syncToken)
+    {
+        QString props;
+        QString missing;
+        if (ctag.isEmpty()) {
+            missing += "<cs:getctag/>";
+        } else {
+            props += QString("<cs:getctag>%1</cs:getctag>").arg(ctag);
+        }
+        if (syncToken.isEmpty()) {
+            missing += "<d:sync-token/>";
+        } else {
+            props += QString("<d:sync-token>%1</d:sync-token>").arg(syncToken);
+        }
+
+        QString body("<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+                     "<d:multistatus xmlns:d=\"DAV:\" xmlns:cs=\"http://calendarserver.org/ns/\">"
+                     "<d:response><d:href>" + href + "</d:href>");
+        if (!props.isEmpty()) {
+            body += "<d:propstat><d:prop>" + props + "</d:prop>"
+                    "<d:status>HTTP/1.1 200 OK</d:status></d:propstat>";
+        }
+        if (!missing.isEmpty()) {
+            body += "<d:propstat><d:prop>" + missing + "</d:prop>"
+                    "<d:status>HTTP/1.1 404 Not Found</d:status></d:propstat>";
+        }
+        body += "</d:response></d:multistatus>";
+        return body.toUtf8();
+    }
+
+    QByteArray request(const QString &path) const
+    {
+        Q_FOREACH(const QByteArray &req, m_server->requests) {
+            if (QString::fromUtf8(req.split(' ').value(1)) == path) {
+                return req;
+            }
+        }
+        return QByteArray();
+    }
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        qRegisterMetaType<QMap<QString, QString> >();
+    }
+
+    void init()
+    {
+        m_server = new FakeCalDavServer;
+        QVERIFY(m_server->listen(QHostAddress::LocalHost));
+        m_manager = new QNetworkAccessManager;
+        m_manager->setProxy(QNetworkProxy::NoProxy);
+    }
+
+    void cleanup()
+    {
+        delete m_manager;
+        delete m_server;
+    }
+
+    void testParseToken_data()
+    {
+        QTest::addColumn<QByteArray>("data");
+        QTest::addColumn<QString>("token");
+
+        QTest::newRow("sync-token") << multistatus("/cal/", "", "http://server/ns/sync/12") << "http://server/ns/sync/12";
+        QTest::newRow("ctag") << multistatus("/cal/", "ctag-3", "") << "ctag-3";
+        QTest::newRow("prefer sync-token") << multistatus("/cal/", "ctag-3", "token-4") << "token-4";
+        QTest::newRow("not supported") << multistatus("/cal/", "", "") << "";
+        QTest::newRow("invalid") << QByteArray("<d:multistatus xmlns:d=\"DAV:\"><d:sync-token>1") << "";
+    }
+
+    void testParseToken()
+    {
+        QFETCH(QByteArray, data);
+        QFETCH(QString, token);
+
+        QCOMPARE(CalDavChangeCheck::parseToken(data), token);
+    }
+
+    void testCheckCollections()
+    {
+        m_server->setCollection("/calendars/work/", 207, multistatus("/calendars/work/", "", "token-1"));
+        m_server->setCollection("/calendars/home/", 207, multistatus("/calendars/home/", "ctag-7", ""));
+        m_server->setCollection("/calendars/old/", 404, QByteArray());
+        m_server->setCollection("/calendars/plain/", 207, multistatus("/calendars/plain/", "", ""));
+
+        QMap<QString, QUrl> collections;
+        collections.insert("work", QUrl(m_server->url("/calendars/work/?SyncEvolution=Google")));
+        collections.insert("home", QUrl(m_server->url("/calendars/home/")));
+        collections.insert("old", QUrl(m_server->url("/calendars/old/")));
+        collections.insert("plain", QUrl(m_server->url("/calendars/plain/")));
+
+        CalDavChangeCheck check(m_manager);
+        check.setToken("secret-token");
+        QSignalSpy finished(&check, SIGNAL(finished(QMap<QString,QString>)));
+        check.check(collections);
+        QVERIFY(check.isChecking());
+        QTRY_COMPARE(finished.count(), 1);
+        QVERIFY(!check.isChecking());
+
+        // collections failed or without token always sync
+        QMap<QString, QString> tokens = finished.at(0).at(0).value<QMap<QString, QString> >();
+        QCOMPARE(tokens.size(), 2);
+        QCOMPARE(tokens.value("work"), QStringLiteral("token-1"));
+        QCOMPARE(tokens.value("home"), QStringLiteral("ctag-7"));
+
+        // one request for each collection, without the syncevolution hints
+        QCOMPARE(m_server->requests.size(), 4);
+        const QByteArray req = request("/calendars/work/");
+        QVERIFY(req.startsWith("PROPFIND "));
+        QVERIFY(req.contains("Depth: 0"));
+        QVERIFY(req.contains("Authorization: Bearer secret-token"));
+        QVERIFY(req.contains("getctag"));
+        QVERIFY(req.contains("sync-token"));
+    }
+
+    void testCredentials()
+    {
+        m_server->setCollection("/dav/personal/", 207, multistatus("/dav/personal/", "ctag-1", ""));
+
+        QMap<QString, QUrl> collections;
+        collections.insert("personal", QUrl(m_server->url("/dav/personal/")));
+
+        CalDavChangeCheck check(m_manager);
+        check.setCredentials("user", "password");
+        QSignalSpy finished(&check, SIGNAL(finished(QMap<QString,QString>)));
+        check.check(collections);
+        QTRY_COMPARE(finished.count(), 1);
+
+        QCOMPARE(m_server->requests.size(), 1);
+        QVERIFY(m_server->requests.at(0).contains("Authorization: Basic " + QByteArray("user:password").toBase64()));
+    }
+
+    void testRedirectNotFollowed()
+    {
+        m_server->setRedirect("/calendars/old/", m_server->url("/calendars/new/"));
+        m_server->setCollection("/calendars/new/", 207, multistatus("/calendars/new/", "", "token-3"));
+
+        QMap<QString, QUrl> collections;
+        collections.insert("moved", QUrl(m_server->url("/calendars/old/")));
+
+        CalDavChangeCheck check(m_manager);
+        check.setCredentials("user", "password");
+        QSignalSpy finished(&check, SIGNAL(finished(QMap<QString,QString>)));
+        check.check(collections);
+        QTRY_COMPARE(finished.count(), 1);
+
+        // the credentials are not sent to the new location, the collection syncs
+        QVERIFY(finished.at(0).at(0).value<QMap<QString, QString> >().isEmpty());
+        QTest::qWait(100);
+        QCOMPARE(m_server->requests.size(), 1);
+        QVERIFY(request("/calendars/new/").isEmpty());
+    }
+
+    void testTimeout()
+    {
+        m_server->setCollection("/calendars/fast/", 207, multistatus("/calendars/fast/", "", "token-2"));
+
+        QMap<QString, QUrl> collections;
+        collections.insert("fast", QUrl(m_server->url("/calendars/fast/")));
+        collections.insert("slow", QUrl(m_server->url("/calendars/slow/")));
+
+        CalDavChangeCheck check(m_manager);
+        check.setTimeout(500);
+        QSignalSpy finished(&check, SIGNAL(finished(QMap<QString,QString>)));
+        check.check(collections);
+        QTRY_COMPARE(finished.count(), 1);
+
+        // the collection without answer syncs as usual
+        QMap<QString, QString> tokens = finished.at(0).at(0).value<QMap<QString, QString> >();
+        QCOMPARE(tokens.size(), 1);
+        QCOMPARE(tokens.value("fast"), QStringLiteral("token-2"));
+        QVERIFY(!check.isChecking());
+    }
+
+    void testNoCollections()
+    {
+        CalDavChangeCheck check(m_manager);
+        QSignalSpy finished(&check, SIGNAL(finished(QMap<QString,QString>)));
+        check.check(QMap<QString, QUrl>());
+        QTRY_COMPARE(finished.count(), 1);
+        QVERIFY(finished.at(0).at(0).value<QMap<QString, QString> >().isEmpty());
+        QCOMPARE(m_server->requests.size(), 0);
+    }
+};
+
+QTEST_MAIN(CalDavChangeCheckTest)
+
+#include "caldav-change-check-test.moc"
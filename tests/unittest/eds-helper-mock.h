@@ -49,7 +49,7 @@ public:
     { m_trackedItem = item; }
 
     virtual QString getCollectionIdFromItemId(const QtOrganizer::QOrganizerItemId&) const
-    { return m_trackedItem->collectionId().toString(); }
+    { return sourceFromCollectionId(m_trackedItem->collectionId()); }
 
 private:
     QtOrganizer::QOrganizerItem *m_trackedItem;
@@ -54,7 +54,40 @@ private Q_SLOTS:
 
         QTRY_COMPARE(spy.count(), 1);
         QList<QVariant> args = spy.takeFirst();
-        QCOMPARE(args[0].toString(), ev.collectionId().toString());
+        QCOMPARE(args[0].toString(), mock.sourceFromCollectionId(ev.collectionId()));
+    }
+
+    void testSetEnabled()
+    {
+        EdsHelperMock mock;
+        QTRY_VERIFY(mock.isIndexReady());
+        QSignalSpy spy(&mock, SIGNAL(dataChanged(QString)));
+
+        // enabling again does not duplicate the notifications
+        mock.setEnabled(true);
+        QOrganizerEvent ev;
+        ev.setDisplayLabel("enabled twice");
+        ev.setStartDateTime(QDateTime::currentDateTime());
+        mock.trackCollectionFromItem(&ev);
+        mock.organizerEngine()->saveItem(&ev);
+        QTRY_COMPARE(spy.count(), 1);
+        QTest::qWait(100);
+        QCOMPARE(spy.count(), 1);
+
+        // disabled: no item notifications, but the index still follows the collections
+        mock.setEnabled(false);
+        spy.clear();
+        ev.setDisplayLabel("disabled");
+        mock.organizerEngine()->saveItem(&ev);
+
+        QOrganizerCollection collection;
+        collection.setMetaData(QOrganizerCollection::KeyName, "Disabled");
+        collection.setExtendedMetaData("collection-account-id", 9);
+        collection.setExtendedMetaData("collection-metadata", "disabled@example.com");
+        QVERIFY(mock.organizerEngine()->saveCollection(&collection));
+        QTRY_COMPARE(mock.sourceByRemoteId("disabled@example.com", 9).id,
+                     mock.sourceFromCollectionId(collection.id()));
+        QCOMPARE(spy.count(), 0);
     }
 
     void testFreezeNotify()
@@ -79,7 +112,226 @@ private Q_SLOTS:
         QTRY_COMPARE(spy.count(), 1);
 
         QList<QVariant> args = spy.takeFirst();
-        QCOMPARE(args[0].toString(), ev.collectionId().toString());
+        QCOMPARE(args[0].toString(), mock.sourceFromCollectionId(ev.collectionId()));
+    }
+
+    void testSyncWritesAreNotNotified()
+    {
+        EdsHelperMock mock;
+        QSignalSpy spy(&mock, SIGNAL(dataChanged(QString)));
+        const QString sourceId = mock.createSource("Work", "#ff0000", "work@example.com", true, 5);
+
+        QOrganizerEvent ev;
+        ev.setDisplayLabel("written by sync");
+        ev.setStartDateTime(QDateTime::currentDateTime());
+        ev.setCollectionId(mock.sourceToCollectionId(sourceId));
+        mock.trackCollectionFromItem(&ev);
+
+        mock.beginSync(5);
+        QVERIFY(mock.isSyncing(5));
+        mock.organizerEngine()->saveItem(&ev);
+        mock.endSync(5);
+
+        // late notification of the same item and the sync report
+        mock.organizerEngine()->saveItem(&ev);
+        mock.addSyncWrites(5, "work@example.com", 1);
+        QTRY_VERIFY(!mock.isSyncing(5));
+
+        QTest::qWait(500);
+        QCOMPARE(spy.count(), 0);
+
+        // other items are user changes
+        QOrganizerEvent userEv;
+        userEv.setDisplayLabel("user change");
+        userEv.setStartDateTime(QDateTime::currentDateTime());
+        userEv.setCollectionId(mock.sourceToCollectionId(sourceId));
+        mock.trackCollectionFromItem(&userEv);
+        mock.organizerEngine()->saveItem(&userEv);
+
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.takeFirst().at(0).toString(), sourceId);
+    }
+
+    void testUserChangesDuringSyncAreKept()
+    {
+        EdsHelperMock mock;
+        QSignalSpy spy(&mock, SIGNAL(dataChanged(QString)));
+        const QString syncingSource = mock.createSource("Work", "#ff0000", "work@example.com", true, 5);
+        const QString otherSource = mock.createSource("Home", "#00ff00", "home@example.com", true, 6);
+
+        mock.freezeNotify();
+        mock.beginSync(5);
+
+        QOrganizerEvent syncEv;
+        syncEv.setDisplayLabel("written by sync");
+        syncEv.setStartDateTime(QDateTime::currentDateTime());
+        syncEv.setCollectionId(mock.sourceToCollectionId(syncingSource));
+        mock.trackCollectionFromItem(&syncEv);
+        mock.organizerEngine()->saveItem(&syncEv);
+        QTest::qWait(100);
+
+        QOrganizerEvent userEv;
+        userEv.setDisplayLabel("user change");
+        userEv.setStartDateTime(QDateTime::currentDateTime());
+        userEv.setCollectionId(mock.sourceToCollectionId(otherSource));
+        mock.trackCollectionFromItem(&userEv);
+        mock.organizerEngine()->saveItem(&userEv);
+        QTest::qWait(100);
+        QCOMPARE(spy.count(), 0);
+
+        // the change is notified as soon as the sync finishes
+        mock.endSync(5);
+        mock.unfreezeNotify();
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.takeFirst().at(0).toString(), otherSource);
+    }
+
+    void testUserChangesOnSyncingSource()
+    {
+        EdsHelperMock mock;
+        QSignalSpy spy(&mock, SIGNAL(dataChanged(QString)));
+        const QString sourceId = mock.createSource("Work", "#ff0000", "work@example.com", true, 5);
+
+        mock.beginSync(5);
+
+        QOrganizerEvent syncEv;
+        syncEv.setDisplayLabel("written by sync");
+        syncEv.setStartDateTime(QDateTime::currentDateTime());
+        syncEv.setCollectionId(mock.sourceToCollectionId(sourceId));
+        mock.trackCollectionFromItem(&syncEv);
+        mock.organizerEngine()->saveItem(&syncEv);
+
+        QOrganizerEvent userEv;
+        userEv.setDisplayLabel("user change");
+        userEv.setStartDateTime(QDateTime::currentDateTime());
+        userEv.setCollectionId(mock.sourceToCollectionId(sourceId));
+        mock.trackCollectionFromItem(&userEv);
+        mock.organizerEngine()->saveItem(&userEv);
+        QTest::qWait(100);
+        QCOMPARE(spy.count(), 0);
+
+        // the sync wrote a single item, the other change is from the user
+        mock.addSyncWrites(5, "work@example.com", 1);
+        mock.endSync(5);
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.takeFirst().at(0).toString(), sourceId);
+        QVERIFY(!mock.isSyncing(5));
+    }
+
+    void testSyncChangesInvalidateToken()
+    {
+        EdsHelperMock mock;
+        QSignalSpy spy(&mock, SIGNAL(dataChanged(QString)));
+        QSignalSpy bySync(&mock, SIGNAL(sourceChangedBySync(uint,QString)));
+        const QString sourceId = mock.createSource("Work", "#ff0000", "work@example.com", true, 5);
+        mock.createSource("Home", "#00ff00", "home@example.com", true, 5);
+        QVERIFY(mock.isEnabled());
+
+        mock.beginSync(5);
+        QOrganizerEvent ev;
+        ev.setDisplayLabel("written by sync");
+        ev.setStartDateTime(QDateTime::currentDateTime());
+        ev.setCollectionId(mock.sourceToCollectionId(sourceId));
+        mock.trackCollectionFromItem(&ev);
+        mock.organizerEngine()->saveItem(&ev);
+        mock.addSyncWrites(5, "work@example.com", 1);
+        mock.endSync(5);
+
+        // only the calendar changed during the sync is reported
+        QTRY_COMPARE(bySync.count(), 1);
+        QCOMPARE(bySync.at(0).at(0).toUInt(), 5u);
+        QCOMPARE(bySync.at(0).at(1).toString(), QStringLiteral("work@example.com"));
+        QCOMPARE(spy.count(), 0);
+    }
+
+    void testEditAfterCanceledSync()
+    {
+        EdsHelperMock mock;
+        QSignalSpy spy(&mock, SIGNAL(dataChanged(QString)));
+        const QString sourceId = mock.createSource("Work", "#ff0000", "work@example.com", true, 5);
+
+        // canceled before any report
+        mock.beginSync(5);
+        mock.endSync(5);
+        QTRY_VERIFY(!mock.isSyncing(5));
+
+        QOrganizerEvent ev;
+        ev.setDisplayLabel("user change");
+        ev.setStartDateTime(QDateTime::currentDateTime());
+        ev.setCollectionId(mock.sourceToCollectionId(sourceId));
+        mock.trackCollectionFromItem(&ev);
+        mock.organizerEngine()->saveItem(&ev);
+
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.takeFirst().at(0).toString(), sourceId);
+
+        // reports of the canceled sync are ignored
+        mock.addSyncWrites(5, "work@example.com", 1);
+        QVERIFY(!mock.isSyncing(5));
+    }
+
+    void testIndexPopulatedInBackground()
+    {
+        EdsHelperMock mock;
+        QSignalSpy spy(&mock, SIGNAL(indexReady()));
+        QTRY_COMPARE(spy.count(), 1);
+        QVERIFY(mock.isIndexReady());
+    }
+
+    void testSourceLookup()
+    {
+        EdsHelperMock mock;
+        const QString sourceId = mock.createSource("Work", "#ff0000", "work@example.com", true, 42);
+        QVERIFY(!sourceId.isEmpty());
+
+        EdsSource source = mock.sourceById(sourceId);
+        QCOMPARE(source.id, sourceId);
+        QCOMPARE(source.name, QStringLiteral("Work"));
+        QCOMPARE(source.account, 42u);
+        QCOMPARE(source.remoteId, QStringLiteral("work@example.com"));
+
+        QCOMPARE(mock.sourceByRemoteId("work@example.com", 42).id, sourceId);
+        QVERIFY(mock.sourceByRemoteId("work@example.com", 43).id.isEmpty());
+        QCOMPARE(mock.sourceIdByName("Work", 42), sourceId);
+        QVERIFY(mock.sourceIdByName("Work", 0).isEmpty());
+        QVERIFY(mock.sources().value(42).contains(sourceId));
+
+        // creating it again returns the same source
+        QCOMPARE(mock.createSource("Work", "#ff0000", "work@example.com", true, 42), sourceId);
+
+        mock.removeSource(sourceId);
+        QVERIFY(!mock.sourceById(sourceId).isValid());
+        QVERIFY(mock.sourceByRemoteId("work@example.com", 42).id.isEmpty());
+        QVERIFY(mock.sourceIdByName("Work", 42).isEmpty());
+    }
+
+    void testIndexFollowsCollectionChanges()
+    {
+        EdsHelperMock mock;
+        QTRY_VERIFY(mock.isIndexReady());
+
+        // collection created outside of the helper
+        QOrganizerCollection collection;
+        collection.setMetaData(QOrganizerCollection::KeyName, "Personal");
+        collection.setExtendedMetaData("collection-account-id", 7);
+        collection.setExtendedMetaData("collection-metadata", "personal@example.com");
+        QVERIFY(mock.organizerEngine()->saveCollection(&collection));
+        const QString sourceId = mock.sourceFromCollectionId(collection.id());
+
+        QTRY_COMPARE(mock.sourceByRemoteId("personal@example.com", 7).id, sourceId);
+        QCOMPARE(mock.sourceIdByName("Personal", 7), sourceId);
+
+        // renamed
+        collection.setMetaData(QOrganizerCollection::KeyName, "Home");
+        QVERIFY(mock.organizerEngine()->saveCollection(&collection));
+        QTRY_COMPARE(mock.sourceIdByName("Home", 7), sourceId);
+        QVERIFY(mock.sourceIdByName("Personal", 7).isEmpty());
+        QCOMPARE(mock.sourceById(sourceId).name, QStringLiteral("Home"));
+
+        // removed
+        QVERIFY(mock.organizerEngine()->removeCollection(collection.id()));
+        QTRY_VERIFY(!mock.sourceById(sourceId).isValid());
+        QVERIFY(mock.sourceByRemoteId("personal@example.com", 7).id.isEmpty());
     }
 };
 
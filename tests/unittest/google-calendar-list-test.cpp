@@ -0,0 +1,222 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/google-calendar-list.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QNetworkAccessManager>
+#include <QNetworkProxy>
+
+// Minimal http server, answers each request with the next queued response
+class FakeHttpServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    QList<QByteArray> responses;
+    QList<QByteArray> requests;
+
+    void queue(int status, const QByteArray &body, const QByteArray &extraHeaders = QByteArray())
+    {
+        QByteArray response;
+        response += QString("HTTP/1.1 %1 %2\r\n").arg(status).arg(status == 200 ? "OK" : "Status").toUtf8();
+        response += "Content-Type: application/json\r\n";
+        response += QString("Content-Length: %1\r\n").arg(body.size()).toUtf8();
+        response += "Connection: close\r\n";
+        response += extraHeaders;
+        response += "\r\n";
+        response += body;
+        responses << response;
+    }
+
+protected:
+    void incomingConnection(qintptr handle)
+    {
+        QTcpSocket *socket = new QTcpSocket(this);
+        socket->setSocketDescriptor(handle);
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+            QByteArray buffer = socket->property("buffer").toByteArray() + socket->readAll();
+            socket->setProperty("buffer", buffer);
+            if (!buffer.contains("\r\n\r\n")) {
+                return;
+            }
+            requests << buffer;
+            socket->write(responses.isEmpty() ? QByteArray("HTTP/1.1 500 Error\r\nContent-Length: 0\r\n\r\n")
+                                              : responses.takeFirst());
+            socket->disconnectFromHost();
+        });
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    }
+};
+
+class GoogleCalendarListTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    FakeHttpServer *m_server;
+    QNetworkAccessManager *m_manager;
+
+    GoogleCalendarList *createList()
+    {
+        GoogleCalendarList *list = new GoogleCalendarList(m_manager, this);
+        list->setUrl(QUrl(QString("http://127.0.0.1:%1/calendarList").arg(m_server->serverPort())));
+        return list;
+    }
+
+    static QByteArray calendar(const QString &id, bool selected, const QString &role, bool primary = false)
+    {
+        return QString("{\"id\": \"%1\", \"summary\": \"%1 summary\", \"selected\": %2, "
+                       "\"accessRole\": \"%3\", \"primary\": %4, \"backgroundColor\": \"#ff0000\"}")
+                .arg(id)
+                .arg(selected ? "true" : "false")
+                .arg(role)
+                .arg(primary ? "true" : "false").toUtf8();
+    }
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        qRegisterMetaType<QArrayOfDatabases>();
+    }
+
+    void init()
+    {
+        m_server = new FakeHttpServer;
+        QVERIFY(m_server->listen(QHostAddress::LocalHost));
+        m_manager = new QNetworkAccessManager;
+        m_manager->setProxy(QNetworkProxy::NoProxy);
+    }
+
+    void cleanup()
+    {
+        delete m_manager;
+        delete m_server;
+    }
+
+    void testFetchSelectedCalendars()
+    {
+        m_server->queue(200, "{\"items\": [" + calendar("primary@gmail.com", true, "owner", true) + ","
+                                             + calendar("hidden@gmail.com", false, "owner") + ","
+                                             + calendar("holidays@google.com", true, "reader") + "]}");
+
+        GoogleCalendarList *list = createList();
+        QSignalSpy finished(list, SIGNAL(finished(QArrayOfDatabases,int)));
+        list->fetch("token");
+        QTRY_COMPARE(finished.count(), 1);
+
+        QCOMPARE(finished.at(0).at(1).toInt(), 0);
+        QArrayOfDatabases dbs = list->calendars();
+        QCOMPARE(dbs.size(), 2);
+        QCOMPARE(dbs[0].remoteId, QStringLiteral("primary@gmail.com"));
+        QVERIFY(dbs[0].writable);
+        QVERIFY(dbs[0].defaultCalendar);
+        QCOMPARE(dbs[0].color, QStringLiteral("#ff0000"));
+        QCOMPARE(dbs[1].remoteId, QStringLiteral("holidays@google.com"));
+        QVERIFY(!dbs[1].writable);
+        QVERIFY(dbs[1].source.contains("holidays%40google.com"));
+        QCOMPARE(list->pageCount(), 1);
+        QVERIFY(!list->notModified());
+
+        // request only the necessary fields and accept compressed responses
+        QCOMPARE(m_server->requests.size(), 1);
+        const QByteArray request = m_server->requests.first();
+        QVERIFY(request.contains("fields="));
+        QVERIFY(request.contains("Authorization: Bearer token"));
+        QVERIFY(request.contains("User-Agent: sync-monitor (gzip)"));
+        QVERIFY(!request.contains("If-None-Match"));
+    }
+
+    void testPagination()
+    {
+        m_server->queue(200, "{\"nextPageToken\": \"page2\", \"items\": [" + calendar("first", true, "owner") + "]}");
+        m_server->queue(200, "{\"nextPageToken\": \"page3\", \"items\": [" + calendar("second", true, "writer") + "]}");
+        m_server->queue(200, "{\"items\": [" + calendar("third", true, "reader") + "]}");
+
+        GoogleCalendarList *list = createList();
+        QSignalSpy finished(list, SIGNAL(finished(QArrayOfDatabases,int)));
+        list->fetch("token");
+        QTRY_COMPARE(finished.count(), 1);
+
+        QCOMPARE(finished.at(0).at(1).toInt(), 0);
+        QCOMPARE(list->pageCount(), 3);
+        QArrayOfDatabases dbs = list->calendars();
+        QCOMPARE(dbs.size(), 3);
+        QCOMPARE(dbs[0].remoteId, QStringLiteral("first"));
+        QCOMPARE(dbs[1].remoteId, QStringLiteral("second"));
+        QCOMPARE(dbs[2].remoteId, QStringLiteral("third"));
+
+        QCOMPARE(m_server->requests.size(), 3);
+        QVERIFY(!m_server->requests[0].contains("pageToken="));
+        QVERIFY(m_server->requests[1].contains("pageToken=page2"));
+        QVERIFY(m_server->requests[2].contains("pageToken=page3"));
+    }
+
+    void testNotModified()
+    {
+        m_server->queue(200, "{\"items\": [" + calendar("primary", true, "owner") + "]}",
+                        "ETag: \"list-v1\"\r\n");
+        m_server->queue(304, QByteArray());
+
+        GoogleCalendarList *list = createList();
+        QSignalSpy finished(list, SIGNAL(finished(QArrayOfDatabases,int)));
+        list->fetch("token");
+        QTRY_COMPARE(finished.count(), 1);
+        QCOMPARE(list->etag(), QByteArray("\"list-v1\""));
+
+        list->fetch("token");
+        QTRY_COMPARE(finished.count(), 2);
+
+        QCOMPARE(finished.at(1).at(1).toInt(), 0);
+        QVERIFY(list->notModified());
+        QArrayOfDatabases dbs = finished.at(1).at(0).value<QArrayOfDatabases>();
+        QCOMPARE(dbs.size(), 1);
+        QCOMPARE(dbs[0].remoteId, QStringLiteral("primary"));
+        QVERIFY(m_server->requests[1].contains("If-None-Match: \"list-v1\""));
+    }
+
+    void testErrorKeepsPreviousList()
+    {
+        m_server->queue(200, "{\"nextPageToken\": \"page2\", \"items\": [" + calendar("first", true, "owner") + "]}",
+                        "ETag: \"list-v1\"\r\n");
+        m_server->queue(200, "{\"items\": [" + calendar("second", true, "owner") + "]}");
+        m_server->queue(200, "{\"nextPageToken\": \"page2\", \"items\": []}", "ETag: \"list-v2\"\r\n");
+        m_server->queue(500, QByteArray());
+
+        GoogleCalendarList *list = createList();
+        QSignalSpy finished(list, SIGNAL(finished(QArrayOfDatabases,int)));
+        list->fetch("token");
+        QTRY_COMPARE(finished.count(), 1);
+        QCOMPARE(list->calendars().size(), 2);
+
+        // a failure in the middle of the pages does not replace the list
+        list->fetch("token");
+        QTRY_COMPARE(finished.count(), 2);
+        QCOMPARE(finished.at(1).at(1).toInt(), 20007);
+        QVERIFY(finished.at(1).at(0).value<QArrayOfDatabases>().isEmpty());
+        QCOMPARE(list->calendars().size(), 2);
+        QCOMPARE(list->etag(), QByteArray("\"list-v1\""));
+    }
+};
+
+QTEST_MAIN(GoogleCalendarListTest)
+
+#include "google-calendar-list-test.moc"
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/sync-account.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+
+class SyncAccountTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    static QList<SourceData> calendars()
+    {
+        QList<SourceData> sources;
+        sources << SourceData("1_work", "work@example.com", true)
+                << SourceData("1_home", "home@example.com", true)
+                << SourceData("1_holidays", "holidays@example.com", false);
+        return sources;
+    }
+
+    static QStringList names(const QList<SourceData> &sources)
+    {
+        QStringList result;
+        Q_FOREACH(const SourceData &source, sources) {
+            result << source.sourceName;
+        }
+        return result;
+    }
+
+private Q_SLOTS:
+
+    void testSplitPrioritySources()
+    {
+        QStringList deferred;
+        QList<SourceData> first = SyncAccount::splitPrioritySources(calendars(),
+                                                                    QSet<QString>() << "home@example.com",
+                                                                    &deferred);
+        QCOMPARE(names(first), QStringList() << "1_home");
+        QCOMPARE(deferred, QStringList() << "work@example.com" << "holidays@example.com");
+    }
+
+    void testSplitWithoutPriority()
+    {
+        // a single session when there is nothing to defer or to sync first
+        QStringList deferred("stale@example.com");
+        QList<SourceData> first = SyncAccount::splitPrioritySources(calendars(), QSet<QString>(), &deferred);
+        QCOMPARE(names(first), names(calendars()));
+        QVERIFY(deferred.isEmpty());
+
+        QSet<QString> all;
+        all << "work@example.com" << "home@example.com" << "holidays@example.com";
+        first = SyncAccount::splitPrioritySources(calendars(), all, &deferred);
+        QCOMPARE(names(first), names(calendars()));
+        QVERIFY(deferred.isEmpty());
+    }
+
+    void testUnchangedSources()
+    {
+        QStringList sources;
+        sources << "work@example.com" << "home@example.com" << "holidays@example.com" << "new@example.com";
+
+        QMap<QString, QString> tokens;
+        tokens.insert("work@example.com", "token-2");
+        tokens.insert("home@example.com", "ctag-5");
+        tokens.insert("new@example.com", "token-1");
+
+        QHash<QString, QString> knownTokens;
+        knownTokens.insert("work@example.com", "token-1");
+        knownTokens.insert("home@example.com", "ctag-5");
+        knownTokens.insert("holidays@example.com", "token-9");
+
+        // only the calendar with the same token skips the sync
+        QCOMPARE(SyncAccount::unchangedSources(sources, tokens, knownTokens, true),
+                 QStringList() << "home@example.com");
+
+        // local changes could be missed, everything syncs
+        QVERIFY(SyncAccount::unchangedSources(sources, tokens, knownTokens, false).isEmpty());
+    }
+
+    void testReportSources()
+    {
+        // results accumulate over the priority and the deferred session
+        QMap<QString, QString> results;
+        results.insert("1_home", "200");
+        results.insert("1_work", "200");
+        results.insert("1_holidays", "403");
+        results.insert("", "-1");
+
+        // the priority session reports its sources only
+        QCOMPARE(SyncAccount::reportSources(QStringList() << "1_home", results),
+                 QStringList() << "1_home");
+
+        // the deferred session does not report the priority ones again
+        QCOMPARE(SyncAccount::reportSources(QStringList() << "1_work" << "1_holidays" << "1_new", results),
+                 QStringList() << "1_work" << "1_holidays");
+
+        QVERIFY(SyncAccount::reportSources(QStringList() << "", results).isEmpty());
+    }
+};
+
+QTEST_MAIN(SyncAccountTest)
+
+#include "sync-account-test.moc"
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/sync-debounce.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+
+// the daemon defaults scaled down: 5s, 15s and 60s
+#define TEST_MIN_WAIT       100
+#define TEST_BURST_INTERVAL 300
+#define TEST_MAX_WAIT       1200
+
+class SyncDebounceTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+
+    void testIsolatedChange()
+    {
+        SyncDebounce debounce(0, TEST_MIN_WAIT, TEST_BURST_INTERVAL, TEST_MAX_WAIT);
+        QSignalSpy timeout(&debounce, SIGNAL(timeout()));
+
+        debounce.notifyChange();
+        QVERIFY(debounce.isActive());
+        QVERIFY(debounce.remainingTime() <= TEST_MIN_WAIT);
+        QTRY_COMPARE(timeout.count(), 1);
+        QVERIFY(!debounce.isActive());
+    }
+
+    void testBurstExtendsWait()
+    {
+        SyncDebounce debounce(0, TEST_MIN_WAIT, TEST_BURST_INTERVAL, TEST_MAX_WAIT);
+        QSignalSpy timeout(&debounce, SIGNAL(timeout()));
+
+        debounce.notifyChange();
+        QTest::qWait(80);
+        debounce.notifyChange();
+        QTest::qWait(80);
+        debounce.notifyChange();
+
+        // twice the interval between the changes
+        QVERIFY(debounce.remainingTime() > TEST_MIN_WAIT);
+        QCOMPARE(timeout.count(), 0);
+        QTRY_COMPARE(timeout.count(), 1);
+    }
+
+    void testBurstAcrossDispatch()
+    {
+        SyncDebounce debounce(0, TEST_MIN_WAIT, TEST_BURST_INTERVAL, TEST_MAX_WAIT);
+        QSignalSpy timeout(&debounce, SIGNAL(timeout()));
+
+        // the second change arrives after the first dispatch but within the
+        // burst interval, the next window waits for the rest of the burst
+        debounce.notifyChange();
+        QTRY_COMPARE(timeout.count(), 1);
+        QTest::qWait(TEST_BURST_INTERVAL / 2 - TEST_MIN_WAIT / 2);
+        debounce.notifyChange();
+        QVERIFY(debounce.remainingTime() > TEST_MIN_WAIT);
+
+        // the isolated change after the burst uses the short wait again
+        QTRY_COMPARE(timeout.count(), 2);
+        QTest::qWait(TEST_BURST_INTERVAL + 50);
+        debounce.notifyChange();
+        QVERIFY(debounce.remainingTime() <= TEST_MIN_WAIT);
+        QTRY_COMPARE(timeout.count(), 3);
+    }
+
+    void testMaxLatency()
+    {
+        SyncDebounce debounce(0, TEST_MIN_WAIT, TEST_BURST_INTERVAL, TEST_MAX_WAIT);
+        QSignalSpy timeout(&debounce, SIGNAL(timeout()));
+        QElapsedTimer elapsed;
+        elapsed.start();
+
+        // changes keep arriving, the dispatch is not postponed forever
+        while (timeout.isEmpty() && (elapsed.elapsed() < (TEST_MAX_WAIT * 3))) {
+            debounce.notifyChange();
+            QVERIFY(elapsed.elapsed() + debounce.remainingTime() <= TEST_MAX_WAIT + 50);
+            QTest::qWait(TEST_MIN_WAIT * 4 / 5);
+        }
+        QCOMPARE(timeout.count(), 1);
+        QVERIFY(elapsed.elapsed() < TEST_MAX_WAIT + TEST_MIN_WAIT);
+    }
+
+    void testStop()
+    {
+        SyncDebounce debounce(0, TEST_MIN_WAIT, TEST_BURST_INTERVAL, TEST_MAX_WAIT);
+        QSignalSpy timeout(&debounce, SIGNAL(timeout()));
+
+        debounce.notifyChange();
+        debounce.stop();
+        QVERIFY(!debounce.isActive());
+        QTest::qWait(TEST_MIN_WAIT * 2);
+        QCOMPARE(timeout.count(), 0);
+    }
+};
+
+QTEST_MAIN(SyncDebounceTest)
+
+#include "sync-debounce-test.moc"
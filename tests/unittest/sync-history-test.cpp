@@ -0,0 +1,231 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/sync-history.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+#include <QTemporaryDir>
+
+
+class SyncHistoryTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir m_dir;
+
+    QString historyFile() const
+    {
+        return m_dir.path() + QStringLiteral("/sync-history.log");
+    }
+
+    SyncHistoryEntry createEntry(uint accountId, const QString &sourceName, const QDateTime &start)
+    {
+        SyncHistoryEntry entry;
+        entry.accountId = accountId;
+        entry.sourceName = sourceName;
+        entry.remoteId = sourceName + QStringLiteral("@example.com");
+        entry.start = start;
+        entry.duration = 1500;
+        entry.mode = QStringLiteral("two-way");
+        entry.status = QStringLiteral("0");
+        entry.added[SyncHistoryEntry::Local] = 1;
+        entry.removed[SyncHistoryEntry::Remote] = 2;
+        entry.receivedBytes = 2048;
+        return entry;
+    }
+
+private Q_SLOTS:
+
+    void cleanup()
+    {
+        QFile::remove(historyFile());
+    }
+
+    void testFilterSourceReport()
+    {
+        QStringMap report;
+        report.insert("start", "1451642400");
+        report.insert("end", "1451642412");
+        report.insert("status", "200");
+        report.insert("peer", "google-12");
+        report.insert("source-12__calendar_+1-mode", "slow");
+        report.insert("source-12__calendar_+1-status", "0");
+        report.insert("source-12__calendar_+1-stat-local-added-total", "10");
+        report.insert("source-12__calendar_+1-stat-local-updated-total", "2");
+        report.insert("source-12__calendar_+1-stat-remote-removed-total", "3");
+        report.insert("source-12__calendar_+1-stat-local-any-sent-bytes", "512");
+        report.insert("source-12__calendar_+1-stat-local-any-received-bytes", "4096");
+        report.insert("source-12__other-mode", "two-way");
+        report.insert("source-12__other-stat-local-added-total", "99");
+
+        QStringMap sourceReport = SyncHistory::filterSourceReport(report, "12_calendar-1");
+        QCOMPARE(sourceReport.value("mode"), QStringLiteral("slow"));
+        // source status replaces the session one
+        QCOMPARE(sourceReport.value("status"), QStringLiteral("0"));
+        QCOMPARE(sourceReport.value("peer"), QStringLiteral("google-12"));
+        QVERIFY(!sourceReport.contains("source-12__other-mode"));
+
+        SyncHistoryEntry entry = SyncHistory::entryFromReport(12, "12_calendar-1", "calendar-1@example.com", sourceReport);
+        QCOMPARE(entry.accountId, 12u);
+        QCOMPARE(entry.remoteId, QStringLiteral("calendar-1@example.com"));
+        QCOMPARE(entry.mode, QStringLiteral("slow"));
+        QCOMPARE(entry.status, QStringLiteral("0"));
+        QCOMPARE(entry.start, QDateTime::fromTime_t(1451642400));
+        QCOMPARE(entry.duration, qint64(12000));
+        QCOMPARE(entry.added[SyncHistoryEntry::Local], 10);
+        QCOMPARE(entry.updated[SyncHistoryEntry::Local], 2);
+        QCOMPARE(entry.removed[SyncHistoryEntry::Local], 0);
+        QCOMPARE(entry.removed[SyncHistoryEntry::Remote], 3);
+        QCOMPARE(entry.items(), 15);
+        QCOMPARE(entry.sentBytes, qint64(512));
+        QCOMPARE(entry.receivedBytes, qint64(4096));
+    }
+
+    void testPersistEntries()
+    {
+        const QDateTime now = QDateTime::fromTime_t(QDateTime::currentDateTime().toTime_t());
+        {
+            SyncHistory history(historyFile());
+            history.add(createEntry(1, "1_calendar", now.addSecs(-20)));
+            history.add(createEntry(2, "2_calendar", now.addSecs(-10)));
+            history.add(createEntry(1, "1_calendar 2", now));
+            QCOMPARE(history.pendingRecords(), 3);
+            history.flush();
+            QCOMPARE(history.pendingRecords(), 0);
+        }
+
+        SyncHistory history(historyFile());
+        history.load();
+        QCOMPARE(history.count(), 3);
+
+        // newest first
+        QList<SyncHistoryEntry> entries = history.entries();
+        QCOMPARE(entries.size(), 3);
+        QCOMPARE(entries[0].sourceName, QStringLiteral("1_calendar 2"));
+        QCOMPARE(entries[2].sourceName, QStringLiteral("1_calendar"));
+        QCOMPARE(entries[0].start, now);
+        QCOMPARE(entries[0].duration, qint64(1500));
+        QCOMPARE(entries[0].mode, QStringLiteral("two-way"));
+        QCOMPARE(entries[0].added[SyncHistoryEntry::Local], 1);
+        QCOMPARE(entries[0].removed[SyncHistoryEntry::Remote], 2);
+        QCOMPARE(entries[0].receivedBytes, qint64(2048));
+
+        entries = history.entries(1);
+        QCOMPARE(entries.size(), 2);
+        QCOMPARE(history.entries(1, 1).size(), 1);
+        QCOMPARE(history.entries(3).size(), 0);
+
+        QStringMap map = entries[0].toMap();
+        QCOMPARE(map.value("account"), QStringLiteral("1"));
+        QCOMPARE(map.value("remoteId"), QStringLiteral("1_calendar 2@example.com"));
+        QCOMPARE(map.value("local-added"), QStringLiteral("1"));
+        QCOMPARE(map.value("remote-removed"), QStringLiteral("2"));
+        QCOMPARE(map.value("received-bytes"), QStringLiteral("2048"));
+    }
+
+    void testLoadRecordsWithoutBytes()
+    {
+        QFile file(historyFile());
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("V 1\nH 1 1_calendar - 1451642400 1500 two-way 0 1 0 0 0 2 0\n");
+        file.close();
+
+        SyncHistory history(historyFile(), -1, 100000);
+        history.load();
+        QCOMPARE(history.count(), 1);
+        const SyncHistoryEntry entry = history.entries().first();
+        QCOMPARE(entry.updated[SyncHistoryEntry::Remote], 2);
+        QCOMPARE(entry.sentBytes, qint64(0));
+        QCOMPARE(entry.receivedBytes, qint64(0));
+    }
+
+    void testPartialRecord()
+    {
+        {
+            QFile file(historyFile());
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write("V 1\nH 1 1_calendar - 1451642400 1500 two-way 0 1 0 0 0 2 0\nH 1 1_cal");
+            file.close();
+        }
+
+        const QDateTime now = QDateTime::fromTime_t(QDateTime::currentDateTime().toTime_t());
+        {
+            SyncHistory history(historyFile(), -1, 100000);
+            history.load();
+            QCOMPARE(history.count(), 1);
+
+            // the next record is not merged with the incomplete line
+            history.add(createEntry(2, "2_calendar", now));
+            history.flush();
+        }
+
+        SyncHistory history(historyFile(), -1, 100000);
+        history.load();
+        QCOMPARE(history.count(), 2);
+        QCOMPARE(history.entries().first().sourceName, QStringLiteral("2_calendar"));
+    }
+
+    void testRetention()
+    {
+        const QDateTime now = QDateTime::currentDateTime();
+        {
+            SyncHistory history(historyFile(), 5, 2);
+            history.add(createEntry(1, "old", now.addDays(-3)));
+            for(int i = 0; i < 10; i++) {
+                history.add(createEntry(1, QString("calendar_%1").arg(i), now.addSecs(i)));
+            }
+            // bounded in memory
+            QCOMPARE(history.count(), 5);
+            QCOMPARE(history.entries().last().sourceName, QStringLiteral("calendar_5"));
+        }
+
+        SyncHistory history(historyFile(), 5, 2);
+        history.load();
+        QCOMPARE(history.count(), 5);
+
+        // entries older than the retention time are dropped
+        SyncHistory shortHistory(historyFile(), 5, 1);
+        shortHistory.add(createEntry(1, "old", now.addDays(-1).addSecs(-60)));
+        QCOMPARE(shortHistory.count(), 0);
+    }
+
+    void testRemoveAccount()
+    {
+        const QDateTime now = QDateTime::currentDateTime();
+        {
+            SyncHistory history(historyFile());
+            history.add(createEntry(1, "1_calendar", now));
+            history.add(createEntry(2, "2_calendar", now));
+            history.flush();
+            history.removeAccount(1);
+            QCOMPARE(history.count(), 1);
+        }
+
+        SyncHistory history(historyFile());
+        history.load();
+        QCOMPARE(history.count(), 1);
+        QCOMPARE(history.entries().first().accountId, 2u);
+    }
+};
+
+QTEST_MAIN(SyncHistoryTest)
+
+#include "sync-history-test.moc"
@@ -0,0 +1,361 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sync-account-mock.h"
+#include "syncevolution-server-mock.h"
+#include "src/sync-queue.h"
+#include "src/syncevolution-server-proxy.h"
+#include "src/syncevolution-session-proxy.h"
+
+#include <gmock/gmock.h>
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+#include <QDBusPendingCallWatcher>
+#include <QSharedPointer>
+
+#include <algorithm>
+
+#define BENCHMARK_TIMEOUT   10 * 60 * 1000
+
+// Runs the jobs of a SyncQueue through the SyncEvolution proxies: open the
+// session, wait while it is queued, configure it on the first sync, read the
+// config, sync and fetch the report. Only the queue, the proxies and the
+// D-Bus round trips are measured, SyncAccount and SyncDaemon are not used and
+// changes on their logic do not show up here.
+class SyncPipelineDriver : public QObject
+{
+    Q_OBJECT
+public:
+    SyncPipelineDriver(int maxActiveJobs)
+        : m_maxActiveJobs(maxActiveJobs),
+          m_failures(0)
+    {
+        m_clock.start();
+    }
+
+    void push(SyncAccount *account, const QStringList &sources)
+    {
+        m_queue.push(account, sources, false, SyncJob::PeriodicPriority);
+        if (!m_pushTime.contains(account->id())) {
+            m_pushTime.insert(account->id(), m_clock.elapsed());
+        }
+    }
+
+    void run()
+    {
+        m_clock.restart();
+        continueSync();
+    }
+
+    QList<qint64> latencies() const
+    {
+        return m_latencies;
+    }
+
+    int failures() const
+    {
+        return m_failures;
+    }
+
+Q_SIGNALS:
+    void finished();
+
+private:
+    SyncQueue m_queue;
+    QSet<int> m_activeAccounts;
+    QSet<int> m_configuredAccounts;
+    QHash<int, qint64> m_pushTime;
+    QList<qint64> m_latencies;
+    QElapsedTimer m_clock;
+    int m_maxActiveJobs;
+    int m_failures;
+
+    void continueSync()
+    {
+        while ((m_activeAccounts.size() < m_maxActiveJobs) && !m_queue.isEmpty()) {
+            const SyncJob job = m_queue.popNext(m_activeAccounts);
+            if (!job.isValid()) {
+                break;
+            }
+            m_activeAccounts << job.account()->id();
+            openSession(job);
+        }
+
+        if (m_activeAccounts.isEmpty() && m_queue.isEmpty()) {
+            Q_EMIT finished();
+        }
+    }
+
+    void jobDone(const SyncJob &job, SyncEvolutionSessionProxy *session, bool success)
+    {
+        const int accountId = job.account()->id();
+        if (session) {
+            session->destroy();
+        }
+        if (!success) {
+            m_failures++;
+        }
+        m_latencies << (m_clock.elapsed() - m_pushTime.take(accountId));
+        m_activeAccounts.remove(accountId);
+        continueSync();
+    }
+
+    template<typename Function>
+    void watch(const QDBusPendingCall &call, Function function)
+    {
+        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+        connect(watcher, &QDBusPendingCallWatcher::finished, this,
+                [function](QDBusPendingCallWatcher *call) {
+            call->deleteLater();
+            function(*call);
+        });
+    }
+
+    void openSession(const SyncJob &job)
+    {
+        const QString sessionName = QString("bench-%1").arg(job.account()->id());
+        watch(SyncEvolutionServerProxy::instance()->openSession(sessionName, QStringList()),
+              [this, job, sessionName](const QDBusPendingCall &call) {
+            QDBusPendingReply<QDBusObjectPath> reply = call;
+            if (reply.isError()) {
+                jobDone(job, 0, false);
+                return;
+            }
+            SyncEvolutionSessionProxy *session = SyncEvolutionServerProxy::instance()->createSession(sessionName, reply.value());
+            waitForSession(job, session);
+        });
+    }
+
+    void waitForSession(const SyncJob &job, SyncEvolutionSessionProxy *session)
+    {
+        // the session can be ready on the status reply or on a later signal
+        QSharedPointer<QMetaObject::Connection> conn(new QMetaObject::Connection);
+        auto start = [this, job, session, conn]() {
+            if (!(*conn)) {
+                return;
+            }
+            disconnect(*conn);
+            configure(job, session);
+        };
+
+        *conn = connect(session, &SyncEvolutionSessionProxy::statusChanged, this,
+                        [start](const QString &status) {
+            if (status != "queueing") {
+                start();
+            }
+        });
+
+        watch(session->status(), [start](const QDBusPendingCall &call) {
+            QDBusPendingReply<QString> reply = call;
+            if (reply.isError() || (reply.value() != "queueing")) {
+                start();
+            }
+        });
+    }
+
+    void configure(const SyncJob &job, SyncEvolutionSessionProxy *session)
+    {
+        const int accountId = job.account()->id();
+        if (m_configuredAccounts.contains(accountId)) {
+            sync(job, session);
+            return;
+        }
+
+        QStringMultiMap config;
+        config[""]["syncURL"] = QString("https://example.com/caldav/%1").arg(accountId);
+        Q_FOREACH(const QString &source, job.sources()) {
+            config["source/" + source]["backend"] = "caldav";
+            config["source/" + source]["database"] = source;
+        }
+        watch(session->saveConfig(session->sessionName(), config),
+              [this, job, session, accountId](const QDBusPendingCall &call) {
+            if (call.isError()) {
+                jobDone(job, session, false);
+                return;
+            }
+            m_configuredAccounts << accountId;
+            sync(job, session);
+        });
+    }
+
+    void sync(const SyncJob &job, SyncEvolutionSessionProxy *session)
+    {
+        watch(session->getConfig("@default", false),
+              [this, job, session](const QDBusPendingCall &call) {
+            Q_UNUSED(call);
+            QStringMap flags;
+            Q_FOREACH(const QString &source, job.sources()) {
+                flags.insert(source, "two-way");
+            }
+
+            QSharedPointer<QMetaObject::Connection> conn(new QMetaObject::Connection);
+            *conn = connect(session, &SyncEvolutionSessionProxy::statusChanged, this,
+                            [this, job, session, conn](const QString &status, uint error, const QSyncStatusMap &sources) {
+                if (status != "done") {
+                    return;
+                }
+                disconnect(*conn);
+
+                bool success = (error == 0);
+                Q_FOREACH(const SyncStatus &source, sources) {
+                    success &= (source.error == 0);
+                }
+                watch(session->reports(0, 1), [this, job, session, success](const QDBusPendingCall &call) {
+                    jobDone(job, session, success && !call.isError());
+                });
+            });
+
+            watch(session->sync("none", flags), [this, job, session, conn](const QDBusPendingCall &call) {
+                if (call.isError() && (*conn)) {
+                    disconnect(*conn);
+                    jobDone(job, session, false);
+                }
+            });
+        });
+    }
+};
+
+class SyncPipelineBenchmark : public QObject
+{
+    Q_OBJECT
+
+private:
+    SyncEvolutionServerMock *m_server;
+    QList<SyncAccountMock*> m_accounts;
+
+    static qint64 percentile(const QList<qint64> &sorted, int p)
+    {
+        if (sorted.isEmpty()) {
+            return 0;
+        }
+        return sorted.value(qMin(sorted.size() - 1, (sorted.size() * p) / 100));
+    }
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        syncevolution_qt_dbus_register_types();
+        m_server = new SyncEvolutionServerMock(this);
+        if (!m_server->start()) {
+            QSKIP("org.syncevolution already running on this bus");
+        }
+    }
+
+    void cleanupTestCase()
+    {
+        delete m_server;
+    }
+
+    void cleanup()
+    {
+        qDeleteAll(m_accounts);
+        m_accounts.clear();
+    }
+
+    void benchmarkSyncRound_data()
+    {
+        QTest::addColumn<int>("accounts");
+        QTest::addColumn<int>("sources");
+        QTest::addColumn<int>("workers");
+        QTest::addColumn<int>("serverSessions");
+        QTest::addColumn<int>("callLatency");
+        QTest::addColumn<int>("syncLatency");
+        QTest::addColumn<int>("failureInterval");
+
+        QTest::newRow("100 accounts, 1000 sources") << 100 << 10 << 4 << 1 << 0 << 0 << 0;
+        QTest::newRow("300 accounts, 3000 sources") << 300 << 10 << 4 << 1 << 0 << 0 << 0;
+        QTest::newRow("300 accounts, 3000 sources, 1ms latency") << 300 << 10 << 4 << 1 << 1 << 1 << 0;
+        QTest::newRow("300 accounts, 3000 sources, 1ms latency, 4 server sessions") << 300 << 10 << 4 << 4 << 1 << 1 << 0;
+        QTest::newRow("200 accounts, 2000 sources, failures") << 200 << 10 << 4 << 1 << 0 << 0 << 25;
+    }
+
+    void benchmarkSyncRound()
+    {
+        QFETCH(int, accounts);
+        QFETCH(int, sources);
+        QFETCH(int, workers);
+        QFETCH(int, serverSessions);
+        QFETCH(int, callLatency);
+        QFETCH(int, syncLatency);
+        QFETCH(int, failureInterval);
+
+        m_server->setMaxActiveSessions(serverSessions);
+        m_server->setCallLatency(callLatency);
+        m_server->setSyncLatency(syncLatency);
+        m_server->setSessionFailureInterval(failureInterval);
+        m_server->setSyncFailureInterval(failureInterval);
+
+        SyncPipelineDriver driver(workers);
+        for(int i = 0; i < accounts; i++) {
+            SyncAccountMock *account = new SyncAccountMock(i + 1);
+            m_accounts << account;
+            QStringList sourceNames;
+            for(int s = 0; s < sources; s++) {
+                sourceNames << QString("%1_calendar%2").arg(i + 1).arg(s);
+            }
+            driver.push(account, sourceNames);
+        }
+
+        QSignalSpy finishedSpy(&driver, SIGNAL(finished()));
+        QElapsedTimer timer;
+        timer.start();
+        driver.run();
+        QVERIFY(finishedSpy.count() > 0 || finishedSpy.wait(BENCHMARK_TIMEOUT));
+        const qint64 elapsed = qMax<qint64>(timer.elapsed(), 1);
+
+        QList<qint64> latencies = driver.latencies();
+        QCOMPARE(latencies.size(), accounts);
+        std::sort(latencies.begin(), latencies.end());
+
+        qDebug() << QString("%1 jobs (%2 sources) in %3 ms: %4 jobs/s, %5 sources/s, failures %6")
+                    .arg(accounts)
+                    .arg(accounts * sources)
+                    .arg(elapsed)
+                    .arg(accounts * 1000.0 / elapsed, 0, 'f', 1)
+                    .arg(accounts * sources * 1000.0 / elapsed, 0, 'f', 1)
+                    .arg(driver.failures());
+        qDebug() << QString("job latency ms: p50 %1, p90 %2, p99 %3, max %4")
+                    .arg(percentile(latencies, 50))
+                    .arg(percentile(latencies, 90))
+                    .arg(percentile(latencies, 99))
+                    .arg(latencies.last());
+
+        if (failureInterval == 0) {
+            QCOMPARE(driver.failures(), 0);
+        } else {
+            QVERIFY(driver.failures() > 0);
+        }
+        QTRY_COMPARE(m_server->activeSessions(), 0);
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    // The following line causes Google Mock to throw an exception on failure,
+    // which will be interpreted by your testing framework as a test failure.
+    ::testing::GTEST_FLAG(throw_on_failure) = true;
+    ::testing::InitGoogleMock(&argc, argv);
+
+    QCoreApplication app(argc, argv);
+    SyncPipelineBenchmark tc;
+    return QTest::qExec(&tc, argc, argv);
+}
+
+#include "sync-pipeline-benchmark.moc"
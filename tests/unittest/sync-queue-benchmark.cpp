@@ -0,0 +1,169 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sync-account-mock.h"
+#include "src/sync-queue.h"
+
+#include <gmock/gmock.h>
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+
+#define BENCHMARK_SOURCES_PER_ACCOUNT   20
+
+class SyncQueueBenchmark : public QObject
+{
+    Q_OBJECT
+
+private:
+    QList<SyncAccountMock*> m_accounts;
+
+    QStringList sourceNames(int accountId) const
+    {
+        QStringList sources;
+        for(int i=0; i < BENCHMARK_SOURCES_PER_ACCOUNT; i++) {
+            sources << QString("account%1Source%2").arg(accountId).arg(i);
+        }
+        return sources;
+    }
+
+    void createAccounts(int count)
+    {
+        qDeleteAll(m_accounts);
+        m_accounts.clear();
+        for(int i=0; i < count; i++) {
+            m_accounts << new SyncAccountMock(i + 1);
+        }
+    }
+
+private Q_SLOTS:
+    void cleanup()
+    {
+        qDeleteAll(m_accounts);
+        m_accounts.clear();
+    }
+
+    void benchmarkPush_data()
+    {
+        QTest::addColumn<int>("accounts");
+        QTest::newRow("10 accounts") << 10;
+        QTest::newRow("100 accounts") << 100;
+        QTest::newRow("1000 accounts") << 1000;
+    }
+
+    void benchmarkPush()
+    {
+        QFETCH(int, accounts);
+        createAccounts(accounts);
+
+        QBENCHMARK {
+            SyncQueue queue;
+            Q_FOREACH(SyncAccountMock *account, m_accounts) {
+                Q_FOREACH(const QString &source, sourceNames(account->id())) {
+                    queue.push(account, source, false, SyncJob::LocalChangePriority);
+                }
+            }
+        }
+    }
+
+    void benchmarkContains_data()
+    {
+        benchmarkPush_data();
+    }
+
+    void benchmarkContains()
+    {
+        QFETCH(int, accounts);
+        createAccounts(accounts);
+
+        SyncQueue queue;
+        Q_FOREACH(SyncAccountMock *account, m_accounts) {
+            queue.push(account, sourceNames(account->id()), false);
+        }
+
+        QBENCHMARK {
+            Q_FOREACH(SyncAccountMock *account, m_accounts) {
+                QVERIFY(queue.contains(account, QString("account%1Source0").arg(account->id())));
+            }
+        }
+    }
+
+    void benchmarkMergeOfflineQueue_data()
+    {
+        benchmarkPush_data();
+    }
+
+    void benchmarkMergeOfflineQueue()
+    {
+        QFETCH(int, accounts);
+        createAccounts(accounts);
+
+        SyncQueue offlineQueue;
+        Q_FOREACH(SyncAccountMock *account, m_accounts) {
+            offlineQueue.push(account, sourceNames(account->id()), false, SyncJob::RetryPriority);
+        }
+
+        QBENCHMARK {
+            SyncQueue queue;
+            Q_FOREACH(SyncAccountMock *account, m_accounts) {
+                queue.push(account, QString("account%1Source0").arg(account->id()), false);
+            }
+            queue.push(offlineQueue);
+            QCOMPARE(queue.count(), accounts);
+        }
+    }
+
+    void benchmarkPopAndRemove_data()
+    {
+        benchmarkPush_data();
+    }
+
+    void benchmarkPopAndRemove()
+    {
+        QFETCH(int, accounts);
+        createAccounts(accounts);
+
+        QBENCHMARK {
+            SyncQueue queue;
+            Q_FOREACH(SyncAccountMock *account, m_accounts) {
+                queue.push(account, sourceNames(account->id()), false, SyncJob::PeriodicPriority);
+            }
+            for(int i=0; i < m_accounts.size(); i += 2) {
+                queue.remove(m_accounts[i]);
+            }
+            while (!queue.isEmpty()) {
+                queue.popNext();
+            }
+        }
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    // The following line causes Google Mock to throw an exception on failure,
+    // which will be interpreted by your testing framework as a test failure.
+    ::testing::GTEST_FLAG(throw_on_failure) = true;
+    ::testing::InitGoogleMock(&argc, argv);
+
+    QCoreApplication app(argc, argv);
+    SyncQueueBenchmark tc;
+    return QTest::qExec(&tc, argc, argv);
+}
+
+#include "sync-queue-benchmark.moc"
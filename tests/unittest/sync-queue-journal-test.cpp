@@ -0,0 +1,277 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sync-account-mock.h"
+#include "src/sync-queue.h"
+#include "src/sync-queue-journal.h"
+
+#include <gmock/gmock.h>
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+#include <QTemporaryDir>
+
+
+class SyncQueueJournalTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir m_dir;
+
+    QString journalFile() const
+    {
+        return m_dir.path() + QStringLiteral("/queue.journal");
+    }
+
+    int countLines() const
+    {
+        QFile file(journalFile());
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            return 0;
+        }
+        return file.readAll().count('\n');
+    }
+
+private Q_SLOTS:
+
+    void cleanup()
+    {
+        QFile::remove(journalFile());
+    }
+
+    void testReplayPush()
+    {
+        SyncAccountMock account(1);
+        SyncAccountMock account2(2);
+        {
+            SyncQueueJournal journal(journalFile());
+            SyncQueue queue;
+            queue.setJournal(&journal);
+
+            queue.push(&account, QStringList() << "source1", false, SyncJob::LocalChangePriority);
+            queue.push(&account, QStringList() << "source2", false, SyncJob::InteractivePriority);
+            queue.push(&account2, QStringList(), true, SyncJob::PeriodicPriority);
+        }
+
+        SyncQueueJournal journal(journalFile());
+        QList<SyncJournalEntry> entries = journal.load();
+        QCOMPARE(entries.size(), 2);
+
+        QCOMPARE(entries[0].accountId, 1);
+        QCOMPARE(entries[0].sources.toSet(), QSet<QString>() << "source1" << "source2");
+        QCOMPARE(entries[0].runOnPayedConnection, false);
+        QCOMPARE(entries[0].priority, SyncJob::InteractivePriority);
+
+        QCOMPARE(entries[1].accountId, 2);
+        QVERIFY(entries[1].sources.isEmpty());
+        QCOMPARE(entries[1].runOnPayedConnection, true);
+        QCOMPARE(entries[1].priority, SyncJob::PeriodicPriority);
+    }
+
+    void testReplayRemove()
+    {
+        SyncAccountMock account(1);
+        SyncAccountMock account2(2);
+        SyncAccountMock account3(3);
+        {
+            SyncQueueJournal journal(journalFile());
+            SyncQueue queue;
+            queue.setJournal(&journal);
+
+            queue.push(&account, QStringList() << "source1" << "source2");
+            queue.push(&account2);
+            queue.push(&account3);
+
+            queue.remove(&account, "source1");
+            // finished jobs are not pending anymore
+            SyncJob job = queue.popNext();
+            QCOMPARE(job.account()->id(), 1);
+            queue.finish(job.account());
+            queue.remove(&account3);
+        }
+
+        SyncQueueJournal journal(journalFile());
+        QList<SyncJournalEntry> entries = journal.load();
+        QCOMPARE(entries.size(), 1);
+        QCOMPARE(entries[0].accountId, 2);
+    }
+
+    void testReplayRunningJob()
+    {
+        SyncAccountMock account(1);
+        SyncAccountMock account2(2);
+        {
+            SyncQueueJournal journal(journalFile());
+            SyncQueue queue;
+            queue.setJournal(&journal);
+
+            queue.push(&account, QStringList() << "source1");
+            queue.push(&account2);
+
+            // crash while the job runs, it is restored on the next start
+            SyncJob job = queue.popNext();
+            QCOMPARE(job.account()->id(), 1);
+            QCOMPARE(queue.count(), 1);
+        }
+
+        SyncQueueJournal journal(journalFile());
+        QList<SyncJournalEntry> entries = journal.load();
+        QCOMPARE(entries.size(), 2);
+        QCOMPARE(entries[0].accountId, 1);
+        QCOMPARE(entries[0].sources, QStringList() << "source1");
+        QCOMPARE(entries[1].accountId, 2);
+    }
+
+    void testFinishKeepsQueuedJob()
+    {
+        SyncAccountMock account(1);
+        {
+            SyncQueueJournal journal(journalFile());
+            SyncQueue queue;
+            queue.setJournal(&journal);
+
+            queue.push(&account, QStringList() << "source1");
+            queue.popNext();
+            // a new change while the account syncs
+            queue.push(&account, QStringList() << "source1");
+            queue.finish(&account);
+        }
+
+        SyncQueueJournal journal(journalFile());
+        QList<SyncJournalEntry> entries = journal.load();
+        QCOMPARE(entries.size(), 1);
+        QCOMPARE(entries[0].sources, QStringList() << "source1");
+    }
+
+    void testDetachBeforeDrain()
+    {
+        SyncAccountMock account(1);
+        SyncAccountMock account2(2);
+        {
+            SyncQueueJournal journal(journalFile());
+            SyncQueue queue;
+            queue.setJournal(&journal);
+            queue.push(&account);
+            queue.push(&account2);
+
+            // the daemon drains the queues on quit
+            queue.setJournal(0);
+            while (queue.count()) {
+                queue.popNext();
+            }
+        }
+
+        SyncQueueJournal journal(journalFile());
+        QCOMPARE(journal.load().size(), 2);
+    }
+
+    void testReplayClear()
+    {
+        SyncAccountMock account(1);
+        {
+            SyncQueueJournal journal(journalFile());
+            SyncQueue queue;
+            queue.setJournal(&journal);
+
+            queue.push(&account);
+            queue.clear();
+        }
+
+        SyncQueueJournal journal(journalFile());
+        QVERIFY(journal.load().isEmpty());
+    }
+
+    void testEncodeSources()
+    {
+        SyncAccountMock account(1);
+        const QStringList sources = QStringList() << "my calendar" << "a,b" << "*";
+        {
+            SyncQueueJournal journal(journalFile());
+            SyncQueue queue;
+            queue.setJournal(&journal);
+            queue.push(&account, sources);
+        }
+
+        SyncQueueJournal journal(journalFile());
+        QList<SyncJournalEntry> entries = journal.load();
+        QCOMPARE(entries.size(), 1);
+        QCOMPARE(entries[0].sources.toSet(), sources.toSet());
+    }
+
+    void testIgnorePartialRecord()
+    {
+        SyncAccountMock account(1);
+        {
+            SyncQueueJournal journal(journalFile());
+            SyncQueue queue;
+            queue.setJournal(&journal);
+            queue.push(&account, "source1", false);
+        }
+
+        // simulate a crash during a write
+        QFile file(journalFile());
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Append));
+        file.write("P 2 0");
+        file.close();
+
+        SyncQueueJournal journal(journalFile());
+        QList<SyncJournalEntry> entries = journal.load();
+        QCOMPARE(entries.size(), 1);
+        QCOMPARE(entries[0].accountId, 1);
+    }
+
+    void testCompaction()
+    {
+        SyncAccountMock account(1);
+        SyncAccountMock account2(2);
+
+        SyncQueueJournal journal(journalFile());
+        SyncQueue queue;
+        queue.setJournal(&journal);
+        for (int i = 0; i < 1000; i++) {
+            queue.push(&account, QString("source%1").arg(i % 10), false);
+            queue.push(&account2);
+            queue.remove(&account2);
+        }
+
+        // the journal does not grow with the number of changes
+        QVERIFY(countLines() < 300);
+
+        QList<SyncJournalEntry> entries = journal.load();
+        QCOMPARE(entries.size(), 1);
+        QCOMPARE(entries[0].accountId, 1);
+        QCOMPARE(entries[0].sources.size(), 10);
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    // The following line causes Google Mock to throw an exception on failure,
+    // which will be interpreted by your testing framework as a test failure.
+    ::testing::GTEST_FLAG(throw_on_failure) = true;
+    ::testing::InitGoogleMock(&argc, argv);
+
+    QCoreApplication app(argc, argv);
+    app.setAttribute(Qt::AA_Use96Dpi, true);
+    SyncQueueJournalTest tc;
+    return QTest::qExec(&tc, argc, argv);
+}
+
+#include "sync-queue-journal-test.moc"
@@ -160,6 +160,84 @@ private Q_SLOTS:
         QVERIFY(queue.contains(&account, QStringLiteral("account1Source0")));
         QVERIFY(queue.contains(&account, QStringLiteral("account1Source1")));
     }
+
+    void testPopByPriority()
+    {
+        SyncQueue queue;
+        SyncAccountMock account(1);
+        SyncAccountMock account2(2);
+        SyncAccountMock account3(3);
+
+        queue.push(&account, QStringList(), false, SyncJob::PeriodicPriority);
+        queue.push(&account2, QStringList(), false, SyncJob::LocalChangePriority);
+        queue.push(&account3, QStringList(), false, SyncJob::InteractivePriority);
+
+        QCOMPARE(queue.popNext().account()->id(), account3.id());
+        QCOMPARE(queue.popNext().account()->id(), account2.id());
+        QCOMPARE(queue.popNext().account()->id(), account.id());
+        QVERIFY(queue.isEmpty());
+    }
+
+    void testPromotePriority()
+    {
+        SyncQueue queue;
+        SyncAccountMock account(1);
+        SyncAccountMock account2(2);
+
+        queue.push(&account, QStringLiteral("account1Source0"), false, SyncJob::LocalChangePriority);
+        queue.push(&account2, QStringList(), false, SyncJob::PeriodicPriority);
+
+        // a interactive request moves the periodic job to the front
+        queue.push(&account2, QStringLiteral("account2Source0"), false, SyncJob::InteractivePriority);
+        QCOMPARE(queue.count(), 2);
+
+        SyncJob job = queue.popNext();
+        QCOMPARE(job.account()->id(), account2.id());
+        QCOMPARE(job.priority(), SyncJob::InteractivePriority);
+        QCOMPARE(job.sources().size(), 0);
+
+        // a lower priority request does not change the job order
+        queue.push(&account2, QStringList(), false, SyncJob::PeriodicPriority);
+        queue.push(&account, QStringList(), false, SyncJob::PeriodicPriority);
+        QCOMPARE(queue.popNext().account()->id(), account.id());
+    }
+
+    void testPushQueue()
+    {
+        SyncQueue queue;
+        SyncQueue offlineQueue;
+        SyncAccountMock account(1);
+        SyncAccountMock account2(2);
+
+        queue.push(&account, QStringLiteral("account1Source0"), false);
+        offlineQueue.push(&account, QStringLiteral("account1Source1"), false);
+        offlineQueue.push(&account2, QStringLiteral("account2Source0"), false);
+
+        // jobs for the same account are merged
+        queue.push(offlineQueue);
+        QCOMPARE(queue.count(), 2);
+        QVERIFY(queue.contains(&account, QStringList() << QStringLiteral("account1Source0")
+                                                       << QStringLiteral("account1Source1")));
+        QVERIFY(queue.contains(&account2, QStringLiteral("account2Source0")));
+    }
+
+    void testPopNextSkipBusyAccounts()
+    {
+        SyncQueue queue;
+        SyncAccountMock account(1);
+        SyncAccountMock account2(2);
+
+        queue.push(&account);
+        queue.push(&account2);
+
+        SyncJob job = queue.popNext(QSet<int>() << account.id());
+        QCOMPARE(job.account()->id(), account2.id());
+        QCOMPARE(queue.count(), 1);
+
+        job = queue.popNext(QSet<int>() << account.id());
+        QVERIFY(!job.isValid());
+        QCOMPARE(queue.count(), 1);
+    }
 };
 
 int main(int argc, char *argv[])
@@ -0,0 +1,310 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/sync-result-store.h"
+#include "config.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+#include <QTemporaryDir>
+#include <QSettings>
+
+
+class SyncResultStoreTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir m_dir;
+
+    QString logFile() const
+    {
+        return m_dir.path() + QStringLiteral("/sync-results.log");
+    }
+
+    int countLines() const
+    {
+        QFile file(logFile());
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            return 0;
+        }
+        return file.readAll().count('\n');
+    }
+
+private Q_SLOTS:
+
+    void cleanup()
+    {
+        QFile::remove(logFile());
+        QFile::remove(m_dir.path() + QStringLiteral("/sync-monitor.conf"));
+    }
+
+    void testSaveResult()
+    {
+        SyncResultStore store(logFile());
+        QVERIFY(!store.hasResults(1));
+
+        store.save(1, "calendar_1", "200", "2016-01-01T10:00:00Z");
+        QVERIFY(store.hasResults(1));
+        QCOMPARE(store.lastResult(1, "calendar_1"), QStringLiteral("200"));
+        QCOMPARE(store.lastSuccessfulDate(1, "calendar_1"), QStringLiteral("2016-01-01T10:00:00Z"));
+
+        // failures keep the last successful date
+        store.save(1, "calendar_1", "403", "2016-01-02T10:00:00Z");
+        SyncResult result = store.result(1, "calendar_1");
+        QCOMPARE(result.result, QStringLiteral("403"));
+        QCOMPARE(result.date, QStringLiteral("2016-01-02T10:00:00Z"));
+        QCOMPARE(result.lastSuccessfulDate, QStringLiteral("2016-01-01T10:00:00Z"));
+
+        QVERIFY(store.lastResult(1, "calendar_2").isEmpty());
+        QVERIFY(store.lastResult(2, "calendar_1").isEmpty());
+    }
+
+    void testBatchedWrite()
+    {
+        {
+            SyncResultStore store(logFile());
+            store.save(1, "calendar_1", "200", "2016-01-01T10:00:00Z");
+            store.save(1, "calendar 2", "0", "2016-01-01T10:00:01Z");
+            store.save(2, "calendar-3", "500", "2016-01-01T10:00:02Z");
+
+            // nothing is written until flush
+            QCOMPARE(store.pendingRecords(), 3);
+            QCOMPARE(countLines(), 0);
+
+            store.flush();
+            QCOMPARE(store.pendingRecords(), 0);
+            QCOMPARE(countLines(), 3);
+        }
+
+        SyncResultStore store(logFile());
+        store.load();
+        QCOMPARE(store.accounts().toSet(), QSet<uint>() << 1 << 2);
+        QCOMPARE(store.lastResult(1, "calendar_1"), QStringLiteral("200"));
+        QCOMPARE(store.lastResult(1, "calendar 2"), QStringLiteral("0"));
+        QCOMPARE(store.lastResult(2, "calendar-3"), QStringLiteral("500"));
+        QVERIFY(store.lastSuccessfulDate(2, "calendar-3").isEmpty());
+    }
+
+    void testFlushOnDestroy()
+    {
+        {
+            SyncResultStore store(logFile());
+            store.save(1, "calendar_1", "200", "2016-01-01T10:00:00Z");
+        }
+
+        SyncResultStore store(logFile());
+        store.load();
+        QCOMPARE(store.lastResult(1, "calendar_1"), QStringLiteral("200"));
+    }
+
+    void testRemove()
+    {
+        {
+            SyncResultStore store(logFile());
+            store.save(1, "calendar_1", "200", "2016-01-01T10:00:00Z");
+            store.save(1, "calendar_2", "200", "2016-01-01T10:00:00Z");
+            store.save(2, "calendar_3", "200", "2016-01-01T10:00:00Z");
+            store.save(2, "calendar_4", "200", "2016-01-01T10:00:00Z");
+            store.flush();
+
+            store.remove(1, "calendar_1");
+            store.removeAccount(2);
+            // removing unknown results does not write anything
+            store.remove(3, "calendar_5");
+            store.removeAccount(4);
+            QCOMPARE(store.pendingRecords(), 2);
+            store.flush();
+
+            QCOMPARE(store.accounts(), QList<uint>() << 1);
+        }
+
+        SyncResultStore store(logFile());
+        store.load();
+        QCOMPARE(store.accounts(), QList<uint>() << 1);
+        QVERIFY(store.lastResult(1, "calendar_1").isEmpty());
+        QCOMPARE(store.lastResult(1, "calendar_2"), QStringLiteral("200"));
+        QVERIFY(!store.hasResults(2));
+
+        store.remove(1, "calendar_2");
+        QVERIFY(!store.hasResults(1));
+    }
+
+    void testWindows()
+    {
+        {
+            SyncResultStore store(logFile());
+            store.setWindow(1, "calendar_1", 7);
+            store.setWindow(1, "calendar_2", 14);
+            store.setWindow(2, "calendar_3", 7);
+            // windows do not count as results
+            QVERIFY(!store.hasResults(1));
+            store.setWindow(1, "calendar_2", 0);
+            store.removeAccount(2);
+            store.flush();
+        }
+
+        SyncResultStore store(logFile());
+        store.load();
+        QCOMPARE(store.window(1, "calendar_1"), 7);
+        QCOMPARE(store.window(1, "calendar_2"), 0);
+        QCOMPARE(store.window(2, "calendar_3"), 0);
+        QCOMPARE(store.windows(1).keys(), QStringList() << "calendar_1");
+
+        // survives a compaction
+        store.compact();
+        store.load();
+        QCOMPARE(store.window(1, "calendar_1"), 7);
+
+        store.remove(1, "calendar_1");
+        QCOMPARE(store.window(1, "calendar_1"), 0);
+    }
+
+    void testNextWindow()
+    {
+        SyncResultStore store(logFile());
+        QCOMPARE(store.nextWindow(1, "calendar_1", 7, 30), 7);
+
+        // a failed first sync retries with the first window
+        store.save(1, "calendar_1", "403", "2016-01-01T10:00:00Z");
+        QCOMPARE(store.nextWindow(1, "calendar_1", 7, 30), 7);
+
+        // the window advances once the daemon saves the synced one
+        store.save(1, "calendar_1", "200", "2016-01-02T10:00:00Z");
+        store.setWindow(1, "calendar_1", 7);
+        QCOMPARE(store.nextWindow(1, "calendar_1", 7, 30), 14);
+        store.setWindow(1, "calendar_1", 28);
+        QCOMPARE(store.nextWindow(1, "calendar_1", 7, 30), 0);
+
+        // a failed backfill keeps the last window
+        store.save(1, "calendar_1", "20020", "2016-01-03T10:00:00Z");
+        QCOMPARE(store.nextWindow(1, "calendar_1", 7, 30), 0);
+        QCOMPARE(store.window(1, "calendar_1"), 28);
+
+        // sources synced before the staged first sync use the full window
+        store.save(1, "calendar_2", "200", "2016-01-01T10:00:00Z");
+        QCOMPARE(store.nextWindow(1, "calendar_2", 7, 30), 0);
+    }
+
+    void testCompaction()
+    {
+        {
+            SyncResultStore store(logFile());
+            for(int i = 0; i < 1000; i++) {
+                store.save(1, "calendar_1", QString::number(i), "2016-01-01T10:00:00Z");
+                store.flush();
+            }
+        }
+
+        // the log never grows much more than the number of results
+        QVERIFY(countLines() < 300);
+
+        SyncResultStore store(logFile());
+        store.load();
+        QCOMPARE(store.lastResult(1, "calendar_1"), QStringLiteral("999"));
+        QVERIFY(!store.needsCompaction());
+    }
+
+    void testInvalidRecords()
+    {
+        QFile file(logFile());
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Text));
+        file.write("V 1\n"
+                   "S 1 calendar_1 200 2016-01-01T10:00:00Z 2016-01-01T10:00:00Z\n"
+                   "S 1 calendar_2 20");
+        file.close();
+
+        {
+            SyncResultStore store(logFile());
+            store.load();
+            QCOMPARE(store.lastResult(1, "calendar_1"), QStringLiteral("200"));
+            QVERIFY(store.lastResult(1, "calendar_2").isEmpty());
+
+            // the next record is not merged with the incomplete line
+            store.save(1, "calendar_3", "403", "2016-01-02T10:00:00Z");
+            store.setWindow(1, "calendar_3", 7);
+            store.flush();
+        }
+
+        SyncResultStore store(logFile());
+        store.load();
+        QCOMPARE(store.lastResult(1, "calendar_1"), QStringLiteral("200"));
+        QCOMPARE(store.lastResult(1, "calendar_3"), QStringLiteral("403"));
+        QCOMPARE(store.window(1, "calendar_3"), 7);
+    }
+
+    void testFailureCountIgnored()
+    {
+        QFile file(logFile());
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Text));
+        file.write("V 1\n"
+                   "S 1 calendar_1 20020 2016-01-02T10:00:00Z 2016-01-01T10:00:00Z 2\n");
+        file.close();
+
+        SyncResultStore store(logFile());
+        store.load();
+        QCOMPARE(store.lastResult(1, "calendar_1"), QStringLiteral("20020"));
+        QCOMPARE(store.lastSuccessfulDate(1, "calendar_1"), QStringLiteral("2016-01-01T10:00:00Z"));
+    }
+
+    void testMigrateSettings()
+    {
+        QSettings settings(m_dir.path() + QStringLiteral("/sync-monitor.conf"), QSettings::IniFormat);
+        settings.setValue("account_1_calendar_1/" ACCOUNT_LOG_LAST_SYNC_RESULT, "200");
+        settings.setValue("account_1_calendar_1/" ACCOUNT_LOG_LAST_SYNC_DATE, "2016-01-02T10:00:00Z");
+        settings.setValue("account_1_calendar_1/" ACCOUNT_LOG_LAST_SUCCESSFUL_DATE, "2016-01-02T10:00:00Z");
+        settings.setValue("account_2_calendar_2/" ACCOUNT_LOG_LAST_SYNC_RESULT, "403");
+        settings.setValue("account_2_calendar_2/" ACCOUNT_LOG_LAST_SYNC_DATE, "2016-01-03T10:00:00Z");
+        settings.setValue("retry/1", "keep");
+        settings.sync();
+
+        {
+            SyncResultStore store(logFile());
+            QCOMPARE(store.migrate(&settings), 2);
+            QCOMPARE(store.lastResult(1, "calendar_1"), QStringLiteral("200"));
+            QCOMPARE(store.lastSuccessfulDate(1, "calendar_1"), QStringLiteral("2016-01-02T10:00:00Z"));
+            QCOMPARE(store.lastResult(2, "calendar_2"), QStringLiteral("403"));
+            QVERIFY(store.lastSuccessfulDate(2, "calendar_2").isEmpty());
+            QCOMPARE(store.pendingRecords(), 0);
+        }
+
+        // migrated groups are removed from the settings
+        QCOMPARE(settings.childGroups(), QStringList() << "retry");
+
+        SyncResultStore store(logFile());
+        store.load();
+        QCOMPARE(store.migrate(&settings), 0);
+        QCOMPARE(store.lastResult(2, "calendar_2"), QStringLiteral("403"));
+    }
+
+    void testIsSuccess()
+    {
+        QVERIFY(SyncResultStore::isSuccess("0"));
+        QVERIFY(SyncResultStore::isSuccess("200"));
+        QVERIFY(SyncResultStore::isSuccess("204"));
+        QVERIFY(SyncResultStore::isSuccess("207"));
+        QVERIFY(!SyncResultStore::isSuccess(""));
+        QVERIFY(!SyncResultStore::isSuccess("403"));
+        QVERIFY(!SyncResultStore::isSuccess("22000"));
+    }
+};
+
+QTEST_MAIN(SyncResultStoreTest)
+
+#include "sync-result-store-test.moc"
@@ -0,0 +1,250 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/sync-retry-policy.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+#include <QTemporaryDir>
+
+
+class SyncRetryPolicyTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir m_dir;
+
+    QString settingsFile() const
+    {
+        return m_dir.path() + QStringLiteral("/sync-monitor.conf");
+    }
+
+private Q_SLOTS:
+
+    void cleanup()
+    {
+        QFile::remove(settingsFile());
+    }
+
+    void testClassifyStatus()
+    {
+        QCOMPARE(SyncRetryPolicy::classify(""), SyncRetryPolicy::Success);
+        QCOMPARE(SyncRetryPolicy::classify("0"), SyncRetryPolicy::Success);
+        QCOMPARE(SyncRetryPolicy::classify("200"), SyncRetryPolicy::Success);
+        QCOMPARE(SyncRetryPolicy::classify("500"), SyncRetryPolicy::Transient);
+        QCOMPARE(SyncRetryPolicy::classify("10403"), SyncRetryPolicy::Transient);
+        QCOMPARE(SyncRetryPolicy::classify("10500"), SyncRetryPolicy::Transient);
+        QCOMPARE(SyncRetryPolicy::classify("20020"), SyncRetryPolicy::Transient);
+        QCOMPARE(SyncRetryPolicy::classify("403"), SyncRetryPolicy::Permanent);
+        QCOMPARE(SyncRetryPolicy::classify("420"), SyncRetryPolicy::Permanent);
+        QCOMPARE(SyncRetryPolicy::classify("1500"), SyncRetryPolicy::Transient);
+        QCOMPARE(SyncRetryPolicy::classify("20021"), SyncRetryPolicy::Permanent);
+        // unknown statuses are retried
+        QCOMPARE(SyncRetryPolicy::classify("-1"), SyncRetryPolicy::Transient);
+        QCOMPARE(SyncRetryPolicy::classify("12345"), SyncRetryPolicy::Transient);
+    }
+
+    void testClassifyMatchesSyncMode()
+    {
+        // a retried error must not reset or rewrite the local data
+        QStringList statuses;
+        statuses << "401" << "403" << "404" << "405" << "406" << "407" << "420" << "500"
+                 << "506" << "514" << "1500" << "10403" << "10500" << "20006" << "20007"
+                 << "20017" << "20020" << "20021" << "20022" << "20026" << "20027"
+                 << "20028" << "20046" << "20047" << "22000" << "22001" << "22002";
+        Q_FOREACH(const QString &status, statuses) {
+            if (SyncRetryPolicy::classify(status) == SyncRetryPolicy::Transient) {
+                QCOMPARE(SyncRetryPolicy::syncMode(status, true, 1), QString("two-way"));
+            }
+        }
+    }
+
+    void testSyncMode_data()
+    {
+        QTest::addColumn<QString>("lastStatus");
+        QTest::addColumn<bool>("hasBaseline");
+        QTest::addColumn<int>("failures");
+        QTest::addColumn<QString>("mode");
+
+        QTest::newRow("first sync") << "" << false << 0 << "refresh-from-remote";
+        QTest::newRow("never succeeded") << "20020" << false << 1 << "refresh-from-remote";
+        QTest::newRow("success") << "200" << true << 0 << "two-way";
+        QTest::newRow("timeout") << "20020" << true << 1 << "two-way";
+        QTest::newRow("server not found") << "20046" << true << 5 << "two-way";
+        QTest::newRow("canceled") << "20017" << true << 1 << "two-way";
+        QTest::newRow("remote fatal") << "1500" << true << 1 << "two-way";
+        QTest::newRow("refused") << "20022" << true << 1 << "two-way";
+        QTest::newRow("disk full") << "420" << true << 1 << "refresh-from-remote";
+        QTest::newRow("bad content") << "20007" << true << 1 << "slow";
+        QTest::newRow("items failed") << "22001" << true << 1 << "slow";
+        QTest::newRow("unknown") << "20023" << true << 1 << "two-way";
+        QTest::newRow("unknown repeated") << "20023" << true << 3 << "slow";
+        QTest::newRow("no status") << "-1" << true << 3 << "slow";
+    }
+
+    void testSyncMode()
+    {
+        QFETCH(QString, lastStatus);
+        QFETCH(bool, hasBaseline);
+        QFETCH(int, failures);
+        QFETCH(QString, mode);
+
+        QString reason;
+        QCOMPARE(SyncRetryPolicy::syncMode(lastStatus, hasBaseline, failures, &reason), mode);
+        QVERIFY(!reason.isEmpty());
+    }
+
+    void testBackoffGrows()
+    {
+        SyncRetryPolicy policy(0);
+
+        qint64 previousMax = 0;
+        for (int i = 1; i <= 5; i++) {
+            const QDateTime before = QDateTime::currentDateTimeUtc();
+            QVERIFY(policy.failed(1, "calendar"));
+            QCOMPARE(policy.failures(1, "calendar"), i);
+
+            // delay is between half and the full backoff interval
+            const qint64 full = 30000 * (1 << (i - 1));
+            const qint64 delay = before.msecsTo(policy.nextAttempt(1, "calendar"));
+            QVERIFY(delay >= (full / 2) - 1000);
+            QVERIFY(delay <= full + 1000);
+            QVERIFY(full > previousMax);
+            previousMax = full;
+        }
+
+        // other sources are not affected
+        QCOMPARE(policy.failures(1, "other"), 0);
+        QCOMPARE(policy.failures(2, "calendar"), 0);
+    }
+
+    void testBackoffIsCapped()
+    {
+        SyncRetryPolicy policy(0);
+        for (int i = 0; i < 7; i++) {
+            QVERIFY(policy.failed(1, "calendar"));
+        }
+        const qint64 delay = QDateTime::currentDateTimeUtc().msecsTo(policy.nextAttempt(1, "calendar"));
+        QVERIFY(delay <= 60 * 60 * 1000);
+    }
+
+    void testGiveUp()
+    {
+        SyncRetryPolicy policy(0);
+        for (int i = 0; i < 8; i++) {
+            QVERIFY(policy.failed(1, "calendar"));
+        }
+        QVERIFY(!policy.failed(1, "calendar"));
+        QVERIFY(!policy.nextAttempt(1, "calendar").isValid());
+    }
+
+    void testClear()
+    {
+        SyncRetryPolicy policy(0);
+        policy.failed(1, "calendar");
+        policy.failed(1, "other");
+        policy.failed(1, "");
+        policy.failed(2, "calendar");
+
+        // a working source also clears the account failure
+        policy.clear(1, "calendar");
+        QCOMPARE(policy.failures(1, "calendar"), 0);
+        QCOMPARE(policy.failures(1, ""), 0);
+        QCOMPARE(policy.failures(1, "other"), 1);
+
+        policy.reset(1);
+        QCOMPARE(policy.failures(1, "other"), 0);
+        QCOMPARE(policy.failures(2, "calendar"), 1);
+    }
+
+    void testNextDue()
+    {
+        SyncRetryPolicy policy(0);
+        QVERIFY(!policy.nextDue().isValid());
+
+        policy.failed(1, "calendar");
+        policy.failed(2, "");
+        QDateTime first = qMin(policy.nextAttempt(1, "calendar"), policy.nextAttempt(2, ""));
+        QCOMPARE(policy.nextDue(), first);
+
+        policy.reset(1);
+        policy.reset(2);
+        QVERIFY(!policy.nextDue().isValid());
+    }
+
+    void testPersistState()
+    {
+        QDateTime next;
+        {
+            QSettings settings(settingsFile(), QSettings::IniFormat);
+            SyncRetryPolicy policy(&settings);
+            policy.failed(1, "calendar");
+            policy.failed(1, "calendar");
+            policy.failed(3, "");
+            next = policy.nextAttempt(1, "calendar");
+        }
+
+        QSettings settings(settingsFile(), QSettings::IniFormat);
+        SyncRetryPolicy policy(&settings);
+        QCOMPARE(policy.failures(1, "calendar"), 2);
+        QCOMPARE(policy.failures(3, ""), 1);
+        // stored with seconds precision
+        QVERIFY(qAbs(policy.nextAttempt(1, "calendar").secsTo(next)) <= 1);
+    }
+
+    void testRetryDue()
+    {
+        QSettings settings(settingsFile(), QSettings::IniFormat);
+        // an attempt overdue since the last run
+        settings.beginWriteArray("retry", 2);
+        settings.setArrayIndex(0);
+        settings.setValue("account", 1);
+        settings.setValue("source", "calendar");
+        settings.setValue("failures", 1);
+        settings.setValue("next", QDateTime::currentDateTimeUtc().addSecs(-10).toString(Qt::ISODate));
+        settings.setArrayIndex(1);
+        settings.setValue("account", 2);
+        settings.setValue("source", "");
+        settings.setValue("failures", 3);
+        settings.setValue("next", QDateTime::currentDateTimeUtc().addSecs(-10).toString(Qt::ISODate));
+        settings.endArray();
+
+        SyncRetryPolicy policy(&settings);
+        QSignalSpy spy(&policy, SIGNAL(retryDue(int,QStringList)));
+        QTRY_COMPARE(spy.count(), 2);
+
+        QHash<int, QStringList> due;
+        Q_FOREACH(const QList<QVariant> &args, spy) {
+            due.insert(args[0].toInt(), args[1].toStringList());
+        }
+        QCOMPARE(due.value(1), QStringList() << "calendar");
+        // empty list means the whole account
+        QVERIFY(due.contains(2));
+        QVERIFY(due.value(2).isEmpty());
+
+        // failures are kept until the source syncs successfully
+        QCOMPARE(policy.failures(1, "calendar"), 1);
+        QVERIFY(!policy.nextAttempt(1, "calendar").isValid());
+    }
+};
+
+QTEST_MAIN(SyncRetryPolicyTest)
+
+#include "sync-retry-policy-test.moc"
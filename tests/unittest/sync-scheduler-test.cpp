@@ -0,0 +1,145 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/sync-scheduler.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+
+// use small slots to keep the tests fast
+#define TEST_SLOT_SIZE  100
+
+class SyncSchedulerTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+
+    void testScheduleAndRemove()
+    {
+        SyncScheduler scheduler(0, TEST_SLOT_SIZE);
+        QCOMPARE(scheduler.count(), 0);
+
+        scheduler.schedule(1, "", 60);
+        scheduler.schedule(1, "calendar", 120);
+        scheduler.schedule(2, "", 60);
+        QCOMPARE(scheduler.count(), 3);
+        QVERIFY(scheduler.contains(1, ""));
+        QVERIFY(scheduler.contains(1, "calendar"));
+        QCOMPARE(scheduler.period(1, "calendar"), 120);
+        QVERIFY(scheduler.nextSync(1, "calendar") > QDateTime::currentDateTime().addSecs(119));
+
+        QStringList sources = scheduler.sources(1);
+        sources.sort();
+        QCOMPARE(sources, QStringList() << "" << "calendar");
+        QCOMPARE(scheduler.sources(3), QStringList());
+
+        scheduler.remove(1, "calendar");
+        QVERIFY(!scheduler.contains(1, "calendar"));
+        QCOMPARE(scheduler.count(), 2);
+
+        scheduler.remove(1);
+        QVERIFY(!scheduler.contains(1, ""));
+        QCOMPARE(scheduler.count(), 1);
+
+        // zero period disables the periodic sync
+        scheduler.schedule(2, "", 0);
+        QCOMPARE(scheduler.count(), 0);
+    }
+
+    void testReschedule()
+    {
+        SyncScheduler scheduler(0, TEST_SLOT_SIZE);
+        scheduler.schedule(1, "", 2);
+        const QDateTime first = scheduler.nextSync(1, "");
+
+        QTest::qWait(500);
+        scheduler.reschedule(1, "");
+        QVERIFY(scheduler.nextSync(1, "") > first);
+
+        // unknown entries are not created
+        scheduler.reschedule(2, "");
+        QVERIFY(!scheduler.contains(2, ""));
+    }
+
+    void testNextDue()
+    {
+        SyncScheduler scheduler(0, TEST_SLOT_SIZE);
+        QVERIFY(!scheduler.nextDue().isValid());
+
+        scheduler.schedule(1, "", 120);
+        scheduler.schedule(2, "calendar", 60);
+        QCOMPARE(scheduler.nextDue(), scheduler.nextSync(2, "calendar"));
+
+        scheduler.remove(2);
+        QCOMPARE(scheduler.nextDue(), scheduler.nextSync(1, ""));
+
+        // nothing expired yet
+        QSignalSpy spy(&scheduler, SIGNAL(syncDue(int,QStringList)));
+        scheduler.checkDue();
+        QCOMPARE(spy.count(), 0);
+    }
+
+    void testSyncDue()
+    {
+        SyncScheduler scheduler(0, TEST_SLOT_SIZE);
+        QSignalSpy spy(&scheduler, SIGNAL(syncDue(int,QStringList)));
+
+        scheduler.schedule(1, "calendar", 1);
+        QTRY_COMPARE_WITH_TIMEOUT(spy.count(), 1, 3000);
+        QCOMPARE(spy[0][0].toInt(), 1);
+        QCOMPARE(spy[0][1].toStringList(), QStringList() << "calendar");
+
+        // entry is kept for the next period
+        QVERIFY(scheduler.contains(1, "calendar"));
+        QVERIFY(scheduler.nextSync(1, "calendar") > QDateTime::currentDateTime());
+        QTRY_COMPARE_WITH_TIMEOUT(spy.count(), 2, 3000);
+    }
+
+    void testWholeAccountDue()
+    {
+        SyncScheduler scheduler(0, TEST_SLOT_SIZE);
+        QSignalSpy spy(&scheduler, SIGNAL(syncDue(int,QStringList)));
+
+        scheduler.schedule(1, "", 1);
+        scheduler.schedule(1, "calendar", 1);
+        QTRY_COMPARE_WITH_TIMEOUT(spy.count(), 1, 3000);
+        // empty list means all sources
+        QVERIFY(spy[0][1].toStringList().isEmpty());
+    }
+
+    void testAlignJobs()
+    {
+        SyncScheduler scheduler(0, TEST_SLOT_SIZE);
+        QSignalSpy spy(&scheduler, SIGNAL(syncDue(int,QStringList)));
+
+        // a few slots apart, but close enough to share the wake-up
+        scheduler.schedule(1, "", 4);
+        QTest::qWait(300);
+        scheduler.schedule(2, "", 4);
+
+        QTRY_VERIFY_WITH_TIMEOUT(spy.count() > 0, 6000);
+        QCOMPARE(spy.count(), 2);
+        QCOMPARE(scheduler.nextSync(1, ""), scheduler.nextSync(2, ""));
+    }
+};
+
+QTEST_MAIN(SyncSchedulerTest)
+
+#include "sync-scheduler-test.moc"
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/sync-token-cache.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+
+// tokens expire in one second, the last 200ms are not used
+#define TEST_REFRESH_MARGIN 200
+
+class SyncTokenCacheTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+
+    void testTokenLookup()
+    {
+        SyncTokenCache cache(0, TEST_REFRESH_MARGIN);
+        QString token;
+
+        QVERIFY(!cache.token(1, "google-caldav", &token));
+        cache.insert(1, "google-caldav", "token-1", 3600);
+        cache.insert(2, "google-caldav", "token-2", 3600);
+
+        QVERIFY(cache.token(1, "google-caldav", &token));
+        QCOMPARE(token, QStringLiteral("token-1"));
+        QVERIFY(cache.token(2, "google-caldav", &token));
+        QCOMPARE(token, QStringLiteral("token-2"));
+        QVERIFY(!cache.token(1, "other-service", &token));
+        QCOMPARE(cache.count(), 2);
+    }
+
+    void testReplaceToken()
+    {
+        SyncTokenCache cache(0, TEST_REFRESH_MARGIN);
+        QString token;
+
+        cache.insert(1, "google-caldav", "old", 3600);
+        cache.insert(1, "google-caldav", "new", 3600);
+        QVERIFY(cache.token(1, "google-caldav", &token));
+        QCOMPARE(token, QStringLiteral("new"));
+        QCOMPARE(cache.count(), 1);
+    }
+
+    void testRemove()
+    {
+        SyncTokenCache cache(0, TEST_REFRESH_MARGIN);
+        cache.insert(1, "calendar", "a", 3600);
+        cache.insert(1, "contacts", "b", 3600);
+        cache.insert(2, "calendar", "c", 3600);
+
+        cache.remove(1, "contacts");
+        QVERIFY(cache.contains(1, "calendar"));
+        QVERIFY(!cache.contains(1, "contacts"));
+
+        cache.remove(1);
+        QVERIFY(!cache.contains(1, "calendar"));
+        QVERIFY(cache.contains(2, "calendar"));
+
+        cache.clear();
+        QCOMPARE(cache.count(), 0);
+    }
+
+    void testExpiration()
+    {
+        SyncTokenCache cache(0, TEST_REFRESH_MARGIN);
+        QString token;
+
+        cache.insert(1, "google-caldav", "token", 1);
+        QVERIFY(cache.contains(1, "google-caldav"));
+
+        // the token is dropped before it really expires
+        QTest::qWait(900);
+        QVERIFY(!cache.contains(1, "google-caldav"));
+        QVERIFY(!cache.token(1, "google-caldav", &token));
+        QTRY_COMPARE(cache.count(), 0);
+    }
+
+    void testRefreshUsedToken()
+    {
+        SyncTokenCache cache(0, TEST_REFRESH_MARGIN);
+        QSignalSpy refreshNeeded(&cache, SIGNAL(refreshNeeded(uint,QString)));
+        QString token;
+
+        cache.insert(1, "google-caldav", "used", 1);
+        cache.insert(2, "google-caldav", "unused", 1);
+        QVERIFY(cache.token(1, "google-caldav", &token));
+
+        // only the token in use is refreshed, before it stops being valid
+        QTRY_COMPARE(refreshNeeded.count(), 1);
+        QCOMPARE(refreshNeeded.at(0).at(0).toUInt(), 1u);
+        QCOMPARE(refreshNeeded.at(0).at(1).toString(), QStringLiteral("google-caldav"));
+        QVERIFY(cache.contains(1, "google-caldav"));
+
+        // not requested again while the refreshed token is not used
+        QTest::qWait(500);
+        QCOMPARE(refreshNeeded.count(), 1);
+    }
+
+    void testShortLivedTokenIsNotRefreshed()
+    {
+        SyncTokenCache cache(0, 400);
+        QSignalSpy refreshNeeded(&cache, SIGNAL(refreshNeeded(uint,QString)));
+        QString token;
+
+        // valid for 600ms, refresh would happen after 200ms
+        cache.insert(1, "google-caldav", "token", 1);
+        QVERIFY(cache.token(1, "google-caldav", &token));
+        QTRY_COMPARE(cache.count(), 0);
+        QCOMPARE(refreshNeeded.count(), 0);
+    }
+};
+
+QTEST_MAIN(SyncTokenCacheTest)
+
+#include "sync-token-cache-test.moc"
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/sync-trace.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+
+class SyncTraceTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+
+    void testSpans()
+    {
+        SyncTrace trace;
+        trace.begin(1, QString(), "queue");
+        // already open
+        trace.begin(1, QString(), "queue");
+        QVERIFY(trace.isOpen(1, QString(), "queue"));
+        trace.end(1, QString(), "queue");
+        QVERIFY(!trace.isOpen(1, QString(), "queue"));
+        // no matching begin
+        trace.end(1, QString(), "queue");
+        trace.end(2, "source", "sync-source");
+        trace.instant(1, QString(), "status: running");
+
+        QList<SyncTraceEvent> events = trace.events();
+        QCOMPARE(events.size(), 3);
+        QCOMPARE(events[0].type, SyncTraceEvent::Begin);
+        QCOMPARE(events[1].type, SyncTraceEvent::End);
+        QCOMPARE(events[2].type, SyncTraceEvent::Instant);
+        QCOMPARE(events[2].name, QStringLiteral("status: running"));
+        QVERIFY(events[0].timestamp <= events[1].timestamp);
+    }
+
+    void testSourceSpans()
+    {
+        SyncTrace trace;
+        trace.begin(1, "calendar_1", "sync-source");
+        trace.begin(1, "calendar_2", "sync-source");
+        trace.end(1, "calendar_1", "sync-source");
+        QVERIFY(trace.isOpen(1, "calendar_2", "sync-source"));
+        QCOMPARE(trace.count(), 3);
+    }
+
+    void testEndAll()
+    {
+        SyncTrace trace;
+        trace.begin(1, QString(), "job");
+        trace.begin(1, QString(), "configure");
+        trace.begin(1, "calendar_1", "sync-source");
+        trace.begin(2, QString(), "job");
+        trace.endAll(1);
+
+        QList<SyncTraceEvent> events = trace.events();
+        QCOMPARE(events.size(), 7);
+        // inner phases first
+        QCOMPARE(events[4].name, QStringLiteral("sync-source"));
+        QCOMPARE(events[4].source, QStringLiteral("calendar_1"));
+        QCOMPARE(events[5].name, QStringLiteral("configure"));
+        QCOMPARE(events[6].name, QStringLiteral("job"));
+        QVERIFY(!trace.isOpen(1, QString(), "job"));
+        QVERIFY(trace.isOpen(2, QString(), "job"));
+    }
+
+    void testRingBuffer()
+    {
+        SyncTrace trace(10);
+        QCOMPARE(trace.capacity(), 10);
+        for(int i = 0; i < 25; i++) {
+            trace.instant(1, QString(), QString::number(i));
+        }
+        QCOMPARE(trace.count(), 10);
+
+        // only the newest events are kept, oldest first
+        QList<SyncTraceEvent> events = trace.events();
+        QCOMPARE(events.first().name, QStringLiteral("15"));
+        QCOMPARE(events.last().name, QStringLiteral("24"));
+
+        trace.clear();
+        QCOMPARE(trace.count(), 0);
+        QVERIFY(trace.events().isEmpty());
+    }
+
+    void testDisabled()
+    {
+        SyncTrace trace;
+        trace.setEnabled(false);
+        trace.begin(1, QString(), "job");
+        trace.instant(1, QString(), "status: done");
+        trace.end(1, QString(), "job");
+        QCOMPARE(trace.count(), 0);
+    }
+
+    void testChromeTraceJson()
+    {
+        SyncTrace trace;
+        trace.begin(3, QString(), "configure");
+        trace.begin(3, "calendar_1", "sync-source");
+        trace.end(3, "calendar_1", "sync-source");
+        trace.end(3, QString(), "configure");
+
+        QJsonParseError error;
+        QJsonDocument doc = QJsonDocument::fromJson(trace.toJson(), &error);
+        QCOMPARE(error.error, QJsonParseError::NoError);
+
+        QJsonArray events = doc.object().value("traceEvents").toArray();
+        QCOMPARE(events.size(), 4);
+
+        QJsonObject first = events[0].toObject();
+        QCOMPARE(first.value("name").toString(), QStringLiteral("configure"));
+        QCOMPARE(first.value("ph").toString(), QStringLiteral("b"));
+        QCOMPARE(first.value("cat").toString(), QStringLiteral("sync"));
+        QCOMPARE(first.value("tid").toInt(), 3);
+        QCOMPARE(first.value("id").toString(), QStringLiteral("3/"));
+        QVERIFY(first.contains("ts"));
+        QVERIFY(first.contains("pid"));
+
+        QJsonObject source = events[2].toObject();
+        QCOMPARE(source.value("ph").toString(), QStringLiteral("e"));
+        QCOMPARE(source.value("id").toString(), QStringLiteral("3/calendar_1"));
+        QCOMPARE(source.value("args").toObject().value("source").toString(), QStringLiteral("calendar_1"));
+        QVERIFY(events[3].toObject().value("ts").toDouble() >= first.value("ts").toDouble());
+    }
+};
+
+QTEST_MAIN(SyncTraceTest)
+
+#include "sync-trace-test.moc"
@@ -0,0 +1,232 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "syncevolution-server-mock.h"
+#include "src/syncevolution-server-proxy.h"
+#include "src/syncevolution-session-proxy.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QDebug>
+#include <QDBusPendingCallWatcher>
+
+#define REPLY_TIMEOUT   5000
+
+class SyncEvolutionProxyTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    SyncEvolutionServerMock *m_server;
+
+    // the mock runs on this thread, a blocking wait would never get the reply
+    bool waitReply(const QDBusPendingCall &call)
+    {
+        QDBusPendingCallWatcher watcher(call);
+        QSignalSpy spy(&watcher, SIGNAL(finished(QDBusPendingCallWatcher*)));
+        return watcher.isFinished() || spy.wait(REPLY_TIMEOUT);
+    }
+
+    SyncEvolutionSessionProxy *openSession(const QString &sessionName)
+    {
+        QDBusPendingReply<QDBusObjectPath> reply = SyncEvolutionServerProxy::instance()->openSession(sessionName, QStringList());
+        if (!waitReply(reply) || reply.isError()) {
+            return 0;
+        }
+        return SyncEvolutionServerProxy::instance()->createSession(sessionName, reply.value());
+    }
+
+    QString sessionStatus(SyncEvolutionSessionProxy *session)
+    {
+        QDBusPendingReply<QString> reply = session->status();
+        if (!waitReply(reply) || reply.isError()) {
+            return QString();
+        }
+        return reply.value();
+    }
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        syncevolution_qt_dbus_register_types();
+        m_server = new SyncEvolutionServerMock(this);
+        if (!m_server->start()) {
+            QSKIP("org.syncevolution already running on this bus");
+        }
+    }
+
+    void cleanupTestCase()
+    {
+        delete m_server;
+    }
+
+    void init()
+    {
+        m_server->setCallLatency(0);
+        m_server->setSyncLatency(0);
+        m_server->setMaxActiveSessions(1);
+        m_server->setSessionFailureInterval(0);
+        m_server->setSyncFailureInterval(0);
+    }
+
+    void testOpenSession()
+    {
+        SyncEvolutionSessionProxy *session = openSession("google-1");
+        QVERIFY(session);
+        QVERIFY(session->isValid());
+        QCOMPARE(sessionStatus(session), QStringLiteral("idle"));
+        QCOMPARE(m_server->activeSessions(), 1);
+
+        session->destroy();
+        QTRY_COMPARE(m_server->activeSessions(), 0);
+    }
+
+    void testQueuedSession()
+    {
+        SyncEvolutionSessionProxy *first = openSession("google-1");
+        SyncEvolutionSessionProxy *second = openSession("google-2");
+        QVERIFY(first && second);
+        QCOMPARE(sessionStatus(second), QStringLiteral("queueing"));
+
+        QSignalSpy statusSpy(second, SIGNAL(statusChanged(QString,uint,QSyncStatusMap)));
+        first->destroy();
+        QTRY_COMPARE(statusSpy.count(), 1);
+        QCOMPARE(statusSpy.first().at(0).toString(), QStringLiteral("idle"));
+
+        second->destroy();
+        QTRY_COMPARE(m_server->activeSessions(), 0);
+    }
+
+    void testConfig()
+    {
+        SyncEvolutionSessionProxy *session = openSession("google-1");
+        QVERIFY(session);
+
+        QStringMultiMap config;
+        config[""]["syncURL"] = "https://example.com/caldav";
+        config["source/1_calendar"]["backend"] = "caldav";
+        QDBusPendingReply<> saveReply = session->saveConfig("google-1", config);
+        QVERIFY(waitReply(saveReply));
+        QVERIFY(!saveReply.isError());
+        QCOMPARE(m_server->config("google-1"), config);
+
+        QDBusPendingReply<QStringMultiMap> configReply = session->getConfig("google-1", false);
+        QVERIFY(waitReply(configReply));
+        QCOMPARE(configReply.value(), config);
+
+        // temporary configs are not saved on the server
+        QStringMultiMap tempConfig;
+        tempConfig[""]["username"] = "user";
+        saveReply = session->saveConfig("", tempConfig, true);
+        QVERIFY(waitReply(saveReply));
+        QCOMPARE(m_server->config("google-1"), config);
+        configReply = session->getConfig("", false);
+        QVERIFY(waitReply(configReply));
+        QCOMPARE(configReply.value(), tempConfig);
+
+        session->destroy();
+    }
+
+    void testSync()
+    {
+        m_server->setSyncLatency(10);
+        SyncEvolutionSessionProxy *session = openSession("google-1");
+        QVERIFY(session);
+
+        QSignalSpy statusSpy(session, SIGNAL(statusChanged(QString,uint,QSyncStatusMap)));
+        QSignalSpy progressSpy(session, SIGNAL(progressChanged(int)));
+        QStringMap sources;
+        sources.insert("1_calendar", "two-way");
+        sources.insert("1_other-calendar", "refresh-from-remote");
+        QDBusPendingReply<> syncReply = session->sync("none", sources);
+        QVERIFY(waitReply(syncReply));
+        QVERIFY(!syncReply.isError());
+
+        QTRY_VERIFY(!statusSpy.isEmpty() && (statusSpy.last().at(0).toString() == "done"));
+        QCOMPARE(progressSpy.count(), 2);
+        QCOMPARE(progressSpy.last().at(0).toInt(), 100);
+        QSyncStatusMap result = qvariant_cast<QSyncStatusMap>(statusSpy.last().at(2));
+        QCOMPARE(result.size(), 2);
+        QCOMPARE(result.value("1_calendar").status, QStringLiteral("done"));
+        QCOMPARE(result.value("1_calendar").error, 0u);
+
+        QDBusPendingReply<QArrayOfStringMap> reportReply = session->reports(0, 1);
+        QVERIFY(waitReply(reportReply));
+        QCOMPARE(reportReply.value().size(), 1);
+        QStringMap report = reportReply.value().first();
+        QCOMPARE(report.value("source-1__other_+calendar-mode"), QStringLiteral("refresh-from-remote"));
+        QCOMPARE(report.value("source-1__calendar-stat-local-added-total"), QStringLiteral("1"));
+
+        session->destroy();
+    }
+
+    void testDatabases()
+    {
+        SyncDatabase db;
+        db.name = "Personal";
+        db.source = "https://example.com/caldav/personal";
+        db.remoteId = "personal";
+        db.defaultCalendar = true;
+        db.writable = true;
+        m_server->setDatabases(QArrayOfDatabases() << db);
+
+        SyncEvolutionSessionProxy *session = openSession("google-1-databases");
+        QVERIFY(session);
+        QDBusPendingReply<QArrayOfDatabases> reply = session->getDatabases("calendar");
+        QVERIFY(waitReply(reply));
+        QCOMPARE(reply.value().size(), 1);
+        QCOMPARE(reply.value().first().remoteId, QStringLiteral("personal"));
+        session->destroy();
+    }
+
+    void testFailureInjection()
+    {
+        m_server->setSessionFailureInterval(1);
+        QVERIFY(!openSession("google-1"));
+        m_server->setSessionFailureInterval(0);
+
+        m_server->setSyncFailureInterval(2, 403);
+        SyncEvolutionSessionProxy *session = openSession("google-1");
+        QVERIFY(session);
+        QSignalSpy statusSpy(session, SIGNAL(statusChanged(QString,uint,QSyncStatusMap)));
+        QStringMap sources;
+        sources.insert("1_a", "two-way");
+        sources.insert("1_b", "two-way");
+        const int failures = m_server->failedSources();
+        QVERIFY(waitReply(session->sync("none", sources)));
+        QTRY_VERIFY(!statusSpy.isEmpty() && (statusSpy.last().at(0).toString() == "done"));
+        QCOMPARE(m_server->failedSources(), failures + 1);
+        session->destroy();
+    }
+
+    void testCallLatency()
+    {
+        m_server->setCallLatency(100);
+        QElapsedTimer timer;
+        timer.start();
+        SyncEvolutionSessionProxy *session = openSession("google-1");
+        QVERIFY(session);
+        QVERIFY(timer.elapsed() >= 100);
+        session->destroy();
+        QTRY_COMPARE(m_server->activeSessions(), 0);
+    }
+};
+
+QTEST_MAIN(SyncEvolutionProxyTest)
+
+#include "syncevolution-proxy-test.moc"
@@ -0,0 +1,472 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "syncevolution-server-mock.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+#include <QtCore/QTimer>
+
+#define SYNCEVOLUTION_SERVICE_NAME          "org.syncevolution"
+#define SYNCEVOLUTION_OBJECT_PATH           "/org/syncevolution/Server"
+#define SYNCEVOLUTION_SESSION_PATH          "/org/syncevolution/Session/%1"
+#define SYNCEVOLUTION_SESSION_IFACE_NAME    "org.syncevolution.Session"
+#define SYNCEVOLUTION_ERROR_NAME            "org.syncevolution.Exception"
+#define SYNCEVOLUTION_ABORT_ERROR           20017
+#define SYNCEVOLUTION_MOCK_CONNECTION       "syncevolution-server-mock"
+
+SyncEvolutionSessionMock::SyncEvolutionSessionMock(SyncEvolutionServerMock *server,
+                                                   const QString &configName,
+                                                   const QString &path)
+    : QObject(server),
+      m_server(server),
+      m_configName(configName),
+      m_path(path),
+      m_status("queueing"),
+      m_progress(0)
+{
+}
+
+QString SyncEvolutionSessionMock::path() const
+{
+    return m_path;
+}
+
+QString SyncEvolutionSessionMock::configName() const
+{
+    return m_configName;
+}
+
+QString SyncEvolutionSessionMock::status() const
+{
+    return m_status;
+}
+
+void SyncEvolutionSessionMock::activate()
+{
+    setStatus("idle");
+}
+
+void SyncEvolutionSessionMock::setStatus(const QString &status, uint error)
+{
+    m_status = status;
+    m_server->emitSignal(m_path, "StatusChanged",
+                         QVariantList() << status << error << QVariant::fromValue(m_sources));
+}
+
+void SyncEvolutionSessionMock::GetStatus(const QDBusMessage &message)
+{
+    m_server->reply(message, QVariantList() << m_status << 0u << QVariant::fromValue(m_sources));
+}
+
+void SyncEvolutionSessionMock::GetConfig(bool isTemplate, const QDBusMessage &message)
+{
+    Q_UNUSED(isTemplate);
+    if (!m_tempConfig.isEmpty()) {
+        m_server->reply(message, QVariantList() << QVariant::fromValue(m_tempConfig));
+    } else {
+        m_server->reply(message, QVariantList() << QVariant::fromValue(m_server->config(m_configName)));
+    }
+}
+
+void SyncEvolutionSessionMock::GetNamedConfig(const QString &configName, bool isTemplate, const QDBusMessage &message)
+{
+    Q_UNUSED(isTemplate);
+    m_server->reply(message, QVariantList() << QVariant::fromValue(m_server->config(configName)));
+}
+
+void SyncEvolutionSessionMock::SetConfig(bool update, bool temporary, const QStringMultiMap &config, const QDBusMessage &message)
+{
+    if (temporary) {
+        if (!update) {
+            m_tempConfig.clear();
+        }
+        for(QStringMultiMap::const_iterator i = config.begin(); i != config.end(); i++) {
+            m_tempConfig.insert(i.key(), i.value());
+        }
+    } else {
+        SetNamedConfig(m_configName, update, temporary, config, message);
+        return;
+    }
+    m_server->reply(message);
+}
+
+void SyncEvolutionSessionMock::SetNamedConfig(const QString &configName, bool update, bool temporary,
+                                              const QStringMultiMap &config, const QDBusMessage &message)
+{
+    Q_UNUSED(temporary);
+    QStringMultiMap newConfig = update ? m_server->config(configName) : QStringMultiMap();
+    for(QStringMultiMap::const_iterator i = config.begin(); i != config.end(); i++) {
+        newConfig.insert(i.key(), i.value());
+    }
+    m_server->setConfig(configName, newConfig);
+    m_server->reply(message);
+}
+
+void SyncEvolutionSessionMock::Sync(const QString &mode, const QStringMap &sources, const QDBusMessage &message)
+{
+    Q_UNUSED(mode);
+    if (m_status != "idle") {
+        m_server->replyError(message, QString("Session is %1").arg(m_status));
+        return;
+    }
+
+    m_server->reply(message);
+
+    m_sources.clear();
+    m_pendingSources = sources.keys();
+    m_progress = 0;
+    m_report.clear();
+    m_report.insert("start", QString::number(QDateTime::currentDateTime().toTime_t()));
+    m_report.insert("peer", m_configName);
+    for(QStringMap::const_iterator i = sources.begin(); i != sources.end(); i++) {
+        SyncStatus status;
+        status.mode = i.value();
+        status.status = "running";
+        status.error = 0;
+        m_sources.insert(i.key(), status);
+    }
+    setStatus("running");
+    syncNextSource();
+}
+
+void SyncEvolutionSessionMock::syncNextSource()
+{
+    if (m_status != "running") {
+        return;
+    }
+
+    if (m_pendingSources.isEmpty()) {
+        m_report.insert("end", QString::number(QDateTime::currentDateTime().toTime_t()));
+        m_report.insert("status", "200");
+        m_server->addReport(m_configName, m_report);
+        setStatus("done");
+        return;
+    }
+
+    QTimer::singleShot(m_server->syncLatency(), this, [this]() {
+        if ((m_status != "running") || m_pendingSources.isEmpty()) {
+            return;
+        }
+
+        const QString sourceName = m_pendingSources.takeFirst();
+        SyncStatus &status = m_sources[sourceName];
+        status.status = "done";
+        status.error = m_server->nextSyncError();
+
+        QString prefix(sourceName);
+        prefix = QString("source-%1-").arg(prefix.replace("_", "__").replace("-", "_+"));
+        m_report.insert(prefix + "mode", status.mode);
+        m_report.insert(prefix + "status", QString::number(status.error));
+        m_report.insert(prefix + "stat-local-added-total", status.error ? "0" : "1");
+        m_report.insert(prefix + "stat-remote-updated-total", status.error ? "0" : "1");
+
+        m_progress = 100 * (m_sources.size() - m_pendingSources.size()) / m_sources.size();
+        m_server->emitSignal(m_path, "ProgressChanged",
+                             QVariantList() << m_progress << QVariant::fromValue(QSyncProgressMap()));
+        setStatus("running");
+        syncNextSource();
+    });
+}
+
+void SyncEvolutionSessionMock::GetReports(uint start, uint count, const QDBusMessage &message)
+{
+    m_server->reply(message, QVariantList() << QVariant::fromValue(m_server->reports(m_configName, start, count)));
+}
+
+void SyncEvolutionSessionMock::GetDatabases(const QString &sourceName, const QDBusMessage &message)
+{
+    Q_UNUSED(sourceName);
+    m_server->reply(message, QVariantList() << QVariant::fromValue(m_server->databases()));
+}
+
+void SyncEvolutionSessionMock::Execute(const QStringList &args, const QDBusMessage &message)
+{
+    Q_UNUSED(args);
+    m_server->reply(message);
+}
+
+void SyncEvolutionSessionMock::Abort(const QDBusMessage &message)
+{
+    if (m_status == "running") {
+        m_pendingSources.clear();
+        setStatus("done", SYNCEVOLUTION_ABORT_ERROR);
+    }
+    m_server->reply(message);
+}
+
+void SyncEvolutionSessionMock::Detach(const QDBusMessage &message)
+{
+    m_server->reply(message);
+    m_server->removeSession(this);
+}
+
+SyncEvolutionServerMock::SyncEvolutionServerMock(QObject *parent)
+    : QObject(parent),
+      m_connection(QDBusConnection::connectToBus(QDBusConnection::SessionBus, SYNCEVOLUTION_MOCK_CONNECTION)),
+      m_registered(false),
+      m_callLatency(0),
+      m_syncLatency(0),
+      m_maxActiveSessions(1),
+      m_sessionFailureInterval(0),
+      m_syncFailureInterval(0),
+      m_syncFailureError(500),
+      m_sessionCount(0),
+      m_syncedSources(0),
+      m_failedSources(0)
+{
+}
+
+SyncEvolutionServerMock::~SyncEvolutionServerMock()
+{
+    stop();
+    QDBusConnection::disconnectFromBus(SYNCEVOLUTION_MOCK_CONNECTION);
+}
+
+bool SyncEvolutionServerMock::start()
+{
+    if (m_registered) {
+        return true;
+    }
+
+    if (!m_connection.isConnected()) {
+        qWarning() << "Session bus not available";
+        return false;
+    }
+
+    if (!m_connection.registerService(SYNCEVOLUTION_SERVICE_NAME)) {
+        qWarning() << "Could not register" << SYNCEVOLUTION_SERVICE_NAME << m_connection.lastError().message();
+        return false;
+    }
+
+    if (!m_connection.registerObject(SYNCEVOLUTION_OBJECT_PATH, this, QDBusConnection::ExportAllSlots)) {
+        qWarning() << "Could not register" << SYNCEVOLUTION_OBJECT_PATH;
+        m_connection.unregisterService(SYNCEVOLUTION_SERVICE_NAME);
+        return false;
+    }
+
+    m_registered = true;
+    return true;
+}
+
+void SyncEvolutionServerMock::stop()
+{
+    if (!m_registered) {
+        return;
+    }
+
+    Q_FOREACH(SyncEvolutionSessionMock *session, m_activeSessions + m_queuedSessions) {
+        m_connection.unregisterObject(session->path());
+        delete session;
+    }
+    m_activeSessions.clear();
+    m_queuedSessions.clear();
+
+    m_connection.unregisterObject(SYNCEVOLUTION_OBJECT_PATH);
+    m_connection.unregisterService(SYNCEVOLUTION_SERVICE_NAME);
+    m_registered = false;
+}
+
+QDBusConnection SyncEvolutionServerMock::connection() const
+{
+    return m_connection;
+}
+
+void SyncEvolutionServerMock::setCallLatency(int msecs)
+{
+    m_callLatency = msecs;
+}
+
+int SyncEvolutionServerMock::callLatency() const
+{
+    return m_callLatency;
+}
+
+void SyncEvolutionServerMock::setSyncLatency(int msecs)
+{
+    m_syncLatency = msecs;
+}
+
+int SyncEvolutionServerMock::syncLatency() const
+{
+    return m_syncLatency;
+}
+
+void SyncEvolutionServerMock::setMaxActiveSessions(int count)
+{
+    m_maxActiveSessions = qMax(1, count);
+}
+
+void SyncEvolutionServerMock::setSessionFailureInterval(int interval)
+{
+    m_sessionFailureInterval = interval;
+}
+
+void SyncEvolutionServerMock::setSyncFailureInterval(int interval, uint error)
+{
+    m_syncFailureInterval = interval;
+    m_syncFailureError = error;
+}
+
+void SyncEvolutionServerMock::setDatabases(const QArrayOfDatabases &databases)
+{
+    m_databases = databases;
+}
+
+QArrayOfDatabases SyncEvolutionServerMock::databases() const
+{
+    return m_databases;
+}
+
+QStringMultiMap SyncEvolutionServerMock::config(const QString &configName) const
+{
+    return m_configs.value(configName);
+}
+
+void SyncEvolutionServerMock::setConfig(const QString &configName, const QStringMultiMap &config)
+{
+    m_configs.insert(configName, config);
+}
+
+void SyncEvolutionServerMock::addReport(const QString &configName, const QStringMap &report)
+{
+    // newest first, like the server
+    m_reports[configName].prepend(report);
+}
+
+QArrayOfStringMap SyncEvolutionServerMock::reports(const QString &configName, uint start, uint count) const
+{
+    return m_reports.value(configName).mid(start, count);
+}
+
+void SyncEvolutionServerMock::reply(const QDBusMessage &message, const QVariantList &args)
+{
+    // replies are always sent by us, never by the adaptor
+    message.setDelayedReply(true);
+
+    const QDBusMessage reply = message.createReply(args);
+    if (m_callLatency <= 0) {
+        m_connection.send(reply);
+        return;
+    }
+
+    const QDBusConnection connection(m_connection);
+    QTimer::singleShot(m_callLatency, this, [connection, reply]() {
+        connection.send(reply);
+    });
+}
+
+void SyncEvolutionServerMock::replyError(const QDBusMessage &message, const QString &error)
+{
+    message.setDelayedReply(true);
+    m_connection.send(message.createErrorReply(SYNCEVOLUTION_ERROR_NAME, error));
+}
+
+void SyncEvolutionServerMock::emitSignal(const QString &path, const QString &name, const QVariantList &args)
+{
+    QDBusMessage signal = QDBusMessage::createSignal(path, SYNCEVOLUTION_SESSION_IFACE_NAME, name);
+    signal.setArguments(args);
+    m_connection.send(signal);
+}
+
+uint SyncEvolutionServerMock::nextSyncError()
+{
+    m_syncedSources++;
+    if ((m_syncFailureInterval > 0) && ((m_syncedSources % m_syncFailureInterval) == 0)) {
+        m_failedSources++;
+        return m_syncFailureError;
+    }
+    return 0;
+}
+
+void SyncEvolutionServerMock::removeSession(SyncEvolutionSessionMock *session)
+{
+    m_connection.unregisterObject(session->path());
+    m_queuedSessions.removeAll(session);
+    if (m_activeSessions.removeAll(session) > 0) {
+        // the next queued session can run now
+        if (!m_queuedSessions.isEmpty()) {
+            SyncEvolutionSessionMock *next = m_queuedSessions.takeFirst();
+            m_activeSessions << next;
+            next->activate();
+        }
+    }
+    session->deleteLater();
+}
+
+int SyncEvolutionServerMock::sessionCount() const
+{
+    return m_sessionCount;
+}
+
+int SyncEvolutionServerMock::activeSessions() const
+{
+    return m_activeSessions.size();
+}
+
+int SyncEvolutionServerMock::syncedSources() const
+{
+    return m_syncedSources;
+}
+
+int SyncEvolutionServerMock::failedSources() const
+{
+    return m_failedSources;
+}
+
+void SyncEvolutionServerMock::StartSession(const QString &configName, const QDBusMessage &message)
+{
+    StartSessionWithFlags(configName, QStringList(), message);
+}
+
+void SyncEvolutionServerMock::StartSessionWithFlags(const QString &configName, const QStringList &flags, const QDBusMessage &message)
+{
+    Q_UNUSED(flags);
+    m_sessionCount++;
+    if ((m_sessionFailureInterval > 0) && ((m_sessionCount % m_sessionFailureInterval) == 0)) {
+        replyError(message, "Fail to start session");
+        return;
+    }
+
+    const QString path = QString(SYNCEVOLUTION_SESSION_PATH).arg(m_sessionCount);
+    SyncEvolutionSessionMock *session = new SyncEvolutionSessionMock(this, configName, path);
+    m_connection.registerObject(path, session, QDBusConnection::ExportAllSlots);
+    if (m_activeSessions.size() < m_maxActiveSessions) {
+        m_activeSessions << session;
+        session->activate();
+    } else {
+        m_queuedSessions << session;
+    }
+    reply(message, QVariantList() << QVariant::fromValue(QDBusObjectPath(path)));
+}
+
+void SyncEvolutionServerMock::GetConfigs(bool templates, const QDBusMessage &message)
+{
+    Q_UNUSED(templates);
+    reply(message, QVariantList() << QStringList(m_configs.keys()));
+}
+
+void SyncEvolutionServerMock::GetReports(const QString &configName, uint start, uint count, const QDBusMessage &message)
+{
+    reply(message, QVariantList() << QVariant::fromValue(reports(configName, start, count)));
+}
+
+void SyncEvolutionServerMock::Detach(const QDBusMessage &message)
+{
+    reply(message);
+}
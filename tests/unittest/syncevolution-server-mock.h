@@ -0,0 +1,145 @@
+/*
+ * Copyright 2014 Canonical Ltd.
+ *
+ * This file is part of sync-monitor.
+ *
+ * sync-monitor is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * contact-service-app is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYNCEVOLUTION_SERVER_MOCK_H__
+#define __SYNCEVOLUTION_SERVER_MOCK_H__
+
+#include <QtCore/QObject>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QStringList>
+#include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusMessage>
+
+#include "dbustypes.h"
+
+class SyncEvolutionServerMock;
+
+// org.syncevolution.Session stand-in, only the calls used by the proxies
+class SyncEvolutionSessionMock : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.syncevolution.Session")
+public:
+    SyncEvolutionSessionMock(SyncEvolutionServerMock *server, const QString &configName, const QString &path);
+
+    QString path() const;
+    QString configName() const;
+    QString status() const;
+    void activate();
+
+public Q_SLOTS:
+    void GetStatus(const QDBusMessage &message);
+    void GetConfig(bool isTemplate, const QDBusMessage &message);
+    void GetNamedConfig(const QString &configName, bool isTemplate, const QDBusMessage &message);
+    void SetConfig(bool update, bool temporary, const QStringMultiMap &config, const QDBusMessage &message);
+    void SetNamedConfig(const QString &configName, bool update, bool temporary,
+                        const QStringMultiMap &config, const QDBusMessage &message);
+    void Sync(const QString &mode, const QStringMap &sources, const QDBusMessage &message);
+    void GetReports(uint start, uint count, const QDBusMessage &message);
+    void GetDatabases(const QString &sourceName, const QDBusMessage &message);
+    void Execute(const QStringList &args, const QDBusMessage &message);
+    void Abort(const QDBusMessage &message);
+    void Detach(const QDBusMessage &message);
+
+private:
+    SyncEvolutionServerMock *m_server;
+    QString m_configName;
+    QString m_path;
+    QString m_status;
+    QStringMultiMap m_tempConfig;
+    QSyncStatusMap m_sources;
+    QStringList m_pendingSources;
+    QStringMap m_report;
+    int m_progress;
+
+    void setStatus(const QString &status, uint error = 0);
+    void syncNextSource();
+};
+
+// org.syncevolution.Server stand-in running on its own bus connection.
+// Replies are delayed by the configured latency, sources take the sync
+// latency to finish and failures can be injected on the session start
+// and on the source sync.
+class SyncEvolutionServerMock : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.syncevolution.Server")
+public:
+    SyncEvolutionServerMock(QObject *parent = 0);
+    ~SyncEvolutionServerMock();
+
+    bool start();
+    void stop();
+    QDBusConnection connection() const;
+
+    void setCallLatency(int msecs);
+    int callLatency() const;
+    void setSyncLatency(int msecs);
+    int syncLatency() const;
+    void setMaxActiveSessions(int count);
+    // every n-th session start fails, 0 disables it
+    void setSessionFailureInterval(int interval);
+    // every n-th source sync fails with the error code, 0 disables it
+    void setSyncFailureInterval(int interval, uint error = 500);
+    void setDatabases(const QArrayOfDatabases &databases);
+    QArrayOfDatabases databases() const;
+
+    QStringMultiMap config(const QString &configName) const;
+    void setConfig(const QString &configName, const QStringMultiMap &config);
+    void addReport(const QString &configName, const QStringMap &report);
+    QArrayOfStringMap reports(const QString &configName, uint start, uint count) const;
+
+    void reply(const QDBusMessage &message, const QVariantList &args = QVariantList());
+    void replyError(const QDBusMessage &message, const QString &error);
+    void emitSignal(const QString &path, const QString &name, const QVariantList &args);
+    uint nextSyncError();
+    void removeSession(SyncEvolutionSessionMock *session);
+
+    int sessionCount() const;
+    int activeSessions() const;
+    int syncedSources() const;
+    int failedSources() const;
+
+public Q_SLOTS:
+    void StartSession(const QString &configName, const QDBusMessage &message);
+    void StartSessionWithFlags(const QString &configName, const QStringList &flags, const QDBusMessage &message);
+    void GetConfigs(bool templates, const QDBusMessage &message);
+    void GetReports(const QString &configName, uint start, uint count, const QDBusMessage &message);
+    void Detach(const QDBusMessage &message);
+
+private:
+    QDBusConnection m_connection;
+    bool m_registered;
+    int m_callLatency;
+    int m_syncLatency;
+    int m_maxActiveSessions;
+    int m_sessionFailureInterval;
+    int m_syncFailureInterval;
+    uint m_syncFailureError;
+    int m_sessionCount;
+    int m_syncedSources;
+    int m_failedSources;
+    QArrayOfDatabases m_databases;
+    QHash<QString, QStringMultiMap> m_configs;
+    QHash<QString, QArrayOfStringMap> m_reports;
+    QList<SyncEvolutionSessionMock*> m_activeSessions;
+    QList<SyncEvolutionSessionMock*> m_queuedSessions;
+};
+
+#endif